@@ -0,0 +1,149 @@
+/* Combining the gets of many threads into multi-gets: a request queue per server and its wait */
+
+#ifndef LOADBALANCER_COALESCE_H_
+#define LOADBALANCER_COALESCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "shmring.h"
+
+// the largest number of keys combined into one multi-get
+#define COALESCE_MAX 1024
+
+/**
+ * A get waiting to be combined. The issuing thread owns it and waits on its bell until the
+ * flusher set `done`, after which the outcome is in `result` and `value_len`. The bell outlives
+ * the request, the flusher rings it after handing the request back.
+ */
+struct coalesce_req {
+    struct coalesce_req* next;
+    const char* key;
+    size_t keylen;
+    uint64_t objid;
+    // when the request was queued, in timer ticks
+    uint64_t t_enqueue;
+    // the outcome, in the terms of the queue's user, and the length of the value found
+    int result;
+    size_t value_len;
+    uint32_t done;
+    struct shmring_bell* bell;
+};
+
+/**
+ * A lock-free queue of requests with many producers and a single consumer (Vyukov's intrusive
+ * MPSC queue). Producers only swap the head, so a push never waits for another thread, and the
+ * consumer sleeps on the bell while the queue is empty.
+ */
+struct coalesce_queue {
+    struct coalesce_req* head __attribute__((aligned(64)));
+    struct coalesce_req* tail __attribute__((aligned(64)));
+    // stands in for the last request while the queue is empty
+    struct coalesce_req stub;
+    struct shmring_bell bell;
+};
+
+static inline void coalesce_queue_init(struct coalesce_queue* q)
+{
+    memset(q, 0, sizeof(*q));
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+static inline void coalesce_queue_link(struct coalesce_queue* q, struct coalesce_req* r)
+{
+    __atomic_store_n(&r->next, (struct coalesce_req*)NULL, __ATOMIC_RELAXED);
+    struct coalesce_req* prev = __atomic_exchange_n(&q->head, r, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, r, __ATOMIC_RELEASE);
+}
+
+// queues the request and wakes the consumer if it sleeps
+static inline void coalesce_push(struct coalesce_queue* q, struct coalesce_req* r)
+{
+    __atomic_store_n(&r->done, 0, __ATOMIC_RELAXED);
+    coalesce_queue_link(q, r);
+    shmring_notify(&q->bell);
+}
+
+/**
+ * Takes the oldest request off the queue, by the consumer only. Returns NULL if the queue is
+ * empty, or if a producer is in the middle of its push, which it completes right away.
+ */
+static inline struct coalesce_req* coalesce_pop(struct coalesce_queue* q)
+{
+    struct coalesce_req* tail = q->tail;
+    struct coalesce_req* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &q->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    // the last request, put the stub behind it so it can be taken off
+    coalesce_queue_link(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/**
+ * Takes the oldest request off the queue, sleeping for at most `timeout_ns` while it is empty.
+ */
+static inline struct coalesce_req* coalesce_pop_wait(struct coalesce_queue* q, int64_t timeout_ns)
+{
+    struct coalesce_req* r = coalesce_pop(q);
+    if (r != NULL || timeout_ns <= 0) {
+        return r;
+    }
+    uint32_t seq = shmring_sleep_prepare(&q->bell);
+    if ((r = coalesce_pop(q)) != NULL) {
+        shmring_sleep_cancel(&q->bell);
+        return r;
+    }
+    shmring_sleep(&q->bell, seq, timeout_ns);
+    return coalesce_pop(q);
+}
+
+// hands the outcome back to the issuing thread, the request must not be touched afterwards
+static inline void coalesce_complete(struct coalesce_req* r, int result, size_t value_len)
+{
+    struct shmring_bell* bell = r->bell;
+    r->result = result;
+    r->value_len = value_len;
+    __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+    shmring_notify(bell);
+}
+
+// waits for the flusher to complete the request, polling for a while before sleeping
+static inline void coalesce_wait(struct coalesce_req* r)
+{
+    for (size_t spins = 0; spins < SHMRING_SPINS; spins++) {
+        if (__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+        shmring_pause();
+    }
+    while (!__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)) {
+        uint32_t seq = shmring_sleep_prepare(r->bell);
+        if (__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)) {
+            shmring_sleep_cancel(r->bell);
+            break;
+        }
+        shmring_sleep(r->bell, seq, 1000000000L);
+    }
+}
+
+#endif /* LOADBALANCER_COALESCE_H_ */
@@ -0,0 +1,163 @@
+/* Coordinated runs over several processes: the messages between the coordinator and its agents */
+
+#ifndef LOADBALANCER_COORD_H_
+#define LOADBALANCER_COORD_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// the largest payload of a message, the results of an agent with a long time series
+#define COORD_PAYLOAD_MAX (1UL << 30)
+
+enum coord_msg_type {
+    // agent to coordinator, right after connecting: the agent's pid
+    COORD_HELLO = 1,
+    // coordinator to agent: a coord_config followed by the command line
+    COORD_CONFIG,
+    // agent to coordinator: the agent's threads reached the barrier of the phase
+    COORD_ARRIVE,
+    // coordinator to agent: every agent reached the barrier, the phase starts
+    COORD_RELEASE,
+    // agent to coordinator: the counters and histograms of the run
+    COORD_RESULTS,
+};
+
+/**
+ * The header of every message, followed by `len` bytes of payload. Both sides are the same binary
+ * on the same machine, so structs are sent as they are.
+ */
+struct coord_msg {
+    uint32_t type;
+    // the phase of the barrier messages
+    uint32_t phase;
+    uint64_t len;
+};
+
+// the agent's place in the run, followed by the arguments separated by NUL bytes
+struct coord_config {
+    uint32_t index;
+    uint32_t num_agents;
+};
+
+static inline bool coord_write(int fd, const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static inline bool coord_read(int fd, void* buf, size_t len)
+{
+    char* p = (char*)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static inline bool coord_send(int fd, uint32_t type, uint32_t phase, const void* payload, size_t len)
+{
+    struct coord_msg msg = { type, phase, len };
+    return coord_write(fd, &msg, sizeof(msg)) && (len == 0 || coord_write(fd, payload, len));
+}
+
+/**
+ * Receives the next message, which must be of the type. Its payload is returned in a fresh
+ * allocation the caller frees, NULL if it has none.
+ */
+static inline bool coord_recv(int fd, uint32_t type, struct coord_msg* msg, void** payload)
+{
+    *payload = NULL;
+    if (!coord_read(fd, msg, sizeof(*msg)) || msg->type != type || msg->len > COORD_PAYLOAD_MAX) {
+        return false;
+    }
+    if (msg->len == 0) {
+        return true;
+    }
+    *payload = malloc(msg->len);
+    if (*payload == NULL || !coord_read(fd, *payload, msg->len)) {
+        free(*payload);
+        *payload = NULL;
+        return false;
+    }
+    return true;
+}
+
+static inline void coord_addr(struct sockaddr_un* addr, const char* path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+}
+
+// listens on the unix socket for the agents, returns -1 with errno set on failure
+static inline int coord_listen(const char* path, int backlog)
+{
+    struct sockaddr_un addr;
+    coord_addr(&addr, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Connects to the coordinator's socket. Agents may be started before the coordinator, connecting
+ * is retried every 100 ms for up to `timeout_s`. Returns -1 with errno set on failure.
+ */
+static inline int coord_connect(const char* path, unsigned timeout_s)
+{
+    struct sockaddr_un addr;
+    coord_addr(&addr, path);
+    for (unsigned attempt = 0;; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        int err = errno;
+        close(fd);
+        if ((err != ENOENT && err != ECONNREFUSED) || attempt >= timeout_s * 10) {
+            errno = err;
+            return -1;
+        }
+        struct timespec ts = { 0, 100000000L };
+        nanosleep(&ts, NULL);
+    }
+}
+
+#endif /* LOADBALANCER_COORD_H_ */
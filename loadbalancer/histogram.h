@@ -0,0 +1,135 @@
+/* Log-bucketed latency histograms */
+
+#ifndef LOADBALANCER_HISTOGRAM_H_
+#define LOADBALANCER_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// every power of two is split into 2^HISTOGRAM_SUB_BITS buckets, bounding the error to ~3%
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1UL << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * A HDR-style histogram of 64-bit values.
+ *
+ * Values below 2^HISTOGRAM_SUB_BITS are recorded exactly, larger values land in a bucket whose
+ * width is 1/HISTOGRAM_SUB_BUCKETS of their power of two. A histogram is owned by a single thread
+ * and updated without atomics, the histograms of all threads are merged once the run is over.
+ */
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static inline void histogram_init(struct histogram* h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline size_t histogram_index(uint64_t v)
+{
+    if (v < HISTOGRAM_SUB_BUCKETS) {
+        return v;
+    }
+    unsigned msb = 63 - __builtin_clzll(v);
+    unsigned shift = msb - HISTOGRAM_SUB_BITS;
+    // (v >> shift) is in [HISTOGRAM_SUB_BUCKETS, 2 * HISTOGRAM_SUB_BUCKETS)
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((v >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+// the smallest value that is recorded in the bucket
+static inline uint64_t histogram_bucket_lower(size_t idx)
+{
+    if (idx < HISTOGRAM_SUB_BUCKETS) {
+        return idx;
+    }
+    size_t shift = idx / HISTOGRAM_SUB_BUCKETS - 1;
+    return (HISTOGRAM_SUB_BUCKETS + idx % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+// the largest value that is recorded in the bucket
+static inline uint64_t histogram_bucket_upper(size_t idx)
+{
+    if (idx < HISTOGRAM_SUB_BUCKETS) {
+        return idx;
+    }
+    size_t shift = idx / HISTOGRAM_SUB_BUCKETS - 1;
+    return histogram_bucket_lower(idx) + ((1UL << shift) - 1);
+}
+
+static inline void histogram_record_n(struct histogram* h, uint64_t v, uint64_t n)
+{
+    h->buckets[histogram_index(v)] += n;
+    h->count += n;
+    h->sum += v * n;
+    if (v < h->min) {
+        h->min = v;
+    }
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+static inline void histogram_record(struct histogram* h, uint64_t v)
+{
+    histogram_record_n(h, v, 1);
+}
+
+static inline void histogram_merge(struct histogram* dst, const struct histogram* src)
+{
+    if (src->count == 0) {
+        return;
+    }
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/**
+ * Returns the value at the given percentile (0-100).
+ *
+ * The result is the upper bound of the bucket the percentile falls into, clamped to the largest
+ * recorded value, so the reported percentiles never understate the latency.
+ */
+static inline uint64_t histogram_percentile(const struct histogram* h, double percentile)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)((percentile / 100.0) * h->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = histogram_bucket_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static inline double histogram_mean(const struct histogram* h)
+{
+    return h->count ? (double)h->sum / h->count : 0.0;
+}
+
+#endif /* LOADBALANCER_HISTOGRAM_H_ */
@@ -0,0 +1,194 @@
+/* Key popularity distributions for the benchmark phase */
+
+#ifndef LOADBALANCER_KEYDIST_H_
+#define LOADBALANCER_KEYDIST_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "xorshift.h"
+
+// the zipfian constant used by YCSB
+#define KEYDIST_DEFAULT_THETA 0.99
+
+// terms of the zeta sum that are computed exactly, the rest is integrated
+#define KEYDIST_ZETA_EXACT_TERMS (1UL << 20)
+
+enum keydist_kind {
+    // every key is equally likely
+    KEYDIST_UNIFORM,
+    // zipfian popularity, with the popular keys scattered over the key space
+    KEYDIST_ZIPF,
+    // a fraction of the operations goes to a small, contiguous set of hot keys
+    KEYDIST_HOTSPOT,
+    // zipfian popularity by recency, the most recently inserted keys are the hottest
+    KEYDIST_LATEST,
+};
+
+/**
+ * A key distribution over the object ids [0, num_keys).
+ *
+ * All tables are computed by keydist_init(), drawing a key costs a constant number of arithmetic
+ * operations. The structure is shared by all threads, only `latest` is ever written to.
+ */
+struct keydist {
+    enum keydist_kind kind;
+    uint64_t num_keys;
+
+    // zipfian parameters (Gray et al., "Quickly Generating Billion-Record Synthetic Databases")
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow_theta;
+
+    // hotspot parameters
+    uint64_t hot_keys;
+    double hot_ops;
+
+    // the most recently inserted object id
+    uint64_t latest;
+};
+
+static inline const char* keydist_kind_name(enum keydist_kind kind)
+{
+    switch (kind) {
+    case KEYDIST_UNIFORM:
+        return "uniform";
+    case KEYDIST_ZIPF:
+        return "zipf";
+    case KEYDIST_HOTSPOT:
+        return "hotspot";
+    case KEYDIST_LATEST:
+        return "latest";
+    }
+    return "unknown";
+}
+
+static inline bool keydist_parse_kind(const char* name, enum keydist_kind* kind)
+{
+    if (strcmp(name, "uniform") == 0) {
+        *kind = KEYDIST_UNIFORM;
+    } else if (strcmp(name, "zipf") == 0 || strcmp(name, "zipfian") == 0) {
+        *kind = KEYDIST_ZIPF;
+    } else if (strcmp(name, "hotspot") == 0) {
+        *kind = KEYDIST_HOTSPOT;
+    } else if (strcmp(name, "latest") == 0) {
+        *kind = KEYDIST_LATEST;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Computes the generalized harmonic number sum_{i=1}^{n} 1 / i^theta.
+ *
+ * The first KEYDIST_ZETA_EXACT_TERMS terms are summed up, the remaining tail is approximated by
+ * its integral which is accurate to well below 1e-6 at that point and keeps startup time constant
+ * for billions of keys.
+ */
+static inline double keydist_zeta(uint64_t n, double theta)
+{
+    uint64_t exact = n < KEYDIST_ZETA_EXACT_TERMS ? n : KEYDIST_ZETA_EXACT_TERMS;
+    double sum = 0.0;
+    for (uint64_t i = 1; i <= exact; i++) {
+        sum += 1.0 / pow((double)i, theta);
+    }
+    if (n > exact) {
+        double e = 1.0 - theta;
+        sum += (pow(n + 0.5, e) - pow(exact + 0.5, e)) / e;
+    }
+    return sum;
+}
+
+static inline void keydist_init(struct keydist* kd, enum keydist_kind kind, uint64_t num_keys,
+    double theta, double hot_ops, double hot_keys)
+{
+    memset(kd, 0, sizeof(*kd));
+    kd->kind = kind;
+    kd->num_keys = num_keys ? num_keys : 1;
+    kd->latest = kd->num_keys - 1;
+
+    if (kind == KEYDIST_ZIPF || kind == KEYDIST_LATEST) {
+        kd->theta = theta;
+        kd->alpha = 1.0 / (1.0 - theta);
+        kd->zetan = keydist_zeta(kd->num_keys, theta);
+        double zeta2 = keydist_zeta(2, theta);
+        kd->eta = (1.0 - pow(2.0 / kd->num_keys, 1.0 - theta)) / (1.0 - zeta2 / kd->zetan);
+        kd->half_pow_theta = 1.0 + pow(0.5, theta);
+    }
+
+    if (kind == KEYDIST_HOTSPOT) {
+        kd->hot_ops = hot_ops;
+        kd->hot_keys = (uint64_t)(hot_keys * kd->num_keys);
+        if (kd->hot_keys == 0) {
+            kd->hot_keys = 1;
+        }
+        if (kd->hot_keys > kd->num_keys) {
+            kd->hot_keys = kd->num_keys;
+        }
+    }
+}
+
+// draws a zipfian rank in [0, n), rank 0 being the most popular one
+static inline uint64_t keydist_zipf_rank(const struct keydist* kd, struct xor_shift* rand, uint64_t n)
+{
+    double u = xor_shift_next_double(rand);
+    double uz = u * kd->zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < kd->half_pow_theta) {
+        return 1;
+    }
+    uint64_t rank = (uint64_t)(n * pow(kd->eta * u - kd->eta + 1.0, kd->alpha));
+    return rank < n ? rank : n - 1;
+}
+
+static inline uint64_t keydist_scramble(uint64_t rank)
+{
+    // FNV-1a over the bytes of the rank, as in YCSB's scrambled zipfian generator
+    uint64_t h = 0xcbf29ce484222325UL;
+    for (int i = 0; i < 8; i++) {
+        h ^= (rank >> (i * 8)) & 0xff;
+        h *= 0x100000001b3UL;
+    }
+    return h;
+}
+
+/**
+ * Draws the next object id from the distribution.
+ */
+static inline uint64_t keydist_next(struct keydist* kd, struct xor_shift* rand)
+{
+    switch (kd->kind) {
+    case KEYDIST_ZIPF:
+        return keydist_scramble(keydist_zipf_rank(kd, rand, kd->num_keys)) % kd->num_keys;
+    case KEYDIST_HOTSPOT:
+        if (xor_shift_next_double(rand) < kd->hot_ops || kd->hot_keys == kd->num_keys) {
+            return xor_shift_next(rand, kd->hot_keys);
+        }
+        return kd->hot_keys + xor_shift_next(rand, kd->num_keys - kd->hot_keys);
+    case KEYDIST_LATEST: {
+        uint64_t latest = __atomic_load_n(&kd->latest, __ATOMIC_RELAXED);
+        uint64_t rank = keydist_zipf_rank(kd, rand, kd->num_keys);
+        return (latest + kd->num_keys - rank) % kd->num_keys;
+    }
+    case KEYDIST_UNIFORM:
+    default:
+        return xor_shift_next(rand, kd->num_keys);
+    }
+}
+
+/**
+ * Records that the object with the given id has been inserted, making it the hottest key of the
+ * latest distribution.
+ */
+static inline void keydist_inserted(struct keydist* kd, uint64_t objid)
+{
+    __atomic_store_n(&kd->latest, objid, __ATOMIC_RELAXED);
+}
+
+#endif /* LOADBALANCER_KEYDIST_H_ */
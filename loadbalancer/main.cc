@@ -2,49 +2,73 @@
 
 #include <cstdio>
 #include <cstring>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <iostream>
 #include <iomanip>
 #include <libmemcached-1.0/memcached.h>
+#include <limits.h>
 #include <pthread.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 
-#define PERIODIC_PRINT_INTERVAL 1 // seconds
-
-struct xor_shift {
-    uint64_t state;
-};
-
-static inline void xor_shift_init(struct xor_shift *st, uint64_t tid)
-{
-    st->state = 0xdeadbeefdeadbeef ^ tid;
-}
+#include "coalesce.h"
+#include "coord.h"
+#include "histogram.h"
+#include "keydist.h"
+#include "mcproto.h"
+#include "mcstats.h"
+#include "nearcache.h"
+#include "perfcount.h"
+#include "placement.h"
+#include "replica.h"
+#include "results.h"
+#include "router.h"
+#include "shmring.h"
+#include "sizedist.h"
+#include "steady.h"
+#include "slabs.h"
+#include "store.h"
+#include "timer.h"
+#include "trace.h"
+#include "uring.h"
+#include "workload.h"
+#include "xorshift.h"
 
-static inline uint64_t xor_shift_next(struct xor_shift *st, uint64_t num_elements) {
-    // https://en.wikipedia.org/wiki/Xorshift
-    uint64_t x = st->state;
-    x ^= x << 13;
-    x ^= x >> 7;
-    x ^= x << 17;
-    st->state = x;
-    return x % num_elements;
-}
+#define PERIODIC_PRINT_INTERVAL 1 // seconds
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Option Parsing
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#define SERVER_MAX 8
+// the servers a run can route to, members or not, with elastic membership hundreds of them
+#define SERVER_MAX 512
 #define DEFAULT_MEMCACHED_PORT 11211
 
-// we set 64-bit keys
+// the default key size, every key ends in the object id as 8 hex digits
 #define KEY_SIZE 8
-// we set 64 byte values
+// the default value size
 #define VALUE_SIZE 64
+// memcached's limit on the key length
+#define KEY_MAX 250
+// the largest value that fits memcached's default item size limit of 1 MB with its header
+#define VALUE_MAX ((1 << 20) - 512)
 
 typedef unsigned int rel_time_t;
 
@@ -76,13 +100,21 @@ typedef struct _stritem {
     /* then data with terminating \r\n (no terminating null; it's binary!) */
 } item;
 
-#define ITEM_SIZE (sizeof(item) + VALUE_SIZE + KEY_SIZE + 34)
 
+enum server_transport {
+    SERVER_TCP,
+    SERVER_UNIX,
+    // rings in a shared memory segment, served by a local --shm-serve process
+    SERVER_SHM,
+    SERVER_TRANSPORT_MAX,
+};
+
+static const char* server_transport_names[SERVER_TRANSPORT_MAX] = { "tcp", "unix", "shm" };
 
 struct server_info {
     size_t num_servers;
     struct {
-        bool is_unix;
+        enum server_transport transport;
         union {
             struct {
                 char* path;
@@ -91,6 +123,9 @@ struct server_info {
                 char* hostname;
                 uint16_t port;
             } tcp;
+            struct {
+                char* name;
+            } shm;
         };
     } servers[SERVER_MAX + 1];
 };
@@ -109,6 +144,201 @@ static size_t opt_max_mem = 16;
 static size_t opt_num_threads = 1;
 // the duration of the benchmark
 static size_t opt_duration = 5;
+// the number of keys fetched per round trip (1 = single blocking gets)
+static size_t opt_batch_size = 1;
+// how keys are mapped to servers
+static enum router_kind opt_router = ROUTER_MODULO;
+// the number of virtual nodes per server with ketama routing
+static size_t opt_ketama_vnodes = ROUTER_KETAMA_DEFAULT_VNODES;
+// the popularity distribution of the keys in the benchmark phase
+static enum keydist_kind opt_key_dist = KEYDIST_UNIFORM;
+// the skew of the zipfian and latest distributions
+static double opt_zipf_theta = KEYDIST_DEFAULT_THETA;
+// hotspot distribution: the fraction of operations that go to the fraction of hot keys
+static double opt_hotspot_ops = 0.9;
+static double opt_hotspot_keys = 0.1;
+// the operation mix of the benchmark phase
+static struct workload opt_workload = { { 1 }, 1 };
+// open-loop mode: the offered load over all threads in operations per second (0 = closed loop)
+static double opt_target_rate = 0;
+// open-loop mode: the rate ramp start, end and increment (end = 0 runs the target rate only)
+static double opt_rate_ramp[3] = { 0, 0, 0 };
+// open-loop mode: the time each rate is offered for in seconds (0 = the query duration)
+static size_t opt_rate_step_duration = 0;
+// open-loop mode: whether requests arrive in fixed intervals or as a poisson process
+static bool opt_arrival_poisson = false;
+
+enum engine_kind {
+    // one blocking libmemcached connection per server and thread
+    ENGINE_LIBMEMCACHED,
+    // many non-blocking connections per thread driven by epoll, speaking the protocol natively
+    ENGINE_EPOLL,
+    // like epoll, but all sends and receives go through an io_uring with registered files and buffers
+    ENGINE_IO_URING,
+};
+
+// the client engine that executes the benchmark phase
+static enum engine_kind opt_engine = ENGINE_LIBMEMCACHED;
+// native engines: the number of connections each thread opens to each server
+static size_t opt_conns_per_server = 1;
+// native engines: the number of requests each connection keeps in flight
+static size_t opt_pipeline_depth = 1;
+// io_uring engine: let a kernel thread poll the submission queue
+static bool opt_sqpoll = false;
+
+// report the CPU time the client itself spends per operation
+static bool opt_client_overhead = false;
+
+// count cycles, instructions, cache misses, context switches and system calls of the client threads
+static bool opt_perf = false;
+// the processes of the servers whose threads are counted as well
+static pid_t opt_perf_server_pids[SERVER_MAX];
+static size_t opt_perf_num_server_pids = 0;
+
+// the number of servers every key is written to, and how reads choose among them
+static size_t opt_replicas = 1;
+static enum replica_policy opt_read_policy = REPLICA_PRIMARY;
+// hedged reads: the percentile of the primaries' get latency after which a second get is sent
+static double opt_hedge_percentile = 95.0;
+
+// the interval the server statistics are sampled at during the benchmark phase in ms, 0 disables
+static size_t opt_server_stats = 0;
+// the file the sampled time series is written to as CSV
+static const char* opt_server_stats_file = NULL;
+
+// the file the results are written to as a JSON document
+static const char* opt_results_json = NULL;
+// the file a summary row of the results is appended to
+static const char* opt_results_csv = NULL;
+// key=value pairs copied into the results, e.g. the sweep point or the memcached commit
+#define META_MAX 32
+static const char* opt_meta[META_MAX];
+static size_t opt_num_meta = 0;
+
+// the distributions of the key and value sizes over the object ids
+static struct sizedist opt_key_size = { SIZEDIST_FIXED, KEY_SIZE, KEY_SIZE, 1 };
+static struct sizedist opt_value_size = { SIZEDIST_FIXED, VALUE_SIZE, VALUE_SIZE, 2 };
+// the slab configuration of the servers (memcached's -f and -n), to size the key space
+static double opt_slab_factor = SLABS_DEFAULT_FACTOR;
+static size_t opt_slab_min_size = SLABS_DEFAULT_MIN_SIZE;
+
+// how the benchmark threads are pinned to the cores and NUMA nodes
+static enum placement_kind opt_placement = PLACEMENT_NONE;
+// the NUMA node of each of the first servers (the others: server index % number of nodes, as the
+// spawn scripts do)
+static int opt_server_nodes[SERVER_MAX];
+static size_t opt_num_server_nodes = 0;
+// send each thread's operations only to the servers on its own node
+static bool opt_numa_local = false;
+
+// how the keys are stored before the benchmark phase
+enum populate_kind {
+    // one blocking libmemcached set per key
+    POPULATE_SYNC,
+    // quiet sets streamed over native connections, acknowledged per batch
+    POPULATE_BULK,
+};
+
+// the way the population phase stores the keys
+static enum populate_kind opt_populate = POPULATE_SYNC;
+
+// proxy mode: the [host:]port to accept memcached clients on
+static const char* opt_proxy_listen = NULL;
+// proxy mode: the unix socket to accept memcached clients on
+static const char* opt_proxy_socket = NULL;
+// proxy mode: the time to run for in seconds (0 = until SIGINT or SIGTERM)
+static size_t opt_proxy_duration = 0;
+
+// shared memory server mode: the segment to serve, a POSIX shm name or a path on hugetlbfs
+static const char* opt_shm_serve = NULL;
+// shared memory server mode: the time to run for in seconds (0 = until SIGINT or SIGTERM)
+static size_t opt_shm_serve_duration = 0;
+// shared memory server mode: the number of channels, i.e. client connections, of the segment
+static size_t opt_shm_channels = 256;
+// shared memory server mode: the size of each ring in KB
+static size_t opt_shm_ring_size = 256;
+// shm:// servers and the shm server: whether an idle side polls or sleeps on a futex
+static enum shmring_wait opt_shm_wait = SHMRING_FUTEX;
+
+enum backend_kind {
+    // the operations go to the memcached servers
+    BACKEND_MEMCACHED,
+    // the operations go to a table in the client's own memory, one per server
+    BACKEND_INPROC,
+};
+
+// what serves the operations of the libmemcached engine
+static enum backend_kind opt_backend = BACKEND_MEMCACHED;
+
+enum trace_timing {
+    // the records are replayed back to back, as fast as each thread can
+    TRACE_TIMING_FAST,
+    // each record is sent at its time in the trace, scaled by the replay speed
+    TRACE_TIMING_ORIGINAL,
+};
+
+// the file the operations of the run are recorded to as a trace
+static const char* opt_trace_record = NULL;
+// the trace that is replayed instead of the workload
+static const char* opt_trace_replay = NULL;
+// how the records of the replayed trace are paced
+static enum trace_timing opt_trace_timing = TRACE_TIMING_FAST;
+// the factor the times of the replayed trace are sped up by
+static double opt_trace_speed = 1.0;
+// trace import mode: the CSV trace that is converted into the --trace-record file, and its layout
+static const char* opt_trace_import = NULL;
+static enum trace_csv_format opt_trace_import_format = TRACE_CSV_TWITTER;
+
+// the most gets of all threads combined into one multi-get per server (0 = off)
+static size_t opt_coalesce = 0;
+// the time a combined multi-get waits for more gets after its first one in us
+static size_t opt_coalesce_delay = 20;
+
+// the scheduled changes of the membership, at most MEMBERSHIP_EVENTS_MAX
+struct membership_event {
+    // when, in seconds since the benchmark phase started
+    double t;
+    size_t server;
+    // whether the server joins or leaves
+    bool add;
+};
+
+#define MEMBERSHIP_EVENTS_MAX 256
+
+// the number of servers, of those given, that are members at the start (0 = all)
+static size_t opt_initial_servers = 0;
+// the unix socket the membership is changed through during the run
+static const char* opt_control_socket = NULL;
+// the membership changes applied at fixed times of the run
+static struct membership_event opt_membership_events[MEMBERSHIP_EVENTS_MAX];
+static size_t opt_num_membership_events = 0;
+// a get that misses writes the object, as a cache-aside client does after reading the database
+static bool opt_fill_on_miss = false;
+
+// coordinated runs: the unix socket the coordinator listens on and the number of agents it runs
+static const char* opt_coordinator = NULL;
+static size_t opt_agents = 0;
+// coordinated runs: the coordinator's socket to join as an agent, the options come from there
+static const char* opt_agent = NULL;
+
+// adaptive runs: discard the warm-up and measure until the throughput's confidence interval is tight
+static bool opt_steady_state = false;
+// adaptive runs: the length of the intervals the throughput is sampled in, in ms
+static size_t opt_steady_interval = 1000;
+// adaptive runs: the intervals the warm-up is judged over and the coefficient of variation that ends it
+static size_t opt_steady_window = 5;
+static double opt_warmup_cv = 0.05;
+// adaptive runs: the half width of the 95% confidence interval relative to the mean a repeat stops at
+static double opt_ci_target = 0.02;
+// adaptive runs: the measured repeats, at most RUN_CONTROL_REPEATS_MAX, the report gives the mean of
+// their throughputs and its interval
+#define RUN_CONTROL_REPEATS_MAX 64
+static size_t opt_repeats = 1;
+
+// the byte budget of the in-process cache in front of the gets in MB (0 = off)
+static size_t opt_near_cache = 0;
+// the time a value stays in the in-process cache in ms (0 = until evicted or overwritten)
+static size_t opt_near_cache_ttl = 1000;
 
 // basic options
 enum memcached_options {
@@ -119,9 +349,109 @@ enum memcached_options {
     OPT_BINARY = 'b',
     OPT_DEBUG = 'd',
     OPT_THREADS = 'c',
-    OPT_DURATION = 't'
+    OPT_DURATION = 't',
+    // long-only options
+    OPT_BATCH_SIZE = 0x100,
+    OPT_ROUTER,
+    OPT_KETAMA_VNODES,
+    OPT_KEY_DIST,
+    OPT_ZIPF_THETA,
+    OPT_HOTSPOT,
+    OPT_WORKLOAD,
+    OPT_OP_MIX,
+    OPT_TARGET_RATE,
+    OPT_RATE_RAMP,
+    OPT_RATE_STEP_DURATION,
+    OPT_ARRIVAL,
+    OPT_ENGINE,
+    OPT_CONNS_PER_SERVER,
+    OPT_PIPELINE_DEPTH,
+    OPT_SQPOLL,
+    OPT_PROXY_LISTEN,
+    OPT_PROXY_SOCKET,
+    OPT_PROXY_DURATION,
+    OPT_NEAR_CACHE,
+    OPT_NEAR_CACHE_TTL,
+    OPT_POPULATE,
+    OPT_CLIENT_OVERHEAD,
+    OPT_KEY_SIZE,
+    OPT_VALUE_SIZE,
+    OPT_SLAB_GROWTH_FACTOR,
+    OPT_SLAB_MIN_SIZE,
+    OPT_PLACEMENT,
+    OPT_SERVER_NODES,
+    OPT_NUMA_ROUTING,
+    OPT_RESULTS_JSON,
+    OPT_RESULTS_CSV,
+    OPT_META,
+    OPT_PERF,
+    OPT_PERF_SERVER_PIDS,
+    OPT_SERVER_STATS,
+    OPT_SERVER_STATS_FILE,
+    OPT_REPLICAS,
+    OPT_READ_POLICY,
+    OPT_HEDGE_PERCENTILE,
+    OPT_SHM_SERVE,
+    OPT_SHM_SERVE_DURATION,
+    OPT_SHM_CHANNELS,
+    OPT_SHM_RING_SIZE,
+    OPT_SHM_WAIT,
+    OPT_BACKEND,
+    OPT_TRACE_RECORD,
+    OPT_TRACE_REPLAY,
+    OPT_TRACE_TIMING,
+    OPT_TRACE_SPEED,
+    OPT_TRACE_IMPORT,
+    OPT_COALESCE,
+    OPT_COALESCE_DELAY,
+    OPT_INITIAL_SERVERS,
+    OPT_CONTROL_SOCKET,
+    OPT_MEMBERSHIP_EVENTS,
+    OPT_FILL_ON_MISS,
+    OPT_COORDINATOR,
+    OPT_AGENTS,
+    OPT_AGENT,
+    OPT_STEADY_STATE,
+    OPT_STEADY_INTERVAL,
+    OPT_STEADY_WINDOW,
+    OPT_WARMUP_CV,
+    OPT_CI_TARGET,
+    OPT_REPEATS,
 };
 
+static int membership_event_cmp(const void* a, const void* b)
+{
+    double ta = ((const struct membership_event*)a)->t;
+    double tb = ((const struct membership_event*)b)->t;
+    return ta < tb ? -1 : (ta > tb);
+}
+
+// parses --membership-events=<seconds>:<+|-><server index>,...
+static void options_parse_membership_events(const char* arg)
+{
+    char* list = strdup(arg);
+    if (list == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    char* save;
+    for (char* event = strtok_r(list, ",", &save); event != NULL; event = strtok_r(NULL, ",", &save)) {
+        char* end;
+        double t = strtod(event, &end);
+        if (opt_num_membership_events == MEMBERSHIP_EVENTS_MAX || end == event || t < 0 || end[0] != ':'
+            || (end[1] != '+' && end[1] != '-') || end[2] < '0' || end[2] > '9') {
+            printf("Invalid membership event: %s (expected <seconds>:<+|-><server index>, at most %u)\n", event,
+                MEMBERSHIP_EVENTS_MAX);
+            exit(EXIT_FAILURE);
+        }
+        struct membership_event* e = &opt_membership_events[opt_num_membership_events++];
+        e->t = t;
+        e->add = end[1] == '+';
+        e->server = strtoull(end + 2, NULL, 10);
+    }
+    free(list);
+    qsort(opt_membership_events, opt_num_membership_events, sizeof(*opt_membership_events), membership_event_cmp);
+}
+
 static void options_parse_server(const char* _server_list)
 {
     char* server_list = strdup(_server_list);
@@ -137,13 +467,17 @@ static void options_parse_server(const char* _server_list)
             break;
         }
         if (strncmp(server, "unix://", 7) == 0) {
-            opt_server_info.servers[num_servers].is_unix = true;
+            opt_server_info.servers[num_servers].transport = SERVER_UNIX;
             opt_server_info.servers[num_servers].ux.path = server + 7;
             printf("Server [%zu] unix %s\n", num_servers, opt_server_info.servers[num_servers].ux.path);
+        } else if (strncmp(server, "shm://", 6) == 0) {
+            opt_server_info.servers[num_servers].transport = SERVER_SHM;
+            opt_server_info.servers[num_servers].shm.name = server + 6;
+            printf("Server [%zu] shm  %s\n", num_servers, opt_server_info.servers[num_servers].shm.name);
         } else if (strncmp(server, "tcp://", 6) == 0) {
             char* port;
             char* hostname = strtok_r(server + 6, ":", &port);
-            opt_server_info.servers[num_servers].is_unix = false;
+            opt_server_info.servers[num_servers].transport = SERVER_TCP;
             opt_server_info.servers[num_servers].tcp.hostname = hostname;
             printf("port: %s %p\n", port, port);
             if (port && *port != 0) {
@@ -183,6 +517,72 @@ static void options_parse(int argc, char* argv[])
         { "x-benchmark-mem", required_argument, NULL, OPT_MAX_MEM },
         { "x-benchmark-num-queries", required_argument, NULL, OPT_NUM_QUERIES },
         { "x-benchmark-query-duration", required_argument, NULL, OPT_DURATION },
+        { "batch-size", required_argument, NULL, OPT_BATCH_SIZE },
+        { "router", required_argument, NULL, OPT_ROUTER },
+        { "ketama-vnodes", required_argument, NULL, OPT_KETAMA_VNODES },
+        { "key-dist", required_argument, NULL, OPT_KEY_DIST },
+        { "zipf-theta", required_argument, NULL, OPT_ZIPF_THETA },
+        { "hotspot", required_argument, NULL, OPT_HOTSPOT },
+        { "workload", required_argument, NULL, OPT_WORKLOAD },
+        { "op-mix", required_argument, NULL, OPT_OP_MIX },
+        { "target-rate", required_argument, NULL, OPT_TARGET_RATE },
+        { "rate-ramp", required_argument, NULL, OPT_RATE_RAMP },
+        { "rate-step-duration", required_argument, NULL, OPT_RATE_STEP_DURATION },
+        { "arrival", required_argument, NULL, OPT_ARRIVAL },
+        { "engine", required_argument, NULL, OPT_ENGINE },
+        { "conns-per-server", required_argument, NULL, OPT_CONNS_PER_SERVER },
+        { "pipeline-depth", required_argument, NULL, OPT_PIPELINE_DEPTH },
+        { "sqpoll", no_argument, NULL, OPT_SQPOLL },
+        { "proxy-listen", required_argument, NULL, OPT_PROXY_LISTEN },
+        { "proxy-socket", required_argument, NULL, OPT_PROXY_SOCKET },
+        { "proxy-duration", required_argument, NULL, OPT_PROXY_DURATION },
+        { "near-cache", required_argument, NULL, OPT_NEAR_CACHE },
+        { "near-cache-ttl", required_argument, NULL, OPT_NEAR_CACHE_TTL },
+        { "populate", required_argument, NULL, OPT_POPULATE },
+        { "client-overhead", no_argument, NULL, OPT_CLIENT_OVERHEAD },
+        { "key-size", required_argument, NULL, OPT_KEY_SIZE },
+        { "value-size", required_argument, NULL, OPT_VALUE_SIZE },
+        { "slab-growth-factor", required_argument, NULL, OPT_SLAB_GROWTH_FACTOR },
+        { "slab-min-size", required_argument, NULL, OPT_SLAB_MIN_SIZE },
+        { "placement", required_argument, NULL, OPT_PLACEMENT },
+        { "server-nodes", required_argument, NULL, OPT_SERVER_NODES },
+        { "numa-routing", required_argument, NULL, OPT_NUMA_ROUTING },
+        { "results-json", required_argument, NULL, OPT_RESULTS_JSON },
+        { "results-csv", required_argument, NULL, OPT_RESULTS_CSV },
+        { "meta", required_argument, NULL, OPT_META },
+        { "perf", no_argument, NULL, OPT_PERF },
+        { "perf-server-pids", required_argument, NULL, OPT_PERF_SERVER_PIDS },
+        { "server-stats", required_argument, NULL, OPT_SERVER_STATS },
+        { "server-stats-file", required_argument, NULL, OPT_SERVER_STATS_FILE },
+        { "replicas", required_argument, NULL, OPT_REPLICAS },
+        { "read-policy", required_argument, NULL, OPT_READ_POLICY },
+        { "hedge-percentile", required_argument, NULL, OPT_HEDGE_PERCENTILE },
+        { "shm-serve", required_argument, NULL, OPT_SHM_SERVE },
+        { "shm-serve-duration", required_argument, NULL, OPT_SHM_SERVE_DURATION },
+        { "shm-channels", required_argument, NULL, OPT_SHM_CHANNELS },
+        { "shm-ring-size", required_argument, NULL, OPT_SHM_RING_SIZE },
+        { "shm-wait", required_argument, NULL, OPT_SHM_WAIT },
+        { "backend", required_argument, NULL, OPT_BACKEND },
+        { "trace-record", required_argument, NULL, OPT_TRACE_RECORD },
+        { "trace-replay", required_argument, NULL, OPT_TRACE_REPLAY },
+        { "trace-timing", required_argument, NULL, OPT_TRACE_TIMING },
+        { "trace-speed", required_argument, NULL, OPT_TRACE_SPEED },
+        { "trace-import", required_argument, NULL, OPT_TRACE_IMPORT },
+        { "coalesce", required_argument, NULL, OPT_COALESCE },
+        { "coalesce-delay", required_argument, NULL, OPT_COALESCE_DELAY },
+        { "initial-servers", required_argument, NULL, OPT_INITIAL_SERVERS },
+        { "control-socket", required_argument, NULL, OPT_CONTROL_SOCKET },
+        { "membership-events", required_argument, NULL, OPT_MEMBERSHIP_EVENTS },
+        { "fill-on-miss", no_argument, NULL, OPT_FILL_ON_MISS },
+        { "coordinator", required_argument, NULL, OPT_COORDINATOR },
+        { "agents", required_argument, NULL, OPT_AGENTS },
+        { "agent", required_argument, NULL, OPT_AGENT },
+        { "steady-state", no_argument, NULL, OPT_STEADY_STATE },
+        { "steady-interval", required_argument, NULL, OPT_STEADY_INTERVAL },
+        { "steady-window", required_argument, NULL, OPT_STEADY_WINDOW },
+        { "warmup-cv", required_argument, NULL, OPT_WARMUP_CV },
+        { "ci-target", required_argument, NULL, OPT_CI_TARGET },
+        { "repeats", required_argument, NULL, OPT_REPEATS },
         { 0, 0, 0, 0 },
     };
 
@@ -217,6 +617,406 @@ static void options_parse(int argc, char* argv[])
         case OPT_DURATION:
             opt_duration = strtoull(optarg, NULL, 10);
             break;
+        case OPT_BATCH_SIZE:
+            opt_batch_size = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_ROUTER:
+            if (!router_parse_kind(optarg, &opt_router)) {
+                printf("Invalid router: %s (expected modulo, ketama or jump)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_KETAMA_VNODES:
+            opt_ketama_vnodes = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_KEY_DIST:
+            if (!keydist_parse_kind(optarg, &opt_key_dist)) {
+                printf("Invalid key distribution: %s (expected uniform, zipf, hotspot or latest)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_ZIPF_THETA:
+            opt_zipf_theta = strtod(optarg, NULL);
+            if (!(opt_zipf_theta > 0.0 && opt_zipf_theta < 1.0)) {
+                printf("Invalid zipf theta: %s (expected 0 < theta < 1)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_HOTSPOT: { /* --hotspot=<% of operations>,<% of keys> */
+            char* keys;
+            opt_hotspot_ops = strtod(optarg, &keys) / 100.0;
+            if (*keys != ',' || opt_hotspot_ops < 0.0 || opt_hotspot_ops > 1.0) {
+                printf("Invalid hotspot: %s (expected <%% of operations>,<%% of keys>)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            opt_hotspot_keys = strtod(keys + 1, NULL) / 100.0;
+            if (opt_hotspot_keys <= 0.0 || opt_hotspot_keys > 1.0) {
+                printf("Invalid hotspot: %s (expected <%% of operations>,<%% of keys>)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case OPT_WORKLOAD: { /* YCSB-like preset, sets the mix and the key distribution */
+            const struct workload_preset* preset = workload_find_preset(optarg);
+            if (preset == NULL) {
+                printf("Invalid workload: %s (expected one of", optarg);
+                for (size_t i = 0; i < WORKLOAD_NUM_PRESETS; i++) {
+                    printf(" %s (%s)", workload_presets[i].name, workload_presets[i].description);
+                }
+                printf(")\n");
+                exit(EXIT_FAILURE);
+            }
+            workload_parse_mix(&opt_workload, preset->mix);
+            opt_key_dist = preset->key_dist;
+            break;
+        }
+        case OPT_OP_MIX:
+            if (!workload_parse_mix(&opt_workload, optarg)) {
+                printf("Invalid operation mix: %s (expected <op>:<weight>,... with op one of", optarg);
+                for (int i = 0; i < WORKLOAD_OP_MAX; i++) {
+                    printf(" %s", workload_op_names[i]);
+                }
+                printf(")\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_TARGET_RATE:
+            opt_target_rate = strtod(optarg, NULL);
+            break;
+        case OPT_RATE_RAMP: /* --rate-ramp=<start>:<end>:<step> */
+            if (sscanf(optarg, "%lf:%lf:%lf", &opt_rate_ramp[0], &opt_rate_ramp[1], &opt_rate_ramp[2]) != 3
+                || opt_rate_ramp[0] <= 0 || opt_rate_ramp[1] < opt_rate_ramp[0] || opt_rate_ramp[2] <= 0) {
+                printf("Invalid rate ramp: %s (expected <start>:<end>:<step> in ops/s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_RATE_STEP_DURATION:
+            opt_rate_step_duration = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_ARRIVAL:
+            if (strcmp(optarg, "poisson") == 0) {
+                opt_arrival_poisson = true;
+            } else if (strcmp(optarg, "fixed") == 0) {
+                opt_arrival_poisson = false;
+            } else {
+                printf("Invalid arrival process: %s (expected fixed or poisson)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_ENGINE:
+            if (strcmp(optarg, "libmemcached") == 0) {
+                opt_engine = ENGINE_LIBMEMCACHED;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                opt_engine = ENGINE_EPOLL;
+            } else if (strcmp(optarg, "io_uring") == 0 || strcmp(optarg, "uring") == 0) {
+                opt_engine = ENGINE_IO_URING;
+            } else {
+                printf("Invalid engine: %s (expected libmemcached, epoll or io_uring)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_CONNS_PER_SERVER:
+            opt_conns_per_server = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_PIPELINE_DEPTH:
+            opt_pipeline_depth = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_SQPOLL:
+            opt_sqpoll = true;
+            break;
+        case OPT_PROXY_LISTEN:
+            opt_proxy_listen = optarg;
+            break;
+        case OPT_PROXY_SOCKET:
+            opt_proxy_socket = optarg;
+            break;
+        case OPT_PROXY_DURATION:
+            opt_proxy_duration = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_NEAR_CACHE:
+            opt_near_cache = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_NEAR_CACHE_TTL:
+            opt_near_cache_ttl = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_POPULATE:
+            if (strcmp(optarg, "sync") == 0) {
+                opt_populate = POPULATE_SYNC;
+            } else if (strcmp(optarg, "bulk") == 0) {
+                opt_populate = POPULATE_BULK;
+            } else {
+                printf("Invalid populate mode: %s (expected sync or bulk)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_CLIENT_OVERHEAD:
+            opt_client_overhead = true;
+            break;
+        case OPT_KEY_SIZE:
+            if (!sizedist_parse(&opt_key_size, optarg, KEY_SIZE, KEY_MAX, opt_key_size.seed)) {
+                printf("Invalid key size: %s (expected <size>, uniform:<min>:<max> or file:<histogram> with sizes "
+                       "in %u .. %u)\n", optarg, KEY_SIZE, KEY_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_VALUE_SIZE:
+            if (!sizedist_parse(&opt_value_size, optarg, 1, VALUE_MAX, opt_value_size.seed)) {
+                printf("Invalid value size: %s (expected <size>, uniform:<min>:<max> or file:<histogram> with sizes "
+                       "in 1 .. %u)\n", optarg, VALUE_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_SLAB_GROWTH_FACTOR:
+            opt_slab_factor = strtod(optarg, NULL);
+            if (!(opt_slab_factor > 1.0)) {
+                printf("Invalid slab growth factor: %s (expected > 1)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_SLAB_MIN_SIZE:
+            opt_slab_min_size = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_PLACEMENT:
+            if (!placement_kind_parse(optarg, &opt_placement)) {
+                printf("Invalid placement: %s (expected none, compact or spread)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_SERVER_NODES: {
+            int nodes[SERVER_MAX + 1];
+            int n = placement_parse_list(optarg, nodes, SERVER_MAX + 1);
+            if (n <= 0 || n > SERVER_MAX) {
+                printf("Invalid server nodes: %s (expected a comma-separated node per server)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            for (int i = 0; i < n; i++) {
+                opt_server_nodes[i] = nodes[i];
+            }
+            opt_num_server_nodes = n;
+            break;
+        }
+        case OPT_NUMA_ROUTING:
+            if (strcmp(optarg, "all") == 0) {
+                opt_numa_local = false;
+            } else if (strcmp(optarg, "local") == 0) {
+                opt_numa_local = true;
+            } else {
+                printf("Invalid NUMA routing: %s (expected all or local)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_RESULTS_JSON:
+            opt_results_json = optarg;
+            break;
+        case OPT_RESULTS_CSV:
+            opt_results_csv = optarg;
+            break;
+        case OPT_META:
+            if (strchr(optarg, '=') == NULL || opt_num_meta == META_MAX) {
+                printf("Invalid meta: %s (expected <key>=<value>, at most %u times)\n", optarg, META_MAX);
+                exit(EXIT_FAILURE);
+            }
+            opt_meta[opt_num_meta++] = optarg;
+            break;
+        case OPT_PERF:
+            opt_perf = true;
+            break;
+        case OPT_PERF_SERVER_PIDS: {
+            int pids[SERVER_MAX + 1];
+            int n = placement_parse_list(optarg, pids, SERVER_MAX + 1);
+            if (n <= 0 || n > SERVER_MAX) {
+                printf("Invalid server pids: %s (expected a comma-separated list of at most %u pids)\n", optarg,
+                    SERVER_MAX);
+                exit(EXIT_FAILURE);
+            }
+            for (int i = 0; i < n; i++) {
+                opt_perf_server_pids[i] = pids[i];
+            }
+            opt_perf_num_server_pids = n;
+            break;
+        }
+        case OPT_SERVER_STATS:
+            opt_server_stats = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_SERVER_STATS_FILE:
+            opt_server_stats_file = optarg;
+            break;
+        case OPT_REPLICAS:
+            opt_replicas = strtoull(optarg, NULL, 10);
+            if (opt_replicas == 0 || opt_replicas > SERVER_MAX) {
+                printf("Invalid replicas: %s (expected 1 to %u)\n", optarg, SERVER_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_READ_POLICY:
+            if (!replica_policy_parse(optarg, &opt_read_policy)) {
+                printf("Invalid read policy: %s (expected primary, p2c or hedged)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_HEDGE_PERCENTILE:
+            opt_hedge_percentile = strtod(optarg, NULL);
+            if (!(opt_hedge_percentile > 0.0 && opt_hedge_percentile < 100.0)) {
+                printf("Invalid hedge percentile: %s (expected between 0 and 100)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_SHM_SERVE:
+            opt_shm_serve = optarg;
+            break;
+        case OPT_SHM_SERVE_DURATION:
+            opt_shm_serve_duration = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_SHM_CHANNELS:
+            opt_shm_channels = strtoull(optarg, NULL, 10);
+            if (opt_shm_channels == 0) {
+                printf("Invalid shm channels: %s (expected at least 1)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_SHM_RING_SIZE:
+            opt_shm_ring_size = strtoull(optarg, NULL, 10);
+            if (opt_shm_ring_size < 4 || (opt_shm_ring_size & (opt_shm_ring_size - 1)) != 0) {
+                printf("Invalid shm ring size: %s (expected a power of two of at least 4 KB)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_SHM_WAIT:
+            if (strcmp(optarg, "spin") == 0) {
+                opt_shm_wait = SHMRING_SPIN;
+            } else if (strcmp(optarg, "futex") == 0) {
+                opt_shm_wait = SHMRING_FUTEX;
+            } else {
+                printf("Invalid shm wait: %s (expected spin or futex)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_BACKEND:
+            if (strcmp(optarg, "memcached") == 0) {
+                opt_backend = BACKEND_MEMCACHED;
+            } else if (strcmp(optarg, "inproc") == 0) {
+                opt_backend = BACKEND_INPROC;
+            } else {
+                printf("Invalid backend: %s (expected memcached or inproc)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_TRACE_RECORD:
+            opt_trace_record = optarg;
+            break;
+        case OPT_TRACE_REPLAY:
+            opt_trace_replay = optarg;
+            break;
+        case OPT_TRACE_TIMING:
+            if (strcmp(optarg, "fast") == 0) {
+                opt_trace_timing = TRACE_TIMING_FAST;
+            } else if (strcmp(optarg, "original") == 0) {
+                opt_trace_timing = TRACE_TIMING_ORIGINAL;
+            } else {
+                printf("Invalid trace timing: %s (expected fast or original)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_TRACE_SPEED:
+            opt_trace_speed = strtod(optarg, NULL);
+            if (!(opt_trace_speed > 0.0)) {
+                printf("Invalid trace speed: %s (expected a positive factor)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_TRACE_IMPORT: {
+            const char* colon = strchr(optarg, ':');
+            char format[16];
+            if (colon == NULL || (size_t)(colon - optarg) >= sizeof(format) || colon[1] == 0) {
+                printf("Invalid trace import: %s (expected <twitter|simple>:<csv file>)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(format, optarg, colon - optarg);
+            format[colon - optarg] = 0;
+            if (!trace_csv_format_parse(format, &opt_trace_import_format)) {
+                printf("Invalid trace import: %s (expected <twitter|simple>:<csv file>)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            opt_trace_import = colon + 1;
+            break;
+        }
+        case OPT_COALESCE:
+            opt_coalesce = strtoull(optarg, NULL, 10);
+            if (opt_coalesce > COALESCE_MAX) {
+                printf("Invalid coalesce: %s (expected 0 to %u keys)\n", optarg, COALESCE_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_COALESCE_DELAY:
+            opt_coalesce_delay = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_INITIAL_SERVERS:
+            opt_initial_servers = strtoull(optarg, NULL, 10);
+            if (opt_initial_servers == 0) {
+                printf("Invalid initial servers: %s (expected at least 1)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_CONTROL_SOCKET:
+            opt_control_socket = optarg;
+            break;
+        case OPT_MEMBERSHIP_EVENTS:
+            options_parse_membership_events(optarg);
+            break;
+        case OPT_FILL_ON_MISS:
+            opt_fill_on_miss = true;
+            break;
+        case OPT_COORDINATOR:
+            opt_coordinator = optarg;
+            break;
+        case OPT_AGENTS:
+            opt_agents = strtoull(optarg, NULL, 10);
+            if (opt_agents == 0) {
+                printf("Invalid agents: %s (expected at least 1)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_AGENT:
+            opt_agent = optarg;
+            break;
+        case OPT_STEADY_STATE:
+            opt_steady_state = true;
+            break;
+        case OPT_STEADY_INTERVAL:
+            opt_steady_interval = strtoull(optarg, NULL, 10);
+            if (opt_steady_interval < 10) {
+                printf("Invalid steady interval: %s (expected at least 10 ms)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_STEADY_WINDOW:
+            opt_steady_window = strtoull(optarg, NULL, 10);
+            if (opt_steady_window < 2 || opt_steady_window > STEADY_WINDOW_MAX) {
+                printf("Invalid steady window: %s (expected 2 .. %u intervals)\n", optarg, STEADY_WINDOW_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_WARMUP_CV:
+            opt_warmup_cv = strtod(optarg, NULL);
+            if (!(opt_warmup_cv > 0)) {
+                printf("Invalid warmup cv: %s (expected a fraction above 0, e.g. 0.05)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_CI_TARGET:
+            opt_ci_target = strtod(optarg, NULL);
+            if (!(opt_ci_target > 0)) {
+                printf("Invalid ci target: %s (expected a fraction above 0, e.g. 0.02)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_REPEATS:
+            opt_repeats = strtoull(optarg, NULL, 10);
+            if (opt_repeats == 0 || opt_repeats > RUN_CONTROL_REPEATS_MAX) {
+                printf("Invalid repeats: %s (expected 1 .. %u)\n", optarg, RUN_CONTROL_REPEATS_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case '?':
             exit(EXIT_FAILURE);
         default:
@@ -226,15 +1026,7029 @@ static void options_parse(int argc, char* argv[])
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-// Benchmark Function
+// Coordination
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-pthread_barrier_t barrier;
+// the time an agent keeps trying to reach the coordinator in seconds
+#define COORD_CONNECT_TIMEOUT_S 30
 
-size_t num_queries = 0;
-size_t num_missed = 0;
-size_t num_errors = 0;
-size_t num_populated = 0;
+// the barriers of thread_main the agents pass in lockstep, named by the phase they open
+enum coord_phase {
+    COORD_POPULATE,
+    COORD_POPULATED,
+    COORD_BENCHMARK,
+    COORD_BENCHMARKED,
+    COORD_PHASES,
+};
+
+static const char* coord_phase_names[COORD_PHASES] = { "populate", "populated", "benchmark", "benchmarked" };
+
+// the agent's index and the number of agents, 0 of 1 outside coordinated runs
+static size_t coord_index = 0;
+static size_t coord_count = 1;
+// the agent's connection to the coordinator, -1 outside coordinated runs
+static int coord_fd = -1;
+// the phase the agent's next barrier opens
+static uint32_t coord_phase = COORD_POPULATE;
+
+static bool coordinator_enabled(void)
+{
+    return opt_agents > 0;
+}
+
+static bool agent_enabled(void)
+{
+    return coord_fd >= 0;
+}
+
+// the thread's id among the threads of all agents, which places it and partitions the keys
+static inline size_t coord_thread_id(uint64_t tid)
+{
+    return coord_index * opt_num_threads + tid;
+}
+
+// the number of benchmark threads of all agents
+static inline size_t coord_num_threads(void)
+{
+    return coord_count * opt_num_threads;
+}
+
+/**
+ * Joins the coordinator as an agent and parses the command line it hands out, before anything else
+ * is configured. The arguments stay allocated, the options point into them.
+ */
+static void agent_join(void)
+{
+    coord_fd = coord_connect(opt_agent, COORD_CONNECT_TIMEOUT_S);
+    if (coord_fd < 0) {
+        printf("ERROR: failed to connect to the coordinator at %s: %s\n", opt_agent, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    uint32_t pid = (uint32_t)getpid();
+    struct coord_msg msg;
+    void* payload;
+    if (!coord_send(coord_fd, COORD_HELLO, 0, &pid, sizeof(pid)) || !coord_recv(coord_fd, COORD_CONFIG, &msg, &payload)
+        || msg.len < sizeof(struct coord_config)) {
+        printf("ERROR: the coordinator at %s sent no configuration\n", opt_agent);
+        exit(EXIT_FAILURE);
+    }
+    const struct coord_config* config = (const struct coord_config*)payload;
+    coord_index = config->index;
+    coord_count = config->num_agents;
+
+    char* args = (char*)(config + 1);
+    size_t len = msg.len - sizeof(*config);
+    int argc = 1;
+    for (size_t i = 0; i < len; i++) {
+        argc += args[i] == '\0';
+    }
+    char** argv = (char**)calloc(argc + 1, sizeof(*argv));
+    if (argv == NULL) {
+        printf("ERROR: failed to allocate memory for the agent's arguments\n");
+        exit(EXIT_FAILURE);
+    }
+    argv[0] = (char*)"loadbalancer";
+    for (size_t i = 0, a = 1; i < len; i += strlen(&args[i]) + 1) {
+        argv[a++] = &args[i];
+    }
+    // start over with the coordinator's arguments
+    optind = 0;
+    options_parse(argc, argv);
+    opt_agents = 0;
+    opt_coordinator = NULL;
+    printf("agent %zu of %zu: joined the coordinator at %s\n", coord_index, coord_count, opt_agent);
+}
+
+// waits until every agent reached the barrier of the next phase, by the agent's main thread
+static void agent_barrier(void)
+{
+    struct coord_msg msg;
+    void* payload;
+    if (!coord_send(coord_fd, COORD_ARRIVE, coord_phase, NULL, 0) || !coord_recv(coord_fd, COORD_RELEASE, &msg, &payload)
+        || msg.phase != coord_phase) {
+        printf("ERROR: lost the coordinator before the %s phase\n", coord_phase_names[coord_phase]);
+        exit(EXIT_FAILURE);
+    }
+    coord_phase++;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Key Routing
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The servers keys are routed to and the router over them. A membership is never modified once
+ * published, a change builds a new one and swaps the pointer, so routing never takes a lock. The
+ * ketama continuum is built from the members' names, a server keeps its points across changes.
+ */
+struct membership {
+    // counts the changes, the first membership is version 1
+    uint64_t version;
+    size_t num_members;
+    // the server index behind each of the router's servers
+    uint32_t* members;
+    struct router router;
+    // the next older membership that waits to be freed
+    struct membership* retired;
+};
+
+// the membership keys are routed with, swapped by the membership thread during elastic runs
+static struct membership* key_members = NULL;
+// the version of key_members, published after it for the threads to announce what they route with
+static uint64_t key_members_version = 0;
+
+// the requests and bytes (keys and values) exchanged with a single server
+struct server_load {
+    size_t requests;
+    size_t bytes;
+};
+
+// the load of the benchmark phase per server, summed up over all threads
+static struct server_load server_load[SERVER_MAX];
+
+static void server_name(size_t i, char* buf, size_t len)
+{
+    if (opt_server_info.servers[i].transport == SERVER_UNIX) {
+        snprintf(buf, len, "unix://%s", opt_server_info.servers[i].ux.path);
+    } else if (opt_server_info.servers[i].transport == SERVER_SHM) {
+        snprintf(buf, len, "shm://%s", opt_server_info.servers[i].shm.name);
+    } else {
+        snprintf(buf, len, "%s:%u", opt_server_info.servers[i].tcp.hostname,
+            opt_server_info.servers[i].tcp.port);
+    }
+}
+
+static bool server_has_transport(enum server_transport transport)
+{
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        if (opt_server_info.servers[i].transport == transport) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct membership* membership_build(const uint32_t* members, size_t num_members, uint64_t version)
+{
+    struct membership* ms = (struct membership*)calloc(1, sizeof(*ms));
+    char* names = (char*)calloc(num_members, 256);
+    const char** name_ptrs = (const char**)calloc(num_members, sizeof(*name_ptrs));
+    if (ms == NULL || names == NULL || name_ptrs == NULL) {
+        printf("ERROR: failed to allocate memory for the key routing\n");
+        exit(EXIT_FAILURE);
+    }
+    ms->members = (uint32_t*)malloc(num_members * sizeof(*ms->members));
+    if (ms->members == NULL) {
+        printf("ERROR: failed to allocate memory for the key routing\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(ms->members, members, num_members * sizeof(*members));
+    ms->num_members = num_members;
+    ms->version = version;
+    for (size_t i = 0; i < num_members; i++) {
+        server_name(members[i], &names[i * 256], 256);
+        name_ptrs[i] = &names[i * 256];
+    }
+
+    router_init(&ms->router, opt_router, name_ptrs, num_members, opt_ketama_vnodes);
+    free(names);
+    free(name_ptrs);
+    return ms;
+}
+
+static void membership_free(struct membership* ms)
+{
+    router_free(&ms->router);
+    free(ms->members);
+    free(ms);
+}
+
+// routes the keys to the first `num_members` servers
+static void key_router_init(size_t num_members)
+{
+    uint32_t* members = (uint32_t*)malloc(num_members * sizeof(*members));
+    if (members == NULL) {
+        printf("ERROR: failed to allocate memory for the key routing\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < num_members; i++) {
+        members[i] = (uint32_t)i;
+    }
+    key_members = membership_build(members, num_members, 1);
+    key_members_version = 1;
+    free(members);
+}
+
+// frees the membership and those still waiting to be freed, once no thread routes keys anymore
+static void key_router_free(void)
+{
+    while (key_members != NULL) {
+        struct membership* ms = key_members;
+        key_members = ms->retired;
+        membership_free(ms);
+    }
+}
+
+static inline const struct membership* key_membership(void)
+{
+    return __atomic_load_n(&key_members, __ATOMIC_ACQUIRE);
+}
+
+// returns the server the object is stored on
+static inline size_t key_server(uint64_t objid)
+{
+    const struct membership* ms = key_membership();
+    return ms->members[router_lookup(&ms->router, objid)];
+}
+
+// like router_replicas(), with server indices
+static inline size_t key_replicas(uint64_t objid, size_t n, size_t* servers)
+{
+    const struct membership* ms = key_membership();
+    size_t num_replicas = router_replicas(&ms->router, objid, n, servers);
+    for (size_t i = 0; i < num_replicas; i++) {
+        servers[i] = ms->members[servers[i]];
+    }
+    return num_replicas;
+}
+
+static void server_load_merge(const struct server_load* load)
+{
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        __atomic_fetch_add(&server_load[i].requests, load[i].requests, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&server_load[i].bytes, load[i].bytes, __ATOMIC_RELAXED);
+    }
+}
+
+static void server_load_report(void)
+{
+    size_t total_requests = 0, total_bytes = 0;
+    size_t max_requests = 0, max_bytes = 0, hottest = 0;
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        total_requests += server_load[i].requests;
+        total_bytes += server_load[i].bytes;
+        if (server_load[i].requests > max_requests) {
+            max_requests = server_load[i].requests;
+            hottest = i;
+        }
+        if (server_load[i].bytes > max_bytes) {
+            max_bytes = server_load[i].bytes;
+        }
+    }
+
+    printf("benchmark server load (%s routing)\n", router_kind_name(opt_router));
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        char name[256];
+        server_name(i, name, sizeof(name));
+        double share = total_requests ? 100.0 * server_load[i].requests / total_requests : 0.0;
+        printf("  server %zu %-32s requests %12zu (%5.1f%%)  bytes %14zu\n", i, name,
+            server_load[i].requests, share, server_load[i].bytes);
+    }
+
+    double mean_requests = (double)total_requests / opt_server_info.num_servers;
+    double mean_bytes = (double)total_bytes / opt_server_info.num_servers;
+    printf("benchmark server skew (max/mean): requests %.3f, bytes %.3f, hottest server %zu\n",
+        mean_requests > 0 ? max_requests / mean_requests : 0.0,
+        mean_bytes > 0 ? max_bytes / mean_bytes : 0.0, hottest);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Key Distribution
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the distribution the benchmark phase draws its keys from, shared by all threads
+static struct keydist key_dist;
+
+static void key_dist_init(size_t num_keys)
+{
+    keydist_init(&key_dist, opt_key_dist, num_keys, opt_zipf_theta, opt_hotspot_ops, opt_hotspot_keys);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Item Sizes
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the prefix of the values written by sets, followed by the object id in hex
+#define VALUE_PREFIX "value-"
+#define VALUE_PREFIX_SIZE (sizeof(VALUE_PREFIX) - 1)
+
+// the object ids sampled to estimate how the items spread over the slab classes
+#define ITEM_SAMPLES (1 << 16)
+
+// the slab classes of the servers
+static struct slabs slabs;
+
+static void item_sizes_init(void)
+{
+    slabs_init(&slabs, opt_slab_factor, opt_slab_min_size, sizeof(item));
+}
+
+static inline size_t item_key_size(uint64_t objid)
+{
+    return sizedist_size(&opt_key_size, objid);
+}
+
+static inline size_t item_value_size(uint64_t objid)
+{
+    return sizedist_size(&opt_value_size, objid);
+}
+
+static inline void item_put_hex(char* p, uint64_t v, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (int i = digits - 1; i >= 0; i--) {
+        p[i] = hex[v & 0xf];
+        v >>= 4;
+    }
+}
+
+static inline uint64_t item_parse_hex(const char* p, size_t len)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+        v = (v << 4) | (p[i] <= '9' ? p[i] - '0' : (p[i] | 0x20) - 'a' + 10);
+    }
+    return v;
+}
+
+/**
+ * Formats the key of the object into a buffer of KEY_MAX + 1 bytes and returns its length. Keys
+ * are padded to their size in front of the object id as "%08x", counters are "n%07x" as they
+ * live in their own key space.
+ */
+static inline size_t item_format_key(char* key, enum workload_op op, uint64_t objid)
+{
+    size_t len = KEY_SIZE;
+    if (op == WORKLOAD_INCR || op == WORKLOAD_DECR) {
+        key[0] = 'n';
+        item_put_hex(key + 1, objid & 0xfffffff, KEY_SIZE - 1);
+    } else {
+        len = item_key_size(objid);
+        memset(key, 'k', len - KEY_SIZE);
+        item_put_hex(key + len - KEY_SIZE, objid, KEY_SIZE);
+    }
+    key[len] = 0;
+    return len;
+}
+
+// returns the object id of a key formatted by item_format_key()
+static inline uint64_t item_key_objid(const char* key, size_t len)
+{
+    return item_parse_hex(key + len - KEY_SIZE, KEY_SIZE);
+}
+
+// allocates a buffer for the largest value, the prefix and object id followed by zeros
+static char* item_value_alloc(void)
+{
+    size_t size = opt_value_size.max < VALUE_PREFIX_SIZE + 16 ? VALUE_PREFIX_SIZE + 16 : opt_value_size.max;
+    char* value = (char*)calloc(1, size);
+    if (value == NULL) {
+        printf("failed to allocate memory for the values\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(value, VALUE_PREFIX, VALUE_PREFIX_SIZE);
+    return value;
+}
+
+// patches the object id into a buffer from item_value_alloc() and returns the object's value size
+static inline size_t item_format_value(char* value, uint64_t objid)
+{
+    item_put_hex(value + VALUE_PREFIX_SIZE, objid, 16);
+    return item_value_size(objid);
+}
+
+// an upper bound of the encoded size of a single request or response
+static size_t item_max_message(void)
+{
+    return 128 + opt_key_size.max + opt_value_size.max;
+}
+
+/**
+ * Returns the number of keys whose items fit into `mem` bytes of slab pages.
+ *
+ * How the items spread over the slab classes is estimated from a sample of object ids, then the
+ * largest key count is searched whose chunks, rounded up to whole pages per class, fit the memory.
+ */
+static size_t item_count(size_t mem)
+{
+    double chunks[SLABS_MAX_CLASSES] = { 0 };
+    for (uint64_t i = 0; i < ITEM_SAMPLES; i++) {
+        size_t size = slabs_item_size(&slabs, item_key_size(i), item_value_size(i));
+        chunks[slabs_class(&slabs, size)] += slabs_chunks(&slabs, size);
+    }
+
+    size_t pages = mem / SLABS_PAGE_SIZE;
+    size_t lo = 0, hi = mem / slabs.sizes[0] + 1;
+    while (lo + 1 < hi) {
+        size_t n = lo + (hi - lo) / 2;
+        size_t needed = 0;
+        for (size_t c = 0; c < slabs.num_classes; c++) {
+            size_t class_chunks = (size_t)ceil(n * chunks[c] / ITEM_SAMPLES);
+            needed += (class_chunks + slabs.perslab[c] - 1) / slabs.perslab[c];
+        }
+        if (needed <= pages) {
+            lo = n;
+        } else {
+            hi = n;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Prints how the populated keys use the servers' memory: the bytes of keys and values against the
+ * item, chunk and page bytes they take, in total and per slab class.
+ */
+static void item_memory_report(size_t num_keys)
+{
+    size_t items[SLABS_MAX_CLASSES] = { 0 };
+    size_t chunks[SLABS_MAX_CLASSES] = { 0 };
+    size_t data[SLABS_MAX_CLASSES] = { 0 };
+    size_t item_bytes[SLABS_MAX_CLASSES] = { 0 };
+    for (uint64_t i = 0; i < num_keys; i++) {
+        size_t keylen = item_key_size(i), vlen = item_value_size(i);
+        size_t size = slabs_item_size(&slabs, keylen, vlen);
+        size_t c = slabs_class(&slabs, size);
+        items[c]++;
+        chunks[c] += slabs_chunks(&slabs, size);
+        data[c] += keylen + vlen;
+        item_bytes[c] += size;
+    }
+
+    size_t total_data = 0, total_items = 0, total_chunks = 0, total_pages = 0;
+    for (size_t c = 0; c < slabs.num_classes; c++) {
+        total_data += data[c];
+        total_items += item_bytes[c];
+        total_chunks += chunks[c] * slabs.sizes[c];
+        total_pages += (chunks[c] + slabs.perslab[c] - 1) / slabs.perslab[c];
+    }
+
+    double mb = 1 << 20;
+    double limit = (double)(opt_max_mem << 20);
+    printf("populate memory: %zu keys, %.1f MB of keys and values in %.1f MB of items, %.1f MB of chunks, "
+        "%zu of %zu pages\n", num_keys, total_data / mb, total_items / mb, total_chunks / mb, total_pages,
+        opt_max_mem);
+    printf("populate memory: of the %zu MB limit %.1f%% holds keys and values, %.1f%% item headers, "
+        "%.1f%% chunk rounding, %.1f%% partial or unused pages (-f %.2f -n %zu)\n", opt_max_mem,
+        100.0 * total_data / limit, 100.0 * (total_items - total_data) / limit,
+        100.0 * (total_chunks - total_items) / limit, 100.0 * (limit - total_chunks) / limit, opt_slab_factor,
+        opt_slab_min_size);
+    printf("  %-6s %10s %12s %8s %8s\n", "class", "chunk", "items", "pages", "fill");
+    for (size_t c = 0; c < slabs.num_classes; c++) {
+        if (items[c] == 0) {
+            continue;
+        }
+        printf("  %-6zu %10zu %12zu %8zu %7.1f%%\n", c + 1, slabs.sizes[c], items[c],
+            (chunks[c] + slabs.perslab[c] - 1) / slabs.perslab[c], 100.0 * data[c] / (chunks[c] * slabs.sizes[c]));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Latency Recording
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// per-thread latency histograms in timer ticks, each thread has one per server followed by one
+// per operation type and one for the gets answered by the near cache
+static struct histogram* latency_hist;
+
+static size_t latency_per_thread(void)
+{
+    return opt_server_info.num_servers + WORKLOAD_OP_MAX + 1;
+}
+
+static size_t latency_near_cache_slot(void)
+{
+    return opt_server_info.num_servers + WORKLOAD_OP_MAX;
+}
+
+static void latency_init(void)
+{
+    size_t n = opt_num_threads * latency_per_thread();
+    latency_hist = (struct histogram*)calloc(n, sizeof(*latency_hist));
+    if (latency_hist == NULL) {
+        printf("ERROR: failed to allocate memory for the latency histograms\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        histogram_init(&latency_hist[i]);
+    }
+}
+
+// the most one-second slots of the results time series, later operations land in the last slot
+#define LATENCY_SERIES_MAX_SLOTS 600
+
+// the gets, and the gets that missed and operations that failed, in one second of the time series
+struct latency_series_outcomes {
+    uint64_t gets;
+    uint64_t get_misses;
+    uint64_t errors;
+};
+
+// the per-second latency histograms of each thread for the results time series, NULL if off
+static struct histogram** latency_series = NULL;
+// the per-second outcomes of each thread, next to its histograms
+static struct latency_series_outcomes** latency_series_outcomes = NULL;
+// the number of one-second slots per thread
+static size_t latency_series_slots = 0;
+// the length of a slot in timer ticks
+static uint64_t latency_series_ticks = 0;
+
+static bool latency_series_enabled(void)
+{
+    return latency_series != NULL;
+}
+
+// enables the time series for a run of about `seconds`, after the timer has been calibrated
+static void latency_series_init(size_t seconds)
+{
+    latency_series_slots = seconds + 1 < LATENCY_SERIES_MAX_SLOTS ? seconds + 1 : LATENCY_SERIES_MAX_SLOTS;
+    latency_series_ticks = timer_ns_to_ticks(1e9);
+    latency_series = (struct histogram**)calloc(opt_num_threads, sizeof(*latency_series));
+    latency_series_outcomes = (struct latency_series_outcomes**)calloc(opt_num_threads,
+        sizeof(*latency_series_outcomes));
+    if (latency_series == NULL || latency_series_outcomes == NULL) {
+        printf("ERROR: failed to allocate memory for the latency time series\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// allocates the thread's slots, from the thread itself so they are local to it
+static struct histogram* latency_series_thread_init(uint64_t tid)
+{
+    if (!latency_series_enabled()) {
+        return NULL;
+    }
+    struct histogram* series = (struct histogram*)malloc(latency_series_slots * sizeof(*series));
+    latency_series_outcomes[tid] = (struct latency_series_outcomes*)calloc(latency_series_slots,
+        sizeof(**latency_series_outcomes));
+    if (series == NULL || latency_series_outcomes[tid] == NULL) {
+        printf("thread:%lu failed to allocate memory for the latency time series\n", tid);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < latency_series_slots; i++) {
+        histogram_init(&series[i]);
+    }
+    latency_series[tid] = series;
+    return series;
+}
+
+// merges the slot of all threads' time series, must only be called once the threads have been joined
+static void latency_series_merge(size_t slot, struct histogram* h, struct latency_series_outcomes* outcomes)
+{
+    histogram_init(h);
+    memset(outcomes, 0, sizeof(*outcomes));
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        if (latency_series[tid] != NULL) {
+            histogram_merge(h, &latency_series[tid][slot]);
+            outcomes->gets += latency_series_outcomes[tid][slot].gets;
+            outcomes->get_misses += latency_series_outcomes[tid][slot].get_misses;
+            outcomes->errors += latency_series_outcomes[tid][slot].errors;
+        }
+    }
+}
+
+/**
+ * Merges the histograms of all threads into `merged`, which has the per-thread layout: servers,
+ * operations, near cache. Must only be called once the threads have been joined.
+ */
+static void latency_merge(struct histogram* merged)
+{
+    size_t per_thread = latency_per_thread();
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        for (size_t i = 0; i < per_thread; i++) {
+            histogram_merge(&merged[i], &latency_hist[tid * per_thread + i]);
+        }
+    }
+}
+
+static void latency_report_line(const char* name, const struct histogram* h)
+{
+    printf("  %-40s %12lu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, h->count,
+        timer_ticks_to_ns(histogram_mean(h)) / 1000.0,
+        timer_ticks_to_ns(histogram_percentile(h, 50.0)) / 1000.0,
+        timer_ticks_to_ns(histogram_percentile(h, 90.0)) / 1000.0,
+        timer_ticks_to_ns(histogram_percentile(h, 99.0)) / 1000.0,
+        timer_ticks_to_ns(histogram_percentile(h, 99.9)) / 1000.0,
+        timer_ticks_to_ns(h->max) / 1000.0);
+}
+
+/**
+ * Merges the histograms of all threads and prints the percentiles per server, per transport, per
+ * operation and over all servers. Must only be called once the threads have been joined.
+ */
+static void latency_report(void)
+{
+    size_t num_servers = opt_server_info.num_servers;
+    size_t per_thread = latency_per_thread();
+
+    // the per-thread layout (servers, then operations), followed by the transports and overall
+    size_t total = per_thread + SERVER_TRANSPORT_MAX + 1;
+    struct histogram* merged = (struct histogram*)calloc(total, sizeof(*merged));
+    if (merged == NULL) {
+        printf("ERROR: failed to allocate memory for the latency report\n");
+        return;
+    }
+    for (size_t i = 0; i < total; i++) {
+        histogram_init(&merged[i]);
+    }
+    struct histogram* ops = &merged[num_servers];
+    struct histogram* near = &merged[latency_near_cache_slot()];
+    struct histogram* transports = &merged[per_thread];
+    struct histogram* all = &merged[per_thread + SERVER_TRANSPORT_MAX];
+
+    latency_merge(merged);
+    for (size_t i = 0; i < num_servers; i++) {
+        histogram_merge(&transports[opt_server_info.servers[i].transport], &merged[i]);
+        histogram_merge(all, &merged[i]);
+    }
+    histogram_merge(all, near);
+
+    printf("benchmark latency (us) %32s %10s %10s %10s %10s %10s %10s\n", "count", "mean", "p50", "p90",
+        "p99", "p99.9", "max");
+    for (size_t i = 0; i < num_servers; i++) {
+        char name[256], label[300];
+        server_name(i, name, sizeof(name));
+        snprintf(label, sizeof(label), "server %zu %s", i, name);
+        latency_report_line(label, &merged[i]);
+    }
+    for (int t = 0; t < SERVER_TRANSPORT_MAX && opt_backend == BACKEND_MEMCACHED; t++) {
+        if (transports[t].count > 0) {
+            latency_report_line(server_transport_names[t], &transports[t]);
+        }
+    }
+    if (near->count > 0) {
+        latency_report_line("near cache", near);
+    }
+    for (int op = 0; op < WORKLOAD_OP_MAX; op++) {
+        if (ops[op].count > 0) {
+            char label[64];
+            snprintf(label, sizeof(label), "op %s", workload_op_names[op]);
+            latency_report_line(label, &ops[op]);
+        }
+    }
+    latency_report_line("overall", all);
+
+    free(merged);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Near Cache
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the most bytes of a cached value copied out on a hit
+#define NEAR_CACHE_VALUE_MAX 1024
+
+// the in-process cache in front of the gets, shared by all threads
+static struct nearcache near_cache;
+
+static bool near_cache_enabled(void)
+{
+    return opt_near_cache > 0;
+}
+
+static void near_cache_init(void)
+{
+    if (!near_cache_enabled()) {
+        return;
+    }
+
+    // many more shards than threads, so threads rarely meet on a shard lock
+    size_t num_shards = 16 * opt_num_threads < 64 ? 64 : 16 * opt_num_threads;
+    nearcache_init(&near_cache, opt_near_cache << 20, num_shards, (size_t)sizedist_mean(&opt_value_size),
+        timer_ns_to_ticks(opt_near_cache_ttl * 1000000.0));
+}
+
+/**
+ * Prints the cache counters and what the cache took off the servers: the gets it answered and
+ * the latency of those gets compared to the ones that went to a server.
+ */
+static void near_cache_report(void)
+{
+    struct nearcache_stats st;
+    nearcache_get_stats(&near_cache, &st);
+
+    size_t per_thread = latency_per_thread();
+    uint64_t local_count = 0, local_sum = 0, get_count = 0, get_sum = 0;
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        const struct histogram* near = &latency_hist[tid * per_thread + latency_near_cache_slot()];
+        const struct histogram* get = &latency_hist[tid * per_thread + opt_server_info.num_servers + WORKLOAD_GET];
+        local_count += near->count;
+        local_sum += near->sum;
+        get_count += get->count;
+        get_sum += get->sum;
+    }
+    uint64_t remote_count = get_count - local_count;
+    uint64_t remote_sum = get_sum - local_sum;
+
+    uint64_t lookups = st.hits + st.misses;
+    printf("benchmark near cache: %zu MB in %zu shards, ttl %zu ms, %lu entries using %.2f MB\n", opt_near_cache,
+        near_cache.num_shards, opt_near_cache_ttl, st.entries, st.bytes / (1024.0 * 1024.0));
+    printf("benchmark near cache: hits %lu, misses %lu (%.1f%% hit ratio), inserts %lu, evictions %lu, "
+        "expirations %lu\n", st.hits, st.misses, lookups ? 100.0 * st.hits / lookups : 0.0, st.inserts,
+        st.evictions, st.expirations);
+    printf("benchmark near cache: took %lu of %lu gets (%.1f%%) off the servers, mean get latency %.2f us "
+        "(local %.2f us, servers %.2f us)\n", local_count, get_count,
+        get_count ? 100.0 * local_count / get_count : 0.0,
+        get_count ? timer_ticks_to_ns(get_sum / get_count) / 1000.0 : 0.0,
+        local_count ? timer_ticks_to_ns(local_sum / local_count) / 1000.0 : 0.0,
+        remote_count ? timer_ticks_to_ns(remote_sum / remote_count) / 1000.0 : 0.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Placement
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the attempts to draw a key on one of the thread's own servers before taking any key
+#define PLACEMENT_REDRAW_MAX 64
+
+// the NUMA nodes and the cpus the threads may be placed on
+static struct placement_topology placement_topo;
+// the node id and cpu of each thread
+static int* placement_thread_node;
+static int* placement_thread_cpu;
+// the node id of each server
+static int placement_server_node[SERVER_MAX];
+// the load of the benchmark phase on servers on the thread's own node (0) and on other nodes (1)
+static struct server_load placement_load[2];
+
+static bool placement_enabled(void)
+{
+    return opt_placement != PLACEMENT_NONE;
+}
+
+/**
+ * Discovers the topology and assigns every thread a cpu and every server a node. Servers default
+ * to node `index % number of nodes`, the placement of scripts/spawn-memcached-process.sh.
+ */
+static void placement_init(void)
+{
+    if (!placement_enabled()) {
+        return;
+    }
+
+    placement_topology_init(&placement_topo);
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        placement_server_node[i] = i < opt_num_server_nodes && opt_server_nodes[i] >= 0
+            ? opt_server_nodes[i]
+            : placement_topo.nodes[i % placement_topo.num_nodes].id;
+    }
+
+    placement_thread_node = (int*)calloc(opt_num_threads, sizeof(*placement_thread_node));
+    placement_thread_cpu = (int*)calloc(opt_num_threads, sizeof(*placement_thread_cpu));
+    if (placement_thread_node == NULL || placement_thread_cpu == NULL) {
+        printf("ERROR: failed to allocate memory for the thread placement\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        size_t node;
+        placement_assign(&placement_topo, opt_placement, coord_thread_id(tid), &node, &placement_thread_cpu[tid]);
+        placement_thread_node[tid] = placement_topo.nodes[node].id;
+    }
+}
+
+/**
+ * Returns the servers the thread's operations may go to as a bit mask, 0 for all of them. Threads
+ * on a node without servers use all servers.
+ */
+static uint32_t placement_servers(uint64_t tid)
+{
+    if (!placement_enabled() || !opt_numa_local) {
+        return 0;
+    }
+
+    uint32_t servers = 0;
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        if (placement_server_node[i] == placement_thread_node[tid]) {
+            servers |= 1U << i;
+        }
+    }
+    return servers;
+}
+
+// pins the calling thread to its cpu, before it allocates its buffers
+static void placement_bind_thread(uint64_t tid)
+{
+    if (!placement_enabled()) {
+        return;
+    }
+    if (!placement_bind(placement_thread_cpu[tid], placement_thread_node[tid])) {
+        printf("thread:%lu failed to bind to cpu %d on node %d (%s)\n", tid, placement_thread_cpu[tid],
+            placement_thread_node[tid], strerror(errno));
+    } else if (opt_verbose) {
+        printf("thread:%lu bound to cpu %d on node %d\n", tid, placement_thread_cpu[tid], placement_thread_node[tid]);
+    }
+}
+
+static void placement_merge(uint64_t tid, const struct server_load* load)
+{
+    if (!placement_enabled()) {
+        return;
+    }
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        struct server_load* dst = &placement_load[placement_server_node[i] == placement_thread_node[tid] ? 0 : 1];
+        __atomic_fetch_add(&dst->requests, load[i].requests, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&dst->bytes, load[i].bytes, __ATOMIC_RELAXED);
+    }
+}
+
+static void placement_describe(void)
+{
+    printf(" - placement = %s over %zu nodes, %s routing, server nodes", placement_kind_name(opt_placement),
+        placement_topo.num_nodes, opt_numa_local ? "local" : "all");
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        printf("%c%d", i == 0 ? ' ' : ',', placement_server_node[i]);
+    }
+    printf("\n");
+}
+
+/**
+ * Prints the traffic to servers on the thread's own node against the traffic crossing nodes, and
+ * the latency of both. Must only be called once the threads have been joined.
+ */
+static void placement_report(void)
+{
+    if (!placement_enabled()) {
+        return;
+    }
+
+    size_t requests = placement_load[0].requests + placement_load[1].requests;
+    size_t bytes = placement_load[0].bytes + placement_load[1].bytes;
+    printf("benchmark placement: %s over %zu nodes, %s routing\n", placement_kind_name(opt_placement),
+        placement_topo.num_nodes, opt_numa_local ? "local" : "all");
+    for (int remote = 0; remote < 2; remote++) {
+        printf("  %-6s requests %12zu (%5.1f%%)  bytes %14zu (%5.1f%%)\n", remote ? "remote" : "local",
+            placement_load[remote].requests, requests ? 100.0 * placement_load[remote].requests / requests : 0.0,
+            placement_load[remote].bytes, bytes ? 100.0 * placement_load[remote].bytes / bytes : 0.0);
+    }
+
+    struct histogram lat[2];
+    histogram_init(&lat[0]);
+    histogram_init(&lat[1]);
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+            histogram_merge(&lat[placement_server_node[i] == placement_thread_node[tid] ? 0 : 1],
+                &latency_hist[tid * latency_per_thread() + i]);
+        }
+    }
+    printf("benchmark placement latency (us) %22s %10s %10s %10s %10s %10s %10s\n", "count", "mean", "p50",
+        "p90", "p99", "p99.9", "max");
+    latency_report_line("local servers", &lat[0]);
+    latency_report_line("remote servers", &lat[1]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Replication
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the gets a thread waits for before it hedges, so the delay comes from a meaningful percentile
+#define REPLICA_HEDGE_WARMUP 1000
+// the gets between two updates of a thread's hedge delay
+#define REPLICA_HEDGE_UPDATE 1024
+
+// what the replication cost, summed up over all threads
+struct replica_stats {
+    size_t reads;
+    // reads p2c sent to another replica than the primary
+    size_t reads_moved;
+    // second gets sent by hedged reads, and the ones that answered first
+    size_t hedges;
+    size_t hedges_won;
+    // hedge connections closed after a failure
+    size_t conns_lost;
+    size_t writes;
+    // the copies of the writes sent to the replicas beyond the primary
+    size_t replica_writes;
+};
+
+/**
+ * The replication state of a thread: the connections its hedged gets race on, and the latency of
+ * its reads as answered and as the primary alone would have answered them (the same for all but
+ * hedged reads).
+ */
+struct replica_thread {
+    struct replica_conn conns[SERVER_MAX];
+    struct histogram* answered;
+    struct histogram* primary;
+    // the primaries' service time for hedged gets, from sending the get to their answer
+    struct histogram service;
+    uint64_t hedge_delay;
+    size_t gets_since_update;
+    struct xor_shift rand;
+    struct replica_stats stats;
+};
+
+static struct replica_stats replica_stats;
+// the answered and primary-only read latency of each thread, merged after the benchmark
+static struct histogram* replica_latency;
+// the requests in flight per server over all threads, the load p2c compares
+static uint64_t replica_outstanding[SERVER_MAX];
+
+static bool replica_enabled(void)
+{
+    return opt_replicas > 1;
+}
+
+static void replica_init(void)
+{
+    if (!replica_enabled()) {
+        return;
+    }
+    replica_latency = (struct histogram*)calloc(2 * opt_num_threads, sizeof(*replica_latency));
+    if (replica_latency == NULL) {
+        printf("ERROR: failed to allocate memory for the replication\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < 2 * opt_num_threads; i++) {
+        histogram_init(&replica_latency[i]);
+    }
+}
+
+static struct replica_thread* replica_thread_init(uint64_t tid)
+{
+    if (!replica_enabled()) {
+        return NULL;
+    }
+    struct replica_thread* rt = (struct replica_thread*)calloc(1, sizeof(*rt));
+    if (rt == NULL) {
+        printf("thread:%lu failed to allocate memory for the replication\n", tid);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < SERVER_MAX; i++) {
+        rt->conns[i].fd = -1;
+    }
+    rt->answered = &replica_latency[2 * tid];
+    rt->primary = &replica_latency[2 * tid + 1];
+    histogram_init(&rt->service);
+    xor_shift_init(&rt->rand, coord_thread_id(tid) + 1);
+    return rt;
+}
+
+static void replica_thread_free(struct replica_thread* rt)
+{
+    if (rt == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < SERVER_MAX; i++) {
+        if (rt->conns[i].fd >= 0) {
+            replica_conn_free(&rt->conns[i]);
+        }
+    }
+    free(rt);
+}
+
+static void replica_thread_merge(const struct replica_thread* rt)
+{
+    if (rt == NULL) {
+        return;
+    }
+    __atomic_fetch_add(&replica_stats.reads, rt->stats.reads, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&replica_stats.reads_moved, rt->stats.reads_moved, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&replica_stats.hedges, rt->stats.hedges, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&replica_stats.hedges_won, rt->stats.hedges_won, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&replica_stats.conns_lost, rt->stats.conns_lost, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&replica_stats.writes, rt->stats.writes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&replica_stats.replica_writes, rt->stats.replica_writes, __ATOMIC_RELAXED);
+}
+
+// counts a request to the server as outstanding while p2c compares the servers
+static inline void replica_begin(size_t server)
+{
+    if (opt_read_policy == REPLICA_P2C) {
+        __atomic_fetch_add(&replica_outstanding[server], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void replica_end(size_t server)
+{
+    if (opt_read_policy == REPLICA_P2C) {
+        __atomic_fetch_sub(&replica_outstanding[server], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Picks the replica a p2c read goes to: of two random replicas the one with fewer requests in
+ * flight, the earlier in the replica order on a tie.
+ */
+static inline size_t replica_p2c(struct replica_thread* rt, const size_t* replicas, size_t num_replicas)
+{
+    if (num_replicas < 2) {
+        return replicas[0];
+    }
+    size_t a = xor_shift_next(&rt->rand, num_replicas);
+    size_t b = (a + 1 + xor_shift_next(&rt->rand, num_replicas - 1)) % num_replicas;
+    if (b < a) {
+        size_t t = a;
+        a = b;
+        b = t;
+    }
+    uint64_t load_a = __atomic_load_n(&replica_outstanding[replicas[a]], __ATOMIC_RELAXED);
+    uint64_t load_b = __atomic_load_n(&replica_outstanding[replicas[b]], __ATOMIC_RELAXED);
+    return replicas[load_b < load_a ? b : a];
+}
+
+// the delay after which a hedged read sends its second get, negative while still warming up
+static inline int64_t replica_hedge_delay_ns(struct replica_thread* rt)
+{
+    if (rt->service.count < REPLICA_HEDGE_WARMUP) {
+        return -1;
+    }
+    if (rt->hedge_delay == 0 || rt->gets_since_update >= REPLICA_HEDGE_UPDATE) {
+        rt->hedge_delay = histogram_percentile(&rt->service, opt_hedge_percentile);
+        rt->gets_since_update = 0;
+    }
+    return (int64_t)timer_ticks_to_ns(rt->hedge_delay);
+}
+
+static void replica_describe(void)
+{
+    printf(" - replicas = %zu, %s reads", opt_replicas, replica_policy_name(opt_read_policy));
+    if (opt_read_policy == REPLICA_HEDGED) {
+        printf(" after the p%g of the primary", opt_hedge_percentile);
+    }
+    printf("\n");
+}
+
+/**
+ * Prints the load the replication added and what it did to the read latency. Hedged reads also
+ * know when the primary answered, so the latency without hedging comes from the same requests.
+ * Must only be called once the threads have been joined.
+ */
+static void replica_report(void)
+{
+    if (!replica_enabled()) {
+        return;
+    }
+
+    const struct replica_stats* st = &replica_stats;
+    printf("benchmark replication: %zu replicas, %s reads\n", opt_replicas, replica_policy_name(opt_read_policy));
+    printf("  writes %12zu, replica writes %12zu (+%.1f%% write requests)\n", st->writes, st->replica_writes,
+        st->writes ? 100.0 * st->replica_writes / st->writes : 0.0);
+    printf("  reads  %12zu, extra gets     %12zu (+%.1f%% read requests)", st->reads, st->hedges,
+        st->reads ? 100.0 * st->hedges / st->reads : 0.0);
+    if (opt_read_policy == REPLICA_P2C) {
+        printf(", %.1f%% moved off the primary", st->reads ? 100.0 * st->reads_moved / st->reads : 0.0);
+    } else if (opt_read_policy == REPLICA_HEDGED) {
+        printf(", %.1f%% of the hedges answered first", st->hedges ? 100.0 * st->hedges_won / st->hedges : 0.0);
+    }
+    printf("\n");
+
+    struct histogram answered, primary;
+    histogram_init(&answered);
+    histogram_init(&primary);
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        histogram_merge(&answered, &replica_latency[2 * tid]);
+        histogram_merge(&primary, &replica_latency[2 * tid + 1]);
+    }
+    printf("benchmark replication read latency (us) %15s %10s %10s %10s %10s %10s %10s\n", "count", "mean", "p50",
+        "p90", "p99", "p99.9", "max");
+    latency_report_line(replica_policy_name(opt_read_policy), &answered);
+    if (opt_read_policy != REPLICA_HEDGED) {
+        return;
+    }
+    latency_report_line("primary only", &primary);
+    // the slower of two raced replies is read before the thread goes on
+    printf("  hedged gets wait for the slower reply too, the throughput includes that wait\n");
+    if (st->conns_lost > 0) {
+        printf("  %zu hedge connections lost, their gets went to another replica or failed\n", st->conns_lost);
+    }
+    double p99 = timer_ticks_to_ns(histogram_percentile(&answered, 99.0)) / 1000.0;
+    double p99_primary = timer_ticks_to_ns(histogram_percentile(&primary, 99.0)) / 1000.0;
+    printf("  hedging cut the p99 by %.2f us (%.1f%%) for %.1f%% extra gets\n", p99_primary - p99,
+        p99_primary > 0 ? 100.0 * (p99_primary - p99) / p99_primary : 0.0,
+        st->reads ? 100.0 * st->hedges / st->reads : 0.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// In-Process Backend
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the shards of each server's table per benchmark thread, so threads rarely meet on a writer
+#define INPROC_SHARDS_PER_THREAD 16
+
+// the tables standing in for the servers, one per server, shared by all threads
+static struct store* inproc_stores = NULL;
+
+static bool inproc_enabled(void)
+{
+    return opt_backend == BACKEND_INPROC;
+}
+
+static size_t inproc_num_shards(void)
+{
+    return INPROC_SHARDS_PER_THREAD * opt_num_threads;
+}
+
+static void inproc_init(void)
+{
+    if (!inproc_enabled()) {
+        return;
+    }
+    inproc_stores = (struct store*)calloc(opt_server_info.num_servers, sizeof(*inproc_stores));
+    if (inproc_stores == NULL) {
+        printf("ERROR: failed to allocate memory for the in-process tables\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        store_init(&inproc_stores[i], inproc_num_shards());
+    }
+}
+
+static void inproc_free(void)
+{
+    if (inproc_stores == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        store_free(&inproc_stores[i]);
+    }
+    free(inproc_stores);
+    inproc_stores = NULL;
+}
+
+// the libmemcached result of a table operation, so both backends are counted alike
+static memcached_return_t inproc_result(uint16_t status)
+{
+    switch (status) {
+    case MC_BIN_STATUS_OK:
+        return MEMCACHED_SUCCESS;
+    case MC_BIN_STATUS_NOT_FOUND:
+        return MEMCACHED_NOTFOUND;
+    case MC_BIN_STATUS_NOT_STORED:
+        return MEMCACHED_NOTSTORED;
+    case MC_BIN_STATUS_INTERNAL_ERROR:
+        return MEMCACHED_MEMORY_ALLOCATION_FAILURE;
+    default:
+        return MEMCACHED_FAILURE;
+    }
+}
+
+static void inproc_describe(void)
+{
+    printf(" - backend = inproc, %zu tables of %zu shards\n", opt_server_info.num_servers, inproc_num_shards());
+}
+
+static void inproc_report(void)
+{
+    uint64_t items = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        uint64_t n;
+        size_t b;
+        store_get_stats(&inproc_stores[i], &n, &b);
+        items += n;
+        bytes += b;
+    }
+    printf("benchmark inproc backend: %lu items with %.1f MB of keys and values in %zu tables\n", items,
+        bytes / (1024.0 * 1024.0), opt_server_info.num_servers);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Traces
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// a replayed record counts as late if it is sent more than this after its time in the trace
+#define TRACE_LATE_NS 1000000
+
+// the time the recorded operations are stamped relative to, in ticks
+static uint64_t trace_epoch;
+// the header of the replayed trace
+static struct trace_header trace_replay_header;
+
+// the operations recorded, and the records replayed, summed up over all threads
+static uint64_t trace_recorded;
+static uint64_t trace_replayed;
+// the replayed records that were sent late, and the sum and maximum of their delays in ticks
+static uint64_t trace_late;
+static uint64_t trace_lag_ticks;
+static uint64_t trace_lag_max;
+
+static bool trace_recording(void)
+{
+    return opt_trace_record != NULL;
+}
+
+static bool trace_replay_enabled(void)
+{
+    return opt_trace_replay != NULL;
+}
+
+static enum trace_op trace_op_of(enum workload_op op)
+{
+    switch (op) {
+    case WORKLOAD_GET:
+        return TRACE_GET;
+    case WORKLOAD_SET:
+    case WORKLOAD_INSERT:
+        return TRACE_SET;
+    case WORKLOAD_DELETE:
+        return TRACE_DELETE;
+    case WORKLOAD_INCR:
+        return TRACE_INCR;
+    case WORKLOAD_DECR:
+        return TRACE_DECR;
+    case WORKLOAD_CAS:
+        return TRACE_CAS;
+    case WORKLOAD_APPEND:
+        return TRACE_APPEND;
+    default:
+        abort();
+    }
+}
+
+// the operation a record is replayed as, the inproc backend has no cas and writes the value instead
+static enum workload_op trace_workload_op(enum trace_op op)
+{
+    switch (op) {
+    case TRACE_GET:
+        return WORKLOAD_GET;
+    case TRACE_SET:
+        return WORKLOAD_SET;
+    case TRACE_DELETE:
+        return WORKLOAD_DELETE;
+    case TRACE_INCR:
+        return WORKLOAD_INCR;
+    case TRACE_DECR:
+        return WORKLOAD_DECR;
+    case TRACE_CAS:
+        return opt_backend == BACKEND_INPROC ? WORKLOAD_SET : WORKLOAD_CAS;
+    case TRACE_APPEND:
+        return WORKLOAD_APPEND;
+    default:
+        abort();
+    }
+}
+
+/**
+ * Reads the header of the replayed trace, and starts the clock of the recorded one.
+ */
+static void trace_init(void)
+{
+    trace_epoch = timer_now();
+    if (!trace_replay_enabled()) {
+        return;
+    }
+
+    struct trace_reader r;
+    if (!trace_reader_open(&r, opt_trace_replay)) {
+        printf("failed to open the trace %s (%s)\n", opt_trace_replay,
+            errno == EINVAL ? "not a trace of this version, or truncated" : strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    trace_replay_header = r.header;
+    trace_reader_close(&r);
+    if (trace_replay_header.num_records == 0) {
+        printf("the trace %s has no records\n", opt_trace_replay);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void trace_describe(void)
+{
+    if (trace_replay_enabled()) {
+        printf(" - trace_replay = %s, %lu records over %.3f s, ", opt_trace_replay, trace_replay_header.num_records,
+            trace_replay_header.duration_ns / 1e9);
+        if (opt_trace_timing == TRACE_TIMING_ORIGINAL) {
+            printf("original timing at %.2fx\n", opt_trace_speed);
+        } else {
+            printf("fast\n");
+        }
+    }
+    if (trace_recording()) {
+        printf(" - trace_record = %s\n", opt_trace_record);
+    }
+}
+
+// the part of the recorded trace a thread writes, merged into the trace at the end
+static void trace_part_path(char* path, size_t len, size_t tid)
+{
+    snprintf(path, len, "%s.%zu", opt_trace_record, tid);
+}
+
+// opens the thread's part of the recorded trace, or returns NULL if nothing is recorded
+static struct trace_writer* trace_thread_open(size_t tid)
+{
+    if (!trace_recording()) {
+        return NULL;
+    }
+    char path[PATH_MAX];
+    trace_part_path(path, sizeof(path), tid);
+    struct trace_writer* w = (struct trace_writer*)calloc(1, sizeof(*w));
+    if (w == NULL || !trace_writer_open(w, path)) {
+        printf("thread:%lu failed to create the trace %s (%s)\n", tid, path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return w;
+}
+
+static void trace_thread_close(struct trace_writer* w, size_t tid)
+{
+    if (w == NULL) {
+        return;
+    }
+    __atomic_fetch_add(&trace_recorded, w->header.num_records, __ATOMIC_RELAXED);
+    if (!trace_writer_close(w)) {
+        printf("thread:%lu failed to write the trace (%s)\n", tid, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    free(w);
+}
+
+// appends the operation, sent at `t`, to the thread's part of the recorded trace
+static inline void trace_capture(struct trace_writer* w, enum workload_op op, uint64_t objid, size_t vlen,
+    uint32_t ttl, uint64_t t)
+{
+    struct trace_record rec;
+    trace_record_init(&rec, (uint64_t)timer_ticks_to_ns(t - trace_epoch), objid, trace_op_of(op), vlen, ttl);
+    if (!trace_writer_append(w, &rec)) {
+        printf("failed to write the trace (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Merges the threads' parts into the recorded trace, ordered by time, and removes them.
+ */
+static void trace_finish(void)
+{
+    if (!trace_recording()) {
+        return;
+    }
+
+    char** parts = (char**)calloc(opt_num_threads, sizeof(*parts));
+    if (parts == NULL) {
+        printf("ERROR: failed to allocate memory for the trace parts\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        parts[tid] = (char*)malloc(PATH_MAX);
+        if (parts[tid] == NULL) {
+            printf("ERROR: failed to allocate memory for the trace parts\n");
+            exit(EXIT_FAILURE);
+        }
+        trace_part_path(parts[tid], PATH_MAX, tid);
+    }
+
+    uint64_t num_records = 0;
+    bool ok = trace_merge(opt_trace_record, parts, opt_num_threads, &num_records);
+    if (!ok) {
+        printf("failed to write the trace %s (%s)\n", opt_trace_record, strerror(errno));
+    }
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        unlink(parts[tid]);
+        free(parts[tid]);
+    }
+    free(parts);
+    if (ok) {
+        printf("benchmark trace: recorded %lu operations to %s\n", num_records, opt_trace_record);
+    }
+}
+
+/**
+ * Trace import mode: converts the CSV trace of --trace-import into the trace of --trace-record and
+ * exits. The CSV is streamed, so traces far larger than the memory can be converted.
+ */
+static int trace_import_main(void)
+{
+    if (!trace_recording()) {
+        printf("--trace-import needs the trace to write with --trace-record\n");
+        return EXIT_FAILURE;
+    }
+    FILE* in = strcmp(opt_trace_import, "-") == 0 ? stdin : fopen(opt_trace_import, "r");
+    if (in == NULL) {
+        printf("failed to open %s (%s)\n", opt_trace_import, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    struct trace_writer w;
+    if (!trace_writer_open(&w, opt_trace_record)) {
+        printf("failed to create the trace %s (%s)\n", opt_trace_record, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    uint64_t skipped;
+    bool ok = trace_import_csv(in, opt_trace_import_format, &w, &skipped);
+    if (in != stdin) {
+        fclose(in);
+    }
+    uint64_t num_records = w.header.num_records;
+    double duration = w.header.duration_ns / 1e9;
+    uint32_t max_value_size = w.header.max_value_size;
+    if (!trace_writer_close(&w) || !ok) {
+        printf("failed to convert %s to %s (%s)\n", opt_trace_import, opt_trace_record, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    printf("imported %lu records over %.3f s to %s, largest value %u bytes, %lu lines skipped\n", num_records,
+        duration, opt_trace_record, max_value_size, skipped);
+    return EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Coalescing
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the time an idle flusher sleeps before it checks whether the benchmark is over
+#define COALESCE_IDLE_NS 100000000L
+// the power-of-two classes the multi-gets are counted in, 1, 2-3, 4-7, ... up to COALESCE_MAX
+#define COALESCE_CLASSES 11
+
+/**
+ * What a server's flusher saw: the keys per multi-get, the time the gets waited in the queue and
+ * the time each multi-get took. Only the flusher writes them.
+ */
+struct coalesce_stats {
+    struct histogram sizes;
+    struct histogram wait;
+    struct histogram flush;
+    uint64_t classes[COALESCE_CLASSES];
+};
+
+// the gets waiting for each server's flusher
+static struct coalesce_queue* coalesce_queues = NULL;
+// the bells the benchmark threads wait on for their gets, one per thread
+static struct shmring_bell* coalesce_bells = NULL;
+static struct coalesce_stats* coalesce_stats = NULL;
+// the flusher of each server
+static pthread_t* coalesce_threads = NULL;
+static bool coalesce_stopping = false;
+
+static bool coalesce_enabled(void)
+{
+    return opt_coalesce > 0;
+}
+
+static void coalesce_init(void)
+{
+    if (!coalesce_enabled()) {
+        return;
+    }
+    size_t num_servers = opt_server_info.num_servers;
+    coalesce_queues = (struct coalesce_queue*)aligned_alloc(64, num_servers * sizeof(*coalesce_queues));
+    coalesce_bells = (struct shmring_bell*)aligned_alloc(64, opt_num_threads * sizeof(*coalesce_bells));
+    coalesce_stats = (struct coalesce_stats*)calloc(num_servers, sizeof(*coalesce_stats));
+    coalesce_threads = (pthread_t*)calloc(num_servers, sizeof(*coalesce_threads));
+    if (coalesce_queues == NULL || coalesce_bells == NULL || coalesce_stats == NULL || coalesce_threads == NULL) {
+        printf("ERROR: failed to allocate memory for the coalescing queues\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(coalesce_bells, 0, opt_num_threads * sizeof(*coalesce_bells));
+    for (size_t s = 0; s < num_servers; s++) {
+        coalesce_queue_init(&coalesce_queues[s]);
+        histogram_init(&coalesce_stats[s].sizes);
+        histogram_init(&coalesce_stats[s].wait);
+        histogram_init(&coalesce_stats[s].flush);
+    }
+}
+
+static void coalesce_free(void)
+{
+    free(coalesce_queues);
+    free(coalesce_bells);
+    free(coalesce_stats);
+    free(coalesce_threads);
+    coalesce_queues = NULL;
+    coalesce_bells = NULL;
+    coalesce_stats = NULL;
+    coalesce_threads = NULL;
+}
+
+static void coalesce_describe(void)
+{
+    printf(" - coalesce = up to %zu keys per multi-get, flushed %zu us after the first\n", opt_coalesce,
+        opt_coalesce_delay);
+}
+
+// the flusher's own client of the server, NULL for an in-process table
+static memcached_st* coalesce_client(size_t s)
+{
+    if (inproc_enabled()) {
+        return NULL;
+    }
+    memcached_st* m = memcached_create(NULL);
+    if (m == NULL) {
+        printf("coalesce: failed to create the memcached client of server %zu\n", s);
+        exit(EXIT_FAILURE);
+    }
+    memcached_behavior_set(m, MEMCACHED_BEHAVIOR_BINARY_PROTOCOL, (uint64_t)opt_binary);
+
+    memcached_return_t rc;
+    if (opt_server_info.servers[s].transport == SERVER_UNIX) {
+        rc = memcached_server_add_unix_socket(m, opt_server_info.servers[s].ux.path);
+    } else {
+        rc = memcached_server_add(m, opt_server_info.servers[s].tcp.hostname, opt_server_info.servers[s].tcp.port);
+    }
+    if (rc != MEMCACHED_SUCCESS) {
+        printf("coalesce: failed to add server %zu (%s)\n", s, memcached_strerror(m, rc));
+        exit(EXIT_FAILURE);
+    }
+    return m;
+}
+
+/**
+ * Fetches the keys of the gets with one multi-get and hands each get its outcome. A key that was
+ * asked for twice is answered twice, so the answers go to the gets in order.
+ */
+static void coalesce_flush(memcached_st* m, memcached_result_st* result, struct coalesce_req** batch, size_t n)
+{
+    const char* keys[COALESCE_MAX];
+    size_t key_lens[COALESCE_MAX];
+    memcached_return_t results[COALESCE_MAX];
+    size_t value_lens[COALESCE_MAX];
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = batch[i]->key;
+        key_lens[i] = batch[i]->keylen;
+        results[i] = MEMCACHED_NOTFOUND;
+        value_lens[i] = 0;
+    }
+
+    memcached_return_t rc = memcached_mget(m, keys, key_lens, n);
+    while (!memcached_failed(rc) && memcached_fetch_result(m, result, &rc) != NULL) {
+        const char* key = memcached_result_key_value(result);
+        size_t keylen = memcached_result_key_length(result);
+        for (size_t i = 0; i < n; i++) {
+            if (results[i] == MEMCACHED_NOTFOUND && key_lens[i] == keylen && memcmp(keys[i], key, keylen) == 0) {
+                results[i] = MEMCACHED_SUCCESS;
+                value_lens[i] = memcached_result_length(result);
+                if (near_cache_enabled()) {
+                    nearcache_put(&near_cache, batch[i]->objid, memcached_result_value(result), value_lens[i],
+                        timer_now());
+                }
+                break;
+            }
+        }
+    }
+    // the gets without an answer failed with the multi-get
+    bool failed = rc != MEMCACHED_END && rc != MEMCACHED_NOTFOUND;
+    for (size_t i = 0; i < n; i++) {
+        coalesce_complete(batch[i], failed && results[i] == MEMCACHED_NOTFOUND ? rc : results[i], value_lens[i]);
+    }
+}
+
+// answers the gets from the server's in-process table
+static void coalesce_flush_inproc(size_t s, struct coalesce_req** batch, size_t n, struct mc_buf* value)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint32_t flags;
+        mc_buf_consume(value, mc_buf_len(value));
+        if (!store_get(&inproc_stores[s], batch[i]->key, batch[i]->keylen, value, &flags)) {
+            coalesce_complete(batch[i], MEMCACHED_NOTFOUND, 0);
+            continue;
+        }
+        if (near_cache_enabled()) {
+            nearcache_put(&near_cache, batch[i]->objid, mc_buf_head(value), mc_buf_len(value), timer_now());
+        }
+        coalesce_complete(batch[i], MEMCACHED_SUCCESS, mc_buf_len(value));
+    }
+}
+
+/**
+ * The flusher of a server. It takes the first get off the queue, collects more until it has the
+ * most keys of a multi-get or the delay since the first get has passed, and fetches them at once.
+ */
+static void* coalesce_flusher_main(void* arg)
+{
+    size_t s = (size_t)arg;
+    struct coalesce_queue* q = &coalesce_queues[s];
+    struct coalesce_stats* st = &coalesce_stats[s];
+    memcached_st* m = coalesce_client(s);
+    memcached_result_st* result = m != NULL ? memcached_result_create(m, NULL) : NULL;
+    struct mc_buf value;
+    mc_buf_init(&value, 4096);
+
+    struct coalesce_req* batch[COALESCE_MAX];
+    uint64_t delay = timer_ns_to_ticks(opt_coalesce_delay * 1000.0);
+    while (!__atomic_load_n(&coalesce_stopping, __ATOMIC_ACQUIRE)) {
+        struct coalesce_req* r = coalesce_pop_wait(q, COALESCE_IDLE_NS);
+        if (r == NULL) {
+            continue;
+        }
+        size_t n = 0;
+        batch[n++] = r;
+        uint64_t deadline = r->t_enqueue + delay;
+        while (n < opt_coalesce) {
+            uint64_t now = timer_now();
+            r = coalesce_pop_wait(q, now < deadline ? (int64_t)timer_ticks_to_ns(deadline - now) : 0);
+            if (r != NULL) {
+                batch[n++] = r;
+            } else if (timer_now() >= deadline) {
+                break;
+            }
+        }
+
+        uint64_t t_flush = timer_now();
+        for (size_t i = 0; i < n; i++) {
+            histogram_record(&st->wait, t_flush - batch[i]->t_enqueue);
+        }
+        if (m != NULL) {
+            coalesce_flush(m, result, batch, n);
+        } else {
+            coalesce_flush_inproc(s, batch, n, &value);
+        }
+        histogram_record(&st->flush, timer_now() - t_flush);
+        histogram_record(&st->sizes, n);
+        st->classes[63 - __builtin_clzl(n)]++;
+    }
+
+    mc_buf_free(&value);
+    if (m != NULL) {
+        memcached_result_free(result);
+        memcached_free(m);
+    }
+    return NULL;
+}
+
+// starts the flushers right before the benchmark phase
+static void coalesce_start(void)
+{
+    if (!coalesce_enabled()) {
+        return;
+    }
+    for (size_t s = 0; s < opt_server_info.num_servers; s++) {
+        if (pthread_create(&coalesce_threads[s], NULL, coalesce_flusher_main, (void*)s) != 0) {
+            printf("ERROR: failed to create the coalescing thread!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// stops the flushers once the benchmark threads no longer issue gets
+static void coalesce_stop(void)
+{
+    if (!coalesce_enabled()) {
+        return;
+    }
+    __atomic_store_n(&coalesce_stopping, true, __ATOMIC_RELEASE);
+    for (size_t s = 0; s < opt_server_info.num_servers; s++) {
+        shmring_notify(&coalesce_queues[s].bell);
+        pthread_join(coalesce_threads[s], NULL);
+    }
+}
+
+/**
+ * Prints how many keys the multi-gets of each server combined, as percentiles and as the share of
+ * the multi-gets per power of two, and what combining cost: the time the gets waited for their
+ * multi-get and the time the multi-gets took.
+ */
+static void coalesce_report(void)
+{
+    printf("benchmark coalesced keys per multi-get %16s %10s %10s %10s %10s %10s %10s\n", "multi-gets", "mean",
+        "p50", "p90", "p99", "p99.9", "max");
+    for (size_t s = 0; s < opt_server_info.num_servers; s++) {
+        const struct histogram* h = &coalesce_stats[s].sizes;
+        char name[256], label[300];
+        server_name(s, name, sizeof(name));
+        snprintf(label, sizeof(label), "server %zu %s", s, name);
+        printf("  %-40s %12lu %10.2f %10lu %10lu %10lu %10lu %10lu\n", label, h->count, histogram_mean(h),
+            histogram_percentile(h, 50.0), histogram_percentile(h, 90.0), histogram_percentile(h, 99.0),
+            histogram_percentile(h, 99.9), h->max);
+    }
+    for (size_t s = 0; s < opt_server_info.num_servers; s++) {
+        const struct coalesce_stats* st = &coalesce_stats[s];
+        printf("  server %zu multi-gets by keys:", s);
+        for (size_t c = 0; c < COALESCE_CLASSES && (1UL << c) <= opt_coalesce; c++) {
+            if (c == 0) {
+                printf(" 1");
+            } else {
+                printf(" %lu-%lu", 1UL << c, (2UL << c) - 1 < opt_coalesce ? (2UL << c) - 1 : opt_coalesce);
+            }
+            printf(" %.1f%%", st->sizes.count ? 100.0 * st->classes[c] / st->sizes.count : 0.0);
+        }
+        printf("\n");
+    }
+
+    printf("benchmark coalescing queue wait (us) %18s %10s %10s %10s %10s %10s %10s\n", "count", "mean", "p50",
+        "p90", "p99", "p99.9", "max");
+    for (size_t s = 0; s < opt_server_info.num_servers; s++) {
+        char name[256], label[300];
+        server_name(s, name, sizeof(name));
+        snprintf(label, sizeof(label), "server %zu %s", s, name);
+        latency_report_line(label, &coalesce_stats[s].wait);
+    }
+    printf("benchmark coalesced multi-get time (us) %15s %10s %10s %10s %10s %10s %10s\n", "count", "mean", "p50",
+        "p90", "p99", "p99.9", "max");
+    for (size_t s = 0; s < opt_server_info.num_servers; s++) {
+        char name[256], label[300];
+        server_name(s, name, sizeof(name));
+        snprintf(label, sizeof(label), "server %zu %s", s, name);
+        latency_report_line(label, &coalesce_stats[s].flush);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Elastic Membership
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the interval the membership thread checks the control socket and the schedule at in ms
+#define MEMBERSHIP_POLL_MS 50
+// the longest command line on the control socket
+#define MEMBERSHIP_LINE_MAX 256
+// the seconds before a change that its baseline miss rate and throughput are taken over
+#define MEMBERSHIP_BASELINE_S 3
+
+/**
+ * The oldest membership a thread may still route with: the version it saw when it was last between
+ * two operations, UINT64_MAX while it routes no keys. A replaced membership is freed once every
+ * thread has moved past it (quiescent-state based reclamation), so routing never waits for a change.
+ */
+struct membership_reader {
+    uint64_t version;
+} __attribute__((aligned(64)));
+
+// a change of the membership as it was applied
+struct membership_log {
+    // in seconds since the benchmark phase started
+    double t;
+    size_t server;
+    bool add;
+    // the number of members after the change
+    size_t num_members;
+};
+
+static struct membership_reader* membership_readers = NULL;
+// the changes applied during the run, at most MEMBERSHIP_EVENTS_MAX
+static struct membership_log membership_log[MEMBERSHIP_EVENTS_MAX];
+static size_t membership_num_log = 0;
+// the thread that applies the changes and its control socket, -1 without one
+static pthread_t membership_thread;
+static int membership_fd = -1;
+static bool membership_stopping = false;
+// when the benchmark phase started, in timer ticks
+static uint64_t membership_epoch;
+
+static bool membership_elastic(void)
+{
+    return opt_control_socket != NULL || opt_num_membership_events > 0;
+}
+
+static void membership_init(void)
+{
+    if (!membership_elastic()) {
+        return;
+    }
+    size_t size = opt_num_threads * sizeof(*membership_readers);
+    membership_readers = (struct membership_reader*)aligned_alloc(64, size);
+    if (membership_readers == NULL) {
+        printf("ERROR: failed to allocate memory for the membership readers\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        membership_readers[tid].version = UINT64_MAX;
+    }
+}
+
+static void membership_describe(void)
+{
+    printf(" - membership = %zu of %zu servers at the start", opt_initial_servers, opt_server_info.num_servers);
+    if (opt_num_membership_events > 0) {
+        printf(", %zu scheduled changes", opt_num_membership_events);
+    }
+    if (opt_control_socket != NULL) {
+        printf(", control socket %s", opt_control_socket);
+    }
+    printf("%s\n", opt_fill_on_miss ? ", misses are filled" : "");
+}
+
+// announces, between two operations, that the thread no longer routes with older memberships
+static inline void membership_quiescent(uint64_t tid)
+{
+    if (membership_readers == NULL) {
+        return;
+    }
+    uint64_t version = __atomic_load_n(&key_members_version, __ATOMIC_SEQ_CST);
+    if (membership_readers[tid].version != version) {
+        __atomic_store_n(&membership_readers[tid].version, version, __ATOMIC_SEQ_CST);
+        // the announcement must be visible before the thread loads the membership again
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+// announces that the thread routes no more keys
+static void membership_offline(uint64_t tid)
+{
+    if (membership_readers != NULL) {
+        __atomic_store_n(&membership_readers[tid].version, UINT64_MAX, __ATOMIC_RELEASE);
+    }
+}
+
+// frees the replaced memberships no thread may route with anymore, by the membership thread only
+static void membership_reclaim(void)
+{
+    uint64_t oldest = UINT64_MAX;
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        uint64_t version = __atomic_load_n(&membership_readers[tid].version, __ATOMIC_SEQ_CST);
+        oldest = version < oldest ? version : oldest;
+    }
+    // the replaced memberships are chained from the newest to the oldest
+    for (struct membership* ms = key_members; ms->retired != NULL; ms = ms->retired) {
+        if (ms->retired->version < oldest) {
+            struct membership* r = ms->retired;
+            ms->retired = NULL;
+            while (r != NULL) {
+                struct membership* next = r->retired;
+                membership_free(r);
+                r = next;
+            }
+            break;
+        }
+    }
+}
+
+// returns the number of members at the end of the second of the run
+static size_t membership_members_at(size_t second)
+{
+    size_t num_members = opt_initial_servers;
+    for (size_t i = 0; i < membership_num_log && membership_log[i].t < second + 1; i++) {
+        num_members = membership_log[i].num_members;
+    }
+    return num_members;
+}
+
+/**
+ * Adds the server to the membership or removes it, by the membership thread only. The new
+ * membership is published for the next key routed, returns false with the reason in `err` if the
+ * change does not apply.
+ */
+static bool membership_change(size_t server, bool add, char* err, size_t len)
+{
+    struct membership* current = key_members;
+    bool member = false;
+    for (size_t i = 0; i < current->num_members; i++) {
+        member |= current->members[i] == server;
+    }
+    if (server >= opt_server_info.num_servers) {
+        snprintf(err, len, "no server %zu, there are %zu", server, opt_server_info.num_servers);
+        return false;
+    } else if (add && member) {
+        snprintf(err, len, "server %zu is a member already", server);
+        return false;
+    } else if (!add && !member) {
+        snprintf(err, len, "server %zu is not a member", server);
+        return false;
+    } else if (!add && current->num_members == 1) {
+        snprintf(err, len, "server %zu is the last member", server);
+        return false;
+    } else if (!add && current->num_members <= opt_replicas) {
+        snprintf(err, len, "%zu replicas need at least as many members, got %zu", opt_replicas,
+            current->num_members - 1);
+        return false;
+    } else if (membership_num_log == MEMBERSHIP_EVENTS_MAX) {
+        snprintf(err, len, "no more than %u changes per run", MEMBERSHIP_EVENTS_MAX);
+        return false;
+    }
+
+    uint32_t members[SERVER_MAX];
+    size_t num_members = 0;
+    for (size_t i = 0; i < current->num_members; i++) {
+        if (add || current->members[i] != server) {
+            members[num_members++] = current->members[i];
+        }
+    }
+    if (add) {
+        members[num_members++] = (uint32_t)server;
+    }
+    struct membership* ms = membership_build(members, num_members, current->version + 1);
+    ms->retired = current;
+    __atomic_store_n(&key_members, ms, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&key_members_version, ms->version, __ATOMIC_SEQ_CST);
+
+    struct membership_log* log = &membership_log[membership_num_log++];
+    log->t = timer_ticks_to_ns(timer_now() - membership_epoch) / 1e9;
+    log->server = server;
+    log->add = add;
+    log->num_members = num_members;
+
+    char name[256];
+    server_name(server, name, sizeof(name));
+    printf("membership: %.3f s %s server %zu %s, %zu members (version %lu)\n", log->t,
+        add ? "added" : "removed", server, name, num_members, ms->version);
+    return true;
+}
+
+// parses the server of a command, by its index or by its name as the reports print it
+static bool membership_parse_server(const char* arg, size_t* server)
+{
+    char* end;
+    *server = strtoull(arg, &end, 10);
+    if (end != arg && *end == '\0') {
+        return true;
+    }
+    if (strncmp(arg, "tcp://", 6) == 0) {
+        arg += 6;
+    }
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        char name[256];
+        server_name(i, name, sizeof(name));
+        if (strcmp(name, arg) == 0) {
+            *server = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// executes a line of the control socket: add <server>, remove <server> or members
+static void membership_command(char* line, char* reply, size_t len)
+{
+    char* save;
+    const char* cmd = strtok_r(line, " \t\r", &save);
+    const char* arg = strtok_r(NULL, " \t\r", &save);
+    size_t server;
+    char err[128];
+
+    if (cmd != NULL && (strcmp(cmd, "add") == 0 || strcmp(cmd, "remove") == 0)) {
+        if (arg == NULL || !membership_parse_server(arg, &server)) {
+            snprintf(reply, len, "ERROR unknown server %s\n", arg != NULL ? arg : "");
+        } else if (!membership_change(server, cmd[0] == 'a', err, sizeof(err))) {
+            snprintf(reply, len, "ERROR %s\n", err);
+        } else {
+            snprintf(reply, len, "OK version %lu, %zu members\n", key_members->version, key_members->num_members);
+        }
+    } else if (cmd != NULL && strcmp(cmd, "members") == 0) {
+        size_t n = snprintf(reply, len, "OK version %lu:", key_members->version);
+        for (size_t i = 0; i < key_members->num_members && n < len; i++) {
+            n += snprintf(reply + n, len - n, " %u", key_members->members[i]);
+        }
+        if (n < len) {
+            snprintf(reply + n, len - n, "\n");
+        }
+    } else {
+        snprintf(reply, len, "ERROR unknown command %s (expected add <server>, remove <server> or members)\n",
+            cmd != NULL ? cmd : "");
+    }
+}
+
+// reads the commands of the connected client, returns false once it hung up
+static bool membership_serve(int fd, char* line, size_t* len)
+{
+    ssize_t n = read(fd, line + *len, MEMBERSHIP_LINE_MAX - 1 - *len);
+    if (n <= 0) {
+        return n < 0 && errno == EINTR;
+    }
+    *len += n;
+    line[*len] = '\0';
+
+    char* eol;
+    while ((eol = strchr(line, '\n')) != NULL) {
+        *eol = '\0';
+        char reply[4096];
+        membership_command(line, reply, sizeof(reply));
+        if (write(fd, reply, strlen(reply)) < 0) {
+            return false;
+        }
+        *len -= eol + 1 - line;
+        memmove(line, eol + 1, *len + 1);
+    }
+    if (*len == MEMBERSHIP_LINE_MAX - 1) {
+        const char* reply = "ERROR line too long\n";
+        *len = 0;
+        return write(fd, reply, strlen(reply)) >= 0;
+    }
+    return true;
+}
+
+/**
+ * Applies the scheduled changes when they are due and those sent to the control socket, one
+ * client at a time, and frees the memberships the threads are done with.
+ */
+static void* membership_main(void* arg)
+{
+    (void)arg;
+    size_t next_event = 0;
+    int client = -1;
+    char line[MEMBERSHIP_LINE_MAX];
+    size_t len = 0;
+
+    while (!__atomic_load_n(&membership_stopping, __ATOMIC_ACQUIRE)) {
+        double now = timer_ticks_to_ns(timer_now() - membership_epoch) / 1e9;
+        for (; next_event < opt_num_membership_events && opt_membership_events[next_event].t <= now; next_event++) {
+            char err[128];
+            const struct membership_event* e = &opt_membership_events[next_event];
+            if (!membership_change(e->server, e->add, err, sizeof(err))) {
+                printf("membership: %.3f s ignoring %c%zu, %s\n", now, e->add ? '+' : '-', e->server, err);
+            }
+        }
+        membership_reclaim();
+
+        struct pollfd pfd = { client >= 0 ? client : membership_fd, POLLIN, 0 };
+        if (pfd.fd < 0) {
+            usleep(MEMBERSHIP_POLL_MS * 1000);
+            continue;
+        }
+        if (poll(&pfd, 1, MEMBERSHIP_POLL_MS) <= 0) {
+            continue;
+        }
+        if (client < 0) {
+            client = accept(membership_fd, NULL, NULL);
+            len = 0;
+        } else if (!membership_serve(client, line, &len)) {
+            close(client);
+            client = -1;
+        }
+    }
+    if (client >= 0) {
+        close(client);
+    }
+    return NULL;
+}
+
+// opens the control socket and starts the membership thread as the benchmark phase starts
+static void membership_start(void)
+{
+    if (!membership_elastic()) {
+        return;
+    }
+    if (opt_control_socket != NULL) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, opt_control_socket, sizeof(addr.sun_path) - 1);
+
+        membership_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(opt_control_socket);
+        if (membership_fd < 0 || bind(membership_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+            || listen(membership_fd, 16) != 0) {
+            printf("ERROR: failed to listen on the control socket %s: %s\n", opt_control_socket, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    membership_epoch = timer_now();
+    if (pthread_create(&membership_thread, NULL, membership_main, NULL) != 0) {
+        printf("ERROR: failed to create the membership thread!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// stops the membership thread once the benchmark threads no longer route keys
+static void membership_stop(void)
+{
+    if (!membership_elastic()) {
+        return;
+    }
+    __atomic_store_n(&membership_stopping, true, __ATOMIC_RELEASE);
+    pthread_join(membership_thread, NULL);
+    if (membership_fd >= 0) {
+        close(membership_fd);
+        unlink(opt_control_socket);
+    }
+}
+
+// the gets that missed as a percentage of all gets in the seconds [from, to)
+static double membership_miss_rate(const struct latency_series_outcomes* outcomes, size_t from, size_t to)
+{
+    uint64_t gets = 0, misses = 0;
+    for (size_t s = from; s < to; s++) {
+        gets += outcomes[s].gets;
+        misses += outcomes[s].get_misses;
+    }
+    return gets ? 100.0 * misses / gets : 0.0;
+}
+
+/**
+ * Prints the run second by second with the changes, and for each change the miss rate and
+ * throughput before it, the peak miss rate after it, and the time until both were back: the miss
+ * rate within a point of the baseline and the throughput at 90% of it. Must only be called once
+ * the threads have been joined.
+ */
+static void membership_report(double elapsed_s)
+{
+    if (!membership_elastic()) {
+        return;
+    }
+    size_t num_slots = latency_series_slots;
+    struct latency_series_outcomes* outcomes = (struct latency_series_outcomes*)calloc(num_slots, sizeof(*outcomes));
+    uint64_t* ops = (uint64_t*)calloc(num_slots, sizeof(*ops));
+    uint64_t* p99 = (uint64_t*)calloc(num_slots, sizeof(*p99));
+    if (outcomes == NULL || ops == NULL || p99 == NULL) {
+        printf("ERROR: failed to allocate memory for the membership report\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t s = 0; s < num_slots; s++) {
+        struct histogram h;
+        latency_series_merge(s, &h, &outcomes[s]);
+        ops[s] = h.count;
+        p99[s] = histogram_percentile(&h, 99.0);
+    }
+    // only whole seconds count for the baselines and recoveries
+    size_t full = (size_t)elapsed_s < num_slots ? (size_t)elapsed_s : num_slots;
+
+    printf("benchmark membership, %zu changes\n", membership_num_log);
+    printf("  %6s %8s %12s %8s %10s %10s  %s\n", "second", "members", "ops/s", "miss%", "errors", "p99 (us)",
+        "changes");
+    for (size_t s = 0; s < num_slots; s++) {
+        if (ops[s] == 0) {
+            continue;
+        }
+        printf("  %6zu %8zu %12lu %8.2f %10lu %10.2f ", s, membership_members_at(s), ops[s],
+            membership_miss_rate(outcomes, s, s + 1), outcomes[s].errors, timer_ticks_to_ns(p99[s]) / 1000.0);
+        for (size_t i = 0; i < membership_num_log; i++) {
+            if ((size_t)membership_log[i].t == s) {
+                printf(" %c%zu", membership_log[i].add ? '+' : '-', membership_log[i].server);
+            }
+        }
+        printf("\n");
+    }
+
+    for (size_t i = 0; i < membership_num_log; i++) {
+        const struct membership_log* log = &membership_log[i];
+        size_t at = (size_t)log->t;
+        size_t end = i + 1 < membership_num_log ? (size_t)membership_log[i + 1].t : full;
+        end = end < full ? end : full;
+        printf("  change %c%zu at %.3f s, %zu members:", log->add ? '+' : '-', log->server, log->t, log->num_members);
+        if (at < 1 || at >= end) {
+            printf(" no whole seconds around it\n");
+            continue;
+        }
+        size_t from = at > MEMBERSHIP_BASELINE_S ? at - MEMBERSHIP_BASELINE_S : 0;
+        double base_miss = membership_miss_rate(outcomes, from, at);
+        double base_ops = 0;
+        for (size_t s = from; s < at; s++) {
+            base_ops += ops[s];
+        }
+        base_ops /= at - from;
+
+        double peak_miss = 0;
+        size_t recovered = end;
+        for (size_t s = at; s < end; s++) {
+            double miss = membership_miss_rate(outcomes, s, s + 1);
+            peak_miss = miss > peak_miss ? miss : peak_miss;
+            if (recovered == end && miss <= base_miss + 1.0 && ops[s] >= 0.9 * base_ops) {
+                recovered = s;
+            }
+        }
+        printf(" baseline %.2f%% misses at %.0f ops/s, peak %.2f%% misses, ", base_miss, base_ops, peak_miss);
+        if (recovered < end) {
+            printf("recovered within %.1f s\n", recovered + 1 - log->t);
+        } else {
+            printf("not recovered after %.1f s\n", end - log->t);
+        }
+    }
+
+    free(outcomes);
+    free(ops);
+    free(p99);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Operations
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the value appended by append operations
+#define APPEND_SUFFIX "appended"
+#define APPEND_SIZE (sizeof(APPEND_SUFFIX) - 1)
+
+enum op_result {
+    // the key was found, or the update was applied
+    OP_HIT,
+    // the key was not found, or the update was not applied (e.g., a cas conflict)
+    OP_MISS,
+    OP_ERROR,
+};
+
+// the outcomes of one operation type
+struct op_stats {
+    size_t hits;
+    size_t misses;
+    size_t errors;
+};
+
+// the outcomes of the benchmark phase per operation type, summed up over all threads
+static struct op_stats op_stats[WORKLOAD_OP_MAX];
+
+// the object id the next insert operation writes, wraps around in the key space
+static uint64_t op_insert_next;
+
+// the gets that missed and wrote the object with --fill-on-miss, summed up over all threads
+static size_t op_fills = 0;
+
+/**
+ * Per-thread state for executing operations against the servers.
+ */
+struct op_context {
+    uint64_t tid;
+    memcached_st** memc;
+    // one reusable result per server for gets that return a cas value
+    memcached_result_st** results;
+    struct server_load load[SERVER_MAX];
+    // this thread's latency histograms, per server followed by per operation type
+    struct histogram* lat;
+    struct op_stats stats[WORKLOAD_OP_MAX];
+    // the value written by sets, only the digits of the object id change between operations
+    char* value;
+    // the servers keys are drawn for as a bit mask, 0 for all of them
+    uint32_t servers;
+    // the per-second histograms of the results time series starting at `series_start`, or NULL
+    struct histogram* series;
+    struct latency_series_outcomes* series_outcomes;
+    uint64_t series_start;
+    // the operations completed per server and in the near cache, read by the stats sampler, or NULL
+    uint64_t* progress;
+    // the replication state, or NULL without replicas
+    struct replica_thread* replica;
+    // the value of the last get from an in-process table
+    struct mc_buf inproc_value;
+    // this thread's part of the recorded trace, or NULL
+    struct trace_writer* trace;
+    // the value size of the writes, 0 for the object's size from the distribution
+    size_t value_size;
+    // the expiration time of the writes in seconds, 0 for none
+    uint32_t expires;
+    // the get handed to a flusher when coalescing
+    struct coalesce_req coalesce;
+    // the gets that missed and wrote the object
+    size_t fills;
+};
+
+static void op_context_init(struct op_context* ctx, uint64_t tid, memcached_st** memc)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->tid = tid;
+    ctx->memc = memc;
+    ctx->lat = &latency_hist[tid * latency_per_thread()];
+    ctx->value = item_value_alloc();
+    ctx->servers = placement_servers(tid);
+    ctx->series = latency_series_thread_init(tid);
+    ctx->series_outcomes = ctx->series != NULL ? latency_series_outcomes[tid] : NULL;
+    ctx->series_start = timer_now();
+    ctx->replica = replica_thread_init(tid);
+    if (inproc_enabled()) {
+        mc_buf_init(&ctx->inproc_value, 4096);
+    }
+    ctx->trace = trace_thread_open(tid);
+    membership_quiescent(tid);
+    if (coalesce_enabled()) {
+        ctx->coalesce.bell = &coalesce_bells[tid];
+    }
+
+    ctx->results = (memcached_result_st**)calloc(opt_server_info.num_servers, sizeof(*ctx->results));
+    if (ctx->results == NULL) {
+        printf("thread:%lu failed to allocate memory for the results\n", tid);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        ctx->results[i] = memcached_result_create(memc[i], NULL);
+        if (ctx->results[i] == NULL) {
+            printf("thread:%lu failed to allocate the result for server %zu\n", tid, i);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void op_context_free(struct op_context* ctx)
+{
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        memcached_result_free(ctx->results[i]);
+    }
+    free(ctx->results);
+    free(ctx->value);
+    replica_thread_free(ctx->replica);
+    mc_buf_free(&ctx->inproc_value);
+    trace_thread_close(ctx->trace, ctx->tid);
+    membership_offline(ctx->tid);
+}
+
+/**
+ * Drops the outcomes, load and latencies the thread recorded so far, once the warm-up of an
+ * adaptive run is over. The time series and the statistics of the other features keep the whole run.
+ */
+static void op_context_reset(struct op_context* ctx)
+{
+    memset(ctx->stats, 0, sizeof(ctx->stats));
+    memset(ctx->load, 0, sizeof(ctx->load));
+    for (size_t i = 0; i < latency_per_thread(); i++) {
+        histogram_init(&ctx->lat[i]);
+    }
+    ctx->fills = 0;
+}
+
+static void op_context_merge(struct op_context* ctx)
+{
+    for (int op = 0; op < WORKLOAD_OP_MAX; op++) {
+        __atomic_fetch_add(&op_stats[op].hits, ctx->stats[op].hits, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&op_stats[op].misses, ctx->stats[op].misses, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&op_stats[op].errors, ctx->stats[op].errors, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&op_fills, ctx->fills, __ATOMIC_RELAXED);
+    server_load_merge(ctx->load);
+    replica_thread_merge(ctx->replica);
+}
+
+// publishes the operations completed on the server (or near cache) to the stats sampler
+static inline void op_record_progress(struct op_context* ctx, size_t slot, size_t n)
+{
+    if (ctx->progress != NULL) {
+        __atomic_store_n(&ctx->progress[slot], ctx->progress[slot] + n, __ATOMIC_RELAXED);
+    }
+}
+
+// records the operations in the time series slot of the current second
+static inline void op_record_series(struct op_context* ctx, enum workload_op op, uint64_t latency,
+    enum op_result result, size_t n)
+{
+    if (ctx->series != NULL) {
+        uint64_t slot = (timer_now() - ctx->series_start) / latency_series_ticks;
+        slot = slot < latency_series_slots ? slot : latency_series_slots - 1;
+        histogram_record_n(&ctx->series[slot], latency, n);
+        if (op == WORKLOAD_GET) {
+            ctx->series_outcomes[slot].gets += n;
+            ctx->series_outcomes[slot].get_misses += result == OP_MISS ? n : 0;
+        }
+        ctx->series_outcomes[slot].errors += result == OP_ERROR ? n : 0;
+    }
+}
+
+static inline void op_record(struct op_context* ctx, enum workload_op op, size_t server,
+    uint64_t latency, enum op_result result, size_t n)
+{
+    op_record_series(ctx, op, latency, result, n);
+    op_record_progress(ctx, server, n);
+    histogram_record_n(&ctx->lat[server], latency, n);
+    histogram_record_n(&ctx->lat[opt_server_info.num_servers + op], latency, n);
+    switch (result) {
+    case OP_HIT:
+        ctx->stats[op].hits += n;
+        break;
+    case OP_MISS:
+        ctx->stats[op].misses += n;
+        break;
+    case OP_ERROR:
+        ctx->stats[op].errors += n;
+        break;
+    }
+}
+
+/**
+ * Patches the object id into the thread's value and returns the size to write: the object's size,
+ * or the one of the replayed record.
+ */
+static inline size_t op_format_value(struct op_context* ctx, uint64_t objid)
+{
+    size_t vlen = item_format_value(ctx->value, objid);
+    return ctx->value_size ? ctx->value_size : vlen;
+}
+
+// records the operation, sent at `t` (0 = now), in the thread's part of the trace
+static inline void op_trace(struct op_context* ctx, enum workload_op op, uint64_t objid, uint64_t t)
+{
+    if (ctx->trace == NULL) {
+        return;
+    }
+    size_t vlen = 0;
+    if (op == WORKLOAD_APPEND) {
+        vlen = APPEND_SIZE;
+    } else if (op != WORKLOAD_INCR && op != WORKLOAD_DECR) {
+        vlen = ctx->value_size ? ctx->value_size : item_value_size(objid);
+    }
+    trace_capture(ctx->trace, op, objid, vlen, ctx->expires, t ? t : timer_now());
+}
+
+/**
+ * Answers a get from the near cache. On a hit the get is recorded with its latency since `t_start`
+ * and no server load, and `t_end` is set to the time it completed.
+ */
+static inline bool op_near_cache_get(struct op_context* ctx, uint64_t objid, uint64_t t_start, uint64_t* t_end)
+{
+    char value[NEAR_CACHE_VALUE_MAX];
+    size_t len;
+
+    if (!nearcache_get(&near_cache, objid, value, sizeof(value), &len, timer_now())) {
+        return false;
+    }
+    *t_end = timer_now();
+    uint64_t latency = *t_end - t_start;
+
+    op_record_series(ctx, WORKLOAD_GET, latency, OP_HIT, 1);
+    op_record_progress(ctx, opt_server_info.num_servers, 1);
+    histogram_record(&ctx->lat[latency_near_cache_slot()], latency);
+    histogram_record(&ctx->lat[opt_server_info.num_servers + WORKLOAD_GET], latency);
+    ctx->stats[WORKLOAD_GET].hits++;
+    return true;
+}
+
+static inline enum op_result op_classify(memcached_return_t rc)
+{
+    switch (rc) {
+    case MEMCACHED_SUCCESS:
+    case MEMCACHED_STORED:
+    case MEMCACHED_DELETED:
+    case MEMCACHED_END:
+        return OP_HIT;
+    case MEMCACHED_NOTFOUND:
+    case MEMCACHED_NOTSTORED:
+    case MEMCACHED_DATA_EXISTS:
+        return OP_MISS;
+    default:
+        return OP_ERROR;
+    }
+}
+
+// returns the object id for the next insert operation
+static inline uint64_t op_insert_id(void)
+{
+    return __atomic_fetch_add(&op_insert_next, coord_count, __ATOMIC_RELAXED) % key_dist.num_keys;
+}
+
+/**
+ * Draws the operation and the object id it works on. Keys outside the thread's servers are drawn
+ * again, inserts take the next id wherever it lives.
+ */
+static inline enum workload_op op_next(const struct op_context* ctx, struct xor_shift* rand, uint64_t* objid)
+{
+    membership_quiescent(ctx->tid);
+    enum workload_op op = workload_next(&opt_workload, rand);
+    if (op == WORKLOAD_INSERT) {
+        *objid = op_insert_id();
+        return op;
+    }
+
+    *objid = keydist_next(&key_dist, rand);
+    for (int i = 0; ctx->servers != 0 && i < PLACEMENT_REDRAW_MAX; i++) {
+        if (ctx->servers & (1U << key_server(*objid))) {
+            break;
+        }
+        *objid = keydist_next(&key_dist, rand);
+    }
+    return op;
+}
+
+/**
+ * Gets the key into the server's reusable result instead of memcached_get(), which hands out every
+ * value in a fresh allocation. With `cas` set the cas value is returned, plain gets of the object
+ * fill the near cache instead.
+ */
+static memcached_return_t op_get(struct op_context* ctx, size_t server, const char* key, size_t keylen,
+    uint64_t objid, uint64_t* cas, size_t* bytes)
+{
+    memcached_st* m = ctx->memc[server];
+    const char* keys[1] = { key };
+    size_t key_lens[1] = { keylen };
+
+    memcached_return_t rc = memcached_mget(m, keys, key_lens, 1);
+    if (memcached_failed(rc)) {
+        return rc;
+    }
+
+    bool found = false;
+    memcached_result_st* result;
+    while ((result = memcached_fetch_result(m, ctx->results[server], &rc)) != NULL) {
+        if (opt_verbose) {
+            printf("thread:%lu key %s = %.*s...\n", ctx->tid, key, (int)memcached_result_length(result),
+                memcached_result_value(result));
+        }
+        if (cas != NULL) {
+            *cas = memcached_result_cas(result);
+        } else if (near_cache_enabled()) {
+            nearcache_put(&near_cache, objid, memcached_result_value(result), memcached_result_length(result),
+                timer_now());
+        }
+        *bytes += memcached_result_length(result);
+        found = true;
+    }
+    if (rc != MEMCACHED_END && rc != MEMCACHED_NOTFOUND) {
+        return rc;
+    }
+    return found ? MEMCACHED_SUCCESS : MEMCACHED_NOTFOUND;
+}
+
+/**
+ * Fetches the key with its cas value and writes it back conditionally on the cas value.
+ */
+static memcached_return_t op_read_modify_write(struct op_context* ctx, size_t server, const char* key,
+    size_t keylen, const char* value, size_t vlen, size_t* bytes)
+{
+    uint64_t cas = 0;
+    memcached_return_t rc = op_get(ctx, server, key, keylen, 0, &cas, bytes);
+    if (rc != MEMCACHED_SUCCESS) {
+        return rc;
+    }
+
+    *bytes += keylen + vlen;
+    return memcached_cas(ctx->memc[server], key, keylen, value, vlen, ctx->expires, 0 /* flags */, cas);
+}
+
+/**
+ * Executes the operation on the server's in-process table instead of the server. A get copies the
+ * value out, as a client receiving it would.
+ */
+static memcached_return_t op_inproc(struct op_context* ctx, enum workload_op op, size_t server, const char* key,
+    size_t keylen, uint64_t objid, size_t vlen, size_t* bytes)
+{
+    struct store* st = &inproc_stores[server];
+    uint64_t counter;
+    uint16_t status;
+
+    switch (op) {
+    case WORKLOAD_GET: {
+        uint32_t flags;
+        mc_buf_consume(&ctx->inproc_value, mc_buf_len(&ctx->inproc_value));
+        if (!store_get(st, key, keylen, &ctx->inproc_value, &flags)) {
+            return MEMCACHED_NOTFOUND;
+        }
+        if (near_cache_enabled()) {
+            nearcache_put(&near_cache, objid, mc_buf_head(&ctx->inproc_value), mc_buf_len(&ctx->inproc_value),
+                timer_now());
+        }
+        *bytes += mc_buf_len(&ctx->inproc_value);
+        return MEMCACHED_SUCCESS;
+    }
+    case WORKLOAD_SET:
+    case WORKLOAD_INSERT:
+        status = store_put(st, STORE_SET, key, keylen, ctx->value, vlen, 0);
+        *bytes += vlen;
+        break;
+    case WORKLOAD_DELETE:
+        status = store_delete(st, key, keylen);
+        break;
+    case WORKLOAD_INCR:
+    case WORKLOAD_DECR:
+        status = store_delta(st, key, keylen, op == WORKLOAD_INCR, 1, &counter);
+        if (status == MC_BIN_STATUS_NOT_FOUND) {
+            // create the counter, the operation still counts as a miss
+            store_put(st, STORE_ADD, key, keylen, "0", 1, 0);
+        }
+        break;
+    case WORKLOAD_APPEND:
+        status = store_put(st, STORE_APPEND, key, keylen, APPEND_SUFFIX, APPEND_SIZE, 0);
+        *bytes += APPEND_SIZE;
+        break;
+    default:
+        abort();
+    }
+    return inproc_result(status);
+}
+
+/**
+ * Hands the get to the server's flusher, which combines it with the gets of other threads into one
+ * multi-get, and waits for its outcome.
+ */
+static memcached_return_t op_coalesced_get(struct op_context* ctx, size_t server, const char* key, size_t keylen,
+    uint64_t objid, size_t* bytes)
+{
+    struct coalesce_req* r = &ctx->coalesce;
+    r->key = key;
+    r->keylen = keylen;
+    r->objid = objid;
+    r->t_enqueue = timer_now();
+    coalesce_push(&coalesce_queues[server], r);
+    coalesce_wait(r);
+    *bytes += r->value_len;
+    return (memcached_return_t)r->result;
+}
+
+/**
+ * Races a get on the key's replicas: it goes to the primary, and if the primary has not answered
+ * within the hedge delay or failed a second get goes to another replica. The first answer counts
+ * and sets `t_answer`; the slower one is still waited for, so `t_primary` tells when the primary
+ * answered. Failed connections are dropped, the get fails if no replica answered.
+ */
+static memcached_return_t op_hedged_get(struct op_context* ctx, const size_t* replicas, size_t num_replicas,
+    const char* key, size_t keylen, uint64_t objid, size_t* bytes, uint64_t* t_answer, uint64_t* t_primary)
+{
+    struct replica_thread* rt = ctx->replica;
+    struct replica_conn* conns[2] = { &rt->conns[replicas[0]], &rt->conns[replicas[0]] };
+    struct mc_response resp;
+    uint64_t t_start = timer_now();
+    bool open[2] = { conns[0]->fd >= 0, false };
+
+    size_t racing = 1;
+    int winner = -2;
+    if (replica_conn_send_get(conns[0], opt_binary, key, keylen)) {
+        winner = replica_wait(conns, 1, opt_binary, replica_hedge_delay_ns(rt), &resp);
+    }
+    if (winner < 0) {
+        size_t hedge = replicas[1 + xor_shift_next(&rt->rand, num_replicas - 1)];
+        conns[1] = &rt->conns[hedge];
+        open[1] = conns[1]->fd >= 0;
+        if (replica_conn_send_get(conns[1], opt_binary, key, keylen)) {
+            racing = 2;
+            rt->stats.hedges++;
+            ctx->load[hedge].requests++;
+            ctx->load[hedge].bytes += keylen;
+        }
+        winner = replica_wait(conns, racing, opt_binary, -1, &resp);
+    }
+    *t_answer = timer_now();
+
+    memcached_return_t rc = MEMCACHED_FAILURE;
+    if (winner >= 0) {
+        rc = resp.status == MC_STATUS_HIT ? MEMCACHED_SUCCESS
+            : resp.status == MC_STATUS_MISS ? MEMCACHED_NOTFOUND
+                                            : MEMCACHED_FAILURE;
+        if (resp.status == MC_STATUS_HIT) {
+            *bytes += resp.value_len;
+            if (near_cache_enabled()) {
+                nearcache_put(&near_cache, objid, resp.value, resp.value_len, *t_answer);
+            }
+        }
+        mc_buf_consume(&conns[winner]->rbuf, resp.len);
+        rt->stats.hedges_won += winner == 1;
+    }
+
+    *t_primary = *t_answer;
+    if (winner == 1) {
+        // the primary may still answer, or have failed already
+        if (replica_wait(&conns[0], 1, opt_binary, -1, &resp) == 0) {
+            mc_buf_consume(&conns[0]->rbuf, resp.len);
+        }
+        *t_primary = timer_now();
+    } else if (winner == 0 && racing == 2 && replica_wait(&conns[1], 1, opt_binary, -1, &resp) == 0) {
+        mc_buf_consume(&conns[1]->rbuf, resp.len);
+    }
+    if (winner >= 0 && conns[0]->fd >= 0) {
+        histogram_record(&rt->service, *t_primary - t_start);
+        rt->gets_since_update++;
+    }
+    rt->stats.conns_lost += (open[0] && conns[0]->fd < 0) + (open[1] && conns[1]->fd < 0);
+    return rc;
+}
+
+/**
+ * Applies a write that succeeded on the primary to the other replicas as well. A cas is decided on
+ * the primary, the replicas get its value with a plain set.
+ */
+static void op_replicate(struct op_context* ctx, enum workload_op op, const size_t* replicas, size_t num_replicas,
+    const char* key, size_t keylen, size_t vlen)
+{
+    uint64_t counter;
+    for (size_t i = 1; i < num_replicas; i++) {
+        memcached_st* m = ctx->memc[replicas[i]];
+        size_t bytes = keylen;
+        replica_begin(replicas[i]);
+        switch (op) {
+        case WORKLOAD_SET:
+        case WORKLOAD_INSERT:
+        case WORKLOAD_CAS:
+            memcached_set(m, key, keylen, ctx->value, vlen, ctx->expires, 0 /* flags */);
+            bytes += vlen;
+            break;
+        case WORKLOAD_DELETE:
+            memcached_delete(m, key, keylen, 0 /* expires */);
+            break;
+        case WORKLOAD_INCR:
+        case WORKLOAD_DECR:
+            if ((op == WORKLOAD_INCR ? memcached_increment(m, key, keylen, 1, &counter)
+                                     : memcached_decrement(m, key, keylen, 1, &counter)) == MEMCACHED_NOTFOUND) {
+                memcached_add(m, key, keylen, "0", 1, 0 /* expires */, 0 /* flags */);
+            }
+            break;
+        case WORKLOAD_APPEND:
+            memcached_append(m, key, keylen, APPEND_SUFFIX, APPEND_SIZE, ctx->expires, 0 /* flags */);
+            bytes += APPEND_SIZE;
+            break;
+        default:
+            abort();
+        }
+        replica_end(replicas[i]);
+        ctx->load[replicas[i]].requests++;
+        ctx->load[replicas[i]].bytes += bytes;
+    }
+    ctx->replica->stats.replica_writes += num_replicas - 1;
+}
+
+/**
+ * Writes the object a get missed to the server it was routed to, as the application would after
+ * reading it from the database. The write is not timed, the get paid for the miss already.
+ */
+static void op_fill(struct op_context* ctx, size_t server, const char* key, size_t keylen, uint64_t objid)
+{
+    size_t vlen = op_format_value(ctx, objid);
+    size_t bytes = keylen;
+    memcached_return_t rc;
+    if (inproc_enabled()) {
+        rc = op_inproc(ctx, WORKLOAD_SET, server, key, keylen, objid, vlen, &bytes);
+    } else {
+        rc = memcached_set(ctx->memc[server], key, keylen, ctx->value, vlen, ctx->expires, 0 /* flags */);
+    }
+    ctx->fills += !memcached_failed(rc);
+}
+
+/**
+ * Executes a single operation on the object and records its outcome and latency.
+ *
+ * The latency is measured from `t_intended` if it is set, so an open-loop schedule accounts for the
+ * time a request waited for its turn, and from the actual send time otherwise. Returns the time
+ * the response was received.
+ */
+static uint64_t op_execute(struct op_context* ctx, enum workload_op op, uint64_t objid, uint64_t t_intended)
+{
+    memcached_return_t rc;
+    uint64_t counter;
+
+    membership_quiescent(ctx->tid);
+    op_trace(ctx, op, objid, t_intended);
+    if (op == WORKLOAD_GET && near_cache_enabled()) {
+        // a miss pays for the lookup as well
+        if (t_intended == 0) {
+            t_intended = timer_now();
+        }
+        uint64_t t_end;
+        if (op_near_cache_get(ctx, objid, t_intended, &t_end)) {
+            return t_end;
+        }
+    }
+
+    char key[KEY_MAX + 1];
+    size_t keylen = item_format_key(key, op, objid);
+
+    size_t vlen = 0;
+    if (op == WORKLOAD_SET || op == WORKLOAD_INSERT || op == WORKLOAD_CAS) {
+        vlen = op_format_value(ctx, objid);
+    }
+
+    // pick the server the key is stored on, with replicas the one the read policy chooses
+    size_t replicas[SERVER_MAX];
+    size_t num_replicas = 1;
+    replicas[0] = key_server(objid);
+    if (replica_enabled()) {
+        num_replicas = key_replicas(objid, opt_replicas, replicas);
+    }
+    size_t server = replicas[0];
+    if (op == WORKLOAD_GET && opt_read_policy == REPLICA_P2C) {
+        server = replica_p2c(ctx->replica, replicas, num_replicas);
+        ctx->replica->stats.reads_moved += server != replicas[0];
+    }
+    memcached_st* m = ctx->memc[server];
+    size_t bytes = keylen;
+    // set by hedged gets, which wait for the slower replica after the answer
+    uint64_t t_answer = 0;
+    uint64_t t_primary = 0;
+
+    uint64_t t_start = timer_now();
+    replica_begin(server);
+    if (op == WORKLOAD_GET && coalesce_enabled()) {
+        rc = op_coalesced_get(ctx, server, key, keylen, objid, &bytes);
+    } else if (inproc_enabled()) {
+        rc = op_inproc(ctx, op, server, key, keylen, objid, vlen, &bytes);
+    } else switch (op) {
+    case WORKLOAD_GET:
+        if (opt_read_policy == REPLICA_HEDGED) {
+            rc = op_hedged_get(ctx, replicas, num_replicas, key, keylen, objid, &bytes, &t_answer, &t_primary);
+        } else {
+            rc = op_get(ctx, server, key, keylen, objid, NULL, &bytes);
+        }
+        break;
+    case WORKLOAD_SET:
+    case WORKLOAD_INSERT:
+        rc = memcached_set(m, key, keylen, ctx->value, vlen, ctx->expires, 0 /* flags */);
+        bytes += vlen;
+        break;
+    case WORKLOAD_DELETE:
+        rc = memcached_delete(m, key, keylen, 0 /* expires */);
+        break;
+    case WORKLOAD_INCR:
+    case WORKLOAD_DECR:
+        if (op == WORKLOAD_INCR) {
+            rc = memcached_increment(m, key, keylen, 1, &counter);
+        } else {
+            rc = memcached_decrement(m, key, keylen, 1, &counter);
+        }
+        if (rc == MEMCACHED_NOTFOUND) {
+            // create the counter, the operation still counts as a miss
+            memcached_add(m, key, keylen, "0", 1, 0 /* expires */, 0 /* flags */);
+        }
+        break;
+    case WORKLOAD_CAS:
+        rc = op_read_modify_write(ctx, server, key, keylen, ctx->value, vlen, &bytes);
+        break;
+    case WORKLOAD_APPEND:
+        rc = memcached_append(m, key, keylen, APPEND_SUFFIX, APPEND_SIZE, ctx->expires, 0 /* flags */);
+        bytes += APPEND_SIZE;
+        break;
+    default:
+        abort();
+    }
+    replica_end(server);
+
+    enum op_result result = op_classify(rc);
+    if (replica_enabled()) {
+        // the write is done once every replica has it
+        if (op != WORKLOAD_GET && result != OP_ERROR) {
+            op_replicate(ctx, op, replicas, num_replicas, key, keylen, vlen);
+        }
+        ctx->replica->stats.reads += op == WORKLOAD_GET;
+        ctx->replica->stats.writes += op != WORKLOAD_GET;
+    }
+    uint64_t t_end = t_answer ? t_answer : timer_now();
+    uint64_t latency = t_end - (t_intended ? t_intended : t_start);
+    if (replica_enabled() && op == WORKLOAD_GET) {
+        histogram_record(ctx->replica->answered, latency);
+        histogram_record(ctx->replica->primary, latency + (t_primary - t_answer));
+    }
+
+    if (opt_verbose && result != OP_HIT) {
+        printf("thread:%lu %s %s = %s...\n", ctx->tid, workload_op_names[op], key,
+            result == OP_MISS ? "NOT_FOUND" : memcached_strerror(m, rc));
+    }
+
+    if (op == WORKLOAD_INSERT && result == OP_HIT) {
+        keydist_inserted(&key_dist, objid);
+    }
+
+    // drop the cached value of a written key, counters live in their own key space and are never cached
+    if (near_cache_enabled() && op != WORKLOAD_GET && op != WORKLOAD_INCR && op != WORKLOAD_DECR) {
+        nearcache_invalidate(&near_cache, objid);
+    }
+
+    ctx->load[server].requests++;
+    ctx->load[server].bytes += bytes;
+    op_record(ctx, op, server, latency, result, 1);
+
+    if (op == WORKLOAD_GET && result == OP_MISS && opt_fill_on_miss) {
+        op_fill(ctx, server, key, keylen, objid);
+    }
+    return t_end;
+}
+
+static void op_stats_report(void)
+{
+    printf("benchmark operations %34s %12s %12s %12s\n", "count", "hits", "misses", "errors");
+    for (int op = 0; op < WORKLOAD_OP_MAX; op++) {
+        size_t count = op_stats[op].hits + op_stats[op].misses + op_stats[op].errors;
+        if (count == 0) {
+            continue;
+        }
+        printf("  %-40s %12zu %12zu %12zu %12zu\n", workload_op_names[op], count, op_stats[op].hits,
+            op_stats[op].misses, op_stats[op].errors);
+    }
+    if (opt_fill_on_miss) {
+        printf("  %-40s %12zu\n", "fills of missed gets", op_fills);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Batched Gets
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * State for issuing a batch of gets as one multi-get per server.
+ *
+ * All buffers are allocated once per thread and reused for every batch, the keys of a batch are
+ * grouped by their target server so that each server sees a single pipelined request.
+ */
+struct get_batch {
+    size_t num_servers;
+    size_t batch_size;
+    // the formatted keys of the current batch
+    char (*keys)[KEY_MAX + 1];
+    // per-server key lists handed to memcached_mget (num_servers x batch_size)
+    const char** key_ptrs;
+    size_t* key_lens;
+    // number of keys of the current batch that go to the server
+    size_t* server_keys;
+};
+
+static void get_batch_init(struct get_batch* b, size_t num_servers, size_t batch_size)
+{
+    b->num_servers = num_servers;
+    b->batch_size = batch_size;
+    b->keys = (char(*)[KEY_MAX + 1])calloc(batch_size, sizeof(*b->keys));
+    b->key_ptrs = (const char**)calloc(num_servers * batch_size, sizeof(*b->key_ptrs));
+    b->key_lens = (size_t*)calloc(num_servers * batch_size, sizeof(*b->key_lens));
+    b->server_keys = (size_t*)calloc(num_servers, sizeof(*b->server_keys));
+    if (!b->keys || !b->key_ptrs || !b->key_lens || !b->server_keys) {
+        printf("failed to allocate memory for the get batch\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void get_batch_free(struct get_batch* b)
+{
+    free(b->server_keys);
+    free(b->key_lens);
+    free(b->key_ptrs);
+    free(b->keys);
+}
+
+// looks up the server's keys of the batch in its in-process table, returns the number found
+static size_t get_batch_inproc(struct get_batch* b, struct op_context* ctx, size_t s)
+{
+    size_t idx = s * b->batch_size;
+    size_t found = 0;
+    for (size_t i = 0; i < b->server_keys[s]; i++) {
+        uint32_t flags;
+        mc_buf_consume(&ctx->inproc_value, mc_buf_len(&ctx->inproc_value));
+        if (!store_get(&inproc_stores[s], b->key_ptrs[idx + i], b->key_lens[idx + i], &ctx->inproc_value, &flags)) {
+            continue;
+        }
+        if (near_cache_enabled()) {
+            uint64_t objid = item_key_objid(b->key_ptrs[idx + i], b->key_lens[idx + i]);
+            nearcache_put(&near_cache, objid, mc_buf_head(&ctx->inproc_value), mc_buf_len(&ctx->inproc_value),
+                timer_now());
+        }
+        ctx->load[s].bytes += mc_buf_len(&ctx->inproc_value);
+        found++;
+    }
+    return found;
+}
+
+/**
+ * Draws `n` operations and fetches the keys of all gets among them with one multi-get per server.
+ *
+ * Other operations of a mixed workload are executed one by one as they are drawn. The requests to
+ * all servers are sent out first and only then the responses are collected, so the servers process
+ * their part of the batch concurrently.
+ */
+static void get_batch_execute(struct get_batch* b, struct op_context* ctx, struct xor_shift* rand, size_t n)
+{
+    memcached_return_t rc;
+    memcached_st** memc = ctx->memc;
+
+    memset(b->server_keys, 0, b->num_servers * sizeof(*b->server_keys));
+
+    size_t num_gets = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t objid;
+        enum workload_op op = op_next(ctx, rand, &objid);
+        if (op != WORKLOAD_GET) {
+            op_execute(ctx, op, objid, 0);
+            continue;
+        }
+        op_trace(ctx, op, objid, 0);
+        uint64_t t_end;
+        if (near_cache_enabled() && op_near_cache_get(ctx, objid, timer_now(), &t_end)) {
+            continue;
+        }
+
+        char* key = b->keys[num_gets++];
+        size_t keylen = item_format_key(key, WORKLOAD_GET, objid);
+
+        size_t s = key_server(objid);
+        size_t idx = s * b->batch_size + b->server_keys[s]++;
+        b->key_ptrs[idx] = key;
+        b->key_lens[idx] = keylen;
+        ctx->load[s].bytes += keylen;
+    }
+
+    if (num_gets == 0) {
+        return;
+    }
+
+    // every key of the batch sees the latency until its server's responses are complete
+    uint64_t t_start = timer_now();
+
+    for (size_t s = 0; s < b->num_servers; s++) {
+        if (b->server_keys[s] == 0) {
+            continue;
+        }
+
+        ctx->load[s].requests += b->server_keys[s];
+        if (inproc_enabled()) {
+            continue;
+        }
+
+        size_t idx = s * b->batch_size;
+        rc = memcached_mget(memc[s], &b->key_ptrs[idx], &b->key_lens[idx], b->server_keys[s]);
+        if (memcached_failed(rc)) {
+            if (opt_verbose) {
+                printf("mget of %zu keys on server %zu = ERROR (%s)...\n", b->server_keys[s], s,
+                    memcached_strerror(memc[s], rc));
+            }
+            op_record(ctx, WORKLOAD_GET, s, timer_now() - t_start, OP_ERROR, b->server_keys[s]);
+            b->server_keys[s] = 0;
+        }
+    }
+
+    for (size_t s = 0; s < b->num_servers; s++) {
+        if (b->server_keys[s] == 0) {
+            continue;
+        }
+
+        size_t found = 0;
+        if (inproc_enabled()) {
+            found = get_batch_inproc(b, ctx, s);
+            rc = MEMCACHED_END;
+        }
+        memcached_result_st* result;
+        while (!inproc_enabled() && (result = memcached_fetch_result(memc[s], ctx->results[s], &rc)) != NULL) {
+            if (opt_verbose) {
+                printf("key %.*s = %.*s...\n", (int)memcached_result_key_length(result),
+                    memcached_result_key_value(result), (int)memcached_result_length(result),
+                    memcached_result_value(result));
+            }
+            if (near_cache_enabled()) {
+                uint64_t objid = item_key_objid(memcached_result_key_value(result), memcached_result_key_length(result));
+                nearcache_put(&near_cache, objid, memcached_result_value(result), memcached_result_length(result),
+                    timer_now());
+            }
+            ctx->load[s].bytes += memcached_result_length(result);
+            found++;
+        }
+
+        uint64_t latency = timer_now() - t_start;
+        op_record(ctx, WORKLOAD_GET, s, latency, OP_HIT, found);
+        if (rc == MEMCACHED_END || rc == MEMCACHED_NOTFOUND) {
+            // the keys the server did not return a value for
+            op_record(ctx, WORKLOAD_GET, s, latency, OP_MISS, b->server_keys[s] - found);
+        } else {
+            if (opt_verbose) {
+                printf("fetch on server %zu = ERROR (%s)...\n", s, memcached_strerror(memc[s], rc));
+            }
+            op_record(ctx, WORKLOAD_GET, s, latency, OP_ERROR, b->server_keys[s] - found);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Open-Loop Load
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the offered and achieved load of one step of the rate ramp, summed up over all threads
+struct rate_step {
+    // the offered load in operations per second
+    double rate;
+    size_t num_ops;
+    // operations that were due in the step but could not be sent before it ended
+    size_t num_dropped;
+    // the sum of the service times, i.e., without the time spent waiting for the send
+    uint64_t service_ticks;
+};
+
+static struct rate_step* rate_steps;
+static size_t num_rate_steps;
+// per-thread response time histograms of each step (num_threads x num_rate_steps)
+static struct histogram* rate_step_hist;
+
+static bool open_loop_enabled(void)
+{
+    return num_rate_steps > 0;
+}
+
+static void open_loop_init(void)
+{
+    if (opt_rate_ramp[1] > 0) {
+        num_rate_steps = (size_t)((opt_rate_ramp[1] - opt_rate_ramp[0]) / opt_rate_ramp[2]) + 1;
+    } else if (opt_target_rate > 0) {
+        num_rate_steps = 1;
+    } else {
+        return;
+    }
+
+    if (opt_rate_step_duration == 0) {
+        opt_rate_step_duration = opt_duration ? opt_duration : 3600 * 24;
+    }
+
+    rate_steps = (struct rate_step*)calloc(num_rate_steps, sizeof(*rate_steps));
+    rate_step_hist = (struct histogram*)calloc(opt_num_threads * num_rate_steps, sizeof(*rate_step_hist));
+    if (rate_steps == NULL || rate_step_hist == NULL) {
+        printf("ERROR: failed to allocate memory for the rate steps\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < num_rate_steps; i++) {
+        rate_steps[i].rate = opt_rate_ramp[1] > 0 ? opt_rate_ramp[0] + i * opt_rate_ramp[2] : opt_target_rate;
+    }
+    for (size_t i = 0; i < opt_num_threads * num_rate_steps; i++) {
+        histogram_init(&rate_step_hist[i]);
+    }
+}
+
+static void open_loop_wait_until(uint64_t t)
+{
+    for (;;) {
+        uint64_t now = timer_now();
+        if (now >= t) {
+            return;
+        }
+        // sleep through long gaps, spin through the last stretch to hit the send time
+        double remaining_ns = timer_ticks_to_ns(t - now);
+        if (remaining_ns > 200000) {
+            struct timespec ts = { 0, (long)(remaining_ns - 100000) };
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec = ts.tv_nsec / 1000000000L;
+                ts.tv_nsec %= 1000000000L;
+            }
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+/**
+ * Runs the benchmark phase open-loop: every thread sends its share of the offered load on a fixed
+ * or poisson schedule, independent of how fast the servers respond.
+ *
+ * Latencies are measured from the time an operation was scheduled to be sent, so a stalled server
+ * shows up as latency instead of silently lowering the offered load (coordinated omission).
+ * Operations still due when a step ends are dropped and counted. Returns the number of operations.
+ */
+static size_t open_loop_run(struct op_context* ctx, struct xor_shift* rand, size_t max_queries)
+{
+    struct histogram* hist = &rate_step_hist[ctx->tid * num_rate_steps];
+    uint64_t step_ticks = timer_ns_to_ticks(opt_rate_step_duration * 1e9);
+    uint64_t t_step = timer_now();
+    size_t query_counter = 0;
+
+    for (size_t step = 0; step < num_rate_steps && query_counter < max_queries; step++) {
+        // the mean time between two sends of this thread
+        double interval = timer_ns_to_ticks(1e9) * (double)coord_num_threads() / rate_steps[step].rate;
+        uint64_t t_end = t_step + step_ticks;
+        double t_next = (double)t_step;
+
+        size_t step_ops = 0;
+        uint64_t service_ticks = 0;
+
+        while (query_counter < max_queries) {
+            uint64_t t_intended = (uint64_t)t_next;
+            if (t_intended >= t_end || timer_now() >= t_end) {
+                break;
+            }
+            open_loop_wait_until(t_intended);
+
+            uint64_t objid;
+            enum workload_op op = op_next(ctx, rand, &objid);
+            uint64_t t_send = timer_now();
+            uint64_t t_done = op_execute(ctx, op, objid, t_intended);
+            histogram_record(&hist[step], t_done - t_intended);
+            service_ticks += t_done - t_send;
+
+            step_ops++;
+            query_counter++;
+
+            if (opt_arrival_poisson) {
+                t_next += -log(1.0 - xor_shift_next_double(rand)) * interval;
+            } else {
+                t_next += interval;
+            }
+        }
+
+        size_t dropped = 0;
+        if (t_next < (double)t_end) {
+            dropped = (size_t)(((double)t_end - t_next) / interval);
+        }
+
+        __atomic_fetch_add(&rate_steps[step].num_ops, step_ops, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&rate_steps[step].num_dropped, dropped, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&rate_steps[step].service_ticks, service_ticks, __ATOMIC_RELAXED);
+
+        if (opt_verbose) {
+            printf("thread:%03zu step %zu executed %zu queries (%zu dropped)\n", ctx->tid, step, step_ops, dropped);
+        }
+
+        // all threads move to the next rate at the same time
+        open_loop_wait_until(t_end);
+        t_step = t_end;
+    }
+
+    return query_counter;
+}
+
+/**
+ * Prints the throughput-latency curve of the rate ramp. The knee is the first step in which the
+ * servers did not keep up with the offered load.
+ */
+static void open_loop_report(void)
+{
+    struct histogram h;
+
+    printf("benchmark open-loop (%s arrivals, %zu s per step)\n", opt_arrival_poisson ? "poisson" : "fixed",
+        opt_rate_step_duration);
+    printf("  %4s %14s %14s %12s %12s %10s %10s %10s %10s %10s\n", "step", "offered/s", "achieved/s",
+        "dropped", "service us", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+
+    ssize_t knee = -1;
+    for (size_t step = 0; step < num_rate_steps; step++) {
+        histogram_init(&h);
+        for (size_t tid = 0; tid < opt_num_threads; tid++) {
+            histogram_merge(&h, &rate_step_hist[tid * num_rate_steps + step]);
+        }
+
+        const struct rate_step* rs = &rate_steps[step];
+        double achieved = (double)rs->num_ops / opt_rate_step_duration;
+        double service_us = rs->num_ops ? timer_ticks_to_ns(rs->service_ticks / rs->num_ops) / 1000.0 : 0.0;
+        printf("  %4zu %14.0f %14.0f %12zu %12.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", step, rs->rate,
+            achieved, rs->num_dropped, service_us,
+            timer_ticks_to_ns(histogram_percentile(&h, 50.0)) / 1000.0,
+            timer_ticks_to_ns(histogram_percentile(&h, 90.0)) / 1000.0,
+            timer_ticks_to_ns(histogram_percentile(&h, 99.0)) / 1000.0,
+            timer_ticks_to_ns(histogram_percentile(&h, 99.9)) / 1000.0,
+            timer_ticks_to_ns(h.max) / 1000.0);
+
+        // saturated: the load was not delivered, or requests mostly wait instead of being served
+        double p50_us = timer_ticks_to_ns(histogram_percentile(&h, 50.0)) / 1000.0;
+        if (knee < 0 && (rs->num_dropped > rs->num_ops / 100 || achieved < 0.95 * rs->rate
+                || p50_us > 4 * service_us)) {
+            knee = step;
+        }
+    }
+
+    if (knee >= 0) {
+        printf("benchmark saturated at step %zd (offered %.0f ops/s)\n", knee, rate_steps[knee].rate);
+    } else {
+        printf("benchmark did not saturate\n");
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Trace Replay
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Replays the trace in place of the workload.
+ *
+ * Every thread streams through the whole trace and executes the records whose key falls into its
+ * share of the key space, so the operations on a key keep their order. The keys of the trace are
+ * folded into the populated object ids. With the original timing a record is sent at its time in
+ * the trace and its latency counts from then, fast replay sends the records back to back.
+ */
+static size_t trace_replay_run(struct op_context* ctx, size_t max_queries)
+{
+    struct trace_reader r;
+    if (!trace_reader_open(&r, opt_trace_replay)) {
+        printf("thread:%lu failed to open the trace %s (%s)\n", ctx->tid, opt_trace_replay, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // the values of the trace's writes, as large as the largest one or the configured value size
+    size_t value_max = r.header.max_value_size < VALUE_MAX ? r.header.max_value_size : VALUE_MAX;
+    size_t value_cap = value_max > opt_value_size.max ? value_max : opt_value_size.max;
+    char* values = (char*)calloc(1, value_cap > VALUE_PREFIX_SIZE + 16 ? value_cap : VALUE_PREFIX_SIZE + 16);
+    if (values == NULL) {
+        printf("thread:%lu failed to allocate memory for the trace's values\n", ctx->tid);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(values, VALUE_PREFIX, VALUE_PREFIX_SIZE);
+    char* workload_values = ctx->value;
+    ctx->value = values;
+
+    uint64_t t_start = timer_now();
+    uint64_t t_stop = opt_duration ? t_start + timer_ns_to_ticks(opt_duration * 1e9) : UINT64_MAX;
+    uint64_t late_ticks = timer_ns_to_ticks(TRACE_LATE_NS);
+    uint64_t late = 0, lag_ticks = 0, lag_max = 0;
+    size_t query_counter = 0;
+
+    const struct trace_record* rec;
+    for (uint64_t i = 0; query_counter < max_queries && (rec = trace_reader_get(&r, i)) != NULL; i++) {
+        uint64_t objid = rec->key % key_dist.num_keys;
+        if (objid % coord_num_threads() != coord_thread_id(ctx->tid) || trace_record_op(rec) >= TRACE_OP_MAX) {
+            continue;
+        }
+
+        uint64_t t_intended = 0;
+        if (opt_trace_timing == TRACE_TIMING_ORIGINAL) {
+            t_intended = t_start + timer_ns_to_ticks(rec->time_ns / opt_trace_speed);
+            if (t_intended >= t_stop) {
+                break;
+            }
+            open_loop_wait_until(t_intended);
+            uint64_t lag = timer_now() - t_intended;
+            late += lag > late_ticks;
+            lag_ticks += lag;
+            lag_max = lag > lag_max ? lag : lag_max;
+        } else if ((query_counter & 127) == 0 && timer_now() >= t_stop) {
+            break;
+        }
+
+        ctx->value_size = trace_record_value_size(rec) < value_max ? trace_record_value_size(rec) : value_max;
+        ctx->expires = rec->ttl;
+        op_execute(ctx, trace_workload_op(trace_record_op(rec)), objid, t_intended);
+        query_counter++;
+    }
+
+    ctx->value = workload_values;
+    ctx->value_size = 0;
+    ctx->expires = 0;
+    free(values);
+    trace_reader_close(&r);
+
+    __atomic_fetch_add(&trace_replayed, query_counter, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&trace_late, late, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&trace_lag_ticks, lag_ticks, __ATOMIC_RELAXED);
+    uint64_t prev = __atomic_load_n(&trace_lag_max, __ATOMIC_RELAXED);
+    while (lag_max > prev && !__atomic_compare_exchange_n(&trace_lag_max, &prev, lag_max, false, __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED)) {
+    }
+    return query_counter;
+}
+
+static void trace_report(void)
+{
+    if (trace_replay_enabled()) {
+        printf("benchmark trace replay: %lu of %lu records (%.1f%%)\n", trace_replayed,
+            trace_replay_header.num_records, 100.0 * trace_replayed / trace_replay_header.num_records);
+        if (opt_trace_timing == TRACE_TIMING_ORIGINAL && trace_replayed > 0) {
+            printf("benchmark trace replay: %lu records (%.2f%%) sent over %.1f ms late, mean lag %.1f us, "
+                "max %.1f us\n", trace_late, 100.0 * trace_late / trace_replayed, TRACE_LATE_NS / 1e6,
+                timer_ticks_to_ns(trace_lag_ticks) / trace_replayed / 1e3, timer_ticks_to_ns(trace_lag_max) / 1e3);
+        }
+    }
+    trace_finish();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Native Connections
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the opaque value of binary requests whose response is dropped (quiet commands report failures)
+#define NATIVE_OPAQUE_QUIET 0xffffffffU
+
+// the initial size of the per-connection protocol buffers
+#define NATIVE_BUFFER_SIZE (16 << 10)
+
+// the system calls the native engines made on the request path, summed up over all threads
+static uint64_t native_syscalls = 0;
+
+static const char* engine_name(enum engine_kind engine)
+{
+    switch (engine) {
+    case ENGINE_LIBMEMCACHED:
+        return "libmemcached";
+    case ENGINE_EPOLL:
+        return "epoll";
+    case ENGINE_IO_URING:
+        return "io_uring";
+    }
+    return "unknown";
+}
+
+/**
+ * Opens a socket connection to the server, optionally in non-blocking mode. Returns -1 on failure,
+ * shared memory servers have no socket.
+ */
+static int native_connect(size_t server, bool nonblock)
+{
+    int fd = -1;
+
+    if (opt_server_info.servers[server].transport == SERVER_SHM) {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    } else if (opt_server_info.servers[server].transport == SERVER_UNIX) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, opt_server_info.servers[server].ux.path, sizeof(addr.sun_path) - 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+    } else {
+        char port[16];
+        snprintf(port, sizeof(port), "%u", opt_server_info.servers[server].tcp.port);
+
+        struct addrinfo hints, *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(opt_server_info.servers[server].tcp.hostname, port, &hints, &res) != 0) {
+            return -1;
+        }
+        for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                break;
+            }
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        if (fd < 0) {
+            return -1;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    if (nonblock) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return fd;
+}
+
+// a request that has been queued on a connection and waits for its response
+struct native_request {
+    enum workload_op op;
+    enum mc_req req;
+    uint64_t objid;
+    uint64_t t_start;
+};
+
+/**
+ * A native connection to a server with its protocol buffers and the requests in flight.
+ */
+struct native_conn {
+    int fd;
+    // the channel to a shm:// server, which has no socket (fd is -1)
+    struct shmring_conn shm;
+    size_t server;
+    // responses received but not yet parsed
+    struct mc_buf rbuf;
+    // requests encoded but not yet sent
+    struct mc_buf wbuf;
+    // ring of the requests in flight, in the order they were sent
+    struct native_request* inflight;
+    size_t head;
+    size_t count;
+    size_t cap;
+    // whether the connection is on the engine's flush list
+    bool dirty;
+    // whether the engine waits for the socket to become writable
+    bool want_out;
+    // the reads and writes issued on the socket
+    uint64_t syscalls;
+};
+
+static void native_conn_init(struct native_conn* c, size_t server, int fd)
+{
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->server = server;
+    mc_buf_init(&c->rbuf, NATIVE_BUFFER_SIZE);
+    mc_buf_init(&c->wbuf, NATIVE_BUFFER_SIZE);
+    c->cap = opt_pipeline_depth * 2;
+    c->inflight = (struct native_request*)calloc(c->cap, sizeof(*c->inflight));
+    if (c->inflight == NULL) {
+        printf("failed to allocate memory for the requests in flight\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Connects the connection to the server over its transport. Returns false on failure.
+ */
+static bool native_conn_open(struct native_conn* c, size_t server, bool nonblock)
+{
+    if (opt_server_info.servers[server].transport == SERVER_SHM) {
+        struct shmring_conn shm;
+        if (!shmring_connect(&shm, opt_server_info.servers[server].shm.name)) {
+            return false;
+        }
+        native_conn_init(c, server, -1);
+        c->shm = shm;
+        return true;
+    }
+
+    int fd = native_connect(server, nonblock);
+    if (fd < 0) {
+        return false;
+    }
+    native_conn_init(c, server, fd);
+    return true;
+}
+
+static bool native_conn_is_shm(const struct native_conn* c)
+{
+    return c->shm.seg != NULL;
+}
+
+static void native_conn_free(struct native_conn* c)
+{
+    if (native_conn_is_shm(c)) {
+        shmring_disconnect(&c->shm);
+    } else {
+        close(c->fd);
+    }
+    mc_buf_free(&c->rbuf);
+    mc_buf_free(&c->wbuf);
+    free(c->inflight);
+}
+
+static void native_conn_push(struct native_conn* c, const struct native_request* r)
+{
+    if (c->count == c->cap) {
+        // grow the ring, unwrapping it into the new array
+        struct native_request* inflight = (struct native_request*)calloc(c->cap * 2, sizeof(*inflight));
+        if (inflight == NULL) {
+            printf("failed to allocate memory for the requests in flight\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < c->count; i++) {
+            inflight[i] = c->inflight[(c->head + i) % c->cap];
+        }
+        free(c->inflight);
+        c->inflight = inflight;
+        c->head = 0;
+        c->cap *= 2;
+    }
+    c->inflight[(c->head + c->count) % c->cap] = *r;
+    c->count++;
+}
+
+static struct native_request* native_conn_front(struct native_conn* c)
+{
+    return &c->inflight[c->head];
+}
+
+static void native_conn_pop(struct native_conn* c)
+{
+    c->head = (c->head + 1) % c->cap;
+    c->count--;
+}
+
+static enum mc_req native_request_kind(enum workload_op op)
+{
+    switch (op) {
+    case WORKLOAD_GET:
+        return MC_REQ_GET;
+    case WORKLOAD_SET:
+    case WORKLOAD_INSERT:
+        return MC_REQ_SET;
+    case WORKLOAD_DELETE:
+        return MC_REQ_DELETE;
+    case WORKLOAD_INCR:
+        return MC_REQ_INCR;
+    case WORKLOAD_DECR:
+        return MC_REQ_DECR;
+    case WORKLOAD_APPEND:
+        return MC_REQ_APPEND;
+    default:
+        // read-modify-writes need two round trips, main() rejects them for the native engines
+        abort();
+    }
+}
+
+/**
+ * Encodes the operation into the connection's write buffer and records it as in flight.
+ */
+static void native_encode(struct native_conn* c, struct op_context* ctx, enum workload_op op, uint64_t objid)
+{
+    char key[KEY_MAX + 1];
+    size_t keylen = item_format_key(key, op, objid);
+
+    const char* v = NULL;
+    size_t vlen = 0;
+    if (op == WORKLOAD_SET || op == WORKLOAD_INSERT) {
+        v = ctx->value;
+        vlen = item_format_value(ctx->value, objid);
+    } else if (op == WORKLOAD_APPEND) {
+        v = APPEND_SUFFIX;
+        vlen = APPEND_SIZE;
+    }
+
+    struct native_request r;
+    r.op = op;
+    r.req = native_request_kind(op);
+    r.objid = objid;
+    r.t_start = timer_now();
+    op_trace(ctx, op, objid, r.t_start);
+
+    mc_encode_request(&c->wbuf, opt_binary, r.req, key, keylen, v, vlen, 0);
+    native_conn_push(c, &r);
+
+    ctx->load[c->server].requests++;
+    ctx->load[c->server].bytes += keylen + vlen;
+}
+
+/**
+ * Parses all complete responses in the connection's read buffer and records their outcome.
+ * Returns the number of requests completed, or -1 if the server sent garbage.
+ */
+static ssize_t native_complete(struct native_conn* c, struct op_context* ctx)
+{
+    ssize_t completed = 0;
+
+    while (mc_buf_len(&c->rbuf) > 0) {
+        // in ascii mode nothing but the requests in flight is answered
+        if (c->count == 0 && !opt_binary) {
+            return -1;
+        }
+
+        struct mc_response resp;
+        enum mc_req req = c->count ? native_conn_front(c)->req : MC_REQ_ADD_QUIET;
+        int rv = mc_parse_response(mc_buf_head(&c->rbuf), mc_buf_len(&c->rbuf), opt_binary, req, &resp);
+        if (rv == MC_PARSE_INCOMPLETE) {
+            break;
+        }
+        if (rv == MC_PARSE_ERROR) {
+            return -1;
+        }
+
+        if (opt_binary && resp.opaque == NATIVE_OPAQUE_QUIET) {
+            // the failure of a quiet add, e.g. another thread created the counter first
+            mc_buf_consume(&c->rbuf, resp.len);
+            continue;
+        }
+        if (c->count == 0) {
+            return -1;
+        }
+
+        struct native_request* r = native_conn_front(c);
+        uint64_t latency = timer_now() - r->t_start;
+
+        enum op_result result = resp.status == MC_STATUS_HIT ? OP_HIT
+            : resp.status == MC_STATUS_MISS                  ? OP_MISS
+                                                             : OP_ERROR;
+        if (r->req == MC_REQ_GET && result == OP_HIT) {
+            ctx->load[c->server].bytes += resp.value_len;
+        }
+        if (r->op == WORKLOAD_INSERT && result == OP_HIT) {
+            keydist_inserted(&key_dist, r->objid);
+        }
+        if ((r->req == MC_REQ_INCR || r->req == MC_REQ_DECR) && result == OP_MISS) {
+            // create the counter, the operation still counts as a miss
+            char key[KEY_MAX + 1];
+            size_t keylen = item_format_key(key, r->op, r->objid);
+            mc_encode_request(&c->wbuf, opt_binary, MC_REQ_ADD_QUIET, key, keylen, "0", 1, NATIVE_OPAQUE_QUIET);
+        }
+        if (opt_verbose && result != OP_HIT) {
+            printf("thread:%lu %s %08lx = %s...\n", ctx->tid, workload_op_names[r->op], r->objid,
+                result == OP_MISS ? "NOT_FOUND" : "ERROR");
+        }
+
+        op_record(ctx, r->op, c->server, latency, result, 1);
+
+        mc_buf_consume(&c->rbuf, resp.len);
+        native_conn_pop(c);
+        completed++;
+    }
+
+    return completed;
+}
+
+/**
+ * Reads everything that is available on the connection. Returns false if it was closed or failed.
+ */
+static bool native_read(struct native_conn* c)
+{
+    if (native_conn_is_shm(c)) {
+        while (shmring_readable(&c->shm) > 0) {
+            char* p = mc_buf_reserve(&c->rbuf, NATIVE_BUFFER_SIZE / 2);
+            mc_buf_commit(&c->rbuf, shmring_read(&c->shm, p, c->rbuf.cap - c->rbuf.end));
+        }
+        return !shmring_closed(&c->shm);
+    }
+
+    for (;;) {
+        char* p = mc_buf_reserve(&c->rbuf, NATIVE_BUFFER_SIZE / 2);
+        c->syscalls++;
+        ssize_t n = recv(c->fd, p, c->rbuf.cap - c->rbuf.end, 0);
+        if (n > 0) {
+            mc_buf_commit(&c->rbuf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return false;
+    }
+}
+
+/**
+ * Writes as much of the queued requests as the socket takes. Returns false if the write failed,
+ * sets `want_out` if data is left over.
+ */
+static bool native_flush(struct native_conn* c)
+{
+    if (native_conn_is_shm(c)) {
+        size_t n = shmring_write(&c->shm, mc_buf_head(&c->wbuf), mc_buf_len(&c->wbuf));
+        mc_buf_consume(&c->wbuf, n);
+        // the server only needs waking if it went to sleep
+        c->syscalls += n > 0 && shmring_notify(c->shm.tx_bell);
+        c->want_out = mc_buf_len(&c->wbuf) > 0;
+        return !shmring_closed(&c->shm);
+    }
+
+    while (mc_buf_len(&c->wbuf) > 0) {
+        c->syscalls++;
+        ssize_t n = send(c->fd, mc_buf_head(&c->wbuf), mc_buf_len(&c->wbuf), MSG_NOSIGNAL);
+        if (n > 0) {
+            mc_buf_consume(&c->wbuf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            c->want_out = true;
+            return true;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return false;
+    }
+    c->want_out = false;
+    return true;
+}
+
+/**
+ * Writes all queued requests on a blocking connection. A ring takes them in parts as the server
+ * consumes them, its responses are read meanwhile so it never stalls on a full response ring.
+ */
+static bool native_flush_all(struct native_conn* c)
+{
+    for (;;) {
+        if (!native_flush(c)) {
+            return false;
+        }
+        if (!c->want_out) {
+            return true;
+        }
+        if (!native_read(c)) {
+            return false;
+        }
+        shmring_pause();
+    }
+}
+
+/**
+ * Waits for more data on a blocking connection and reads it. Returns false if it was closed or
+ * failed.
+ */
+static bool native_receive(struct native_conn* c)
+{
+    if (native_conn_is_shm(c)) {
+        while (shmring_readable(&c->shm) == 0 && !shmring_closed(&c->shm)) {
+            c->syscalls += shmring_wait(&c->shm, opt_shm_wait, 100000000);
+        }
+        return native_read(c) || shmring_readable(&c->shm) > 0;
+    }
+
+    for (;;) {
+        char* p = mc_buf_reserve(&c->rbuf, NATIVE_BUFFER_SIZE / 2);
+        c->syscalls++;
+        ssize_t n = recv(c->fd, p, c->rbuf.cap - c->rbuf.end, 0);
+        if (n > 0) {
+            mc_buf_commit(&c->rbuf, n);
+            return true;
+        }
+        if (!(n < 0 && errno == EINTR)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * The connections of one thread, opt_conns_per_server per server, grouped by server.
+ */
+struct native_pool {
+    size_t num_conns;
+    struct native_conn* conns;
+    // the connection of each server the next request goes to
+    size_t* next_conn;
+    // connections with queued requests that have not been flushed yet
+    struct native_conn** dirty;
+    size_t num_dirty;
+    // the connections to shm:// servers, which are polled instead of waited for
+    size_t num_shm;
+    // system calls made by the engine itself, e.g. to wait for events
+    uint64_t syscalls;
+};
+
+static void native_pool_init(struct native_pool* p, uint64_t tid, bool nonblock)
+{
+    memset(p, 0, sizeof(*p));
+    p->num_conns = opt_server_info.num_servers * opt_conns_per_server;
+    p->conns = (struct native_conn*)calloc(p->num_conns, sizeof(*p->conns));
+    p->next_conn = (size_t*)calloc(opt_server_info.num_servers, sizeof(*p->next_conn));
+    p->dirty = (struct native_conn**)calloc(p->num_conns, sizeof(*p->dirty));
+    if (p->conns == NULL || p->next_conn == NULL || p->dirty == NULL) {
+        printf("thread:%lu failed to allocate memory for the connections\n", tid);
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < p->num_conns; i++) {
+        size_t server = i / opt_conns_per_server;
+        if (!native_conn_open(&p->conns[i], server, nonblock)) {
+            printf("thread:%lu failed to connect to server %zu (%s)\n", tid, server, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        p->num_shm += native_conn_is_shm(&p->conns[i]);
+    }
+}
+
+static void native_pool_free(struct native_pool* p)
+{
+    for (size_t i = 0; i < p->num_conns; i++) {
+        p->syscalls += p->conns[i].syscalls;
+        native_conn_free(&p->conns[i]);
+    }
+    __atomic_fetch_add(&native_syscalls, p->syscalls, __ATOMIC_RELAXED);
+    free(p->dirty);
+    free(p->next_conn);
+    free(p->conns);
+}
+
+static void native_pool_mark_dirty(struct native_pool* p, struct native_conn* c)
+{
+    if (!c->dirty) {
+        c->dirty = true;
+        p->dirty[p->num_dirty++] = c;
+    }
+}
+
+// draws the next operation and queues it on a connection to the server of its key
+static void native_pool_issue(struct native_pool* p, struct op_context* ctx, struct xor_shift* rand)
+{
+    uint64_t objid;
+    enum workload_op op = op_next(ctx, rand, &objid);
+    size_t server = key_server(objid);
+
+    size_t idx = p->next_conn[server];
+    p->next_conn[server] = (idx + 1) % opt_conns_per_server;
+    struct native_conn* c = &p->conns[server * opt_conns_per_server + idx];
+
+    native_encode(c, ctx, op, objid);
+    native_pool_mark_dirty(p, c);
+}
+
+// opens the blocking connections hedged gets race on, one per server
+static void native_replica_connect(struct replica_thread* rt, uint64_t tid)
+{
+    if (rt == NULL || opt_read_policy != REPLICA_HEDGED) {
+        return;
+    }
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        int fd = native_connect(i, false);
+        if (fd < 0) {
+            printf("thread:%lu failed to connect to server %zu for hedged gets (%s)\n", tid, i, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        replica_conn_init(&rt->conns[i], fd);
+    }
+    // the default 50 us of timer slack would stretch every hedge delay past the service times
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+}
+
+/**
+ * The stop condition and periodic progress output shared by the native engines.
+ */
+struct native_progress {
+    uint64_t t_stop;
+    uint64_t t_print;
+    uint64_t t_interval;
+    size_t interval_completed;
+};
+
+static void native_progress_init(struct native_progress* pr)
+{
+    uint64_t t_now = timer_now();
+    pr->t_stop = t_now + timer_ns_to_ticks((opt_duration ? opt_duration : 3600 * 24) * 1e9);
+    pr->t_print = t_now + timer_ns_to_ticks(PERIODIC_PRINT_INTERVAL * 1e9);
+    pr->t_interval = t_now;
+    pr->interval_completed = 0;
+}
+
+// prints the throughput of the last interval when it is due, returns false once the run is over
+static bool native_progress_update(struct native_progress* pr, struct op_context* ctx)
+{
+    uint64_t t_now = timer_now();
+    if (t_now >= pr->t_print) {
+        printf("thread:%03zu executed %lu queries in %lu ms\n", ctx->tid, pr->interval_completed,
+            (uint64_t)(timer_ticks_to_ns(t_now - pr->t_interval) / 1000000));
+        pr->t_interval = t_now;
+        pr->t_print = t_now + timer_ns_to_ticks(PERIODIC_PRINT_INTERVAL * 1e9);
+        pr->interval_completed = 0;
+    }
+    return t_now < pr->t_stop;
+}
+
+static void native_report(size_t num_queries)
+{
+    printf("benchmark %s engine: %lu system calls on the request path, %.3f per query\n",
+        engine_name(opt_engine), native_syscalls, num_queries ? (double)native_syscalls / num_queries : 0.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Server Stats
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the operations a thread completed per server followed by the near cache, on cache lines of its own
+struct server_stats_progress {
+    uint64_t ops[SERVER_MAX + 1];
+} __attribute__((aligned(64)));
+
+static struct server_stats_progress* server_stats_progress;
+// the sampler's connection to every server, -1 once it failed
+static int server_stats_fds[SERVER_MAX];
+// the samples at the start of the benchmark phase and at its end
+static struct mcstats server_stats_first[SERVER_MAX];
+static struct mcstats server_stats_last[SERVER_MAX];
+static uint64_t server_stats_t_first;
+static uint64_t server_stats_t_last;
+// the interval with the lowest client throughput, and what the servers did in it
+static double server_stats_dip_t = -1.0;
+static double server_stats_dip_ops = 0.0;
+static struct mcstats server_stats_dip_prev[SERVER_MAX];
+static struct mcstats server_stats_dip_cur[SERVER_MAX];
+static double server_stats_dip_seconds = 0.0;
+
+static pthread_t server_stats_thread;
+static bool server_stats_stopping = false;
+static FILE* server_stats_out;
+static char* server_stats_buf;
+
+static bool server_stats_enabled(void)
+{
+    return opt_server_stats > 0;
+}
+
+// allocates the progress counters of the threads, before they start
+static void server_stats_init(void)
+{
+    if (!server_stats_enabled()) {
+        return;
+    }
+    size_t size = opt_num_threads * sizeof(*server_stats_progress);
+    server_stats_progress = (struct server_stats_progress*)aligned_alloc(64, size);
+    server_stats_buf = (char*)malloc(MCSTATS_RESPONSE_MAX);
+    if (server_stats_progress == NULL || server_stats_buf == NULL) {
+        printf("ERROR: failed to allocate memory for the server stats\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(server_stats_progress, 0, size);
+}
+
+static uint64_t* server_stats_thread_progress(uint64_t tid)
+{
+    return server_stats_enabled() ? server_stats_progress[tid].ops : NULL;
+}
+
+// sums up the operations the threads completed per server, the near cache in the last slot
+static void server_stats_client_ops(uint64_t* ops)
+{
+    memset(ops, 0, (SERVER_MAX + 1) * sizeof(*ops));
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        for (size_t i = 0; i <= opt_server_info.num_servers; i++) {
+            ops[i] += __atomic_load_n(&server_stats_progress[tid].ops[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// samples every server still connected, a server that fails is dropped from the sampling
+static void server_stats_sample(struct mcstats* samples)
+{
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        if (server_stats_fds[i] < 0) {
+            memset(&samples[i], 0, sizeof(samples[i]));
+            continue;
+        }
+        if (!mcstats_sample(server_stats_fds[i], &samples[i], server_stats_buf, MCSTATS_RESPONSE_MAX)) {
+            char name[128];
+            server_name(i, name, sizeof(name));
+            printf("server stats: lost the connection to %s\n", name);
+            close(server_stats_fds[i]);
+            server_stats_fds[i] = -1;
+        }
+    }
+}
+
+static void server_stats_header(void)
+{
+    fputs("t_s,server,client_ops_per_s,client_total_ops_per_s", server_stats_out);
+    for (int f = 0; f < MCSTATS_MAX; f++) {
+        const char* suffix = mcstats_defs[f].kind == MCSTATS_COUNTER ? "_per_s"
+            : mcstats_defs[f].kind == MCSTATS_SECONDS                ? "_pct"
+                                                                     : "";
+        fprintf(server_stats_out, ",%s%s", mcstats_defs[f].name, suffix);
+    }
+    fputc('\n', server_stats_out);
+}
+
+// formats the field of the interval, "-" if the server does not report it
+static const char* server_stats_format(char* buf, size_t len, const struct mcstats* prev, const struct mcstats* cur,
+    enum mcstats_field f, double seconds)
+{
+    double value = 0.0;
+    if (!mcstats_interval(prev, cur, f, seconds, &value)) {
+        return "-";
+    }
+    snprintf(buf, len, mcstats_defs[f].kind == MCSTATS_SECONDS ? "%.1f" : "%.0f", value);
+    return buf;
+}
+
+// formats the user and system CPU time of the interval as a percentage of one core
+static const char* server_stats_format_cpu(char* buf, size_t len, const struct mcstats* prev,
+    const struct mcstats* cur, double seconds)
+{
+    double user = 0.0, system = 0.0;
+    if (!mcstats_interval(prev, cur, MCSTATS_RUSAGE_USER, seconds, &user)
+        || !mcstats_interval(prev, cur, MCSTATS_RUSAGE_SYSTEM, seconds, &system)) {
+        return "-";
+    }
+    snprintf(buf, len, "%.1f", user + system);
+    return buf;
+}
+
+/**
+ * Writes one row per server for the interval ending `t` seconds into the benchmark phase: the
+ * client's throughput to the server and overall, next to the server's own view of the interval.
+ */
+static void server_stats_interval(double t, double seconds, const uint64_t* prev_ops, const uint64_t* ops,
+    const struct mcstats* prev, const struct mcstats* cur)
+{
+    double total = 0.0;
+    for (size_t i = 0; i <= opt_server_info.num_servers; i++) {
+        total += seconds > 0 ? (ops[i] - prev_ops[i]) / seconds : 0.0;
+    }
+
+    char a[32], b[32], c[32], d[32], e[32];
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        double client = seconds > 0 ? (ops[i] - prev_ops[i]) / seconds : 0.0;
+        printf("server stats: %6.1f s server %zu client %9.0f ops/s | get_hits %9s/s evictions %7s/s conns %5s "
+               "conn_yields %6s/s cpu %6s%%\n", t, i, client,
+            server_stats_format(a, sizeof(a), &prev[i], &cur[i], MCSTATS_GET_HITS, seconds),
+            server_stats_format(b, sizeof(b), &prev[i], &cur[i], MCSTATS_EVICTIONS, seconds),
+            server_stats_format(c, sizeof(c), &prev[i], &cur[i], MCSTATS_CURR_CONNECTIONS, seconds),
+            server_stats_format(d, sizeof(d), &prev[i], &cur[i], MCSTATS_CONN_YIELDS, seconds),
+            server_stats_format_cpu(e, sizeof(e), &prev[i], &cur[i], seconds));
+
+        if (server_stats_out == NULL) {
+            continue;
+        }
+        fprintf(server_stats_out, "%.3f,%zu,%.1f,%.1f", t, i, client, total);
+        for (int f = 0; f < MCSTATS_MAX; f++) {
+            const char* v = server_stats_format(a, sizeof(a), &prev[i], &cur[i], (enum mcstats_field)f, seconds);
+            fprintf(server_stats_out, ",%s", strcmp(v, "-") == 0 ? "" : v);
+        }
+        fputc('\n', server_stats_out);
+    }
+
+    // a partial last interval is too short to compare
+    if (seconds >= opt_server_stats / 2000.0 && (server_stats_dip_t < 0 || total < server_stats_dip_ops)) {
+        server_stats_dip_t = t;
+        server_stats_dip_ops = total;
+        server_stats_dip_seconds = seconds;
+        memcpy(server_stats_dip_prev, prev, sizeof(server_stats_dip_prev));
+        memcpy(server_stats_dip_cur, cur, sizeof(server_stats_dip_cur));
+    }
+}
+
+/**
+ * The sampler thread: samples the servers every interval until the benchmark phase ends, and once
+ * more at the end so the last partial interval is covered too.
+ */
+static void* server_stats_main(void* arg)
+{
+    (void)arg;
+    uint64_t interval = opt_server_stats * 1000000UL;
+    uint64_t t_prev = server_stats_t_first;
+    uint64_t prev_ops[SERVER_MAX + 1];
+    uint64_t ops[SERVER_MAX + 1];
+    struct mcstats prev[SERVER_MAX];
+    struct mcstats cur[SERVER_MAX];
+    memset(prev_ops, 0, sizeof(prev_ops));
+    memcpy(prev, server_stats_first, sizeof(prev));
+
+    bool stopping = false;
+    for (uint64_t t_next = t_prev + interval; !stopping; t_next += interval) {
+        // sleep in short steps so the end of the benchmark does not wait for a full interval
+        uint64_t t_now;
+        while ((t_now = timer_monotonic_ns()) < t_next
+            && !(stopping = __atomic_load_n(&server_stats_stopping, __ATOMIC_ACQUIRE))) {
+            uint64_t sleep_ns = t_next - t_now < 10000000UL ? t_next - t_now : 10000000UL;
+            usleep(sleep_ns / 1000 + 1);
+        }
+
+        server_stats_client_ops(ops);
+        server_stats_sample(cur);
+        t_now = timer_monotonic_ns();
+        server_stats_interval((t_now - server_stats_t_first) / 1e9, (t_now - t_prev) / 1e9, prev_ops, ops, prev, cur);
+
+        t_prev = t_now;
+        memcpy(prev_ops, ops, sizeof(prev_ops));
+        memcpy(prev, cur, sizeof(prev));
+    }
+
+    server_stats_t_last = t_prev;
+    memcpy(server_stats_last, prev, sizeof(server_stats_last));
+    return NULL;
+}
+
+/**
+ * Connects to the servers, takes the first sample and starts the sampler, right before the
+ * benchmark phase. The sampler's connection adds one to every server's curr_connections.
+ */
+static void server_stats_start(void)
+{
+    if (!server_stats_enabled()) {
+        return;
+    }
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        server_stats_fds[i] = native_connect(i, false);
+        if (server_stats_fds[i] < 0) {
+            char name[128];
+            server_name(i, name, sizeof(name));
+            printf("server stats: failed to connect to %s (%s)\n", name, strerror(errno));
+            continue;
+        }
+        // a server that stops answering must not stall the benchmark's end
+        struct timeval timeout = { 1, 0 };
+        setsockopt(server_stats_fds[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    if (opt_server_stats_file != NULL) {
+        server_stats_out = fopen(opt_server_stats_file, "w");
+        if (server_stats_out == NULL) {
+            printf("server stats: failed to open %s (%s)\n", opt_server_stats_file, strerror(errno));
+        } else {
+            server_stats_header();
+        }
+    }
+
+    server_stats_sample(server_stats_first);
+    server_stats_t_first = timer_monotonic_ns();
+    if (pthread_create(&server_stats_thread, NULL, server_stats_main, NULL) != 0) {
+        printf("ERROR: failed to create the server stats thread!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// stops the sampler at the end of the benchmark phase
+static void server_stats_stop(void)
+{
+    if (!server_stats_enabled()) {
+        return;
+    }
+    __atomic_store_n(&server_stats_stopping, true, __ATOMIC_RELEASE);
+    pthread_join(server_stats_thread, NULL);
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        if (server_stats_fds[i] >= 0) {
+            close(server_stats_fds[i]);
+        }
+    }
+    if (server_stats_out != NULL) {
+        fclose(server_stats_out);
+    }
+}
+
+/**
+ * Prints each server's view of the whole benchmark phase, and the servers in the interval with
+ * the lowest client throughput: conn_yields or evictions rising there point at the cause of a dip.
+ */
+static void server_stats_report(void)
+{
+    if (!server_stats_enabled()) {
+        return;
+    }
+
+    double seconds = (server_stats_t_last - server_stats_t_first) / 1e9;
+    char a[32], b[32], c[32], d[32], e[32], g[32];
+    printf("benchmark server stats over %.1f s %15s %12s %12s %12s %12s %8s\n", seconds, "cmd_get/s", "get_hits/s",
+        "evictions/s", "conn_yields/s", "conns", "cpu%");
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        char name[128];
+        server_name(i, name, sizeof(name));
+        const struct mcstats* first = &server_stats_first[i];
+        const struct mcstats* last = &server_stats_last[i];
+        printf("  server %zu %-30s %12s %12s %12s %12s %12s %8s\n", i, name,
+            server_stats_format(a, sizeof(a), first, last, MCSTATS_CMD_GET, seconds),
+            server_stats_format(b, sizeof(b), first, last, MCSTATS_GET_HITS, seconds),
+            server_stats_format(c, sizeof(c), first, last, MCSTATS_EVICTIONS, seconds),
+            server_stats_format(d, sizeof(d), first, last, MCSTATS_CONN_YIELDS, seconds),
+            server_stats_format(e, sizeof(e), first, last, MCSTATS_CURR_CONNECTIONS, seconds),
+            server_stats_format_cpu(g, sizeof(g), first, last, seconds));
+    }
+
+    if (server_stats_dip_t < 0) {
+        return;
+    }
+    printf("benchmark server stats: lowest client throughput %.0f ops/s in the interval ending at %.1f s\n",
+        server_stats_dip_ops, server_stats_dip_t);
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        const struct mcstats* prev = &server_stats_dip_prev[i];
+        const struct mcstats* cur = &server_stats_dip_cur[i];
+        printf("  server %zu: evictions %s/s, conn_yields %s/s, listen_disabled %s/s, cpu %s%%\n", i,
+            server_stats_format(a, sizeof(a), prev, cur, MCSTATS_EVICTIONS, server_stats_dip_seconds),
+            server_stats_format(b, sizeof(b), prev, cur, MCSTATS_CONN_YIELDS, server_stats_dip_seconds),
+            server_stats_format(c, sizeof(c), prev, cur, MCSTATS_LISTEN_DISABLED_NUM, server_stats_dip_seconds),
+            server_stats_format_cpu(d, sizeof(d), prev, cur, server_stats_dip_seconds));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bulk Population
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the bytes of sets buffered per server before they are written out and acknowledged
+#define POPULATE_BATCH_BYTES (256 << 10)
+
+// the opaque of the no-op that closes a batch in the binary protocol
+#define POPULATE_OPAQUE_BARRIER 0xfffffffeU
+
+// the reads and writes of the bulk population, summed up over all threads
+static uint64_t populate_syscalls = 0;
+
+static const char* populate_name(enum populate_kind populate)
+{
+    return populate == POPULATE_BULK ? "bulk" : "sync";
+}
+
+/**
+ * Sends the buffered sets followed by a no-op (binary) or version (ascii) request and waits for
+ * its reply. Quiet sets only reply when they fail, so every reply before it counts as an error.
+ */
+static bool populate_flush(struct native_conn* c, size_t* errors)
+{
+    if (mc_buf_len(&c->wbuf) == 0) {
+        return true;
+    }
+    if (opt_binary) {
+        mc_encode_binary(&c->wbuf, MC_BIN_NOOP, NULL, 0, NULL, 0, NULL, 0, POPULATE_OPAQUE_BARRIER);
+    } else {
+        mc_buf_append(&c->wbuf, "version\r\n", 9);
+    }
+    if (!native_flush_all(c)) {
+        return false;
+    }
+
+    for (;;) {
+        struct mc_response r;
+        int rv;
+        while ((rv = mc_parse_response(mc_buf_head(&c->rbuf), mc_buf_len(&c->rbuf), opt_binary, MC_REQ_SET, &r))
+            == MC_PARSE_OK) {
+            bool barrier = opt_binary ? r.opaque == POPULATE_OPAQUE_BARRIER
+                                      : r.len >= 7 && memcmp(mc_buf_head(&c->rbuf), "VERSION", 7) == 0;
+            mc_buf_consume(&c->rbuf, r.len);
+            if (barrier) {
+                return true;
+            }
+            (*errors)++;
+        }
+        if (rv == MC_PARSE_ERROR) {
+            return false;
+        }
+
+        if (!native_receive(c)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * Stores the thread's share of the keys with quiet sets streamed to the servers over blocking
+ * native connections, in batches of POPULATE_BATCH_BYTES per server. Errors are only checked at
+ * the batch boundaries. Returns the number of keys stored and sets `num_failed`.
+ */
+static size_t populate_bulk(uint64_t tid, size_t num_keys, size_t* num_failed)
+{
+    size_t num_servers = opt_server_info.num_servers;
+
+    struct mc_args args;
+    memset(&args, 0, sizeof(args));
+    args.quiet = true;
+    char* value = item_value_alloc();
+
+    struct native_conn* conns = (struct native_conn*)calloc(num_servers, sizeof(*conns));
+    if (conns == NULL) {
+        printf("thread:%lu failed to allocate memory for the bulk population\n", tid);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t s = 0; s < num_servers; s++) {
+        if (!native_conn_open(&conns[s], s, false)) {
+            printf("thread:%lu failed to connect to server %zu for the bulk population\n", tid, s);
+            exit(EXIT_FAILURE);
+        }
+        mc_buf_reserve(&conns[s].wbuf, POPULATE_BATCH_BYTES + item_max_message());
+    }
+
+    size_t sent = 0, errors = 0;
+    size_t replicas[SERVER_MAX];
+    size_t num_replicas = 1;
+    for (size_t i = coord_thread_id(tid); i < num_keys; i += coord_num_threads()) {
+        char key[KEY_MAX + 1];
+        size_t keylen = item_format_key(key, WORKLOAD_SET, i);
+        size_t vlen = item_format_value(value, i);
+        num_replicas = key_replicas(i, opt_replicas, replicas);
+        for (size_t r = 0; r < num_replicas; r++) {
+            struct native_conn* c = &conns[replicas[r]];
+            mc_encode_command(&c->wbuf, opt_binary, MC_REQ_SET, key, keylen, value, vlen, &args);
+            sent++;
+
+            if (mc_buf_len(&c->wbuf) >= POPULATE_BATCH_BYTES && !populate_flush(c, &errors)) {
+                printf("thread:%lu bulk population on server %zu failed\n", tid, c->server);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    uint64_t syscalls = 0;
+    for (size_t s = 0; s < num_servers; s++) {
+        if (!populate_flush(&conns[s], &errors)) {
+            printf("thread:%lu bulk population on server %zu failed\n", tid, s);
+            exit(EXIT_FAILURE);
+        }
+        syscalls += conns[s].syscalls;
+        native_conn_free(&conns[s]);
+    }
+    free(conns);
+    free(value);
+    __atomic_fetch_add(&populate_syscalls, syscalls, __ATOMIC_RELAXED);
+
+    // failures are only known per server, each one counts as a lost key
+    size_t keys = sent / num_replicas;
+    *num_failed = errors;
+    return errors < keys ? keys - errors : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Epoll Engine
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The per-thread state of the epoll engine.
+ */
+struct epoll_engine {
+    int epfd;
+    struct native_pool pool;
+};
+
+static void epoll_engine_init(struct epoll_engine* e, uint64_t tid)
+{
+    native_pool_init(&e->pool, tid, true);
+
+    e->epfd = epoll_create1(0);
+    if (e->epfd < 0) {
+        printf("thread:%lu failed to create the epoll instance (%s)\n", tid, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < e->pool.num_conns; i++) {
+        if (native_conn_is_shm(&e->pool.conns[i])) {
+            continue;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &e->pool.conns[i];
+        if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, e->pool.conns[i].fd, &ev) != 0) {
+            printf("thread:%lu failed to register connection %zu (%s)\n", tid, i, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void epoll_engine_free(struct epoll_engine* e)
+{
+    close(e->epfd);
+    native_pool_free(&e->pool);
+}
+
+static void epoll_engine_update_events(struct epoll_engine* e, struct native_conn* c, bool want_out)
+{
+    if (native_conn_is_shm(c)) {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    e->pool.syscalls++;
+    epoll_ctl(e->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// sends the requests queued since the last flush, one write per connection
+static void epoll_engine_flush(struct epoll_engine* e, struct op_context* ctx)
+{
+    for (size_t i = 0; i < e->pool.num_dirty; i++) {
+        struct native_conn* c = e->pool.dirty[i];
+        c->dirty = false;
+        bool had_out = c->want_out;
+        if (!native_flush(c)) {
+            printf("thread:%lu failed to send to server %zu (%s)\n", ctx->tid, c->server, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (c->want_out != had_out) {
+            epoll_engine_update_events(e, c, c->want_out);
+        }
+    }
+    e->pool.num_dirty = 0;
+}
+
+// reads and completes the responses that arrived on the connection, returns the number completed
+static size_t epoll_engine_receive(struct epoll_engine* e, struct op_context* ctx, struct native_conn* c)
+{
+    bool open = native_read(c);
+    ssize_t done = native_complete(c, ctx);
+    if (done < 0) {
+        printf("thread:%lu protocol error on server %zu\n", ctx->tid, c->server);
+        exit(EXIT_FAILURE);
+    }
+    if (!open && c->count > 0) {
+        printf("thread:%lu lost connection to server %zu\n", ctx->tid, c->server);
+        exit(EXIT_FAILURE);
+    }
+    // completions may queue follow-up requests, e.g. creating a missing counter
+    if (mc_buf_len(&c->wbuf) > 0) {
+        native_pool_mark_dirty(&e->pool, c);
+    }
+    return done;
+}
+
+/**
+ * Polls the connections to shm:// servers, which have no socket to wait for. If nothing arrived
+ * and the pool has no sockets either, waits on a connection with requests in flight.
+ */
+static size_t epoll_engine_poll_shm(struct epoll_engine* e, struct op_context* ctx)
+{
+    size_t done = 0;
+    size_t busy = 0;
+    bool blocked = false;
+    struct native_conn* waiting = NULL;
+    for (size_t i = 0; i < e->pool.num_conns; i++) {
+        struct native_conn* c = &e->pool.conns[i];
+        if (!native_conn_is_shm(c)) {
+            continue;
+        }
+        if (c->want_out) {
+            // the request ring was full at the last flush
+            native_pool_mark_dirty(&e->pool, c);
+            blocked = true;
+        }
+        if (shmring_readable(&c->shm) > 0 || shmring_closed(&c->shm)) {
+            done += epoll_engine_receive(e, ctx, c);
+        } else if (c->count > 0) {
+            waiting = waiting ? waiting : c;
+            busy++;
+        }
+    }
+
+    if (done == 0 && !blocked && waiting != NULL && e->pool.num_shm == e->pool.num_conns) {
+        // a single futex can be slept on, so with more connections busy only sleep briefly
+        e->pool.syscalls += shmring_wait(&waiting->shm, opt_shm_wait, busy == 1 ? 10000000 : 50000);
+    }
+    return done;
+}
+
+/**
+ * Runs the benchmark phase on the epoll engine.
+ *
+ * Every thread keeps conns_per_server x num_servers x pipeline_depth operations in flight and draws
+ * a new operation whenever one completes. Requests queued while handling one batch of events are
+ * sent with a single write per connection. Connections to shm:// servers are polled in every
+ * round, the sockets are then only checked in passing. Returns the number of operations completed.
+ */
+static size_t epoll_engine_run(struct op_context* ctx, struct xor_shift* rand, size_t max_queries)
+{
+    struct epoll_engine e;
+    epoll_engine_init(&e, ctx->tid);
+
+    struct native_progress progress;
+    native_progress_init(&progress);
+
+    size_t window = e.pool.num_conns * opt_pipeline_depth;
+    size_t issued = 0;
+    size_t completed = 0;
+    bool running = true;
+
+    for (size_t i = 0; i < window && issued < max_queries; i++) {
+        native_pool_issue(&e.pool, ctx, rand);
+        issued++;
+    }
+    epoll_engine_flush(&e, ctx);
+
+    struct epoll_event events[64];
+    while (completed < issued) {
+        size_t done = 0;
+        int n = 0;
+        if (e.pool.num_shm < e.pool.num_conns) {
+            e.pool.syscalls++;
+            n = epoll_wait(e.epfd, events, 64, e.pool.num_shm > 0 ? 0 : 10);
+            if (n < 0 && errno != EINTR) {
+                printf("thread:%lu epoll_wait failed (%s)\n", ctx->tid, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct native_conn* c = (struct native_conn*)events[i].data.ptr;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                done += epoll_engine_receive(&e, ctx, c);
+            }
+            if (events[i].events & EPOLLOUT) {
+                native_pool_mark_dirty(&e.pool, c);
+            }
+        }
+        if (e.pool.num_shm > 0) {
+            done += epoll_engine_poll_shm(&e, ctx);
+        }
+        completed += done;
+        progress.interval_completed += done;
+
+        // closed loop: every completed operation makes room for a new one
+        for (size_t j = 0; j < done && running && issued < max_queries; j++) {
+            native_pool_issue(&e.pool, ctx, rand);
+            issued++;
+        }
+
+        epoll_engine_flush(&e, ctx);
+        running = native_progress_update(&progress, ctx);
+    }
+
+    epoll_engine_free(&e);
+    return completed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// io_uring Engine
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the registered receive buffer of every connection
+#define URING_RECV_BUFFER_SIZE (64 << 10)
+
+// completions the engine spins on with SQPOLL before it waits in the kernel
+#define URING_SQPOLL_SPINS 4096
+
+// the low bit of the user data tells receives and sends apart, the rest is the connection index
+#define URING_TAG_RECV 0
+#define URING_TAG_SEND 1
+
+/**
+ * The per-thread state of the io_uring engine.
+ *
+ * Every connection has one receive in flight at all times and at most one send. The sockets are
+ * registered as fixed files and all protocol buffers are carved out of a single registered arena,
+ * so the kernel neither looks up the file nor pins the pages per request. Requests are encoded
+ * into the connection's `wbuf` while the previous batch is being sent from `sending`, the two are
+ * swapped once the send completes.
+ */
+struct uring_engine {
+    struct uring ring;
+    struct native_pool pool;
+    char* arena;
+    size_t arena_size;
+    struct mc_buf* sending;
+    bool* send_busy;
+};
+
+static void uring_engine_init(struct uring_engine* e, uint64_t tid)
+{
+    // io_uring parks on blocking sockets itself, non-blocking ones would fail with EAGAIN
+    native_pool_init(&e->pool, tid, false);
+
+    size_t num_conns = e->pool.num_conns;
+    int rv = uring_init(&e->ring, 2 * num_conns, opt_sqpoll);
+    if (rv < 0) {
+        printf("thread:%lu failed to set up the io_uring (%s)\n", tid, strerror(-rv));
+        exit(EXIT_FAILURE);
+    }
+
+    // a connection may receive the whole window if all keys happen to map to its server
+    size_t send_size = NATIVE_BUFFER_SIZE + 2 * opt_server_info.num_servers * opt_pipeline_depth * item_max_message();
+    // a pipeline of large values is received in pieces, but a single response has to fit
+    size_t recv_size = URING_RECV_BUFFER_SIZE < 2 * item_max_message() ? 2 * item_max_message() : URING_RECV_BUFFER_SIZE;
+    size_t conn_size = recv_size + 2 * send_size;
+    e->arena_size = num_conns * conn_size;
+    e->arena = (char*)mmap(NULL, e->arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    e->sending = (struct mc_buf*)calloc(num_conns, sizeof(*e->sending));
+    e->send_busy = (bool*)calloc(num_conns, sizeof(*e->send_busy));
+    if (e->arena == MAP_FAILED || e->sending == NULL || e->send_busy == NULL) {
+        printf("thread:%lu failed to allocate memory for the io_uring engine\n", tid);
+        exit(EXIT_FAILURE);
+    }
+
+    int* fds = (int*)calloc(num_conns, sizeof(*fds));
+    if (fds == NULL) {
+        printf("thread:%lu failed to allocate memory for the io_uring engine\n", tid);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < num_conns; i++) {
+        struct native_conn* c = &e->pool.conns[i];
+        char* base = e->arena + i * conn_size;
+        mc_buf_free(&c->rbuf);
+        mc_buf_free(&c->wbuf);
+        mc_buf_init_fixed(&c->rbuf, base, recv_size);
+        mc_buf_init_fixed(&c->wbuf, base + recv_size, send_size);
+        mc_buf_init_fixed(&e->sending[i], base + recv_size + send_size, send_size);
+        fds[i] = c->fd;
+    }
+
+    rv = uring_register_files(&e->ring, fds, num_conns);
+    if (rv < 0) {
+        printf("thread:%lu failed to register the sockets (%s)\n", tid, strerror(-rv));
+        exit(EXIT_FAILURE);
+    }
+    rv = uring_register_buffer(&e->ring, e->arena, e->arena_size);
+    if (rv < 0) {
+        printf("thread:%lu failed to register %zu bytes of buffers (%s)\n", tid, e->arena_size, strerror(-rv));
+        exit(EXIT_FAILURE);
+    }
+    free(fds);
+}
+
+static void uring_engine_free(struct uring_engine* e)
+{
+    e->pool.syscalls += e->ring.enters;
+    uring_free(&e->ring);
+    native_pool_free(&e->pool);
+    munmap(e->arena, e->arena_size);
+    free(e->send_busy);
+    free(e->sending);
+}
+
+static struct io_uring_sqe* uring_engine_sqe(struct uring_engine* e, struct op_context* ctx)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(&e->ring);
+    if (sqe == NULL) {
+        // every connection has at most two operations in flight, the ring has room for all of them
+        printf("thread:%lu io_uring submission queue overflow\n", ctx->tid);
+        exit(EXIT_FAILURE);
+    }
+    return sqe;
+}
+
+static void uring_engine_recv(struct uring_engine* e, struct op_context* ctx, size_t idx)
+{
+    struct mc_buf* b = &e->pool.conns[idx].rbuf;
+    char* p = mc_buf_reserve(b, b->cap / 4);
+    uring_prep_rw_fixed(uring_engine_sqe(e, ctx), IORING_OP_READ_FIXED, (int)idx, p, (unsigned)(b->cap - b->end), 0,
+        (idx << 1) | URING_TAG_RECV);
+}
+
+static void uring_engine_send(struct uring_engine* e, struct op_context* ctx, size_t idx)
+{
+    struct mc_buf* b = &e->sending[idx];
+    uring_prep_rw_fixed(uring_engine_sqe(e, ctx), IORING_OP_WRITE_FIXED, (int)idx, mc_buf_head(b), (unsigned)mc_buf_len(b),
+        0, (idx << 1) | URING_TAG_SEND);
+    e->send_busy[idx] = true;
+}
+
+// hands the requests queued since the last flush to idle connections, one send per connection
+static void uring_engine_flush(struct uring_engine* e, struct op_context* ctx)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < e->pool.num_dirty; i++) {
+        struct native_conn* c = e->pool.dirty[i];
+        size_t idx = c - e->pool.conns;
+        if (e->send_busy[idx]) {
+            // retried once the current send completes
+            e->pool.dirty[kept++] = c;
+            continue;
+        }
+        c->dirty = false;
+        if (mc_buf_len(&c->wbuf) == 0) {
+            continue;
+        }
+        struct mc_buf tmp = e->sending[idx];
+        e->sending[idx] = c->wbuf;
+        c->wbuf = tmp;
+        uring_engine_send(e, ctx, idx);
+    }
+    e->pool.num_dirty = kept;
+}
+
+/**
+ * Runs the benchmark phase on the io_uring engine.
+ *
+ * The window is the same as with the epoll engine. Each pass submits all new sends and receives and
+ * waits for completions with a single io_uring_enter(), with SQPOLL the engine polls the completion
+ * queue and only enters the kernel when it runs idle. Returns the number of operations completed.
+ */
+static size_t uring_engine_run(struct op_context* ctx, struct xor_shift* rand, size_t max_queries)
+{
+    struct uring_engine e;
+    uring_engine_init(&e, ctx->tid);
+
+    struct native_progress progress;
+    native_progress_init(&progress);
+
+    size_t window = e.pool.num_conns * opt_pipeline_depth;
+    size_t issued = 0;
+    size_t completed = 0;
+    bool running = true;
+
+    for (size_t i = 0; i < window && issued < max_queries; i++) {
+        native_pool_issue(&e.pool, ctx, rand);
+        issued++;
+    }
+    for (size_t i = 0; i < e.pool.num_conns; i++) {
+        uring_engine_recv(&e, ctx, i);
+    }
+    uring_engine_flush(&e, ctx);
+
+    while (completed < issued) {
+        struct io_uring_cqe* cqe = NULL;
+        if (opt_sqpoll) {
+            uring_submit(&e.ring, 0);
+            for (size_t spin = 0; spin < URING_SQPOLL_SPINS && cqe == NULL; spin++) {
+                cqe = uring_peek_cqe(&e.ring);
+            }
+        }
+        if (cqe == NULL) {
+            int rv = uring_submit(&e.ring, 1);
+            if (rv < 0) {
+                printf("thread:%lu io_uring_enter failed (%s)\n", ctx->tid, strerror(-rv));
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        while ((cqe = uring_peek_cqe(&e.ring)) != NULL) {
+            size_t idx = cqe->user_data >> 1;
+            bool is_send = (cqe->user_data & 1) == URING_TAG_SEND;
+            int res = cqe->res;
+            uring_cq_advance(&e.ring, 1);
+
+            struct native_conn* c = &e.pool.conns[idx];
+            if (res < 0) {
+                printf("thread:%lu %s on server %zu failed (%s)\n", ctx->tid, is_send ? "send" : "receive",
+                    c->server, strerror(-res));
+                exit(EXIT_FAILURE);
+            }
+
+            if (is_send) {
+                mc_buf_consume(&e.sending[idx], res);
+                e.send_busy[idx] = false;
+                if (mc_buf_len(&e.sending[idx]) > 0) {
+                    uring_engine_send(&e, ctx, idx);
+                } else if (mc_buf_len(&c->wbuf) > 0) {
+                    native_pool_mark_dirty(&e.pool, c);
+                }
+                continue;
+            }
+
+            if (res == 0) {
+                if (c->count > 0) {
+                    printf("thread:%lu lost connection to server %zu\n", ctx->tid, c->server);
+                    exit(EXIT_FAILURE);
+                }
+                continue;
+            }
+            mc_buf_commit(&c->rbuf, res);
+
+            ssize_t done = native_complete(c, ctx);
+            if (done < 0) {
+                printf("thread:%lu protocol error on server %zu\n", ctx->tid, c->server);
+                exit(EXIT_FAILURE);
+            }
+            completed += done;
+            progress.interval_completed += done;
+
+            // closed loop: every completed operation makes room for a new one
+            for (ssize_t j = 0; j < done && running && issued < max_queries; j++) {
+                native_pool_issue(&e.pool, ctx, rand);
+                issued++;
+            }
+            if (mc_buf_len(&c->wbuf) > 0) {
+                native_pool_mark_dirty(&e.pool, c);
+            }
+            uring_engine_recv(&e, ctx, idx);
+        }
+
+        uring_engine_flush(&e, ctx);
+        running = native_progress_update(&progress, ctx);
+    }
+
+    uring_engine_free(&e);
+    return completed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Proxy
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the version a proxy reports to its clients
+#define PROXY_VERSION "loadbalancer-proxy"
+
+// the number of responses a client send gathers at most
+#define PROXY_MAX_IOV 64
+
+// set by SIGINT and SIGTERM, the workers stop at their next pass
+static volatile sig_atomic_t proxy_stop = 0;
+
+// the summed up statistics of all workers, merged once they have stopped
+static uint64_t proxy_clients = 0;
+static uint64_t proxy_requests = 0;
+static uint64_t proxy_keys = 0;
+// the time from parsing a request to its response being ready, one histogram per worker
+static struct histogram* proxy_residency = NULL;
+
+enum proxy_kind {
+    PROXY_LISTENER,
+    PROXY_CLIENT,
+    PROXY_BACKEND,
+};
+
+struct proxy_listener {
+    enum proxy_kind kind;
+    int fd;
+};
+
+/**
+ * A response to a client request, completed once all backend requests it waits for have returned.
+ */
+struct proxy_slot {
+    // the response in the client's protocol, the memory is reused by later requests
+    struct mc_buf buf;
+    // backend responses still outstanding
+    size_t pending;
+    enum mc_cmd cmd;
+    // the binary opcode and opaque value echoed in the response
+    uint8_t opcode;
+    uint32_t opaque;
+    bool quiet;
+    bool with_key;
+    uint64_t t_start;
+};
+
+/**
+ * A client connection. Responses are queued in request order in a ring of slots that is indexed
+ * by sequence number, so backends can refer to a slot while the ring grows.
+ */
+struct proxy_client {
+    enum proxy_kind kind;
+    int fd;
+    // the protocol is detected from the first byte the client sends
+    bool binary;
+    bool detected;
+    struct mc_buf rbuf;
+    struct proxy_slot* slots;
+    size_t cap;
+    // the oldest slot that has not been sent, and the next slot to hand out
+    uint64_t head;
+    uint64_t tail;
+    // backend requests that refer to this client
+    size_t outstanding;
+    // the client asked to close the connection once its responses are sent
+    bool quit;
+    // the socket has been closed, the client is freed once no backend request refers to it
+    bool closed;
+    bool dirty;
+    bool want_out;
+};
+
+// a request forwarded to a backend, waiting for its response
+struct proxy_forward {
+    struct proxy_client* client;
+    uint64_t seq;
+    enum mc_req req;
+};
+
+/**
+ * A pipelined connection to a backend server, shared by all clients of a worker.
+ */
+struct proxy_backend {
+    enum proxy_kind kind;
+    int fd;
+    size_t server;
+    struct mc_buf rbuf;
+    struct mc_buf wbuf;
+    struct proxy_forward* inflight;
+    size_t head;
+    size_t count;
+    size_t cap;
+    bool dirty;
+    bool want_out;
+};
+
+/**
+ * The per-thread state of a proxy worker. Every worker accepts clients from the shared listeners
+ * and owns opt_conns_per_server connections to each backend.
+ */
+struct proxy_worker {
+    size_t id;
+    int epfd;
+    struct proxy_backend* backends;
+    size_t num_backends;
+    // clients and backends with data to send or resources to release
+    enum proxy_kind** dirty;
+    size_t num_dirty;
+    size_t dirty_cap;
+
+    uint64_t clients;
+    uint64_t requests;
+    uint64_t keys;
+    struct server_load load[SERVER_MAX];
+    struct histogram* residency;
+};
+
+static struct proxy_listener proxy_listeners[2];
+static size_t proxy_num_listeners = 0;
+
+static bool proxy_enabled(void)
+{
+    return opt_proxy_listen != NULL || opt_proxy_socket != NULL;
+}
+
+static void proxy_signal(int sig)
+{
+    (void)sig;
+    proxy_stop = 1;
+}
+
+static int proxy_listen_tcp(const char* spec)
+{
+    // [host:]port
+    char* copy = strdup(spec);
+    if (copy == NULL) {
+        return -1;
+    }
+    const char* host = NULL;
+    char* port = copy;
+    char* colon = strrchr(copy, ':');
+    if (colon != NULL) {
+        *colon = 0;
+        host = copy;
+        port = colon + 1;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        free(copy);
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 1024) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    free(copy);
+    return fd;
+}
+
+static int proxy_listen_unix(const char* path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1024) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void proxy_mark_dirty(struct proxy_worker* w, enum proxy_kind* e, bool* dirty)
+{
+    if (*dirty) {
+        return;
+    }
+    if (w->num_dirty == w->dirty_cap) {
+        w->dirty_cap = w->dirty_cap ? w->dirty_cap * 2 : 64;
+        w->dirty = (enum proxy_kind**)realloc(w->dirty, w->dirty_cap * sizeof(*w->dirty));
+        if (w->dirty == NULL) {
+            printf("proxy:%03zu failed to allocate memory\n", w->id);
+            exit(EXIT_FAILURE);
+        }
+    }
+    *dirty = true;
+    w->dirty[w->num_dirty++] = e;
+}
+
+static void proxy_client_mark_dirty(struct proxy_worker* w, struct proxy_client* c)
+{
+    proxy_mark_dirty(w, &c->kind, &c->dirty);
+}
+
+static void proxy_backend_mark_dirty(struct proxy_worker* w, struct proxy_backend* b)
+{
+    proxy_mark_dirty(w, &b->kind, &b->dirty);
+}
+
+static void proxy_update_events(struct proxy_worker* w, enum proxy_kind* e, int fd, bool want_out)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+    ev.data.ptr = e;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static struct proxy_slot* proxy_client_slot(struct proxy_client* c, uint64_t seq)
+{
+    return &c->slots[seq & (c->cap - 1)];
+}
+
+// hands out the next response slot, growing the ring if all slots are taken
+static uint64_t proxy_client_slot_new(struct proxy_client* c, const struct mc_request* r)
+{
+    if (c->tail - c->head == c->cap) {
+        size_t cap = c->cap * 2;
+        struct proxy_slot* slots = (struct proxy_slot*)calloc(cap, sizeof(*slots));
+        if (slots == NULL) {
+            printf("failed to allocate memory for the responses of a client\n");
+            exit(EXIT_FAILURE);
+        }
+        // the sequence numbers stay, the slots move to their place in the larger ring
+        for (size_t i = 0; i < c->cap; i++) {
+            uint64_t seq = c->head + i;
+            slots[seq & (cap - 1)] = c->slots[seq & (c->cap - 1)];
+        }
+        free(c->slots);
+        c->slots = slots;
+        c->cap = cap;
+    }
+
+    uint64_t seq = c->tail++;
+    struct proxy_slot* s = proxy_client_slot(c, seq);
+    if (s->buf.data == NULL) {
+        mc_buf_init(&s->buf, 256);
+    }
+    s->buf.start = 0;
+    s->buf.end = 0;
+    s->pending = 0;
+    s->cmd = r->cmd;
+    s->opcode = r->opcode;
+    s->opaque = r->args.opaque;
+    s->quiet = r->args.quiet;
+    s->with_key = r->with_key;
+    s->t_start = timer_now();
+    return seq;
+}
+
+static struct proxy_client* proxy_client_new(int fd)
+{
+    struct proxy_client* c = (struct proxy_client*)calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->kind = PROXY_CLIENT;
+    c->fd = fd;
+    c->cap = 16;
+    c->slots = (struct proxy_slot*)calloc(c->cap, sizeof(*c->slots));
+    if (c->slots == NULL) {
+        free(c);
+        return NULL;
+    }
+    mc_buf_init(&c->rbuf, NATIVE_BUFFER_SIZE);
+    return c;
+}
+
+static void proxy_client_free(struct proxy_client* c)
+{
+    for (size_t i = 0; i < c->cap; i++) {
+        if (c->slots[i].buf.data != NULL) {
+            mc_buf_free(&c->slots[i].buf);
+        }
+    }
+    free(c->slots);
+    mc_buf_free(&c->rbuf);
+    free(c);
+}
+
+static void proxy_client_shutdown(struct proxy_client* c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->closed = true;
+}
+
+static void proxy_client_close(struct proxy_worker* w, struct proxy_client* c)
+{
+    proxy_client_shutdown(c);
+    // released on the next flush once no backend request refers to it anymore
+    proxy_client_mark_dirty(w, c);
+}
+
+static void proxy_backend_push(struct proxy_backend* b, const struct proxy_forward* f)
+{
+    if (b->count == b->cap) {
+        struct proxy_forward* inflight = (struct proxy_forward*)calloc(b->cap * 2, sizeof(*inflight));
+        if (inflight == NULL) {
+            printf("failed to allocate memory for the requests in flight\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < b->count; i++) {
+            inflight[i] = b->inflight[(b->head + i) % b->cap];
+        }
+        free(b->inflight);
+        b->inflight = inflight;
+        b->head = 0;
+        b->cap *= 2;
+    }
+    b->inflight[(b->head + b->count) % b->cap] = *f;
+    b->count++;
+}
+
+/**
+ * Sends a request for the key to its backend on behalf of the client's slot.
+ */
+static void proxy_forward(struct proxy_worker* w, struct proxy_client* c, uint64_t seq, enum mc_req req,
+    const char* key, size_t keylen, const struct mc_request* r)
+{
+    uint64_t hash = router_hash_key(key, keylen);
+    size_t server = key_server(hash);
+    // a key always takes the same connection, so the requests of a client on a key stay ordered
+    size_t idx = (size_t)(hash >> 32) % opt_conns_per_server;
+    struct proxy_backend* b = &w->backends[server * opt_conns_per_server + idx];
+
+    // responses are matched by order, so the backend always answers, even for quiet requests
+    struct mc_args args = r->args;
+    args.quiet = false;
+    args.opaque = 0;
+    mc_encode_command(&b->wbuf, opt_binary, req, key, keylen, r->value, r->vlen, &args);
+
+    struct proxy_forward f;
+    f.client = c;
+    f.seq = seq;
+    f.req = req;
+    proxy_backend_push(b, &f);
+
+    c->outstanding++;
+    proxy_client_slot(c, seq)->pending++;
+    w->keys++;
+    w->load[server].requests++;
+    w->load[server].bytes += keylen + r->vlen;
+    proxy_backend_mark_dirty(w, b);
+}
+
+// appends a binary response header and body to the slot
+static void proxy_encode_binary(struct proxy_slot* s, uint16_t status, const char* key, size_t keylen,
+    const char* extras, size_t extlen, const char* value, size_t vlen)
+{
+    mc_encode_packet(&s->buf, MC_BIN_RES_MAGIC, s->opcode, status, key, keylen, extras, extlen, value, vlen, s->opaque);
+}
+
+// the ascii response line of an update, by binary status code
+static const char* proxy_ascii_status(enum mc_cmd cmd, uint16_t code)
+{
+    switch (code) {
+    case MC_BIN_STATUS_OK:
+        return cmd == MC_CMD_DELETE ? "DELETED\r\n" : "STORED\r\n";
+    case MC_BIN_STATUS_NOT_FOUND:
+        return "NOT_FOUND\r\n";
+    case MC_BIN_STATUS_EXISTS:
+        return "EXISTS\r\n";
+    case MC_BIN_STATUS_NOT_STORED:
+        return "NOT_STORED\r\n";
+    default:
+        return "SERVER_ERROR backend error\r\n";
+    }
+}
+
+/**
+ * Translates a backend response into the client's protocol, copying the value once into the slot.
+ */
+static void proxy_respond(struct proxy_worker* w, struct proxy_client* c, uint64_t seq, const struct mc_response* resp)
+{
+    struct proxy_slot* s = proxy_client_slot(c, seq);
+
+    if (s->cmd == MC_CMD_GET) {
+        if (c->binary) {
+            if (resp->code == MC_BIN_STATUS_OK) {
+                char extras[4];
+                mc_put_be32(extras, resp->flags);
+                proxy_encode_binary(s, MC_BIN_STATUS_OK, s->with_key ? resp->key : NULL, s->with_key ? resp->keylen : 0,
+                    extras, 4, resp->value, resp->value_len);
+            } else if (!s->quiet || resp->code != MC_BIN_STATUS_NOT_FOUND) {
+                proxy_encode_binary(s, resp->code, NULL, 0, NULL, 0, NULL, 0);
+            }
+        } else if (resp->code == MC_BIN_STATUS_OK) {
+            char* p = mc_buf_reserve(&s->buf, resp->keylen + resp->value_len + 64);
+            size_t len = sprintf(p, "VALUE %.*s %u %zu\r\n", (int)resp->keylen, resp->key, resp->flags, resp->value_len);
+            memcpy(p + len, resp->value, resp->value_len);
+            memcpy(p + len + resp->value_len, "\r\n", 2);
+            mc_buf_commit(&s->buf, len + resp->value_len + 2);
+        } else if (resp->code != MC_BIN_STATUS_NOT_FOUND) {
+            const char* err = "SERVER_ERROR backend error\r\n";
+            mc_buf_append(&s->buf, err, strlen(err));
+        }
+    } else if (c->binary) {
+        if (!s->quiet || resp->code != MC_BIN_STATUS_OK) {
+            char number[8];
+            bool counter = (s->cmd == MC_CMD_INCR || s->cmd == MC_CMD_DECR) && resp->code == MC_BIN_STATUS_OK;
+            mc_put_be64(number, resp->number);
+            proxy_encode_binary(s, resp->code, NULL, 0, NULL, 0, counter ? number : NULL, counter ? 8 : 0);
+        }
+    } else if (!s->quiet) {
+        if ((s->cmd == MC_CMD_INCR || s->cmd == MC_CMD_DECR) && resp->code == MC_BIN_STATUS_OK) {
+            char line[32];
+            int len = snprintf(line, sizeof(line), "%lu\r\n", (unsigned long)resp->number);
+            mc_buf_append(&s->buf, line, len);
+        } else {
+            const char* line = proxy_ascii_status(s->cmd, resp->code);
+            mc_buf_append(&s->buf, line, strlen(line));
+        }
+    }
+
+    if (--s->pending == 0) {
+        if (s->cmd == MC_CMD_GET && !c->binary) {
+            mc_buf_append(&s->buf, "END\r\n", 5);
+        }
+        histogram_record(w->residency, timer_now() - s->t_start);
+        if (seq == c->head) {
+            proxy_client_mark_dirty(w, c);
+        }
+    }
+}
+
+// answers a request that does not go to a backend
+static void proxy_respond_local(struct proxy_worker* w, struct proxy_client* c, const struct mc_request* r)
+{
+    uint64_t seq = proxy_client_slot_new(c, r);
+    struct proxy_slot* s = proxy_client_slot(c, seq);
+
+    if (c->binary) {
+        switch (r->cmd) {
+        case MC_CMD_NOOP:
+            proxy_encode_binary(s, MC_BIN_STATUS_OK, NULL, 0, NULL, 0, NULL, 0);
+            break;
+        case MC_CMD_VERSION:
+            proxy_encode_binary(s, MC_BIN_STATUS_OK, NULL, 0, NULL, 0, PROXY_VERSION, strlen(PROXY_VERSION));
+            break;
+        case MC_CMD_QUIT:
+            if (!r->args.quiet) {
+                proxy_encode_binary(s, MC_BIN_STATUS_OK, NULL, 0, NULL, 0, NULL, 0);
+            }
+            break;
+        default:
+            proxy_encode_binary(s, MC_BIN_STATUS_UNKNOWN_COMMAND, NULL, 0, NULL, 0, NULL, 0);
+            break;
+        }
+    } else {
+        const char* line = r->error != NULL ? r->error : "ERROR\r\n";
+        if (r->cmd == MC_CMD_VERSION) {
+            line = "VERSION " PROXY_VERSION "\r\n";
+        } else if (r->cmd == MC_CMD_QUIT) {
+            line = "";
+        }
+        mc_buf_append(&s->buf, line, strlen(line));
+    }
+
+    if (seq == c->head) {
+        proxy_client_mark_dirty(w, c);
+    }
+}
+
+/**
+ * Parses all complete requests of the client and forwards them. Returns false on a protocol error.
+ */
+static bool proxy_client_process(struct proxy_worker* w, struct proxy_client* c)
+{
+    while (mc_buf_len(&c->rbuf) > 0 && !c->quit) {
+        if (!c->detected) {
+            c->binary = (uint8_t)mc_buf_head(&c->rbuf)[0] == MC_BIN_REQ_MAGIC;
+            c->detected = true;
+        }
+
+        struct mc_request r;
+        int rv = mc_parse_request(mc_buf_head(&c->rbuf), mc_buf_len(&c->rbuf), c->binary, &r);
+        if (rv == MC_PARSE_INCOMPLETE) {
+            break;
+        }
+        if (rv == MC_PARSE_ERROR) {
+            return false;
+        }
+        w->requests++;
+
+        switch (r.cmd) {
+        case MC_CMD_GET:
+            if (c->binary) {
+                uint64_t seq = proxy_client_slot_new(c, &r);
+                proxy_forward(w, c, seq, MC_REQ_GETK, r.key, r.keylen, &r);
+            } else {
+                // a multi-get fans out to the backends of its keys and is answered once all returned
+                uint64_t seq = proxy_client_slot_new(c, &r);
+                const char* p = r.key;
+                const char* end = r.key + r.keylen;
+                const char* key;
+                size_t keylen;
+                while (mc_next_token(&p, end, &key, &keylen)) {
+                    proxy_forward(w, c, seq, MC_REQ_GETK, key, keylen, &r);
+                }
+            }
+            break;
+        case MC_CMD_SET:
+        case MC_CMD_ADD:
+        case MC_CMD_APPEND:
+        case MC_CMD_DELETE:
+        case MC_CMD_INCR:
+        case MC_CMD_DECR: {
+            uint64_t seq = proxy_client_slot_new(c, &r);
+            proxy_forward(w, c, seq, mc_cmd_req(r.cmd), r.key, r.keylen, &r);
+            break;
+        }
+        case MC_CMD_QUIT:
+            proxy_respond_local(w, c, &r);
+            c->quit = true;
+            break;
+        default:
+            proxy_respond_local(w, c, &r);
+            break;
+        }
+
+        mc_buf_consume(&c->rbuf, r.len);
+    }
+    return true;
+}
+
+/**
+ * Sends the completed responses at the head of the client's queue with a single gathering write.
+ */
+static bool proxy_client_flush(struct proxy_client* c)
+{
+    while (c->head < c->tail) {
+        struct iovec iov[PROXY_MAX_IOV];
+        int n = 0;
+        for (uint64_t seq = c->head; seq < c->tail && n < PROXY_MAX_IOV; seq++) {
+            struct proxy_slot* s = proxy_client_slot(c, seq);
+            if (s->pending > 0) {
+                break;
+            }
+            iov[n].iov_base = mc_buf_head(&s->buf);
+            iov[n].iov_len = mc_buf_len(&s->buf);
+            n++;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t sent = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                c->want_out = true;
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // release the slots that went out completely
+        for (int i = 0; i < n; i++) {
+            struct proxy_slot* s = proxy_client_slot(c, c->head);
+            size_t len = mc_buf_len(&s->buf);
+            if ((size_t)sent < len) {
+                mc_buf_consume(&s->buf, sent);
+                c->want_out = true;
+                return true;
+            }
+            sent -= len;
+            s->buf.start = 0;
+            s->buf.end = 0;
+            c->head++;
+        }
+    }
+    c->want_out = false;
+    return true;
+}
+
+static bool proxy_backend_flush(struct proxy_backend* b)
+{
+    while (mc_buf_len(&b->wbuf) > 0) {
+        ssize_t n = send(b->fd, mc_buf_head(&b->wbuf), mc_buf_len(&b->wbuf), MSG_NOSIGNAL);
+        if (n > 0) {
+            mc_buf_consume(&b->wbuf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            b->want_out = true;
+            return true;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return false;
+    }
+    b->want_out = false;
+    return true;
+}
+
+// reads all available bytes into the buffer, returns false once the peer closed or failed
+static bool proxy_read(int fd, struct mc_buf* buf)
+{
+    for (;;) {
+        char* p = mc_buf_reserve(buf, NATIVE_BUFFER_SIZE / 2);
+        ssize_t n = recv(fd, p, buf->cap - buf->end, 0);
+        if (n > 0) {
+            mc_buf_commit(buf, n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return false;
+    }
+}
+
+/**
+ * Matches the backend's responses with the requests in flight and passes them to the clients.
+ */
+static void proxy_backend_process(struct proxy_worker* w, struct proxy_backend* b)
+{
+    while (mc_buf_len(&b->rbuf) > 0) {
+        if (b->count == 0) {
+            printf("proxy:%03zu unexpected response from server %zu\n", w->id, b->server);
+            exit(EXIT_FAILURE);
+        }
+
+        struct proxy_forward* f = &b->inflight[b->head];
+        struct mc_response resp;
+        int rv = mc_parse_response(mc_buf_head(&b->rbuf), mc_buf_len(&b->rbuf), opt_binary, f->req, &resp);
+        if (rv == MC_PARSE_INCOMPLETE) {
+            break;
+        }
+        if (rv == MC_PARSE_ERROR) {
+            printf("proxy:%03zu protocol error on server %zu\n", w->id, b->server);
+            exit(EXIT_FAILURE);
+        }
+
+        struct proxy_client* c = f->client;
+        c->outstanding--;
+        if (!c->closed) {
+            proxy_respond(w, c, f->seq, &resp);
+        } else if (c->outstanding == 0) {
+            proxy_client_mark_dirty(w, c);
+        }
+        if (f->req == MC_REQ_GETK && resp.code == MC_BIN_STATUS_OK) {
+            w->load[b->server].bytes += resp.value_len;
+        }
+
+        mc_buf_consume(&b->rbuf, resp.len);
+        b->head = (b->head + 1) % b->cap;
+        b->count--;
+    }
+}
+
+static void proxy_accept(struct proxy_worker* w, struct proxy_listener* l)
+{
+    for (;;) {
+        int fd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            // another worker took it, or the backlog is empty
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct proxy_client* c = proxy_client_new(fd);
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &c->kind;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            proxy_client_free(c);
+            close(fd);
+            continue;
+        }
+        w->clients++;
+    }
+}
+
+// sends what the dirty clients and backends have queued and releases closed clients
+static void proxy_flush(struct proxy_worker* w)
+{
+    for (size_t i = 0; i < w->num_dirty; i++) {
+        enum proxy_kind* e = w->dirty[i];
+        if (*e == PROXY_BACKEND) {
+            struct proxy_backend* b = (struct proxy_backend*)e;
+            b->dirty = false;
+            bool had_out = b->want_out;
+            if (!proxy_backend_flush(b)) {
+                printf("proxy:%03zu failed to send to server %zu (%s)\n", w->id, b->server, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            if (b->want_out != had_out) {
+                proxy_update_events(w, e, b->fd, b->want_out);
+            }
+            continue;
+        }
+
+        struct proxy_client* c = (struct proxy_client*)e;
+        c->dirty = false;
+        if (!c->closed) {
+            bool had_out = c->want_out;
+            if (!proxy_client_flush(c) || (c->quit && c->head == c->tail)) {
+                proxy_client_shutdown(c);
+            } else if (c->want_out != had_out) {
+                proxy_update_events(w, e, c->fd, c->want_out);
+            }
+        }
+        if (c->closed && c->outstanding == 0) {
+            proxy_client_free(c);
+        }
+    }
+    w->num_dirty = 0;
+}
+
+static void proxy_worker_init(struct proxy_worker* w, size_t id)
+{
+    memset(w, 0, sizeof(*w));
+    w->id = id;
+    w->residency = &proxy_residency[id];
+
+    w->epfd = epoll_create1(0);
+    if (w->epfd < 0) {
+        printf("proxy:%03zu failed to create the epoll instance (%s)\n", id, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < proxy_num_listeners; i++) {
+        // only one worker is woken up per incoming connection
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = &proxy_listeners[i].kind;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, proxy_listeners[i].fd, &ev) != 0) {
+            printf("proxy:%03zu failed to watch the listener (%s)\n", id, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    w->num_backends = opt_server_info.num_servers * opt_conns_per_server;
+    w->backends = (struct proxy_backend*)calloc(w->num_backends, sizeof(*w->backends));
+    if (w->backends == NULL) {
+        printf("proxy:%03zu failed to allocate memory for the backends\n", id);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < w->num_backends; i++) {
+        struct proxy_backend* b = &w->backends[i];
+        b->kind = PROXY_BACKEND;
+        b->server = i / opt_conns_per_server;
+        b->fd = native_connect(b->server, true);
+        if (b->fd < 0) {
+            printf("proxy:%03zu failed to connect to server %zu (%s)\n", id, b->server, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        mc_buf_init(&b->rbuf, NATIVE_BUFFER_SIZE);
+        mc_buf_init(&b->wbuf, NATIVE_BUFFER_SIZE);
+        b->cap = 64;
+        b->inflight = (struct proxy_forward*)calloc(b->cap, sizeof(*b->inflight));
+        if (b->inflight == NULL) {
+            printf("proxy:%03zu failed to allocate memory for the backends\n", id);
+            exit(EXIT_FAILURE);
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &b->kind;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, b->fd, &ev) != 0) {
+            printf("proxy:%03zu failed to watch server %zu (%s)\n", id, b->server, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void proxy_worker_free(struct proxy_worker* w)
+{
+    for (size_t i = 0; i < w->num_backends; i++) {
+        struct proxy_backend* b = &w->backends[i];
+        close(b->fd);
+        mc_buf_free(&b->rbuf);
+        mc_buf_free(&b->wbuf);
+        free(b->inflight);
+    }
+    free(w->backends);
+    free(w->dirty);
+    close(w->epfd);
+}
+
+static void* proxy_worker_main(void* arg)
+{
+    struct proxy_worker w;
+    proxy_worker_init(&w, (size_t)arg);
+
+    uint64_t t_stop = opt_proxy_duration ? timer_now() + timer_ns_to_ticks(opt_proxy_duration * 1e9) : UINT64_MAX;
+    uint64_t t_interval = timer_now();
+    uint64_t t_print = t_interval + timer_ns_to_ticks(PERIODIC_PRINT_INTERVAL * 1e9);
+    uint64_t interval_requests = 0;
+
+    struct epoll_event events[64];
+    while (!proxy_stop) {
+        int n = epoll_wait(w.epfd, events, 64, 100);
+        if (n < 0 && errno != EINTR) {
+            printf("proxy:%03zu epoll_wait failed (%s)\n", w.id, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < n; i++) {
+            enum proxy_kind* e = (enum proxy_kind*)events[i].data.ptr;
+            switch (*e) {
+            case PROXY_LISTENER:
+                proxy_accept(&w, (struct proxy_listener*)e);
+                break;
+            case PROXY_CLIENT: {
+                struct proxy_client* c = (struct proxy_client*)e;
+                if (c->closed) {
+                    break;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    bool open = proxy_read(c->fd, &c->rbuf);
+                    if (!proxy_client_process(&w, c) || !open) {
+                        proxy_client_close(&w, c);
+                        break;
+                    }
+                }
+                if (events[i].events & EPOLLOUT) {
+                    proxy_client_mark_dirty(&w, c);
+                }
+                break;
+            }
+            case PROXY_BACKEND: {
+                struct proxy_backend* b = (struct proxy_backend*)e;
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    bool open = proxy_read(b->fd, &b->rbuf);
+                    proxy_backend_process(&w, b);
+                    if (!open) {
+                        printf("proxy:%03zu lost connection to server %zu\n", w.id, b->server);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                if (events[i].events & EPOLLOUT) {
+                    proxy_backend_mark_dirty(&w, b);
+                }
+                break;
+            }
+            }
+        }
+
+        proxy_flush(&w);
+
+        uint64_t t_now = timer_now();
+        if (t_now >= t_print) {
+            printf("proxy:%03zu forwarded %lu requests in %lu ms\n", w.id, w.requests - interval_requests,
+                (uint64_t)(timer_ticks_to_ns(t_now - t_interval) / 1000000));
+            interval_requests = w.requests;
+            t_interval = t_now;
+            t_print = t_now + timer_ns_to_ticks(PERIODIC_PRINT_INTERVAL * 1e9);
+        }
+        if (t_now >= t_stop) {
+            proxy_stop = 1;
+        }
+    }
+
+    __atomic_fetch_add(&proxy_clients, w.clients, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&proxy_requests, w.requests, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&proxy_keys, w.keys, __ATOMIC_RELAXED);
+    server_load_merge(w.load);
+
+    // clients still connected are dropped with the worker
+    proxy_worker_free(&w);
+    return NULL;
+}
+
+/**
+ * Runs the proxy until SIGINT or SIGTERM, or for --proxy-duration seconds if given.
+ */
+static int proxy_main(void)
+{
+    printf("=====================================\n");
+    printf("LOADBALANCER PROXY\n");
+    printf("=====================================\n");
+    printf(" - workers = %zu\n", opt_num_threads);
+    printf(" - listen = %s\n", opt_proxy_listen ? opt_proxy_listen : "-");
+    printf(" - socket = %s\n", opt_proxy_socket ? opt_proxy_socket : "-");
+    printf(" - backend protocol = %s\n", opt_binary ? "binary" : "ascii");
+    printf(" - conns_per_server = %zu\n", opt_conns_per_server);
+    printf(" - router = %s\n", router_kind_name(opt_router));
+    printf("------------------------------------------\n");
+
+    key_router_init(opt_server_info.num_servers);
+    timer_calibrate();
+
+    proxy_residency = (struct histogram*)calloc(opt_num_threads, sizeof(*proxy_residency));
+    if (proxy_residency == NULL) {
+        printf("ERROR: failed to allocate memory for the latency histograms\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t id = 0; id < opt_num_threads; id++) {
+        histogram_init(&proxy_residency[id]);
+    }
+
+    if (opt_proxy_listen != NULL) {
+        int fd = proxy_listen_tcp(opt_proxy_listen);
+        if (fd < 0) {
+            printf("failed to listen on %s (%s)\n", opt_proxy_listen, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        proxy_listeners[proxy_num_listeners].kind = PROXY_LISTENER;
+        proxy_listeners[proxy_num_listeners++].fd = fd;
+    }
+    if (opt_proxy_socket != NULL) {
+        int fd = proxy_listen_unix(opt_proxy_socket);
+        if (fd < 0) {
+            printf("failed to listen on unix://%s (%s)\n", opt_proxy_socket, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        proxy_listeners[proxy_num_listeners].kind = PROXY_LISTENER;
+        proxy_listeners[proxy_num_listeners++].fd = fd;
+    }
+
+    signal(SIGINT, proxy_signal);
+    signal(SIGTERM, proxy_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_t* threads = (pthread_t*)calloc(opt_num_threads, sizeof(pthread_t));
+    if (threads == NULL) {
+        printf("ERROR: failed to allocate memory for threads\n");
+        return EXIT_FAILURE;
+    }
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    for (size_t id = 0; id < opt_num_threads; id++) {
+        if (pthread_create(&threads[id], NULL, proxy_worker_main, (void*)id) != 0) {
+            printf("ERROR: failed to create thread!\n");
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t id = 0; id < opt_num_threads; id++) {
+        pthread_join(threads[id], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    free(threads);
+
+    for (size_t i = 0; i < proxy_num_listeners; i++) {
+        close(proxy_listeners[i].fd);
+    }
+    if (opt_proxy_socket != NULL) {
+        unlink(opt_proxy_socket);
+    }
+
+    struct histogram residency;
+    histogram_init(&residency);
+    for (size_t id = 0; id < opt_num_threads; id++) {
+        histogram_merge(&residency, &proxy_residency[id]);
+    }
+
+    uint64_t elapsed_ms = (t_end.tv_sec - t_start.tv_sec) * 1000 + (t_end.tv_nsec - t_start.tv_nsec) / 1000000;
+    printf("===============================================================================\n");
+    printf("proxy ran for %lu ms with %zu workers, %lu clients connected\n", elapsed_ms, opt_num_threads, proxy_clients);
+    printf("proxy forwarded %lu requests for %lu keys (%.0f requests / second)\n", proxy_requests, proxy_keys,
+        elapsed_ms ? proxy_requests * 1000.0 / elapsed_ms : 0.0);
+    server_load_report();
+    printf("proxy time in proxy incl. backend (us) %16s %10s %10s %10s %10s %10s %10s\n", "count", "mean", "p50",
+        "p90", "p99", "p99.9", "max");
+    latency_report_line("requests", &residency);
+    printf("===============================================================================\n");
+
+    key_router_free();
+    free(proxy_residency);
+    return EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shared Memory Server
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the version the shm server reports to its clients
+#define SHM_SERVER_VERSION "loadbalancer-shm"
+
+// the shards of the server's table, enough that workers rarely meet on a lock
+#define SHM_SERVER_SHARDS 256
+
+// the longest a worker sleeps on its bell before it looks for a stop again
+#define SHM_SERVER_SLEEP_NS 100000000L
+
+// set by SIGINT and SIGTERM, the workers stop at their next pass
+static volatile sig_atomic_t shm_server_stop = 0;
+
+// the segment the workers serve, mapped once for all of them
+static struct shmring_segment* shm_server_segment = NULL;
+
+// the items of all clients of the server
+static struct store shm_store;
+
+// the summed up statistics of all workers, merged once they have stopped
+static uint64_t shm_server_requests = 0;
+static uint64_t shm_server_connects = 0;
+static uint64_t shm_server_sleeps = 0;
+static uint64_t shm_server_wakeups = 0;
+
+/**
+ * The server side of a channel. Requests are copied out of the ring before they are parsed, and
+ * responses are gathered in `wbuf` until the response ring has room for them.
+ */
+struct shm_server_channel {
+    struct shmring_conn ring;
+    struct mc_buf rbuf;
+    struct mc_buf wbuf;
+    // the protocol is detected from the first byte the client sends
+    bool binary;
+    bool detected;
+    bool open;
+    // the client asked to quit or sent garbage, its requests are dropped until it closes
+    bool quit;
+};
+
+// a server thread, serving every channel whose index is its id modulo the number of workers
+struct shm_server_worker {
+    size_t id;
+    struct shmring_segment* seg;
+    struct shm_server_channel* channels;
+    size_t num_channels;
+    // the value of a get on its way into a response
+    struct mc_buf value;
+    uint64_t requests;
+    uint64_t connects;
+    uint64_t sleeps;
+    uint64_t wakeups;
+};
+
+static void shm_server_signal(int sig)
+{
+    (void)sig;
+    shm_server_stop = 1;
+}
+
+static void shm_server_encode(struct shm_server_channel* ch, const struct mc_request* r, uint16_t status,
+    const char* key, size_t keylen, const char* extras, size_t extlen, const char* value, size_t vlen)
+{
+    mc_encode_packet(&ch->wbuf, MC_BIN_RES_MAGIC, r->opcode, status, key, keylen, extras, extlen, value, vlen,
+        r->args.opaque);
+}
+
+static void shm_server_get(struct shm_server_worker* w, struct shm_server_channel* ch, const struct mc_request* r)
+{
+    uint32_t flags = 0;
+    if (ch->binary) {
+        mc_buf_consume(&w->value, mc_buf_len(&w->value));
+        if (store_get(&shm_store, r->key, r->keylen, &w->value, &flags)) {
+            char extras[4];
+            mc_put_be32(extras, flags);
+            shm_server_encode(ch, r, MC_BIN_STATUS_OK, r->with_key ? r->key : NULL, r->with_key ? r->keylen : 0,
+                extras, 4, mc_buf_head(&w->value), mc_buf_len(&w->value));
+        } else if (!r->args.quiet) {
+            shm_server_encode(ch, r, MC_BIN_STATUS_NOT_FOUND, NULL, 0, NULL, 0, NULL, 0);
+        }
+        return;
+    }
+
+    // ascii gets carry all their keys separated by spaces
+    const char* s = r->key;
+    const char* end = r->key + r->keylen;
+    const char* key;
+    size_t keylen;
+    while (mc_next_token(&s, end, &key, &keylen)) {
+        mc_buf_consume(&w->value, mc_buf_len(&w->value));
+        if (!store_get(&shm_store, key, keylen, &w->value, &flags)) {
+            continue;
+        }
+        size_t vlen = mc_buf_len(&w->value);
+        char* p = mc_buf_reserve(&ch->wbuf, keylen + vlen + 64);
+        size_t len = sprintf(p, "VALUE %.*s %u %zu\r\n", (int)keylen, key, flags, vlen);
+        memcpy(p + len, mc_buf_head(&w->value), vlen);
+        memcpy(p + len + vlen, "\r\n", 2);
+        mc_buf_commit(&ch->wbuf, len + vlen + 2);
+    }
+    mc_buf_append(&ch->wbuf, "END\r\n", 5);
+}
+
+// answers an update with its status, counters with their new value
+static void shm_server_status(struct shm_server_channel* ch, const struct mc_request* r, uint16_t status,
+    uint64_t number)
+{
+    bool counter = (r->cmd == MC_CMD_INCR || r->cmd == MC_CMD_DECR) && status == MC_BIN_STATUS_OK;
+    if (ch->binary) {
+        if (!r->args.quiet || status != MC_BIN_STATUS_OK) {
+            char extras[8];
+            mc_put_be64(extras, number);
+            shm_server_encode(ch, r, status, NULL, 0, NULL, 0, counter ? extras : NULL, counter ? 8 : 0);
+        }
+        return;
+    }
+    if (r->args.quiet) {
+        return;
+    }
+    if (counter) {
+        char line[32];
+        int len = snprintf(line, sizeof(line), "%lu\r\n", (unsigned long)number);
+        mc_buf_append(&ch->wbuf, line, len);
+        return;
+    }
+    const char* line;
+    if (status == MC_BIN_STATUS_DELTA_BADVAL) {
+        line = "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n";
+    } else if (status == MC_BIN_STATUS_INTERNAL_ERROR) {
+        line = "SERVER_ERROR out of memory storing object\r\n";
+    } else {
+        line = proxy_ascii_status(r->cmd, status);
+    }
+    mc_buf_append(&ch->wbuf, line, strlen(line));
+}
+
+static void shm_server_execute(struct shm_server_worker* w, struct shm_server_channel* ch, const struct mc_request* r)
+{
+    uint64_t number = 0;
+    uint16_t status;
+    switch (r->cmd) {
+    case MC_CMD_GET:
+        shm_server_get(w, ch, r);
+        return;
+    case MC_CMD_SET:
+    case MC_CMD_ADD:
+    case MC_CMD_APPEND: {
+        enum store_mode mode = r->cmd == MC_CMD_SET ? STORE_SET : r->cmd == MC_CMD_ADD ? STORE_ADD : STORE_APPEND;
+        status = store_put(&shm_store, mode, r->key, r->keylen, r->value, r->vlen, r->args.flags);
+        break;
+    }
+    case MC_CMD_DELETE:
+        status = store_delete(&shm_store, r->key, r->keylen);
+        break;
+    case MC_CMD_INCR:
+    case MC_CMD_DECR:
+        status = store_delta(&shm_store, r->key, r->keylen, r->cmd == MC_CMD_INCR, r->args.delta, &number);
+        break;
+    case MC_CMD_NOOP:
+        shm_server_encode(ch, r, MC_BIN_STATUS_OK, NULL, 0, NULL, 0, NULL, 0);
+        return;
+    case MC_CMD_VERSION:
+        if (ch->binary) {
+            shm_server_encode(ch, r, MC_BIN_STATUS_OK, NULL, 0, NULL, 0, SHM_SERVER_VERSION, strlen(SHM_SERVER_VERSION));
+        } else {
+            mc_buf_append(&ch->wbuf, "VERSION " SHM_SERVER_VERSION "\r\n", strlen("VERSION " SHM_SERVER_VERSION "\r\n"));
+        }
+        return;
+    case MC_CMD_QUIT:
+        if (ch->binary && !r->args.quiet) {
+            shm_server_encode(ch, r, MC_BIN_STATUS_OK, NULL, 0, NULL, 0, NULL, 0);
+        }
+        ch->quit = true;
+        return;
+    default:
+        if (ch->binary) {
+            shm_server_encode(ch, r, MC_BIN_STATUS_UNKNOWN_COMMAND, NULL, 0, NULL, 0, NULL, 0);
+        } else {
+            const char* line = r->error != NULL ? r->error : "ERROR\r\n";
+            mc_buf_append(&ch->wbuf, line, strlen(line));
+        }
+        return;
+    }
+    shm_server_status(ch, r, status, number);
+}
+
+/**
+ * Answers all complete requests of the channel. Returns false on a protocol error.
+ */
+static bool shm_server_process(struct shm_server_worker* w, struct shm_server_channel* ch)
+{
+    while (mc_buf_len(&ch->rbuf) > 0 && !ch->quit) {
+        if (!ch->detected) {
+            ch->binary = (uint8_t)mc_buf_head(&ch->rbuf)[0] == MC_BIN_REQ_MAGIC;
+            ch->detected = true;
+        }
+        struct mc_request r;
+        int rv = mc_parse_request(mc_buf_head(&ch->rbuf), mc_buf_len(&ch->rbuf), ch->binary, &r);
+        if (rv == MC_PARSE_INCOMPLETE) {
+            return true;
+        }
+        if (rv == MC_PARSE_ERROR) {
+            return false;
+        }
+        shm_server_execute(w, ch, &r);
+        mc_buf_consume(&ch->rbuf, r.len);
+        w->requests++;
+    }
+    return true;
+}
+
+// forgets the client that gave up the channel and hands the channel out again
+static void shm_server_reset(struct shm_server_channel* ch)
+{
+    struct shmring_channel* c = ch->ring.channel;
+    mc_buf_consume(&ch->rbuf, mc_buf_len(&ch->rbuf));
+    mc_buf_consume(&ch->wbuf, mc_buf_len(&ch->wbuf));
+    ch->detected = false;
+    ch->open = false;
+    ch->quit = false;
+    c->req.head = c->req.tail = 0;
+    c->resp.head = c->resp.tail = 0;
+    c->bell.sleeping = 0;
+    __atomic_store_n(&c->state, SHMRING_FREE, __ATOMIC_RELEASE);
+}
+
+/**
+ * Serves the channel once: resets it if its client gave it up, answers the requests that arrived
+ * and moves the responses into the response ring. Returns true if there was anything to do.
+ */
+static bool shm_server_poll(struct shm_server_worker* w, struct shm_server_channel* ch)
+{
+    uint32_t state = __atomic_load_n(&ch->ring.channel->state, __ATOMIC_ACQUIRE);
+    if (state == SHMRING_FREE) {
+        return false;
+    }
+    if (state == SHMRING_CLOSED) {
+        shm_server_reset(ch);
+        return true;
+    }
+    if (!ch->open) {
+        ch->open = true;
+        w->connects++;
+    }
+
+    bool busy = false;
+    // no more requests are taken while the responses already back up behind a full ring
+    if (mc_buf_len(&ch->wbuf) <= ch->ring.mask && shmring_readable(&ch->ring) > 0) {
+        uint64_t n = shmring_readable(&ch->ring);
+        char* p = mc_buf_reserve(&ch->rbuf, n);
+        mc_buf_commit(&ch->rbuf, shmring_read(&ch->ring, p, n));
+        if (!shm_server_process(w, ch)) {
+            printf("shm:%03zu protocol error on channel %u\n", w->id, ch->ring.index);
+            ch->quit = true;
+        }
+        if (ch->quit) {
+            mc_buf_consume(&ch->rbuf, mc_buf_len(&ch->rbuf));
+        }
+        busy = true;
+    }
+    if (mc_buf_len(&ch->wbuf) > 0) {
+        size_t n = shmring_write(&ch->ring, mc_buf_head(&ch->wbuf), mc_buf_len(&ch->wbuf));
+        if (n > 0) {
+            mc_buf_consume(&ch->wbuf, n);
+            w->wakeups += shmring_notify(ch->ring.tx_bell);
+            busy = true;
+        }
+    }
+    return busy;
+}
+
+// whether a channel has work a worker must not sleep through
+static bool shm_server_pending(struct shm_server_worker* w)
+{
+    for (size_t i = 0; i < w->num_channels; i++) {
+        struct shm_server_channel* ch = &w->channels[i];
+        uint32_t state = __atomic_load_n(&ch->ring.channel->state, __ATOMIC_ACQUIRE);
+        if (state == SHMRING_CLOSED || (state == SHMRING_OPEN && !ch->open)) {
+            return true;
+        }
+        if (state == SHMRING_OPEN && (shmring_readable(&ch->ring) > 0 || mc_buf_len(&ch->wbuf) > 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void shm_server_worker_init(struct shm_server_worker* w, size_t id, struct shmring_segment* seg)
+{
+    memset(w, 0, sizeof(*w));
+    w->id = id;
+    w->seg = seg;
+    w->num_channels = (seg->num_channels - id + seg->num_threads - 1) / seg->num_threads;
+    w->channels = (struct shm_server_channel*)calloc(w->num_channels, sizeof(*w->channels));
+    if (w->channels == NULL) {
+        printf("shm:%03zu failed to allocate memory for the channels\n", id);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < w->num_channels; i++) {
+        struct shm_server_channel* ch = &w->channels[i];
+        shmring_endpoint(&ch->ring, seg, (uint32_t)(id + i * seg->num_threads), true);
+        mc_buf_init(&ch->rbuf, 4096);
+        mc_buf_init(&ch->wbuf, 4096);
+    }
+    mc_buf_init(&w->value, 4096);
+}
+
+static void shm_server_worker_free(struct shm_server_worker* w)
+{
+    for (size_t i = 0; i < w->num_channels; i++) {
+        mc_buf_free(&w->channels[i].rbuf);
+        mc_buf_free(&w->channels[i].wbuf);
+    }
+    free(w->channels);
+    mc_buf_free(&w->value);
+}
+
+static void* shm_server_worker_main(void* arg)
+{
+    struct shm_server_worker w;
+    shm_server_worker_init(&w, (size_t)arg, shm_server_segment);
+    struct shmring_bell* bell = &w.seg->bells[w.id];
+
+    uint64_t t_stop = opt_shm_serve_duration ? timer_now() + timer_ns_to_ticks(opt_shm_serve_duration * 1e9)
+                                             : UINT64_MAX;
+    uint64_t t_interval = timer_now();
+    uint64_t t_print = t_interval + timer_ns_to_ticks(PERIODIC_PRINT_INTERVAL * 1e9);
+    uint64_t interval_requests = 0;
+    size_t idle = 0;
+
+    while (!shm_server_stop) {
+        bool busy = false;
+        for (size_t i = 0; i < w.num_channels; i++) {
+            busy |= shm_server_poll(&w, &w.channels[i]);
+        }
+
+        if (busy) {
+            idle = 0;
+        } else if (++idle < SHMRING_SPINS || opt_shm_wait == SHMRING_SPIN) {
+            shmring_pause();
+        } else {
+            // a client rings the bell only after the announcement, so look once more before sleeping
+            uint32_t seq = shmring_sleep_prepare(bell);
+            if (shm_server_pending(&w)) {
+                shmring_sleep_cancel(bell);
+            } else {
+                shmring_sleep(bell, seq, SHM_SERVER_SLEEP_NS);
+                w.sleeps++;
+            }
+            idle = 0;
+        }
+
+        uint64_t t_now = timer_now();
+        if (t_now >= t_print) {
+            printf("shm:%03zu served %lu requests in %lu ms\n", w.id, w.requests - interval_requests,
+                (uint64_t)(timer_ticks_to_ns(t_now - t_interval) / 1000000));
+            interval_requests = w.requests;
+            t_interval = t_now;
+            t_print = t_now + timer_ns_to_ticks(PERIODIC_PRINT_INTERVAL * 1e9);
+        }
+        if (t_now >= t_stop) {
+            shm_server_stop = 1;
+        }
+    }
+
+    __atomic_fetch_add(&shm_server_requests, w.requests, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shm_server_connects, w.connects, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shm_server_sleeps, w.sleeps, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shm_server_wakeups, w.wakeups, __ATOMIC_RELAXED);
+    shm_server_worker_free(&w);
+    return NULL;
+}
+
+/**
+ * Serves the memcached protocol over the shared memory segment until SIGINT or SIGTERM, or for
+ * --shm-serve-duration seconds if given. Items live in the server's own table and are gone with it.
+ */
+static int shm_server_main(void)
+{
+    printf("=====================================\n");
+    printf("LOADBALANCER SHM SERVER\n");
+    printf("=====================================\n");
+    printf(" - workers = %zu\n", opt_num_threads);
+    printf(" - segment = %s\n", opt_shm_serve);
+    printf(" - channels = %zu\n", opt_shm_channels);
+    printf(" - ring_size = %zu KB\n", opt_shm_ring_size);
+    printf(" - wait = %s\n", opt_shm_wait == SHMRING_SPIN ? "spin" : "futex");
+    printf("------------------------------------------\n");
+
+    if (opt_num_threads > SHMRING_THREADS_MAX || opt_num_threads > opt_shm_channels) {
+        printf("ERROR: the shm server runs at most %d workers and one per channel\n", SHMRING_THREADS_MAX);
+        return EXIT_FAILURE;
+    }
+
+    timer_calibrate();
+    store_init(&shm_store, SHM_SERVER_SHARDS);
+
+    shm_server_segment = shmring_create(opt_shm_serve, (uint32_t)opt_shm_channels, (uint32_t)opt_num_threads,
+        opt_shm_ring_size * 1024);
+    if (shm_server_segment == NULL) {
+        printf("failed to create shm://%s (%s)\n", opt_shm_serve, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, shm_server_signal);
+    signal(SIGTERM, shm_server_signal);
+
+    pthread_t* threads = (pthread_t*)calloc(opt_num_threads, sizeof(pthread_t));
+    if (threads == NULL) {
+        printf("ERROR: failed to allocate memory for threads\n");
+        return EXIT_FAILURE;
+    }
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    for (size_t id = 0; id < opt_num_threads; id++) {
+        if (pthread_create(&threads[id], NULL, shm_server_worker_main, (void*)id) != 0) {
+            printf("ERROR: failed to create thread!\n");
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t id = 0; id < opt_num_threads; id++) {
+        pthread_join(threads[id], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    free(threads);
+
+    // clients still waiting for responses see the shutdown instead of sleeping forever
+    __atomic_store_n(&shm_server_segment->shutdown, 1, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < shm_server_segment->num_channels; i++) {
+        shmring_notify(&shm_server_segment->channels[i].bell);
+    }
+
+    uint64_t items;
+    size_t bytes;
+    store_get_stats(&shm_store, &items, &bytes);
+    uint64_t elapsed_ms = (t_end.tv_sec - t_start.tv_sec) * 1000 + (t_end.tv_nsec - t_start.tv_nsec) / 1000000;
+    printf("===============================================================================\n");
+    printf("shm server ran for %lu ms with %zu workers, %lu clients connected\n", elapsed_ms, opt_num_threads,
+        shm_server_connects);
+    printf("shm server served %lu requests (%.0f requests / second)\n", shm_server_requests,
+        elapsed_ms ? shm_server_requests * 1000.0 / elapsed_ms : 0.0);
+    printf("shm server holds %lu items in %zu bytes\n", items, bytes);
+    printf("shm server workers slept %lu times, woke clients %lu times\n", shm_server_sleeps, shm_server_wakeups);
+    printf("===============================================================================\n");
+
+    shmring_unlink(opt_shm_serve);
+    shmring_detach(shm_server_segment);
+    store_free(&shm_store);
+    return EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Client Overhead
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the CPU time the threads spent in the benchmark phase in ns, summed up over all threads
+static uint64_t client_user_ns = 0;
+static uint64_t client_system_ns = 0;
+
+static uint64_t client_timeval_ns(const struct timeval* tv)
+{
+    return tv->tv_sec * 1000000000UL + tv->tv_usec * 1000UL;
+}
+
+static void client_usage_start(struct rusage* start)
+{
+    if (opt_client_overhead) {
+        getrusage(RUSAGE_THREAD, start);
+    }
+}
+
+static void client_usage_stop(const struct rusage* start)
+{
+    if (!opt_client_overhead) {
+        return;
+    }
+    struct rusage end;
+    getrusage(RUSAGE_THREAD, &end);
+    __atomic_fetch_add(&client_user_ns, client_timeval_ns(&end.ru_utime) - client_timeval_ns(&start->ru_utime),
+        __ATOMIC_RELAXED);
+    __atomic_fetch_add(&client_system_ns, client_timeval_ns(&end.ru_stime) - client_timeval_ns(&start->ru_stime),
+        __ATOMIC_RELAXED);
+}
+
+/**
+ * Prints the CPU time per operation the client spent itself. A thread waiting for a server does not
+ * use CPU, so user time is the cost of drawing keys, encoding requests, parsing responses and
+ * recording them (including the client library), and system time is the cost of the socket calls.
+ */
+static void client_overhead_report(size_t num_queries, uint64_t elapsed_ms)
+{
+    if (num_queries == 0) {
+        return;
+    }
+    double user = (double)client_user_ns / num_queries;
+    double system = (double)client_system_ns / num_queries;
+    double wall = elapsed_ms * 1000000.0 * opt_num_threads / num_queries;
+    printf("benchmark client overhead: %.0f ns user + %.0f ns system CPU per op, of %.0f ns wall time per op "
+        "and thread (%.1f%% busy)\n", user, system, wall, wall > 0 ? 100.0 * (user + system) / wall : 0.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Performance Counters
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the counters of a server process' threads, across all processes
+#define PERF_SERVER_TASKS_MAX 1024
+
+enum perf_phase {
+    PERF_POPULATE,
+    PERF_BENCHMARK,
+    PERF_PHASE_MAX,
+};
+
+static const char* perf_phase_names[PERF_PHASE_MAX] = { "populate", "benchmark" };
+
+// the events of each phase, summed up over the client threads and over the server threads
+static uint64_t perf_client[PERF_PHASE_MAX][PERFCOUNT_MAX];
+static uint64_t perf_server[PERF_PHASE_MAX][PERFCOUNT_MAX];
+// the events every client thread and every server thread could count, as bit masks
+static uint32_t perf_client_events = (1U << PERFCOUNT_MAX) - 1;
+static uint32_t perf_server_events = (1U << PERFCOUNT_MAX) - 1;
+// whether any of the counters leave out the kernel
+static bool perf_user_only = false;
+// the keys populated and the operations executed, the denominators of the reports
+static size_t perf_ops[PERF_PHASE_MAX];
+
+// the server threads, counted by the main thread
+static struct perfcount_group* perf_server_groups;
+static size_t perf_server_num_groups = 0;
+static uint64_t perf_server_start[PERFCOUNT_MAX];
+
+static bool perf_enabled(void)
+{
+    return opt_perf || opt_perf_num_server_pids > 0;
+}
+
+/**
+ * Opens the counters of the calling client thread. The counters of a thread without --perf, or
+ * of one the kernel refused, read as 0 and are left out of the report.
+ */
+static void perf_thread_open(uint64_t tid, struct perfcount_group* g)
+{
+    for (int e = 0; e < PERFCOUNT_MAX; e++) {
+        g->fd[e] = -1;
+    }
+    if (!opt_perf) {
+        return;
+    }
+    if (perfcount_open(g, 0) == 0) {
+        printf("thread:%lu failed to open the performance counters (%s), see /proc/sys/kernel/perf_event_paranoid\n",
+            tid, strerror(errno));
+    }
+    __atomic_fetch_and(&perf_client_events, perfcount_available(g), __ATOMIC_RELAXED);
+    if (g->user_only) {
+        perf_user_only = true;
+    }
+}
+
+// opens the counters of every thread of the server processes, before the benchmark starts
+static void perf_servers_open(void)
+{
+    if (opt_perf_num_server_pids == 0) {
+        return;
+    }
+    perf_server_groups = (struct perfcount_group*)calloc(PERF_SERVER_TASKS_MAX, sizeof(*perf_server_groups));
+    if (perf_server_groups == NULL) {
+        printf("ERROR: failed to allocate memory for the performance counters\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < opt_perf_num_server_pids; i++) {
+        size_t n = perfcount_open_process(opt_perf_server_pids[i], &perf_server_groups[perf_server_num_groups],
+            PERF_SERVER_TASKS_MAX - perf_server_num_groups);
+        if (n == 0) {
+            printf("failed to open the performance counters of server pid %d (%s)\n", (int)opt_perf_server_pids[i],
+                strerror(errno));
+        }
+        perf_server_num_groups += n;
+    }
+    for (size_t i = 0; i < perf_server_num_groups; i++) {
+        perf_server_events &= perfcount_available(&perf_server_groups[i]);
+        perf_user_only |= perf_server_groups[i].user_only;
+    }
+    if (perf_server_num_groups == 0) {
+        perf_server_events = 0;
+    }
+}
+
+static void perf_servers_close(void)
+{
+    for (size_t i = 0; i < perf_server_num_groups; i++) {
+        perfcount_close(&perf_server_groups[i]);
+    }
+    free(perf_server_groups);
+}
+
+// reads the counters of the groups, summed up
+static void perf_read(const struct perfcount_group* groups, size_t n, uint64_t* values)
+{
+    memset(values, 0, PERFCOUNT_MAX * sizeof(*values));
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v[PERFCOUNT_MAX];
+        perfcount_read(&groups[i], v);
+        for (int e = 0; e < PERFCOUNT_MAX; e++) {
+            values[e] += v[e];
+        }
+    }
+}
+
+// adds the events since `start` to the totals of a phase
+static void perf_phase_add(const struct perfcount_group* groups, size_t n, const uint64_t* start, uint64_t* totals)
+{
+    uint64_t end[PERFCOUNT_MAX];
+    perf_read(groups, n, end);
+    for (int e = 0; e < PERFCOUNT_MAX; e++) {
+        __atomic_fetch_add(&totals[e], end[e] - start[e], __ATOMIC_RELAXED);
+    }
+}
+
+// the main thread marks the phase boundaries of the servers, right after the barriers
+static void perf_servers_begin(void)
+{
+    perf_read(perf_server_groups, perf_server_num_groups, perf_server_start);
+}
+
+static void perf_servers_end(enum perf_phase phase)
+{
+    perf_phase_add(perf_server_groups, perf_server_num_groups, perf_server_start, perf_server[phase]);
+}
+
+static void perf_report_line(const char* name, const uint64_t* totals, uint32_t events, size_t num_ops)
+{
+    printf("  %-10s", name);
+    for (int e = 0; e < PERFCOUNT_MAX; e++) {
+        if (events & (1U << e)) {
+            printf(" %13.1f", num_ops ? (double)totals[e] / num_ops : 0.0);
+        } else {
+            printf(" %13s", "n/a");
+        }
+    }
+    uint32_t ipc = (1U << PERFCOUNT_CYCLES) | (1U << PERFCOUNT_INSTRUCTIONS);
+    if ((events & ipc) == ipc && totals[PERFCOUNT_CYCLES] > 0) {
+        printf(" %6.2f\n", (double)totals[PERFCOUNT_INSTRUCTIONS] / totals[PERFCOUNT_CYCLES]);
+    } else {
+        printf(" %6s\n", "n/a");
+    }
+}
+
+/**
+ * Prints the events of the phase per key populated or per operation executed, for the client
+ * threads and for the server threads. Must only be called after the phase's closing barrier.
+ */
+static void perf_report(enum perf_phase phase, size_t num_ops)
+{
+    perf_ops[phase] = num_ops;
+    printf("%s performance counters per %s (%zu, %s):\n", perf_phase_names[phase],
+        phase == PERF_POPULATE ? "key" : "op", num_ops, perf_user_only ? "user mode only" : "user and kernel mode");
+    printf("  %-10s", "");
+    for (int e = 0; e < PERFCOUNT_MAX; e++) {
+        printf(" %13s", perfcount_event_names[e]);
+    }
+    printf(" %6s\n", "IPC");
+    if (opt_perf) {
+        perf_report_line("client", perf_client[phase], perf_client_events, num_ops);
+    }
+    if (opt_perf_num_server_pids > 0) {
+        char name[32];
+        snprintf(name, sizeof(name), "servers(%zu)", perf_server_num_groups);
+        perf_report_line(name, perf_server[phase], perf_server_events, num_ops);
+    }
+}
+
+static void perf_json_side(struct results_json* j, const char* key, const uint64_t* totals, uint32_t events,
+    size_t num_ops)
+{
+    results_json_object_begin(j, key);
+    for (int e = 0; e < PERFCOUNT_MAX; e++) {
+        if (!(events & (1U << e))) {
+            continue;
+        }
+        // JSON keys with underscores, like the rest of the results
+        char name[64];
+        size_t len = snprintf(name, sizeof(name), "%s", perfcount_event_names[e]);
+        for (size_t c = 0; c < len; c++) {
+            name[c] = name[c] == '-' ? '_' : name[c];
+        }
+        results_json_uint(j, name, totals[e]);
+        snprintf(name + len, sizeof(name) - len, "_per_op");
+        results_json_double(j, name, num_ops ? (double)totals[e] / num_ops : 0.0);
+    }
+    results_json_object_end(j);
+}
+
+// writes the counters of both phases into the results
+static void perf_json(struct results_json* j)
+{
+    results_json_object_begin(j, "perf");
+    results_json_bool(j, "user_only", perf_user_only);
+    for (int phase = 0; phase < PERF_PHASE_MAX; phase++) {
+        results_json_object_begin(j, perf_phase_names[phase]);
+        results_json_uint(j, "ops", perf_ops[phase]);
+        if (opt_perf) {
+            perf_json_side(j, "client", perf_client[phase], perf_client_events, perf_ops[phase]);
+        }
+        if (opt_perf_num_server_pids > 0) {
+            perf_json_side(j, "servers", perf_server[phase], perf_server_events, perf_ops[phase]);
+        }
+        results_json_object_end(j);
+    }
+    results_json_object_end(j);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Run Control
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the time cap of adaptive runs without a query duration in seconds
+#define RUN_CONTROL_CAP_S 600
+// a measured repeat: the throughput of its intervals in operations per second
+struct run_repeat {
+    struct steady_stats intervals;
+    double seconds;
+    // whether its confidence interval got within the target before the run ended
+    bool converged;
+};
+
+// the queries a thread completed so far, read by the run controller
+struct run_progress {
+    uint64_t queries;
+} __attribute__((aligned(64)));
+
+static struct run_progress* run_progress = NULL;
+// bumped when the measurement starts, the threads then drop what they recorded during the warm-up
+static uint32_t run_epoch = 0;
+// set by the run controller once it has measured enough, the threads stop
+static bool run_stopping = false;
+// the threads that left the benchmark loop, e.g. after their --x-benchmark-num-queries
+static size_t run_threads_done = 0;
+// the warm-up that was discarded and the throughput's coefficient of variation that ended it
+static bool run_warmed_up = false;
+static double run_warmup_s = 0.0;
+static double run_warmup_cv = INFINITY;
+// the repeats measured after the warm-up
+static struct run_repeat run_repeats[RUN_CONTROL_REPEATS_MAX];
+static size_t run_num_repeats = 0;
+
+static bool run_control_enabled(void)
+{
+    return opt_steady_state;
+}
+
+static void run_control_init(void)
+{
+    if (!run_control_enabled()) {
+        return;
+    }
+    size_t size = opt_num_threads * sizeof(*run_progress);
+    run_progress = (struct run_progress*)aligned_alloc(64, size);
+    if (run_progress == NULL) {
+        printf("ERROR: failed to allocate memory for the run control\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(run_progress, 0, size);
+}
+
+static uint64_t run_control_cap_s(void)
+{
+    return opt_duration ? opt_duration : RUN_CONTROL_CAP_S;
+}
+
+static void run_control_describe(void)
+{
+    printf(" - steady_state = warm-up until the cv is within %.1f%% over %zu intervals of %zu ms, %zu repeats until "
+        "the 95%% CI is within %.1f%%, at most %lu s\n", opt_warmup_cv * 100.0, opt_steady_window,
+        opt_steady_interval, opt_repeats, opt_ci_target * 100.0, run_control_cap_s());
+}
+
+// publishes the thread's queries, returns true once when the warm-up has ended
+static inline bool run_control_poll(uint64_t tid, size_t queries, uint32_t* epoch)
+{
+    __atomic_store_n(&run_progress[tid].queries, queries, __ATOMIC_RELAXED);
+    uint32_t current = __atomic_load_n(&run_epoch, __ATOMIC_ACQUIRE);
+    if (current == *epoch) {
+        return false;
+    }
+    *epoch = current;
+    return true;
+}
+
+static inline bool run_control_stopped(void)
+{
+    return __atomic_load_n(&run_stopping, __ATOMIC_RELAXED);
+}
+
+// counts the thread out of the benchmark loop
+static void run_control_thread_done(void)
+{
+    if (run_control_enabled()) {
+        __atomic_fetch_add(&run_threads_done, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static uint64_t run_control_queries(void)
+{
+    uint64_t queries = 0;
+    for (size_t tid = 0; tid < opt_num_threads; tid++) {
+        queries += __atomic_load_n(&run_progress[tid].queries, __ATOMIC_RELAXED);
+    }
+    return queries;
+}
+
+// starts the next repeat, returns false once all have been measured
+static bool run_control_next_repeat(void)
+{
+    if (run_num_repeats == opt_repeats) {
+        return false;
+    }
+    struct run_repeat* r = &run_repeats[run_num_repeats++];
+    steady_stats_init(&r->intervals);
+    r->seconds = 0.0;
+    r->converged = false;
+    return true;
+}
+
+/**
+ * Drives the benchmark phase of an adaptive run from the main thread. It samples the throughput of
+ * all threads in intervals. The warm-up ends once the throughput's coefficient of variation over the
+ * last intervals is within the threshold, the threads then drop what they recorded so far. Each
+ * repeat is measured until the 95% confidence interval of its mean interval throughput is within
+ * the target. The run stops after the last repeat, at the time cap, or once the threads ran out of
+ * queries. Returns the seconds measured after the warm-up, 0 if it never ended.
+ */
+static double run_control_main(void)
+{
+    if (!run_control_enabled()) {
+        return 0.0;
+    }
+    uint64_t interval = timer_ns_to_ticks(opt_steady_interval * 1e6);
+    uint64_t cap = timer_ns_to_ticks(run_control_cap_s() * 1e9);
+    uint64_t t_begin = timer_now();
+    uint64_t t_last = t_begin;
+    uint64_t t_measure = 0;
+    uint64_t t_repeat = 0;
+    uint64_t queries_last = run_control_queries();
+    struct steady_window window;
+    steady_window_init(&window, opt_steady_window);
+
+    while (__atomic_load_n(&run_threads_done, __ATOMIC_ACQUIRE) < opt_num_threads) {
+        uint64_t now = timer_now();
+        if (now < t_last + interval) {
+            double remaining_ns = timer_ticks_to_ns(t_last + interval - now);
+            struct timespec ts = { (time_t)(remaining_ns / 1e9), (long)fmod(remaining_ns, 1e9) };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        uint64_t queries = run_control_queries();
+        double rate = (queries - queries_last) * 1e9 / timer_ticks_to_ns(now - t_last);
+        queries_last = queries;
+        t_last = now;
+
+        if (!run_warmed_up) {
+            steady_window_push(&window, rate);
+            if (steady_window_full(&window) && (run_warmup_cv = steady_window_cv(&window)) <= opt_warmup_cv) {
+                run_warmed_up = true;
+                run_warmup_s = timer_ticks_to_ns(now - t_begin) / 1e9;
+                t_measure = now;
+                t_repeat = now;
+                run_control_next_repeat();
+                __atomic_fetch_add(&run_epoch, 1, __ATOMIC_RELEASE);
+                printf("steady state: warm-up over after %.1f s, throughput cv %.2f%% over the last %zu intervals\n",
+                    run_warmup_s, run_warmup_cv * 100.0, window.size);
+            }
+        } else {
+            struct run_repeat* r = &run_repeats[run_num_repeats - 1];
+            steady_stats_add(&r->intervals, rate);
+            r->seconds = timer_ticks_to_ns(now - t_repeat) / 1e9;
+            double ci = steady_stats_ci95(&r->intervals);
+            if (r->intervals.n >= opt_steady_window && ci <= opt_ci_target * r->intervals.mean) {
+                r->converged = true;
+                printf("steady state: repeat %zu: %.0f ops/s +- %.2f%% over %zu intervals\n", run_num_repeats,
+                    r->intervals.mean, 100.0 * ci / r->intervals.mean, r->intervals.n);
+                t_repeat = now;
+                if (!run_control_next_repeat()) {
+                    break;
+                }
+            }
+        }
+        if (now - t_begin >= cap) {
+            printf("steady state: stopping at the cap of %lu s, %s\n", run_control_cap_s(),
+                run_warmed_up ? "the last repeat did not converge" : "the warm-up did not end");
+            break;
+        }
+    }
+
+    __atomic_store_n(&run_stopping, true, __ATOMIC_RELAXED);
+    // a repeat without a single interval is dropped
+    if (run_num_repeats > 0 && run_repeats[run_num_repeats - 1].intervals.n == 0) {
+        run_num_repeats--;
+    }
+    return t_measure ? timer_ticks_to_ns(timer_now() - t_measure) / 1e9 : 0.0;
+}
+
+// the mean throughput over the repeats, or over the intervals of a single repeat, with its 95% CI
+static void run_control_throughput(double* mean, double* ci, size_t* n)
+{
+    struct steady_stats means;
+    steady_stats_init(&means);
+    for (size_t i = 0; i < run_num_repeats; i++) {
+        steady_stats_add(&means, run_repeats[i].intervals.mean);
+    }
+    const struct steady_stats* s = run_num_repeats == 1 ? &run_repeats[0].intervals : &means;
+    *mean = s->mean;
+    *ci = steady_stats_ci95(s);
+    *n = s->n;
+}
+
+// must only be called once the threads have been joined
+static void run_control_report(void)
+{
+    if (!run_control_enabled()) {
+        return;
+    }
+    if (!run_warmed_up && !isfinite(run_warmup_cv)) {
+        printf("benchmark steady state not reached: fewer than %zu intervals, the results include the warm-up\n",
+            opt_steady_window);
+        return;
+    }
+    if (!run_warmed_up) {
+        printf("benchmark steady state not reached: throughput cv %.2f%% over the last %zu intervals (target %.1f%%), "
+            "the results include the warm-up\n", run_warmup_cv * 100.0, opt_steady_window, opt_warmup_cv * 100.0);
+        return;
+    }
+    printf("benchmark steady state: warm-up of %.1f s discarded, throughput cv %.2f%% over %zu intervals of %zu ms\n",
+        run_warmup_s, run_warmup_cv * 100.0, opt_steady_window, opt_steady_interval);
+    for (size_t i = 0; i < run_num_repeats; i++) {
+        const struct run_repeat* r = &run_repeats[i];
+        printf("  repeat %2zu: %14.0f ops/s +- %6.2f%% over %4zu intervals (%.1f s)%s\n", i + 1, r->intervals.mean,
+            100.0 * steady_stats_ci95(&r->intervals) / r->intervals.mean, r->intervals.n, r->seconds,
+            r->converged ? "" : ", not converged");
+    }
+    if (run_num_repeats == 0) {
+        return;
+    }
+    double mean, ci;
+    size_t n;
+    run_control_throughput(&mean, &ci, &n);
+    printf("benchmark throughput %.0f +- %.0f queries / second (95%% CI over %zu %s)\n", mean, ci, n,
+        run_num_repeats == 1 ? "intervals" : "repeats");
+}
+
+static void run_control_json(struct results_json* j)
+{
+    results_json_object_begin(j, "steady_state");
+    results_json_int(j, "warmed_up", run_warmed_up);
+    results_json_double(j, "warmup_s", run_warmup_s);
+    results_json_double(j, "warmup_cv", isfinite(run_warmup_cv) ? run_warmup_cv : -1.0);
+    if (run_num_repeats > 0) {
+        double mean, ci;
+        size_t n;
+        run_control_throughput(&mean, &ci, &n);
+        results_json_double(j, "throughput_qps", mean);
+        results_json_double(j, "ci95_qps", isfinite(ci) ? ci : -1.0);
+    }
+    results_json_array_begin(j, "repeats");
+    for (size_t i = 0; i < run_num_repeats; i++) {
+        const struct run_repeat* r = &run_repeats[i];
+        double ci = steady_stats_ci95(&r->intervals);
+        results_json_object_begin(j, NULL);
+        results_json_double(j, "throughput_qps", r->intervals.mean);
+        results_json_double(j, "ci95_qps", isfinite(ci) ? ci : -1.0);
+        results_json_uint(j, "intervals", r->intervals.n);
+        results_json_double(j, "seconds", r->seconds);
+        results_json_int(j, "converged", r->converged);
+        results_json_object_end(j);
+    }
+    results_json_array_end(j);
+    results_json_object_end(j);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Results
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool results_enabled(void)
+{
+    return opt_results_json != NULL || opt_results_csv != NULL;
+}
+
+// the transport of the servers: tcp, unix, shm, mixed, or inproc for the in-process backend
+static const char* results_transport(void)
+{
+    if (inproc_enabled()) {
+        return "inproc";
+    }
+    enum server_transport transport = opt_server_info.servers[0].transport;
+    for (size_t i = 1; i < opt_server_info.num_servers; i++) {
+        if (opt_server_info.servers[i].transport != transport) {
+            return "mixed";
+        }
+    }
+    return server_transport_names[transport];
+}
+
+static void results_json_latency(struct results_json* j, const char* key, const struct histogram* h)
+{
+    results_json_object_begin(j, key);
+    results_json_uint(j, "count", h->count);
+    results_json_double(j, "mean_us", timer_ticks_to_ns(histogram_mean(h)) / 1000.0);
+    results_json_double(j, "p50_us", timer_ticks_to_ns(histogram_percentile(h, 50.0)) / 1000.0);
+    results_json_double(j, "p90_us", timer_ticks_to_ns(histogram_percentile(h, 90.0)) / 1000.0);
+    results_json_double(j, "p99_us", timer_ticks_to_ns(histogram_percentile(h, 99.0)) / 1000.0);
+    results_json_double(j, "p999_us", timer_ticks_to_ns(histogram_percentile(h, 99.9)) / 1000.0);
+    results_json_double(j, "max_us", timer_ticks_to_ns(h->max) / 1000.0);
+    results_json_object_end(j);
+}
+
+static void results_json_config(struct results_json* j)
+{
+    char buf[256];
+    results_json_object_begin(j, "config");
+    results_json_array_begin(j, "servers");
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        server_name(i, buf, sizeof(buf));
+        results_json_string(j, NULL, buf);
+    }
+    results_json_array_end(j);
+    results_json_string(j, "transport", results_transport());
+    results_json_bool(j, "binary", opt_binary);
+    results_json_uint(j, "num_threads", opt_num_threads);
+    results_json_uint(j, "agents", coord_count);
+    results_json_string(j, "engine", engine_name(opt_engine));
+    results_json_uint(j, "conns_per_server", opt_conns_per_server);
+    results_json_uint(j, "pipeline_depth", opt_pipeline_depth);
+    results_json_uint(j, "batch_size", opt_batch_size);
+    results_json_string(j, "populate", populate_name(opt_populate));
+    results_json_string(j, "router", router_kind_name(opt_router));
+    results_json_string(j, "key_dist", keydist_kind_name(opt_key_dist));
+    results_json_double(j, "zipf_theta", opt_zipf_theta);
+    workload_describe(&opt_workload, buf, sizeof(buf));
+    results_json_string(j, "op_mix", buf);
+    sizedist_describe(&opt_key_size, buf, sizeof(buf));
+    results_json_string(j, "key_size", buf);
+    sizedist_describe(&opt_value_size, buf, sizeof(buf));
+    results_json_string(j, "value_size", buf);
+    results_json_uint(j, "max_mem_mb", opt_max_mem);
+    results_json_uint(j, "num_queries", opt_num_queries);
+    results_json_uint(j, "duration_s", opt_duration);
+    results_json_uint(j, "near_cache_mb", opt_near_cache);
+    results_json_string(j, "placement", placement_kind_name(opt_placement));
+    results_json_uint(j, "replicas", opt_replicas);
+    results_json_string(j, "read_policy", replica_policy_name(opt_read_policy));
+    results_json_bool(j, "open_loop", open_loop_enabled());
+    results_json_object_end(j);
+}
+
+/**
+ * Writes the configuration, the summary, the latency percentiles per server and operation, and
+ * the per-second time series of the run as one JSON document.
+ */
+static void results_write_json(size_t num_queries, size_t num_missed, size_t num_errors, uint64_t elapsed_ms,
+    const struct histogram* merged, const struct histogram* all)
+{
+    FILE* f = fopen(opt_results_json, "w");
+    if (f == NULL) {
+        printf("failed to open the results file %s (%s)\n", opt_results_json, strerror(errno));
+        return;
+    }
+
+    struct results_json j;
+    results_json_init(&j, f);
+    results_json_object_begin(&j, NULL);
+
+    results_json_object_begin(&j, "meta");
+    for (size_t i = 0; i < opt_num_meta; i++) {
+        char key[128];
+        const char* eq = strchr(opt_meta[i], '=');
+        snprintf(key, sizeof(key), "%.*s", (int)(eq - opt_meta[i]), opt_meta[i]);
+        results_json_string(&j, key, eq + 1);
+    }
+    results_json_object_end(&j);
+
+    results_json_config(&j);
+    if (run_control_enabled()) {
+        run_control_json(&j);
+    }
+
+    results_json_object_begin(&j, "summary");
+    results_json_uint(&j, "elapsed_ms", elapsed_ms);
+    results_json_uint(&j, "queries", num_queries);
+    results_json_uint(&j, "missed", num_missed);
+    results_json_uint(&j, "errors", num_errors);
+    results_json_double(&j, "throughput_qps", elapsed_ms ? num_queries * 1000.0 / elapsed_ms : 0.0);
+    results_json_object_end(&j);
+
+    results_json_object_begin(&j, "latency");
+    results_json_latency(&j, "overall", all);
+    results_json_array_begin(&j, "servers");
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        results_json_latency(&j, NULL, &merged[i]);
+    }
+    results_json_array_end(&j);
+    results_json_object_begin(&j, "ops");
+    for (int op = 0; op < WORKLOAD_OP_MAX; op++) {
+        if (merged[opt_server_info.num_servers + op].count > 0) {
+            results_json_latency(&j, workload_op_names[op], &merged[opt_server_info.num_servers + op]);
+        }
+    }
+    results_json_object_end(&j);
+    results_json_object_end(&j);
+
+    results_json_object_begin(&j, "operations");
+    for (int op = 0; op < WORKLOAD_OP_MAX; op++) {
+        size_t count = op_stats[op].hits + op_stats[op].misses + op_stats[op].errors;
+        if (count == 0) {
+            continue;
+        }
+        results_json_object_begin(&j, workload_op_names[op]);
+        results_json_uint(&j, "count", count);
+        results_json_uint(&j, "hits", op_stats[op].hits);
+        results_json_uint(&j, "misses", op_stats[op].misses);
+        results_json_uint(&j, "errors", op_stats[op].errors);
+        results_json_object_end(&j);
+    }
+    results_json_object_end(&j);
+
+    if (perf_enabled()) {
+        perf_json(&j);
+    }
+
+    results_json_array_begin(&j, "series");
+    for (size_t slot = 0; latency_series_enabled() && slot < latency_series_slots; slot++) {
+        struct histogram h;
+        struct latency_series_outcomes outcomes;
+        latency_series_merge(slot, &h, &outcomes);
+        if (h.count == 0) {
+            continue;
+        }
+        results_json_object_begin(&j, NULL);
+        results_json_uint(&j, "second", slot);
+        results_json_uint(&j, "ops", h.count);
+        results_json_uint(&j, "get_misses", outcomes.get_misses);
+        results_json_uint(&j, "errors", outcomes.errors);
+        if (membership_elastic()) {
+            results_json_uint(&j, "members", membership_members_at(slot));
+        }
+        results_json_double(&j, "mean_us", timer_ticks_to_ns(histogram_mean(&h)) / 1000.0);
+        results_json_double(&j, "p50_us", timer_ticks_to_ns(histogram_percentile(&h, 50.0)) / 1000.0);
+        results_json_double(&j, "p99_us", timer_ticks_to_ns(histogram_percentile(&h, 99.0)) / 1000.0);
+        results_json_double(&j, "max_us", timer_ticks_to_ns(h.max) / 1000.0);
+        results_json_object_end(&j);
+    }
+    results_json_array_end(&j);
+
+    results_json_object_end(&j);
+    fclose(f);
+}
+
+/**
+ * Appends one summary row to the CSV file, starting the file with a header if it is empty.
+ */
+static void results_write_csv(size_t num_queries, size_t num_missed, size_t num_errors, uint64_t elapsed_ms,
+    const struct histogram* all)
+{
+    FILE* f = fopen(opt_results_csv, "a");
+    if (f == NULL) {
+        printf("failed to open the results file %s (%s)\n", opt_results_csv, strerror(errno));
+        return;
+    }
+    if (ftell(f) == 0) {
+        fputs("meta,servers,transport,threads,engine,pipeline_depth,batch_size,op_mix,key_dist,value_size,"
+              "elapsed_ms,queries,missed,errors,throughput_qps,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n", f);
+    }
+
+    char buf[512];
+    buf[0] = 0;
+    for (size_t i = 0; i < opt_num_meta; i++) {
+        size_t len = strlen(buf);
+        snprintf(buf + len, sizeof(buf) - len, "%s%s", i ? ";" : "", opt_meta[i]);
+    }
+    results_csv_field(f, buf, false);
+    fprintf(f, "%zu,%s,%zu,%s,%zu,%zu,", opt_server_info.num_servers, results_transport(), opt_num_threads,
+        engine_name(opt_engine), opt_pipeline_depth, opt_batch_size);
+    workload_describe(&opt_workload, buf, sizeof(buf));
+    results_csv_field(f, buf, false);
+    results_csv_field(f, keydist_kind_name(opt_key_dist), false);
+    sizedist_describe(&opt_value_size, buf, sizeof(buf));
+    results_csv_field(f, buf, false);
+    fprintf(f, "%lu,%zu,%zu,%zu,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", elapsed_ms, num_queries, num_missed,
+        num_errors, elapsed_ms ? num_queries * 1000.0 / elapsed_ms : 0.0,
+        timer_ticks_to_ns(histogram_mean(all)) / 1000.0,
+        timer_ticks_to_ns(histogram_percentile(all, 50.0)) / 1000.0,
+        timer_ticks_to_ns(histogram_percentile(all, 90.0)) / 1000.0,
+        timer_ticks_to_ns(histogram_percentile(all, 99.0)) / 1000.0,
+        timer_ticks_to_ns(histogram_percentile(all, 99.9)) / 1000.0, timer_ticks_to_ns(all->max) / 1000.0);
+    fclose(f);
+}
+
+// writes the requested result files, once the threads have been joined
+static void results_write(size_t num_queries, size_t num_missed, size_t num_errors, uint64_t elapsed_ms)
+{
+    if (!results_enabled()) {
+        return;
+    }
+
+    size_t per_thread = latency_per_thread();
+    struct histogram* merged = (struct histogram*)calloc(per_thread + 1, sizeof(*merged));
+    if (merged == NULL) {
+        printf("ERROR: failed to allocate memory for the results\n");
+        return;
+    }
+    for (size_t i = 0; i < per_thread + 1; i++) {
+        histogram_init(&merged[i]);
+    }
+    latency_merge(merged);
+    struct histogram* all = &merged[per_thread];
+    for (size_t i = 0; i < opt_server_info.num_servers; i++) {
+        histogram_merge(all, &merged[i]);
+    }
+    histogram_merge(all, &merged[latency_near_cache_slot()]);
+
+    if (opt_results_json != NULL) {
+        results_write_json(num_queries, num_missed, num_errors, elapsed_ms, merged, all);
+    }
+    if (opt_results_csv != NULL) {
+        results_write_csv(num_queries, num_missed, num_errors, elapsed_ms, all);
+    }
+    free(merged);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Benchmark Function
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+pthread_barrier_t barrier;
+
+size_t num_queries = 0;
+size_t num_missed = 0;
+size_t num_errors = 0;
+size_t num_populated = 0;
+size_t num_batches = 0;
+
+// waits for the other threads, and in coordinated runs for the threads of all agents
+static void barrier_wait(void)
+{
+    pthread_barrier_wait(&barrier);
+    if (agent_enabled()) {
+        // the main thread opens it once every agent is there
+        pthread_barrier_wait(&barrier);
+    }
+}
+
+// the main thread's side of barrier_wait()
+static void barrier_wait_main(void)
+{
+    pthread_barrier_wait(&barrier);
+    if (agent_enabled()) {
+        agent_barrier();
+        pthread_barrier_wait(&barrier);
+    }
+}
 
 void* thread_main(void* arg)
 {
@@ -245,11 +8059,17 @@ void* thread_main(void* arg)
     uint64_t tid = (uint64_t)arg;
 
     printf("thread:%03zu started\n", tid);
+    placement_bind_thread(tid);
 
     struct xor_shift rand;
-    xor_shift_init(&rand, tid);
+    xor_shift_init(&rand, coord_thread_id(tid));
 
-    pthread_barrier_wait(&barrier);
+    struct perfcount_group perf;
+    uint64_t perf_start[PERFCOUNT_MAX];
+    perf_thread_open(tid, &perf);
+
+    barrier_wait();
+    perf_read(&perf, 1, perf_start);
 
     // ---------------------------------------------------------------------------------------------
     // Init Phase
@@ -273,8 +8093,15 @@ void* thread_main(void* arg)
             exit(EXIT_FAILURE);
         }
         memcached_behavior_set(memc[i], MEMCACHED_BEHAVIOR_BINARY_PROTOCOL, (uint64_t)opt_binary);
+        if (workload_has_op(&opt_workload, WORKLOAD_CAS)) {
+            memcached_behavior_set(memc[i], MEMCACHED_BEHAVIOR_SUPPORT_CAS, 1);
+        }
 
-        if (opt_server_info.servers[i].is_unix) {
+        if (opt_server_info.servers[i].transport == SERVER_SHM || inproc_enabled()) {
+            // only the native engines speak to shared memory servers, in-process tables need no
+            // connection, the client stays empty
+            continue;
+        } else if (opt_server_info.servers[i].transport == SERVER_UNIX) {
             if (opt_verbose) {
                 printf("thread:%lu connecting to unix://%s\n", tid, opt_server_info.servers[i].ux.path);
             }
@@ -297,6 +8124,13 @@ void* thread_main(void* arg)
     bool had_failure = false;
     for (size_t i = 0; i < opt_server_info.num_servers; i++) {
         memcached_st* m = memc[i];
+        if (opt_server_info.servers[i].transport == SERVER_SHM || inproc_enabled()) {
+            continue;
+        }
+        if (i >= opt_initial_servers) {
+            // servers that join later need not be up yet
+            continue;
+        }
 
         string = (char*)"my data";
         const char* key = "abc";
@@ -351,32 +8185,45 @@ void* thread_main(void* arg)
     // Population Phase
     // ---------------------------------------------------------------------------------------------
 
-    size_t num_keys = (opt_max_mem << 20) / ITEM_SIZE; // how much memory it stores
+    size_t num_keys = key_dist.num_keys; // how much memory it stores
     size_t num_not_added = 0;
     size_t num_existed = 0;
     size_t num_keys_added = 0;
 
     printf("thread:%03zu populating\n", tid);
 
-    for (size_t i = tid; i < num_keys; i += opt_num_threads) {
-        if (i % (num_keys/ 10) == 0) {
-            printf("thread:%lu added %zu keys to %zu servers\n", tid, num_keys_added, opt_server_info.num_servers);
-        }
-
-        char key[KEY_SIZE + 1];
-        snprintf(key, KEY_SIZE + 1, "%08x", (unsigned int)i);
+    if (opt_populate == POPULATE_BULK) {
+        num_keys_added = populate_bulk(tid, num_keys, &num_not_added);
+    } else {
+        char* value = item_value_alloc();
+        for (size_t i = coord_thread_id(tid); i < num_keys; i += coord_num_threads()) {
+            if (i % (num_keys/ 10) == 0) {
+                printf("thread:%lu added %zu keys to %zu servers\n", tid, num_keys_added, opt_server_info.num_servers);
+            }
 
-        char value[VALUE_SIZE + 1];
-        snprintf(value, VALUE_SIZE, "value-%016lx", i);
+            char key[KEY_MAX + 1];
+            size_t keylen = item_format_key(key, WORKLOAD_SET, i);
+            size_t vlen = item_format_value(value, i);
 
-        memcached_st* m = memc[i % opt_server_info.num_servers];
-        rc = memcached_set(m, key, KEY_SIZE, value, VALUE_SIZE,
-            0 /* expires */, 0 /* flags */);
-        if (memcached_failed(rc)) {
-            num_not_added++;
-        } else {
-            num_keys_added++;
+            size_t replicas[SERVER_MAX];
+            size_t num_replicas = key_replicas(i, opt_replicas, replicas);
+            bool failed = false;
+            for (size_t r = 0; r < num_replicas; r++) {
+                if (inproc_enabled()) {
+                    rc = inproc_result(store_put(&inproc_stores[replicas[r]], STORE_SET, key, keylen, value, vlen, 0));
+                } else {
+                    rc = memcached_set(memc[replicas[r]], key, keylen, value, vlen,
+                        0 /* expires */, 0 /* flags */);
+                }
+                failed |= memcached_failed(rc);
+            }
+            if (failed) {
+                num_not_added++;
+            } else {
+                num_keys_added++;
+            }
         }
+        free(value);
     }
 
     __atomic_fetch_add(&num_populated, num_keys_added, __ATOMIC_RELAXED);
@@ -385,9 +8232,14 @@ void* thread_main(void* arg)
              tid, num_keys_added, num_not_added, num_existed, opt_server_info.num_servers);
 
     printf("thread:%03zu ready\n", tid);
-    pthread_barrier_wait(&barrier);
-    sleep(1);
-    pthread_barrier_wait(&barrier);
+    perf_phase_add(&perf, 1, perf_start, perf_client[PERF_POPULATE]);
+    barrier_wait();
+    if (!run_control_enabled()) {
+        // adaptive runs discard their warm-up instead
+        sleep(1);
+    }
+    barrier_wait();
+    perf_read(&perf, 1, perf_start);
 
     // ---------------------------------------------------------------------------------------------
     // Benchmark Phase
@@ -395,9 +8247,10 @@ void* thread_main(void* arg)
 
     printf("execute: thread:%zu startes executing\n", tid);
 
-    size_t num_success = 0;
-    size_t num_not_found = 0;
-    size_t num_erroneous = 0;
+    struct op_context ctx;
+    op_context_init(&ctx, tid, memc);
+    ctx.progress = server_stats_thread_progress(tid);
+    native_replica_connect(ctx.replica, tid);
 
     struct timeval thread_start, thread_current, thread_elapsed, thread_stop;
     thread_current.tv_usec = 0;
@@ -416,65 +8269,103 @@ void* thread_main(void* arg)
     timeradd(&thread_start, &thread_current, &thread_stop);
 
     size_t thread_queries = 0;
+    size_t thread_batches = 0;
     size_t query_counter = 0;
+    size_t batch_counter = 0;
+    size_t next_time_check = 0;
+    // what ran before the end of the warm-up of an adaptive run
+    uint32_t run_epoch_seen = 0;
+    size_t warmup_queries = 0;
+    size_t warmup_batches = 0;
+
+    struct get_batch batch = { 0 };
+    if (opt_batch_size > 1) {
+        get_batch_init(&batch, opt_server_info.num_servers, opt_batch_size);
+    }
 
-    do {
-        if (query_counter == max_queries) {
+    struct rusage usage;
+    client_usage_start(&usage);
+
+    if (opt_engine == ENGINE_EPOLL) {
+        query_counter = epoll_engine_run(&ctx, &rand, max_queries);
+    } else if (opt_engine == ENGINE_IO_URING) {
+        query_counter = uring_engine_run(&ctx, &rand, max_queries);
+    } else if (open_loop_enabled()) {
+        query_counter = open_loop_run(&ctx, &rand, max_queries);
+    } else if (trace_replay_enabled()) {
+        query_counter = trace_replay_run(&ctx, max_queries);
+    } else do {
+        if (query_counter >= max_queries) {
             break;
         }
+        if (run_control_enabled() && run_control_poll(tid, query_counter, &run_epoch_seen)) {
+            op_context_reset(&ctx);
+            warmup_queries = query_counter;
+            warmup_batches = batch_counter;
+        }
 
         // only check the time so often...
-        if ((query_counter % 128) == 0) {
+        if (query_counter >= next_time_check) {
+            next_time_check = query_counter + 128;
             gettimeofday(&thread_current, NULL);
 
             timersub(&thread_current, &thread_start, &thread_elapsed);
             if (thread_elapsed.tv_sec == PERIODIC_PRINT_INTERVAL) {
 
                 uint64_t thread_elapsed_us = (thread_elapsed.tv_sec * 1000000) + thread_elapsed.tv_usec;
-                printf("thread:%03zu executed %lu queries in %lu ms\n", tid,
-                    (query_counter)-thread_queries, thread_elapsed_us / 1000);
+                if (opt_batch_size > 1) {
+                    printf("thread:%03zu executed %lu queries (%lu batches) in %lu ms\n", tid,
+                        (query_counter)-thread_queries, batch_counter - thread_batches, thread_elapsed_us / 1000);
+                } else {
+                    printf("thread:%03zu executed %lu queries in %lu ms\n", tid,
+                        (query_counter)-thread_queries, thread_elapsed_us / 1000);
+                }
 
                 // reset the thread start time
                 thread_start = thread_current;
                 thread_queries = query_counter;
+                thread_batches = batch_counter;
             }
         }
 
-        query_counter++;
-        uint64_t objid = xor_shift_next(&rand, num_keys);
+        if (opt_batch_size > 1) {
+            size_t n = opt_batch_size;
+            if (max_queries - query_counter < n) {
+                n = max_queries - query_counter;
+            }
+            get_batch_execute(&batch, &ctx, &rand, n);
+            query_counter += n;
+            batch_counter++;
+            continue;
+        }
 
-        // format the key
-        char key[KEY_SIZE + 1];
-        snprintf(key, KEY_SIZE + 1, "%08x", (unsigned int)objid);
+        query_counter++;
+        uint64_t objid;
+        enum workload_op op = op_next(&ctx, &rand, &objid);
+        op_execute(&ctx, op, objid, 0);
+    } while(timercmp(&thread_current, &thread_stop, <) && !run_control_stopped());
 
-        // pick the server, doing some dummy load balance here based on the number of threads
-        memcached_st* m = memc[objid % opt_server_info.num_servers];
+    run_control_thread_done();
+    client_usage_stop(&usage);
 
-        uint32_t flags;
-        string = memcached_get(m, key, KEY_SIZE, &string_length, &flags, &rc);
-        if (rc == MEMCACHED_SUCCESS) {
-            if (opt_verbose) {
-                printf("thread:%lu key %s = %s...\n", tid, key, string);
-            }
-            free(string);
-            num_success++;
-        } else if (rc == MEMCACHED_NOTFOUND) {
-            if (opt_verbose) {
-                printf("thread:%lu key %s = NOT_FOUND...\n", tid, key);
-            }
-            num_not_found++;
-        } else {
-            if (opt_verbose) {
-                printf("thread:%lu key %s = ERROR (%s)...\n", tid, key, memcached_strerror(m, rc) );
-            }
-            num_erroneous++;
-        }
-    } while(timercmp(&thread_current, &thread_stop, <));
+    if (opt_batch_size > 1) {
+        get_batch_free(&batch);
+    }
 
+    size_t num_success = 0;
+    size_t num_not_found = 0;
+    size_t num_erroneous = 0;
+    for (int op = 0; op < WORKLOAD_OP_MAX; op++) {
+        num_success += ctx.stats[op].hits;
+        num_not_found += ctx.stats[op].misses;
+        num_erroneous += ctx.stats[op].errors;
+    }
 
     printf("thread:%03zu done. executed %zu found %zu, missed %zu  (checksum: %lx)\n", tid, query_counter, num_success, num_not_found, num_errors);
 
-    pthread_barrier_wait(&barrier);
+    perf_phase_add(&perf, 1, perf_start, perf_client[PERF_BENCHMARK]);
+    barrier_wait();
+    perfcount_close(&perf);
 
     if (num_not_found > 0) {
         printf("thread:%lu had %zu keys not found\n", tid, num_not_found);
@@ -484,9 +8375,13 @@ void* thread_main(void* arg)
         printf("thread:%lu had %zu errors\n", tid, num_errors);
     }
 
-    __atomic_fetch_add(&num_queries, query_counter, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&num_queries, query_counter - warmup_queries, __ATOMIC_RELAXED);
     __atomic_fetch_add(&num_missed, num_not_found, __ATOMIC_RELAXED);
     __atomic_fetch_add(&num_errors, num_erroneous, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&num_batches, batch_counter - warmup_batches, __ATOMIC_RELAXED);
+    op_context_merge(&ctx);
+    placement_merge(tid, ctx.load);
+    op_context_free(&ctx);
 
     for (size_t i = 0; i < opt_server_info.num_servers; i++) {
         memcached_free(memc[i]);
@@ -497,6 +8392,235 @@ void* thread_main(void* arg)
     return (void *)(num_success + num_not_found);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Coordinated Results
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The counters of an agent's run. They are followed by the outcomes per operation type, the load
+ * per server, the latency histograms in the per-thread layout merged over the agent's threads, and
+ * the merged histograms and outcomes of each second of the time series.
+ */
+struct coord_results {
+    uint64_t num_queries;
+    uint64_t num_missed;
+    uint64_t num_errors;
+    uint64_t num_populated;
+    uint64_t num_batches;
+    uint64_t fills;
+    uint64_t num_servers;
+    uint64_t num_latency;
+    uint64_t num_slots;
+};
+
+// sends the agent's counters and histograms to the coordinator once its threads have been joined
+static void agent_send_results(void)
+{
+    struct coord_results r;
+    r.num_queries = num_queries;
+    r.num_missed = num_missed;
+    r.num_errors = num_errors;
+    r.num_populated = num_populated;
+    r.num_batches = num_batches;
+    r.fills = op_fills;
+    r.num_servers = opt_server_info.num_servers;
+    r.num_latency = latency_per_thread();
+    r.num_slots = latency_series_enabled() ? latency_series_slots : 0;
+
+    struct mc_buf buf;
+    mc_buf_init(&buf, sizeof(r) + (r.num_latency + r.num_slots) * sizeof(struct histogram));
+    mc_buf_append(&buf, &r, sizeof(r));
+    mc_buf_append(&buf, op_stats, sizeof(op_stats));
+    mc_buf_append(&buf, server_load, r.num_servers * sizeof(*server_load));
+
+    struct histogram h;
+    for (size_t i = 0; i < r.num_latency; i++) {
+        histogram_init(&h);
+        for (size_t tid = 0; tid < opt_num_threads; tid++) {
+            histogram_merge(&h, &latency_hist[tid * r.num_latency + i]);
+        }
+        mc_buf_append(&buf, &h, sizeof(h));
+    }
+    for (size_t slot = 0; slot < r.num_slots; slot++) {
+        struct latency_series_outcomes outcomes;
+        latency_series_merge(slot, &h, &outcomes);
+        mc_buf_append(&buf, &h, sizeof(h));
+        mc_buf_append(&buf, &outcomes, sizeof(outcomes));
+    }
+
+    if (!coord_send(coord_fd, COORD_RESULTS, COORD_PHASES, mc_buf_head(&buf), mc_buf_len(&buf))) {
+        printf("ERROR: failed to send the results to the coordinator\n");
+        exit(EXIT_FAILURE);
+    }
+    mc_buf_free(&buf);
+}
+
+/**
+ * Adds an agent's results to the counters and histograms of this process, into those of thread 0.
+ * Returns false if they do not have the layout of this process's configuration.
+ */
+static bool coordinator_merge(const char* data, size_t len)
+{
+    struct coord_results r;
+    if (len < sizeof(r)) {
+        return false;
+    }
+    memcpy(&r, data, sizeof(r));
+    size_t slot_size = sizeof(struct histogram) + sizeof(struct latency_series_outcomes);
+    if (r.num_servers != opt_server_info.num_servers || r.num_latency != latency_per_thread()
+        || len != sizeof(r) + sizeof(op_stats) + r.num_servers * sizeof(*server_load)
+            + r.num_latency * sizeof(struct histogram) + r.num_slots * slot_size) {
+        return false;
+    }
+    num_queries += r.num_queries;
+    num_missed += r.num_missed;
+    num_errors += r.num_errors;
+    num_populated += r.num_populated;
+    num_batches += r.num_batches;
+    op_fills += r.fills;
+
+    const char* p = data + sizeof(r);
+    const struct op_stats* stats = (const struct op_stats*)p;
+    for (int op = 0; op < WORKLOAD_OP_MAX; op++) {
+        op_stats[op].hits += stats[op].hits;
+        op_stats[op].misses += stats[op].misses;
+        op_stats[op].errors += stats[op].errors;
+    }
+    p += sizeof(op_stats);
+    server_load_merge((const struct server_load*)p);
+    p += r.num_servers * sizeof(*server_load);
+
+    struct histogram h;
+    for (size_t i = 0; i < r.num_latency; i++, p += sizeof(h)) {
+        memcpy(&h, p, sizeof(h));
+        histogram_merge(&latency_hist[i], &h);
+    }
+    for (size_t slot = 0; slot < r.num_slots; slot++, p += slot_size) {
+        if (!latency_series_enabled() || slot >= latency_series_slots) {
+            continue;
+        }
+        struct latency_series_outcomes outcomes;
+        memcpy(&h, p, sizeof(h));
+        memcpy(&outcomes, p + sizeof(h), sizeof(outcomes));
+        histogram_merge(&latency_series[0][slot], &h);
+        latency_series_outcomes[0][slot].gets += outcomes.gets;
+        latency_series_outcomes[0][slot].get_misses += outcomes.get_misses;
+        latency_series_outcomes[0][slot].errors += outcomes.errors;
+    }
+    return true;
+}
+
+static uint64_t coordinator_ms(const struct timespec* from, const struct timespec* to)
+{
+    return ((to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec)) / 1000000;
+}
+
+/**
+ * Runs a benchmark over agent processes instead of threads. The coordinator hands every agent the
+ * command line and its index, opens each phase once all agents reached its barrier, and merges
+ * the counters and histograms the agents send at the end into its own. The merged report has the
+ * lines of a single process, the agents print what only they saw (placement, near cache, ...).
+ */
+static int coordinator_main(int argc, char* argv[], size_t num_items)
+{
+    int fd = coord_listen(opt_coordinator, (int)opt_agents);
+    int* agents = (int*)calloc(opt_agents, sizeof(*agents));
+    if (fd < 0 || agents == NULL) {
+        printf("ERROR: failed to listen on %s for the agents: %s\n", opt_coordinator, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    coord_count = opt_agents;
+
+    struct mc_buf config;
+    mc_buf_init(&config, 4096);
+    printf("coordinator: waiting for %zu agents on %s\n", opt_agents, opt_coordinator);
+    for (size_t i = 0; i < opt_agents; i++) {
+        struct coord_msg msg;
+        void* payload;
+        agents[i] = accept(fd, NULL, NULL);
+        if (agents[i] < 0 || !coord_recv(agents[i], COORD_HELLO, &msg, &payload) || msg.len != sizeof(uint32_t)) {
+            printf("ERROR: agent %zu failed to join\n", i);
+            return EXIT_FAILURE;
+        }
+        uint32_t pid;
+        memcpy(&pid, payload, sizeof(pid));
+        free(payload);
+
+        struct coord_config c = { (uint32_t)i, (uint32_t)opt_agents };
+        mc_buf_consume(&config, mc_buf_len(&config));
+        mc_buf_append(&config, &c, sizeof(c));
+        for (int a = 1; a < argc; a++) {
+            mc_buf_append(&config, argv[a], strlen(argv[a]) + 1);
+        }
+        if (!coord_send(agents[i], COORD_CONFIG, 0, mc_buf_head(&config), mc_buf_len(&config))) {
+            printf("ERROR: failed to configure agent %zu\n", i);
+            return EXIT_FAILURE;
+        }
+        printf("coordinator: agent %zu joined (pid %u)\n", i, pid);
+    }
+    mc_buf_free(&config);
+    close(fd);
+    unlink(opt_coordinator);
+
+    struct timespec t_phase[COORD_PHASES];
+    for (uint32_t phase = 0; phase < COORD_PHASES; phase++) {
+        for (size_t i = 0; i < opt_agents; i++) {
+            struct coord_msg msg;
+            void* payload;
+            if (!coord_recv(agents[i], COORD_ARRIVE, &msg, &payload) || msg.phase != phase) {
+                printf("ERROR: agent %zu hung up before the %s phase\n", i, coord_phase_names[phase]);
+                return EXIT_FAILURE;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t_phase[phase]);
+        for (size_t i = 0; i < opt_agents; i++) {
+            if (!coord_send(agents[i], COORD_RELEASE, phase, NULL, 0)) {
+                printf("ERROR: agent %zu hung up before the %s phase\n", i, coord_phase_names[phase]);
+                return EXIT_FAILURE;
+            }
+        }
+        printf("coordinator: %s phase\n", coord_phase_names[phase]);
+    }
+
+    for (size_t i = 0; i < opt_agents; i++) {
+        struct coord_msg msg;
+        void* payload;
+        if (!coord_recv(agents[i], COORD_RESULTS, &msg, &payload) || !coordinator_merge((const char*)payload, msg.len)) {
+            printf("ERROR: agent %zu sent no results\n", i);
+            return EXIT_FAILURE;
+        }
+        free(payload);
+        close(agents[i]);
+    }
+    free(agents);
+
+    uint64_t populate_ms = coordinator_ms(&t_phase[COORD_POPULATE], &t_phase[COORD_POPULATED]);
+    uint64_t elapsed_ms = coordinator_ms(&t_phase[COORD_BENCHMARK], &t_phase[COORD_BENCHMARKED]);
+    double elapsed_s = elapsed_ms / 1000.0;
+    size_t num_threads = coord_num_threads();
+
+    printf("===============================================================================\n");
+    printf("coordinated run of %zu agents with %zu threads each\n", opt_agents, opt_num_threads);
+    printf("Populated %zu / %zu key-value pairs in %lu ms\n", num_populated, num_items, populate_ms);
+    printf("benchmark took %lu ms (of %lu ms)\n", elapsed_ms, opt_duration * 1000);
+    printf("benchmark executed %zu / %zu queries   (%zu missed) \n", num_queries, opt_num_queries * num_threads,
+        num_missed);
+    printf("benchmark throughput %lu queries / second\n", (uint64_t)(elapsed_s > 0 ? num_queries / elapsed_s : 0));
+    if (opt_batch_size > 1) {
+        printf("benchmark executed %zu batches of up to %zu keys\n", num_batches, opt_batch_size);
+        printf("benchmark throughput %lu batches / second\n", (uint64_t)(elapsed_s > 0 ? num_batches / elapsed_s : 0));
+    }
+    op_stats_report();
+    server_load_report();
+    latency_report();
+    results_write(num_queries, num_missed, num_errors, elapsed_ms);
+    printf("terminating.\n");
+    printf("===============================================================================\n");
+
+    free(latency_hist);
+    return EXIT_SUCCESS;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Main
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -504,16 +8628,238 @@ void* thread_main(void* arg)
 int main(int argc, char* argv[])
 {
     options_parse(argc, argv);
+    if (opt_agent != NULL) {
+        if (argc != 2) {
+            printf("an agent takes its options from the coordinator, --agent=<path> must be its only option\n");
+            exit(EXIT_FAILURE);
+        }
+        agent_join();
+    }
 
     if (opt_num_threads == 0) {
         opt_num_threads = 1;
     }
 
+    if (opt_batch_size == 0) {
+        opt_batch_size = 1;
+    }
+
+    open_loop_init();
+    if (open_loop_enabled() && opt_batch_size > 1) {
+        printf("open-loop mode sends single operations, ignoring --batch-size\n");
+        opt_batch_size = 1;
+    }
+
+    if (opt_engine != ENGINE_LIBMEMCACHED) {
+        if (open_loop_enabled()) {
+            printf("open-loop mode is only supported by the libmemcached engine\n");
+            exit(EXIT_FAILURE);
+        }
+        if (workload_has_op(&opt_workload, WORKLOAD_CAS)) {
+            printf("cas operations are only supported by the libmemcached engine\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_batch_size > 1) {
+            printf("the %s engine pipelines with --pipeline-depth, ignoring --batch-size\n", engine_name(opt_engine));
+            opt_batch_size = 1;
+        }
+        if (opt_conns_per_server == 0) {
+            opt_conns_per_server = 1;
+        }
+        if (opt_pipeline_depth == 0) {
+            opt_pipeline_depth = 1;
+        }
+        if (near_cache_enabled()) {
+            printf("the near cache is only supported by the libmemcached engine, ignoring --near-cache\n");
+            opt_near_cache = 0;
+        }
+    }
+
+    if (opt_trace_import != NULL) {
+        return trace_import_main();
+    }
+
+    if (opt_shm_serve != NULL) {
+        return shm_server_main();
+    }
+
     if (opt_server_info.num_servers == 0) {
         printf("no servers given!\n");
         exit(1);
     }
 
+    if (inproc_enabled()) {
+        // the servers only name the tables the keys are routed to
+        if (opt_engine != ENGINE_LIBMEMCACHED || proxy_enabled()) {
+            printf("the inproc backend is only supported by the libmemcached engine\n");
+            exit(EXIT_FAILURE);
+        }
+        if (workload_has_op(&opt_workload, WORKLOAD_CAS)) {
+            printf("cas operations are not supported by the inproc backend\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_replicas > 1) {
+            printf("replication is not supported by the inproc backend\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_populate == POPULATE_BULK) {
+            printf("the inproc backend fills its tables directly, ignoring --populate=bulk\n");
+            opt_populate = POPULATE_SYNC;
+        }
+        if (opt_server_stats > 0) {
+            printf("the inproc backend has no servers to sample, ignoring --server-stats\n");
+            opt_server_stats = 0;
+        }
+    }
+
+    if (trace_replay_enabled()) {
+        if (opt_engine != ENGINE_LIBMEMCACHED || proxy_enabled()) {
+            printf("trace replay is only supported by the libmemcached engine\n");
+            exit(EXIT_FAILURE);
+        }
+        if (open_loop_enabled()) {
+            printf("trace replay is paced by --trace-timing, it cannot run open-loop\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_batch_size > 1) {
+            printf("trace replay sends single operations, ignoring --batch-size\n");
+            opt_batch_size = 1;
+        }
+        if (trace_recording() && strcmp(opt_trace_record, opt_trace_replay) == 0) {
+            printf("cannot record the trace %s while replaying it\n", opt_trace_replay);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (coalesce_enabled()) {
+        if (opt_engine != ENGINE_LIBMEMCACHED || proxy_enabled()) {
+            printf("coalescing is only supported by the libmemcached engine\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_read_policy == REPLICA_HEDGED) {
+            printf("hedged gets race on connections of their own, they cannot be coalesced\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_batch_size > 1) {
+            printf("coalescing combines the single gets of all threads, ignoring --batch-size\n");
+            opt_batch_size = 1;
+        }
+    }
+    if (trace_recording() && proxy_enabled()) {
+        printf("the proxy does not record traces, ignoring --trace-record\n");
+        opt_trace_record = NULL;
+    }
+    if (coordinator_enabled() || agent_enabled()) {
+        if (coordinator_enabled() && opt_coordinator == NULL) {
+            printf("--agents needs the --coordinator=<path> socket the agents join\n");
+            exit(EXIT_FAILURE);
+        }
+        if (proxy_enabled() || inproc_enabled()) {
+            printf("the proxy and the inproc backend live in one process, they cannot be coordinated\n");
+            exit(EXIT_FAILURE);
+        }
+        if (membership_elastic()) {
+            printf("elastic membership changes the routing of one process, it cannot be coordinated\n");
+            exit(EXIT_FAILURE);
+        }
+        if (trace_recording()) {
+            printf("the agents cannot record one trace, ignoring --trace-record\n");
+            opt_trace_record = NULL;
+        }
+        if (opt_server_stats > 0) {
+            printf("the server stats are sampled by single processes, ignoring --server-stats\n");
+            opt_server_stats = 0;
+        }
+    }
+    if (run_control_enabled()) {
+        if (opt_engine != ENGINE_LIBMEMCACHED || proxy_enabled() || open_loop_enabled() || trace_replay_enabled()) {
+            printf("steady-state detection drives the closed loop of the libmemcached engine\n");
+            exit(EXIT_FAILURE);
+        }
+        if (coordinator_enabled() || agent_enabled()) {
+            printf("steady-state detection samples the threads of one process, it cannot be coordinated\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (opt_repeats > 1) {
+        printf("repeats are measured by adaptive runs, ignoring --repeats without --steady-state\n");
+        opt_repeats = 1;
+    }
+    trace_init();
+
+    if (opt_initial_servers == 0) {
+        opt_initial_servers = opt_server_info.num_servers;
+    } else if (opt_initial_servers > opt_server_info.num_servers) {
+        printf("%zu initial servers need at least as many servers, got %zu\n", opt_initial_servers,
+            opt_server_info.num_servers);
+        exit(EXIT_FAILURE);
+    }
+    if (opt_initial_servers < opt_server_info.num_servers && !membership_elastic()) {
+        printf("the servers beyond the %zu initial ones join through --membership-events or --control-socket\n",
+            opt_initial_servers);
+    }
+    if (membership_elastic()) {
+        if (opt_engine != ENGINE_LIBMEMCACHED || proxy_enabled()) {
+            printf("elastic membership is only supported by the libmemcached engine\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_read_policy == REPLICA_HEDGED) {
+            printf("hedged gets connect to every replica up front, they do not support elastic membership\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_replicas > opt_initial_servers) {
+            printf("%zu replicas need at least as many initial servers, got %zu\n", opt_replicas,
+                opt_initial_servers);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (opt_fill_on_miss && opt_batch_size > 1) {
+        printf("batched gets do not fill their misses, --fill-on-miss only applies to single gets\n");
+    }
+
+    if (server_has_transport(SERVER_SHM)) {
+        if (opt_engine != ENGINE_EPOLL || proxy_enabled()) {
+            printf("shm:// servers are only supported by the epoll engine\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opt_populate != POPULATE_BULK) {
+            printf("libmemcached cannot reach shm:// servers, populating with --populate=bulk\n");
+            opt_populate = POPULATE_BULK;
+        }
+    }
+
+    if (opt_numa_local && !placement_enabled()) {
+        printf("NUMA-local routing needs threads placed on nodes, use --placement=compact or spread\n");
+        exit(EXIT_FAILURE);
+    }
+    if (opt_numa_local && opt_server_info.num_servers > 32) {
+        printf("NUMA-local routing supports up to 32 servers, got %zu\n", opt_server_info.num_servers);
+        exit(EXIT_FAILURE);
+    }
+
+    if (opt_replicas > opt_server_info.num_servers) {
+        printf("%zu replicas need at least as many servers, got %zu\n", opt_replicas, opt_server_info.num_servers);
+        exit(EXIT_FAILURE);
+    }
+    if (opt_read_policy != REPLICA_PRIMARY && !replica_enabled()) {
+        printf("the %s read policy needs --replicas of 2 or more\n", replica_policy_name(opt_read_policy));
+        exit(EXIT_FAILURE);
+    }
+    if (replica_enabled() && opt_engine != ENGINE_LIBMEMCACHED) {
+        printf("replication is only supported by the libmemcached engine\n");
+        exit(EXIT_FAILURE);
+    }
+    if (replica_enabled() && opt_batch_size > 1) {
+        printf("batched gets read from the primaries, --read-policy only applies to single gets\n");
+    }
+
+    if (proxy_enabled()) {
+        if (opt_conns_per_server == 0) {
+            opt_conns_per_server = 1;
+        }
+        return proxy_main();
+    }
+
+    placement_init();
+
     printf( "=====================================\n");
     printf("LOADBALANCER CONFIGURE\n");
     printf("=====================================\n");
@@ -523,14 +8869,111 @@ int main(int argc, char* argv[])
     printf(" - x_benchmark_num_queries = %zu\n", opt_num_queries);
     printf(" - x_benchmark_query_time = %zu s\n", opt_duration);
     printf(" - num_threads = %zu\n", opt_num_threads);
+    printf(" - engine = %s\n", engine_name(opt_engine));
+    if (opt_engine != ENGINE_LIBMEMCACHED) {
+        printf(" - conns_per_server = %zu\n", opt_conns_per_server);
+        printf(" - pipeline_depth = %zu\n", opt_pipeline_depth);
+    }
+    if (opt_engine == ENGINE_IO_URING) {
+        printf(" - sqpoll = %s\n", opt_sqpoll ? "yes" : "no");
+    }
+    printf(" - populate = %s\n", populate_name(opt_populate));
+    if (server_has_transport(SERVER_SHM)) {
+        printf(" - shm_wait = %s\n", opt_shm_wait == SHMRING_SPIN ? "spin" : "futex");
+    }
+    printf(" - batch_size = %zu\n", opt_batch_size);
+    if (inproc_enabled()) {
+        inproc_describe();
+    }
+    trace_describe();
+    if (coalesce_enabled()) {
+        coalesce_describe();
+    }
+    if (membership_elastic() || opt_initial_servers < opt_server_info.num_servers) {
+        membership_describe();
+    }
+    if (run_control_enabled()) {
+        run_control_describe();
+    }
+    if (coordinator_enabled()) {
+        printf(" - coordinator = %zu agents on %s\n", opt_agents, opt_coordinator);
+    } else if (agent_enabled()) {
+        printf(" - agent = %zu of %zu, threads %zu to %zu\n", coord_index, coord_count, coord_thread_id(0),
+            coord_thread_id(opt_num_threads - 1));
+    }
+    if (placement_enabled()) {
+        placement_describe();
+    }
+    if (replica_enabled()) {
+        replica_describe();
+    }
+    if (server_stats_enabled()) {
+        printf(" - server_stats = every %zu ms%s%s\n", opt_server_stats, opt_server_stats_file ? " to " : "",
+            opt_server_stats_file ? opt_server_stats_file : "");
+    }
+    if (perf_enabled()) {
+        printf(" - perf = %s client threads, %zu server processes\n", opt_perf ? "all" : "no",
+            opt_perf_num_server_pids);
+    }
+    if (near_cache_enabled()) {
+        printf(" - near_cache = %zu MB, ttl %zu ms\n", opt_near_cache, opt_near_cache_ttl);
+    }
+    printf(" - router = %s\n", router_kind_name(opt_router));
+    printf(" - key_dist = %s", keydist_kind_name(opt_key_dist));
+    if (opt_key_dist == KEYDIST_ZIPF || opt_key_dist == KEYDIST_LATEST) {
+        printf(" (theta %.3f)", opt_zipf_theta);
+    } else if (opt_key_dist == KEYDIST_HOTSPOT) {
+        printf(" (%.1f%% of operations on %.1f%% of keys)", opt_hotspot_ops * 100.0, opt_hotspot_keys * 100.0);
+    }
+    printf("\n");
+    char mix[256];
+    workload_describe(&opt_workload, mix, sizeof(mix));
+    printf(" - op_mix = %s\n", mix);
+    if (open_loop_enabled()) {
+        printf(" - open_loop = %zu steps of %zu s, %.0f .. %.0f ops/s\n", num_rate_steps, opt_rate_step_duration,
+            rate_steps[0].rate, rate_steps[num_rate_steps - 1].rate);
+    }
+    char sizes[128];
+    sizedist_describe(&opt_key_size, sizes, sizeof(sizes));
+    printf(" - key_size = %s\n", sizes);
+    sizedist_describe(&opt_value_size, sizes, sizeof(sizes));
+    printf(" - value_size = %s\n", sizes);
     printf(" - maxbytes = %zu MB\n", opt_max_mem);
+    printf(" - slabs = growth factor %.2f, min size %zu\n", opt_slab_factor, opt_slab_min_size);
     printf("------------------------------------------\n");
 
+    item_sizes_init();
+    size_t num_items = item_count(opt_max_mem << 20);
+
+    latency_init();
+    timer_calibrate();
+    if (results_enabled() || membership_elastic()) {
+        size_t seconds = opt_duration ? opt_duration : LATENCY_SERIES_MAX_SLOTS;
+        latency_series_init(open_loop_enabled() ? num_rate_steps * opt_rate_step_duration : seconds);
+    }
+    if (coordinator_enabled()) {
+        // the agents run the benchmark, this process opens the phases and merges their results
+        latency_series_thread_init(0);
+        return coordinator_main(argc, argv, num_items);
+    }
+
+    key_router_init(opt_initial_servers);
+    key_dist_init(num_items);
+    // the agents insert the ids after the population in turns
+    op_insert_next = num_items + coord_index;
+    near_cache_init();
+    replica_init();
+    inproc_init();
+    coalesce_init();
+    membership_init();
+    run_control_init();
+
+    perf_servers_open();
+    server_stats_init();
+
     // initialize the barrier
     pthread_barrier_init(&barrier, NULL, opt_num_threads + 1);
 
-    size_t num_items = opt_max_mem / (ITEM_SIZE);
-
     printf("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n");
     printf("Populating %zu key-value pairs....\n", num_items);
     printf("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n");
@@ -551,7 +8994,8 @@ int main(int argc, char* argv[])
         }
     }
 
-    pthread_barrier_wait(&barrier);
+    barrier_wait_main();
+    perf_servers_begin();
     struct timespec t_start;
     clock_gettime(CLOCK_MONOTONIC, &t_start);
     printf("Start populating...\n");
@@ -561,7 +9005,8 @@ int main(int argc, char* argv[])
     // ---------------------------------------------------------------------------------------------
 
 
-    pthread_barrier_wait(&barrier);
+    barrier_wait_main();
+    perf_servers_end(PERF_POPULATE);
     struct timespec t_end;
     clock_gettime(CLOCK_MONOTONIC, &t_end);
 
@@ -577,21 +9022,43 @@ int main(int argc, char* argv[])
 
     printf("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n");
     printf("Populated %zu / %zu key-value pairs in %lu ms:\n", num_populated, num_items, elapsed_ms);
+    printf("populate throughput %.0f keys / second, %.1f MB/s of keys and values (%s)\n",
+        elapsed_ms ? num_populated * 1000.0 / elapsed_ms : 0.0,
+        elapsed_ms ? num_populated * (sizedist_mean(&opt_key_size) + sizedist_mean(&opt_value_size)) * 1000.0
+            / elapsed_ms / (1 << 20) : 0.0,
+        populate_name(opt_populate));
+    if (opt_populate == POPULATE_BULK) {
+        printf("populate bulk: %lu system calls, %.4f per key\n", populate_syscalls,
+            num_items ? (double)populate_syscalls / num_items : 0.0);
+    }
+    item_memory_report(num_items);
+    if (perf_enabled()) {
+        perf_report(PERF_POPULATE, num_populated);
+    }
     printf("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n");
 
     printf("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n");
     printf("Executing %zu queries with %zu threads for %zu seconds.\n", opt_num_threads * opt_num_queries, opt_num_threads, opt_duration);
     printf("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n");
 
-    pthread_barrier_wait(&barrier);
+    coalesce_start();
+    barrier_wait_main();
+    perf_servers_begin();
     clock_gettime(CLOCK_MONOTONIC, &t_start);
+    server_stats_start();
+    membership_start();
+    double measured_s = run_control_main();
 
     // ---------------------------------------------------------------------------------------------
     // Benchmark Phase
     // ---------------------------------------------------------------------------------------------
 
-    pthread_barrier_wait(&barrier);
+    barrier_wait_main();
+    perf_servers_end(PERF_BENCHMARK);
     clock_gettime(CLOCK_MONOTONIC, &t_end);
+    server_stats_stop();
+    coalesce_stop();
+    membership_stop();
 
 
     t_elapsed.tv_sec = t_end.tv_sec - t_start.tv_sec;
@@ -617,18 +9084,78 @@ int main(int argc, char* argv[])
     elapsed_ms = (t_elapsed.tv_sec * 1000000000UL + t_elapsed.tv_nsec) / 1000000;
     printf("===============================================================================\n");
     printf("benchmark took %lu ms (of %lu ms)\n", elapsed_ms, opt_duration * 1000);
+    if (measured_s > 0) {
+        // the figures below are those of the measurement after the warm-up
+        printf("benchmark measured %.0f ms after a warm-up of %.0f ms\n", measured_s * 1000.0, run_warmup_s * 1000.0);
+        elapsed_ms = (uint64_t)(measured_s * 1000.0);
+        t_elapsed.tv_sec = (time_t)measured_s;
+        t_elapsed.tv_nsec = (long)((measured_s - t_elapsed.tv_sec) * 1e9);
+    }
     printf("benchmark executed %zu / %zu queries   (%zu missed) \n", num_queries, num_queries_expected, num_missed);
-    // converting num_queries per microsecond to num qeuries per second.
-    printf("benchmark throughput %lu queries / second\n", (num_queries * 1000 / elapsed_ms));
+    // from the nanoseconds, runs against the inproc backend can take less than a millisecond
+    double elapsed_s = t_elapsed.tv_sec + t_elapsed.tv_nsec / 1e9;
+    printf("benchmark throughput %lu queries / second\n", (uint64_t)(elapsed_s > 0 ? num_queries / elapsed_s : 0));
+    if (opt_batch_size > 1) {
+        printf("benchmark executed %zu batches of up to %zu keys\n", num_batches, opt_batch_size);
+        printf("benchmark throughput %lu batches / second\n", (uint64_t)(elapsed_s > 0 ? num_batches / elapsed_s : 0));
+    }
     if (num_missed > 0) {
         printf("benchmark missed %zu queries!\n", num_missed);
     }
+    op_stats_report();
+    server_load_report();
+    server_stats_report();
+    latency_report();
+    placement_report();
+    replica_report();
+    if (inproc_enabled()) {
+        inproc_report();
+    }
+    trace_report();
+    if (coalesce_enabled()) {
+        coalesce_report();
+    }
+    membership_report(elapsed_s);
+    run_control_report();
+    if (near_cache_enabled()) {
+        near_cache_report();
+    }
+    if (open_loop_enabled()) {
+        open_loop_report();
+    }
+    if (opt_engine != ENGINE_LIBMEMCACHED) {
+        native_report(num_queries);
+    }
+    if (opt_client_overhead) {
+        client_overhead_report(num_queries, elapsed_ms);
+    }
+    if (perf_enabled()) {
+        perf_report(PERF_BENCHMARK, num_queries);
+    }
+    if (agent_enabled()) {
+        // the coordinator writes the results of all agents
+        agent_send_results();
+    } else {
+        results_write(num_queries, num_missed, num_errors, elapsed_ms);
+    }
     printf("terminating.\n");
     printf("===============================================================================\n");
     printf("===============================================================================\n");
 
     // destroy the barrier
     pthread_barrier_destroy(&barrier);
+    perf_servers_close();
+
+    key_router_free();
+    if (near_cache_enabled()) {
+        nearcache_free(&near_cache);
+    }
+    inproc_free();
+    coalesce_free();
+    free(membership_readers);
+    free(latency_hist);
+    free(rate_step_hist);
+    free(rate_steps);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,898 @@
+/* Minimal memcached ASCII and binary protocol codec for the native engines */
+
+#ifndef LOADBALANCER_MCPROTO_H_
+#define LOADBALANCER_MCPROTO_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Buffers
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A growable byte buffer, data is appended at `end` and consumed from `start`.
+ *
+ * Buffers are allocated once per connection and reused, consumed space is reclaimed by moving the
+ * remaining bytes to the front once the buffer runs out of room. Buffers over caller-provided
+ * (e.g. registered) memory never grow.
+ */
+struct mc_buf {
+    char* data;
+    size_t start;
+    size_t end;
+    size_t cap;
+    bool fixed;
+};
+
+static inline void mc_buf_init(struct mc_buf* b, size_t cap)
+{
+    b->data = (char*)malloc(cap);
+    if (b->data == NULL) {
+        printf("failed to allocate a protocol buffer of %zu bytes\n", cap);
+        exit(EXIT_FAILURE);
+    }
+    b->start = 0;
+    b->end = 0;
+    b->cap = cap;
+    b->fixed = false;
+}
+
+static inline void mc_buf_init_fixed(struct mc_buf* b, char* data, size_t cap)
+{
+    b->data = data;
+    b->start = 0;
+    b->end = 0;
+    b->cap = cap;
+    b->fixed = true;
+}
+
+static inline void mc_buf_free(struct mc_buf* b)
+{
+    if (!b->fixed) {
+        free(b->data);
+    }
+    b->data = NULL;
+    b->cap = 0;
+}
+
+static inline size_t mc_buf_len(const struct mc_buf* b)
+{
+    return b->end - b->start;
+}
+
+static inline char* mc_buf_head(const struct mc_buf* b)
+{
+    return b->data + b->start;
+}
+
+static inline void mc_buf_consume(struct mc_buf* b, size_t n)
+{
+    b->start += n;
+    if (b->start == b->end) {
+        b->start = 0;
+        b->end = 0;
+    }
+}
+
+/**
+ * Makes room for at least `n` more bytes and returns a pointer to the free space.
+ */
+static inline char* mc_buf_reserve(struct mc_buf* b, size_t n)
+{
+    if (b->cap - b->end >= n) {
+        return b->data + b->end;
+    }
+    if (b->start > 0) {
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+    }
+    if (b->cap - b->end < n) {
+        if (b->fixed) {
+            printf("a fixed protocol buffer of %zu bytes is too small for %zu more bytes\n", b->cap, n);
+            exit(EXIT_FAILURE);
+        }
+        size_t cap = b->cap * 2;
+        while (cap - b->end < n) {
+            cap *= 2;
+        }
+        char* data = (char*)realloc(b->data, cap);
+        if (data == NULL) {
+            printf("failed to grow a protocol buffer to %zu bytes\n", cap);
+            exit(EXIT_FAILURE);
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+    return b->data + b->end;
+}
+
+static inline void mc_buf_commit(struct mc_buf* b, size_t n)
+{
+    b->end += n;
+}
+
+static inline void mc_buf_append(struct mc_buf* b, const void* src, size_t n)
+{
+    memcpy(mc_buf_reserve(b, n), src, n);
+    mc_buf_commit(b, n);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Requests
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum mc_req {
+    MC_REQ_GET,
+    MC_REQ_SET,
+    MC_REQ_DELETE,
+    MC_REQ_INCR,
+    MC_REQ_DECR,
+    MC_REQ_APPEND,
+    // add without a response (ascii noreply, binary ADDQ)
+    MC_REQ_ADD_QUIET,
+    MC_REQ_ADD,
+    // get that returns the key with the value (binary GETK, a plain get in ascii)
+    MC_REQ_GETK,
+};
+
+/**
+ * The optional arguments of a request.
+ */
+struct mc_args {
+    uint32_t flags;
+    uint32_t exptime;
+    // the amount of an incr or decr
+    uint64_t delta;
+    uint32_t opaque;
+    // no response on success (ascii noreply, binary quiet opcodes)
+    bool quiet;
+};
+
+// binary protocol opcodes
+#define MC_BIN_REQ_MAGIC 0x80
+#define MC_BIN_RES_MAGIC 0x81
+#define MC_BIN_GET 0x00
+#define MC_BIN_SET 0x01
+#define MC_BIN_ADD 0x02
+#define MC_BIN_DELETE 0x04
+#define MC_BIN_INCR 0x05
+#define MC_BIN_DECR 0x06
+#define MC_BIN_QUIT 0x07
+#define MC_BIN_GETQ 0x09
+#define MC_BIN_NOOP 0x0a
+#define MC_BIN_VERSION 0x0b
+#define MC_BIN_GETK 0x0c
+#define MC_BIN_GETKQ 0x0d
+#define MC_BIN_APPEND 0x0e
+#define MC_BIN_SETQ 0x11
+#define MC_BIN_ADDQ 0x12
+#define MC_BIN_DELETEQ 0x14
+#define MC_BIN_INCRQ 0x15
+#define MC_BIN_DECRQ 0x16
+#define MC_BIN_QUITQ 0x17
+#define MC_BIN_APPENDQ 0x19
+
+// binary protocol response status
+#define MC_BIN_STATUS_OK 0x00
+#define MC_BIN_STATUS_NOT_FOUND 0x01
+#define MC_BIN_STATUS_EXISTS 0x02
+#define MC_BIN_STATUS_NOT_STORED 0x05
+#define MC_BIN_STATUS_DELTA_BADVAL 0x06
+#define MC_BIN_STATUS_UNKNOWN_COMMAND 0x81
+#define MC_BIN_STATUS_NOT_SUPPORTED 0x83
+#define MC_BIN_STATUS_INTERNAL_ERROR 0x84
+
+#define MC_BIN_HEADER_SIZE 24
+
+// the largest value a client may send, memcached's default item_size_max
+#define MC_ITEM_MAX (1UL << 20)
+
+static inline void mc_put_be16(char* p, uint16_t v)
+{
+    p[0] = (char)(v >> 8);
+    p[1] = (char)v;
+}
+
+static inline void mc_put_be32(char* p, uint32_t v)
+{
+    mc_put_be16(p, (uint16_t)(v >> 16));
+    mc_put_be16(p + 2, (uint16_t)v);
+}
+
+static inline void mc_put_be64(char* p, uint64_t v)
+{
+    mc_put_be32(p, (uint32_t)(v >> 32));
+    mc_put_be32(p + 4, (uint32_t)v);
+}
+
+static inline uint16_t mc_get_be16(const char* p)
+{
+    return (uint16_t)(((uint8_t)p[0] << 8) | (uint8_t)p[1]);
+}
+
+static inline uint32_t mc_get_be32(const char* p)
+{
+    return ((uint32_t)mc_get_be16(p) << 16) | mc_get_be16(p + 2);
+}
+
+static inline uint64_t mc_get_be64(const char* p)
+{
+    return ((uint64_t)mc_get_be32(p) << 32) | mc_get_be32(p + 4);
+}
+
+static inline size_t mc_encode_packet(struct mc_buf* b, uint8_t magic, uint8_t opcode, uint16_t status,
+    const char* key, size_t keylen, const char* extras, size_t extlen, const char* value, size_t vlen,
+    uint32_t opaque)
+{
+    size_t len = MC_BIN_HEADER_SIZE + extlen + keylen + vlen;
+    char* p = mc_buf_reserve(b, len);
+    memset(p, 0, MC_BIN_HEADER_SIZE);
+    p[0] = (char)magic;
+    p[1] = (char)opcode;
+    mc_put_be16(p + 2, (uint16_t)keylen);
+    p[4] = (char)extlen;
+    mc_put_be16(p + 6, status);
+    mc_put_be32(p + 8, (uint32_t)(extlen + keylen + vlen));
+    mc_put_be32(p + 12, opaque);
+    p += MC_BIN_HEADER_SIZE;
+    if (extlen > 0) {
+        memcpy(p, extras, extlen);
+    }
+    if (keylen > 0) {
+        memcpy(p + extlen, key, keylen);
+    }
+    if (vlen > 0) {
+        memcpy(p + extlen + keylen, value, vlen);
+    }
+    mc_buf_commit(b, len);
+    return len;
+}
+
+static inline size_t mc_encode_binary(struct mc_buf* b, uint8_t opcode, const char* key, size_t keylen,
+    const char* extras, size_t extlen, const char* value, size_t vlen, uint32_t opaque)
+{
+    return mc_encode_packet(b, MC_BIN_REQ_MAGIC, opcode, 0, key, keylen, extras, extlen, value, vlen, opaque);
+}
+
+// writes the number in decimal and returns the number of digits
+static inline size_t mc_put_decimal(char* p, uint64_t v)
+{
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    for (size_t i = 0; i < n; i++) {
+        p[i] = digits[n - 1 - i];
+    }
+    return n;
+}
+
+static inline size_t mc_encode_ascii(struct mc_buf* b, const char* cmd, const char* key, size_t keylen,
+    const char* value, size_t vlen, uint32_t flags, uint32_t exptime, const char* suffix)
+{
+    // "<cmd> <key> <flags> <exptime> <vlen><suffix>\r\n<value>\r\n", or "<cmd> <key><suffix>\r\n" without value
+    size_t cmdlen = strlen(cmd);
+    size_t suffixlen = strlen(suffix);
+    char* p = mc_buf_reserve(b, cmdlen + keylen + suffixlen + vlen + 64);
+    size_t len = 0;
+    memcpy(p, cmd, cmdlen);
+    len += cmdlen;
+    p[len++] = ' ';
+    memcpy(p + len, key, keylen);
+    len += keylen;
+    if (value != NULL) {
+        p[len++] = ' ';
+        len += mc_put_decimal(p + len, flags);
+        p[len++] = ' ';
+        len += mc_put_decimal(p + len, exptime);
+        p[len++] = ' ';
+        len += mc_put_decimal(p + len, vlen);
+    }
+    memcpy(p + len, suffix, suffixlen);
+    len += suffixlen;
+    memcpy(p + len, "\r\n", 2);
+    len += 2;
+    if (value != NULL) {
+        memcpy(p + len, value, vlen);
+        memcpy(p + len + vlen, "\r\n", 2);
+        len += vlen + 2;
+    }
+    mc_buf_commit(b, len);
+    return len;
+}
+
+/**
+ * Appends a request with the given arguments to the buffer and returns its size in bytes.
+ */
+static inline size_t mc_encode_command(struct mc_buf* b, bool binary, enum mc_req req, const char* key,
+    size_t keylen, const char* value, size_t vlen, const struct mc_args* args)
+{
+    char extras[20];
+    bool quiet = args->quiet || req == MC_REQ_ADD_QUIET;
+
+    if (binary) {
+        switch (req) {
+        case MC_REQ_GET:
+            return mc_encode_binary(b, MC_BIN_GET, key, keylen, NULL, 0, NULL, 0, args->opaque);
+        case MC_REQ_GETK:
+            return mc_encode_binary(b, MC_BIN_GETK, key, keylen, NULL, 0, NULL, 0, args->opaque);
+        case MC_REQ_SET:
+        case MC_REQ_ADD:
+        case MC_REQ_ADD_QUIET: {
+            uint8_t opcode = req == MC_REQ_SET ? (quiet ? MC_BIN_SETQ : MC_BIN_SET) : (quiet ? MC_BIN_ADDQ : MC_BIN_ADD);
+            mc_put_be32(extras, args->flags);
+            mc_put_be32(extras + 4, args->exptime);
+            return mc_encode_binary(b, opcode, key, keylen, extras, 8, value, vlen, args->opaque);
+        }
+        case MC_REQ_DELETE:
+            return mc_encode_binary(b, quiet ? MC_BIN_DELETEQ : MC_BIN_DELETE, key, keylen, NULL, 0, NULL, 0,
+                args->opaque);
+        case MC_REQ_INCR:
+        case MC_REQ_DECR: {
+            // delta, initial value and an expiration time that makes a missing counter fail
+            uint8_t opcode = req == MC_REQ_INCR ? (quiet ? MC_BIN_INCRQ : MC_BIN_INCR) : (quiet ? MC_BIN_DECRQ : MC_BIN_DECR);
+            mc_put_be64(extras, args->delta);
+            mc_put_be64(extras + 8, 0);
+            mc_put_be32(extras + 16, 0xffffffff);
+            return mc_encode_binary(b, opcode, key, keylen, extras, 20, NULL, 0, args->opaque);
+        }
+        case MC_REQ_APPEND:
+            return mc_encode_binary(b, quiet ? MC_BIN_APPENDQ : MC_BIN_APPEND, key, keylen, NULL, 0, value, vlen,
+                args->opaque);
+        }
+        return 0;
+    }
+
+    const char* noreply = quiet ? " noreply" : "";
+    char suffix[40];
+    switch (req) {
+    case MC_REQ_GET:
+    case MC_REQ_GETK:
+        return mc_encode_ascii(b, "get", key, keylen, NULL, 0, 0, 0, "");
+    case MC_REQ_SET:
+        return mc_encode_ascii(b, "set", key, keylen, value, vlen, args->flags, args->exptime, noreply);
+    case MC_REQ_ADD:
+    case MC_REQ_ADD_QUIET:
+        return mc_encode_ascii(b, "add", key, keylen, value, vlen, args->flags, args->exptime, noreply);
+    case MC_REQ_DELETE:
+        return mc_encode_ascii(b, "delete", key, keylen, NULL, 0, 0, 0, noreply);
+    case MC_REQ_INCR:
+    case MC_REQ_DECR:
+        suffix[0] = ' ';
+        strcpy(suffix + 1 + mc_put_decimal(suffix + 1, args->delta), noreply);
+        return mc_encode_ascii(b, req == MC_REQ_INCR ? "incr" : "decr", key, keylen, NULL, 0, 0, 0, suffix);
+    case MC_REQ_APPEND:
+        return mc_encode_ascii(b, "append", key, keylen, value, vlen, 0, 0, noreply);
+    }
+    return 0;
+}
+
+/**
+ * Appends a request as the benchmark sends it (no flags, no expiration, a delta of one) to the
+ * buffer and returns its size in bytes.
+ */
+static inline size_t mc_encode_request(struct mc_buf* b, bool binary, enum mc_req req, const char* key,
+    size_t keylen, const char* value, size_t vlen, uint32_t opaque)
+{
+    struct mc_args args;
+    memset(&args, 0, sizeof(args));
+    args.delta = 1;
+    args.opaque = opaque;
+    return mc_encode_command(b, binary, req, key, keylen, value, vlen, &args);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Responses
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum mc_status {
+    // the key was found, or the update was applied
+    MC_STATUS_HIT,
+    // the key was not found, or the update was not applied
+    MC_STATUS_MISS,
+    MC_STATUS_ERROR,
+};
+
+enum mc_parse_result {
+    MC_PARSE_ERROR = -1,
+    MC_PARSE_INCOMPLETE = 0,
+    MC_PARSE_OK = 1,
+};
+
+struct mc_response {
+    enum mc_status status;
+    // the status in terms of the binary protocol, also for ascii responses
+    uint16_t code;
+    // the value of a get, points into the parsed buffer
+    const char* value;
+    size_t value_len;
+    // the key of a get hit if the response carries it (ascii, binary GETK), points into the buffer
+    const char* key;
+    size_t keylen;
+    uint32_t flags;
+    // the new value of a counter after an incr or decr
+    uint64_t number;
+    uint32_t opaque;
+    // the size of the whole response in bytes
+    size_t len;
+};
+
+static inline bool mc_line_is(const char* line, size_t len, const char* word)
+{
+    size_t n = strlen(word);
+    return len >= n && memcmp(line, word, n) == 0 && (len == n || line[n] == ' ');
+}
+
+static inline int mc_parse_binary(const char* p, size_t n, struct mc_response* r)
+{
+    if (n < MC_BIN_HEADER_SIZE) {
+        return MC_PARSE_INCOMPLETE;
+    }
+    if ((uint8_t)p[0] != MC_BIN_RES_MAGIC) {
+        return MC_PARSE_ERROR;
+    }
+
+    uint16_t keylen = mc_get_be16(p + 2);
+    uint8_t extlen = (uint8_t)p[4];
+    uint16_t status = mc_get_be16(p + 6);
+    uint32_t bodylen = mc_get_be32(p + 8);
+    if ((size_t)extlen + keylen > bodylen) {
+        return MC_PARSE_ERROR;
+    }
+    if (n < MC_BIN_HEADER_SIZE + (size_t)bodylen) {
+        return MC_PARSE_INCOMPLETE;
+    }
+
+    r->len = MC_BIN_HEADER_SIZE + bodylen;
+    r->opaque = mc_get_be32(p + 12);
+    r->code = status;
+    r->value = NULL;
+    r->value_len = 0;
+    r->key = NULL;
+    r->keylen = 0;
+    r->flags = 0;
+    r->number = 0;
+    switch (status) {
+    case MC_BIN_STATUS_OK:
+        r->status = MC_STATUS_HIT;
+        r->value = p + MC_BIN_HEADER_SIZE + extlen + keylen;
+        r->value_len = bodylen - extlen - keylen;
+        if (keylen > 0) {
+            r->key = p + MC_BIN_HEADER_SIZE + extlen;
+            r->keylen = keylen;
+        }
+        if (extlen >= 4) {
+            r->flags = mc_get_be32(p + MC_BIN_HEADER_SIZE);
+        }
+        if (extlen == 0 && keylen == 0 && r->value_len == 8) {
+            // incr and decr return the new value as a 64-bit number
+            r->number = mc_get_be64(r->value);
+        }
+        break;
+    case MC_BIN_STATUS_NOT_FOUND:
+    case MC_BIN_STATUS_EXISTS:
+    case MC_BIN_STATUS_NOT_STORED:
+        r->status = MC_STATUS_MISS;
+        break;
+    default:
+        r->status = MC_STATUS_ERROR;
+        break;
+    }
+    return MC_PARSE_OK;
+}
+
+static inline int mc_parse_ascii(const char* p, size_t n, enum mc_req req, struct mc_response* r)
+{
+    const char* nl = (const char*)memchr(p, '\n', n);
+    if (nl == NULL) {
+        return MC_PARSE_INCOMPLETE;
+    }
+
+    size_t line_len = nl - p + 1;
+    size_t len = line_len >= 2 && nl[-1] == '\r' ? line_len - 2 : line_len - 1;
+
+    r->len = line_len;
+    r->opaque = 0;
+    r->value = NULL;
+    r->value_len = 0;
+    r->key = NULL;
+    r->keylen = 0;
+    r->flags = 0;
+    r->number = 0;
+    r->status = MC_STATUS_ERROR;
+    r->code = MC_BIN_STATUS_INTERNAL_ERROR;
+
+    switch (req) {
+    case MC_REQ_GET:
+    case MC_REQ_GETK:
+        if (mc_line_is(p, len, "VALUE")) {
+            // VALUE <key> <flags> <bytes> [<cas>]\r\n<data>\r\nEND\r\n
+            if (len <= 6) {
+                return MC_PARSE_ERROR;
+            }
+            const char* fields[2];
+            const char* f = p + 6;
+            const char* end = p + len;
+            for (int field = 0; field < 2; field++) {
+                f = (const char*)memchr(f, ' ', end - f);
+                if (f == NULL) {
+                    return MC_PARSE_ERROR;
+                }
+                fields[field] = ++f;
+            }
+            size_t bytes = strtoul(f, NULL, 10);
+            if (bytes > MC_ITEM_MAX) {
+                return MC_PARSE_ERROR;
+            }
+            size_t total = line_len + bytes + 2 + 5;
+            if (n < total) {
+                return MC_PARSE_INCOMPLETE;
+            }
+            if (memcmp(p + line_len + bytes, "\r\nEND\r\n", 7) != 0) {
+                return MC_PARSE_ERROR;
+            }
+            r->status = MC_STATUS_HIT;
+            r->code = MC_BIN_STATUS_OK;
+            r->value = p + line_len;
+            r->value_len = bytes;
+            r->key = p + 6;
+            r->keylen = fields[0] - 1 - r->key;
+            r->flags = (uint32_t)strtoul(fields[0], NULL, 10);
+            r->len = total;
+        } else if (mc_line_is(p, len, "END")) {
+            r->status = MC_STATUS_MISS;
+            r->code = MC_BIN_STATUS_NOT_FOUND;
+        }
+        break;
+    case MC_REQ_SET:
+    case MC_REQ_ADD:
+    case MC_REQ_APPEND:
+    case MC_REQ_ADD_QUIET:
+        if (mc_line_is(p, len, "STORED")) {
+            r->status = MC_STATUS_HIT;
+            r->code = MC_BIN_STATUS_OK;
+        } else if (mc_line_is(p, len, "NOT_STORED")) {
+            r->status = MC_STATUS_MISS;
+            r->code = MC_BIN_STATUS_NOT_STORED;
+        } else if (mc_line_is(p, len, "EXISTS")) {
+            r->status = MC_STATUS_MISS;
+            r->code = MC_BIN_STATUS_EXISTS;
+        } else if (mc_line_is(p, len, "NOT_FOUND")) {
+            r->status = MC_STATUS_MISS;
+            r->code = MC_BIN_STATUS_NOT_FOUND;
+        }
+        break;
+    case MC_REQ_DELETE:
+        if (mc_line_is(p, len, "DELETED")) {
+            r->status = MC_STATUS_HIT;
+            r->code = MC_BIN_STATUS_OK;
+        } else if (mc_line_is(p, len, "NOT_FOUND")) {
+            r->status = MC_STATUS_MISS;
+            r->code = MC_BIN_STATUS_NOT_FOUND;
+        }
+        break;
+    case MC_REQ_INCR:
+    case MC_REQ_DECR:
+        if (len > 0 && p[0] >= '0' && p[0] <= '9') {
+            r->status = MC_STATUS_HIT;
+            r->code = MC_BIN_STATUS_OK;
+            r->value = p;
+            r->value_len = len;
+            r->number = strtoull(p, NULL, 10);
+        } else if (mc_line_is(p, len, "NOT_FOUND")) {
+            r->status = MC_STATUS_MISS;
+            r->code = MC_BIN_STATUS_NOT_FOUND;
+        }
+        break;
+    }
+    return MC_PARSE_OK;
+}
+
+/**
+ * Parses the response to a request of the given kind from the start of the buffer.
+ *
+ * Returns MC_PARSE_INCOMPLETE until the whole response has been received. The response value
+ * points into the buffer and is only valid until the buffer is consumed.
+ */
+static inline int mc_parse_response(const char* p, size_t n, bool binary, enum mc_req req,
+    struct mc_response* r)
+{
+    return binary ? mc_parse_binary(p, n, r) : mc_parse_ascii(p, n, req, r);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Client Requests
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the commands a proxy understands, everything else is answered with an error
+enum mc_cmd {
+    MC_CMD_GET,
+    MC_CMD_SET,
+    MC_CMD_ADD,
+    MC_CMD_APPEND,
+    MC_CMD_DELETE,
+    MC_CMD_INCR,
+    MC_CMD_DECR,
+    MC_CMD_NOOP,
+    MC_CMD_VERSION,
+    MC_CMD_QUIT,
+    MC_CMD_UNKNOWN,
+};
+
+/**
+ * A request received from a client, all pointers point into the parsed buffer.
+ */
+struct mc_request {
+    enum mc_cmd cmd;
+    // the binary opcode, echoed in the response
+    uint8_t opcode;
+    // the key, for ascii gets all keys separated by spaces
+    const char* key;
+    size_t keylen;
+    const char* value;
+    size_t vlen;
+    struct mc_args args;
+    // binary GETK and GETKQ return the key with the value
+    bool with_key;
+    // the line an unknown ascii request is answered with if not ERROR, e.g. for a malformed data block
+    const char* error;
+    // the size of the whole request in bytes
+    size_t len;
+};
+
+static inline enum mc_req mc_cmd_req(enum mc_cmd cmd)
+{
+    switch (cmd) {
+    case MC_CMD_SET:
+        return MC_REQ_SET;
+    case MC_CMD_ADD:
+        return MC_REQ_ADD;
+    case MC_CMD_APPEND:
+        return MC_REQ_APPEND;
+    case MC_CMD_DELETE:
+        return MC_REQ_DELETE;
+    case MC_CMD_INCR:
+        return MC_REQ_INCR;
+    case MC_CMD_DECR:
+        return MC_REQ_DECR;
+    default:
+        return MC_REQ_GETK;
+    }
+}
+
+// splits off the next space-separated token of [*p, end), returns false at the end
+static inline bool mc_next_token(const char** p, const char* end, const char** tok, size_t* toklen)
+{
+    const char* s = *p;
+    while (s < end && *s == ' ') {
+        s++;
+    }
+    if (s == end) {
+        return false;
+    }
+    const char* e = s;
+    while (e < end && *e != ' ') {
+        e++;
+    }
+    *tok = s;
+    *toklen = e - s;
+    *p = e;
+    return true;
+}
+
+static inline bool mc_token_is(const char* tok, size_t len, const char* word)
+{
+    return strlen(word) == len && memcmp(tok, word, len) == 0;
+}
+
+static inline int mc_parse_request_binary(const char* p, size_t n, struct mc_request* r)
+{
+    if (n < MC_BIN_HEADER_SIZE) {
+        return MC_PARSE_INCOMPLETE;
+    }
+    if ((uint8_t)p[0] != MC_BIN_REQ_MAGIC) {
+        return MC_PARSE_ERROR;
+    }
+
+    uint8_t opcode = (uint8_t)p[1];
+    uint16_t keylen = mc_get_be16(p + 2);
+    uint8_t extlen = (uint8_t)p[4];
+    uint32_t bodylen = mc_get_be32(p + 8);
+    if ((size_t)extlen + keylen > bodylen || bodylen > MC_ITEM_MAX) {
+        return MC_PARSE_ERROR;
+    }
+    if (n < MC_BIN_HEADER_SIZE + (size_t)bodylen) {
+        return MC_PARSE_INCOMPLETE;
+    }
+
+    const char* extras = p + MC_BIN_HEADER_SIZE;
+    memset(r, 0, sizeof(*r));
+    r->opcode = opcode;
+    r->key = extras + extlen;
+    r->keylen = keylen;
+    r->value = r->key + keylen;
+    r->vlen = bodylen - extlen - keylen;
+    r->args.opaque = mc_get_be32(p + 12);
+    r->len = MC_BIN_HEADER_SIZE + bodylen;
+
+    switch (opcode) {
+    case MC_BIN_GET:
+    case MC_BIN_GETQ:
+    case MC_BIN_GETK:
+    case MC_BIN_GETKQ:
+        r->cmd = MC_CMD_GET;
+        r->args.quiet = opcode == MC_BIN_GETQ || opcode == MC_BIN_GETKQ;
+        r->with_key = opcode == MC_BIN_GETK || opcode == MC_BIN_GETKQ;
+        break;
+    case MC_BIN_SET:
+    case MC_BIN_SETQ:
+    case MC_BIN_ADD:
+    case MC_BIN_ADDQ:
+        if (extlen != 8) {
+            return MC_PARSE_ERROR;
+        }
+        r->cmd = opcode == MC_BIN_SET || opcode == MC_BIN_SETQ ? MC_CMD_SET : MC_CMD_ADD;
+        r->args.quiet = opcode == MC_BIN_SETQ || opcode == MC_BIN_ADDQ;
+        r->args.flags = mc_get_be32(extras);
+        r->args.exptime = mc_get_be32(extras + 4);
+        break;
+    case MC_BIN_APPEND:
+    case MC_BIN_APPENDQ:
+        r->cmd = MC_CMD_APPEND;
+        r->args.quiet = opcode == MC_BIN_APPENDQ;
+        break;
+    case MC_BIN_DELETE:
+    case MC_BIN_DELETEQ:
+        r->cmd = MC_CMD_DELETE;
+        r->args.quiet = opcode == MC_BIN_DELETEQ;
+        break;
+    case MC_BIN_INCR:
+    case MC_BIN_INCRQ:
+    case MC_BIN_DECR:
+    case MC_BIN_DECRQ:
+        if (extlen != 20) {
+            return MC_PARSE_ERROR;
+        }
+        r->cmd = opcode == MC_BIN_INCR || opcode == MC_BIN_INCRQ ? MC_CMD_INCR : MC_CMD_DECR;
+        r->args.quiet = opcode == MC_BIN_INCRQ || opcode == MC_BIN_DECRQ;
+        r->args.delta = mc_get_be64(extras);
+        break;
+    case MC_BIN_NOOP:
+        r->cmd = MC_CMD_NOOP;
+        break;
+    case MC_BIN_VERSION:
+        r->cmd = MC_CMD_VERSION;
+        break;
+    case MC_BIN_QUIT:
+    case MC_BIN_QUITQ:
+        r->cmd = MC_CMD_QUIT;
+        r->args.quiet = opcode == MC_BIN_QUITQ;
+        break;
+    default:
+        r->cmd = MC_CMD_UNKNOWN;
+        break;
+    }
+
+    // compare-and-swap needs the cas value of the backend, which the proxy does not pass on
+    if (mc_get_be64(p + 16) != 0 && r->cmd != MC_CMD_UNKNOWN) {
+        r->cmd = MC_CMD_UNKNOWN;
+    }
+    return MC_PARSE_OK;
+}
+
+static inline int mc_parse_request_ascii(const char* p, size_t n, struct mc_request* r)
+{
+    const char* nl = (const char*)memchr(p, '\n', n);
+    if (nl == NULL) {
+        // memcached gives up on command lines longer than this, so does the proxy
+        return n > 2048 ? MC_PARSE_ERROR : MC_PARSE_INCOMPLETE;
+    }
+
+    size_t line_len = nl - p + 1;
+    const char* end = line_len >= 2 && nl[-1] == '\r' ? nl - 1 : nl;
+    const char* s = p;
+
+    memset(r, 0, sizeof(*r));
+    r->len = line_len;
+    r->cmd = MC_CMD_UNKNOWN;
+
+    const char* cmd;
+    size_t cmdlen;
+    if (!mc_next_token(&s, end, &cmd, &cmdlen)) {
+        return MC_PARSE_OK;
+    }
+
+    // the tokens after the command
+    const char* tok[6];
+    size_t toklen[6];
+    size_t ntok = 0;
+
+    if (mc_token_is(cmd, cmdlen, "get")) {
+        while (s < end && *s == ' ') {
+            s++;
+        }
+        if (s == end) {
+            return MC_PARSE_ERROR;
+        }
+        r->cmd = MC_CMD_GET;
+        r->key = s;
+        r->keylen = end - s;
+        return MC_PARSE_OK;
+    }
+
+    while (ntok < 6 && mc_next_token(&s, end, &tok[ntok], &toklen[ntok])) {
+        ntok++;
+    }
+    bool noreply = ntok > 0 && mc_token_is(tok[ntok - 1], toklen[ntok - 1], "noreply");
+
+    bool storage = mc_token_is(cmd, cmdlen, "set") || mc_token_is(cmd, cmdlen, "add")
+        || mc_token_is(cmd, cmdlen, "append") || mc_token_is(cmd, cmdlen, "replace")
+        || mc_token_is(cmd, cmdlen, "prepend") || mc_token_is(cmd, cmdlen, "cas");
+    if (storage) {
+        // <cmd> <key> <flags> <exptime> <bytes> [<cas unique>] [noreply]\r\n<data>\r\n
+        if (ntok < 4) {
+            return MC_PARSE_ERROR;
+        }
+        // the value cannot be skipped without reading it, an oversized one ends the connection
+        size_t bytes = strtoul(tok[3], NULL, 10);
+        if (bytes > MC_ITEM_MAX) {
+            return MC_PARSE_ERROR;
+        }
+        if (n - line_len < bytes + 2) {
+            return MC_PARSE_INCOMPLETE;
+        }
+        if (p[line_len + bytes] != '\r' || p[line_len + bytes + 1] != '\n') {
+            // like memcached, answer and go on after the data block
+            r->error = "CLIENT_ERROR bad data chunk\r\n";
+            r->len = line_len + bytes + 2;
+            return MC_PARSE_OK;
+        }
+        r->key = tok[0];
+        r->keylen = toklen[0];
+        r->args.flags = (uint32_t)strtoul(tok[1], NULL, 10);
+        r->args.exptime = (uint32_t)strtoul(tok[2], NULL, 10);
+        r->args.quiet = noreply;
+        r->value = p + line_len;
+        r->vlen = bytes;
+        r->len = line_len + bytes + 2;
+        if (mc_token_is(cmd, cmdlen, "set")) {
+            r->cmd = MC_CMD_SET;
+        } else if (mc_token_is(cmd, cmdlen, "add")) {
+            r->cmd = MC_CMD_ADD;
+        } else if (mc_token_is(cmd, cmdlen, "append")) {
+            r->cmd = MC_CMD_APPEND;
+        }
+    } else if (mc_token_is(cmd, cmdlen, "delete") && ntok >= 1) {
+        r->cmd = MC_CMD_DELETE;
+        r->key = tok[0];
+        r->keylen = toklen[0];
+        r->args.quiet = noreply;
+    } else if ((mc_token_is(cmd, cmdlen, "incr") || mc_token_is(cmd, cmdlen, "decr")) && ntok >= 2) {
+        r->cmd = cmd[0] == 'i' ? MC_CMD_INCR : MC_CMD_DECR;
+        r->key = tok[0];
+        r->keylen = toklen[0];
+        r->args.delta = strtoull(tok[1], NULL, 10);
+        r->args.quiet = noreply;
+    } else if (mc_token_is(cmd, cmdlen, "version")) {
+        r->cmd = MC_CMD_VERSION;
+    } else if (mc_token_is(cmd, cmdlen, "quit")) {
+        r->cmd = MC_CMD_QUIT;
+    }
+    return MC_PARSE_OK;
+}
+
+/**
+ * Parses the request at the start of the buffer, see mc_parse_response() for the result.
+ */
+static inline int mc_parse_request(const char* p, size_t n, bool binary, struct mc_request* r)
+{
+    return binary ? mc_parse_request_binary(p, n, r) : mc_parse_request_ascii(p, n, r);
+}
+
+#endif /* LOADBALANCER_MCPROTO_H_ */
@@ -0,0 +1,222 @@
+/* Sampling memcached's server-side statistics over the text protocol */
+
+#ifndef LOADBALANCER_MCSTATS_H_
+#define LOADBALANCER_MCSTATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+// the largest response accepted, `stats items` has a dozen lines per slab class
+#define MCSTATS_RESPONSE_MAX (256 << 10)
+
+// the command a statistic comes from
+enum mcstats_source {
+    MCSTATS_GENERAL, // stats
+    MCSTATS_SLABS, // stats slabs
+    MCSTATS_ITEMS, // stats items, summed up over the slab classes
+};
+
+enum mcstats_kind {
+    // a running total, reported as a rate
+    MCSTATS_COUNTER,
+    // a current value, reported as is
+    MCSTATS_GAUGE,
+    // CPU seconds, reported as a percentage of one core
+    MCSTATS_SECONDS,
+};
+
+enum mcstats_field {
+    MCSTATS_CMD_GET,
+    MCSTATS_GET_HITS,
+    MCSTATS_GET_MISSES,
+    MCSTATS_CMD_SET,
+    MCSTATS_EVICTIONS,
+    MCSTATS_CURR_CONNECTIONS,
+    MCSTATS_CONN_YIELDS,
+    MCSTATS_LISTEN_DISABLED_NUM,
+    MCSTATS_RUSAGE_USER,
+    MCSTATS_RUSAGE_SYSTEM,
+    MCSTATS_BYTES_READ,
+    MCSTATS_BYTES_WRITTEN,
+    MCSTATS_ACTIVE_SLABS,
+    MCSTATS_TOTAL_MALLOCED,
+    MCSTATS_OUTOFMEMORY,
+    MCSTATS_EVICTED_UNFETCHED,
+    // items the LRU tail could not be evicted because another thread held a reference
+    MCSTATS_LRUTAIL_REFLOCKED,
+    MCSTATS_MAX,
+};
+
+struct mcstats_def {
+    const char* name;
+    enum mcstats_source source;
+    enum mcstats_kind kind;
+};
+
+static const struct mcstats_def mcstats_defs[MCSTATS_MAX] = {
+    { "cmd_get", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "get_hits", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "get_misses", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "cmd_set", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "evictions", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "curr_connections", MCSTATS_GENERAL, MCSTATS_GAUGE },
+    { "conn_yields", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "listen_disabled_num", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "rusage_user", MCSTATS_GENERAL, MCSTATS_SECONDS },
+    { "rusage_system", MCSTATS_GENERAL, MCSTATS_SECONDS },
+    { "bytes_read", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "bytes_written", MCSTATS_GENERAL, MCSTATS_COUNTER },
+    { "active_slabs", MCSTATS_SLABS, MCSTATS_GAUGE },
+    { "total_malloced", MCSTATS_SLABS, MCSTATS_GAUGE },
+    { "outofmemory", MCSTATS_ITEMS, MCSTATS_COUNTER },
+    { "evicted_unfetched", MCSTATS_ITEMS, MCSTATS_COUNTER },
+    { "lrutail_reflocked", MCSTATS_ITEMS, MCSTATS_COUNTER },
+};
+
+/**
+ * One sample of a server. A statistic the server does not report (older versions, or a field of
+ * a stats command the server refused) is not in `present`.
+ */
+struct mcstats {
+    double values[MCSTATS_MAX];
+    uint32_t present;
+};
+
+static inline bool mcstats_has(const struct mcstats* s, enum mcstats_field f)
+{
+    return (s->present & (1U << f)) != 0;
+}
+
+/**
+ * Parses a "STAT <name> <value>" line of the source into the sample. Per-class lines of
+ * `stats items` ("items:<class>:<name>") are summed up, those of `stats slabs` are skipped.
+ */
+static inline void mcstats_parse_line(struct mcstats* s, enum mcstats_source source, const char* line)
+{
+    if (strncmp(line, "STAT ", 5) != 0) {
+        return;
+    }
+    const char* name = line + 5;
+    const char* value = strchr(name, ' ');
+    if (value == NULL) {
+        return;
+    }
+    size_t name_len = value - name;
+
+    if (source == MCSTATS_ITEMS) {
+        const char* colon = (const char*)memchr(name, ':', name_len);
+        colon = colon != NULL ? (const char*)memchr(colon + 1, ':', value - colon - 1) : NULL;
+        if (colon == NULL) {
+            return;
+        }
+        name_len -= colon + 1 - name;
+        name = colon + 1;
+    } else if (source == MCSTATS_SLABS && memchr(name, ':', name_len) != NULL) {
+        return;
+    }
+
+    for (int f = 0; f < MCSTATS_MAX; f++) {
+        if (mcstats_defs[f].source == source && strlen(mcstats_defs[f].name) == name_len
+            && memcmp(mcstats_defs[f].name, name, name_len) == 0) {
+            double v = strtod(value + 1, NULL);
+            s->values[f] = source == MCSTATS_ITEMS && mcstats_has(s, (enum mcstats_field)f) ? s->values[f] + v : v;
+            s->present |= 1U << f;
+            return;
+        }
+    }
+}
+
+/**
+ * Sends the stats command ("stats", "stats slabs", "stats items") on the blocking connection and
+ * parses the response up to its END line into the sample. Returns false if the connection failed
+ * or the server answered with an error.
+ */
+static inline bool mcstats_query(int fd, const char* command, enum mcstats_source source, struct mcstats* s,
+    char* buf, size_t cap)
+{
+    char request[64];
+    int len = snprintf(request, sizeof(request), "%s\r\n", command);
+    if (send(fd, request, len, MSG_NOSIGNAL) != len) {
+        return false;
+    }
+
+    size_t used = 0;
+    size_t parsed = 0;
+    while (true) {
+        char* eol;
+        while ((eol = (char*)memchr(buf + parsed, '\n', used - parsed)) != NULL) {
+            char* line = buf + parsed;
+            *eol = 0;
+            if (eol > line && eol[-1] == '\r') {
+                eol[-1] = 0;
+            }
+            parsed = eol + 1 - buf;
+            if (strcmp(line, "END") == 0) {
+                return true;
+            }
+            if (strncmp(line, "ERROR", 5) == 0 || strncmp(line, "CLIENT_ERROR", 12) == 0
+                || strncmp(line, "SERVER_ERROR", 12) == 0) {
+                return false;
+            }
+            mcstats_parse_line(s, source, line);
+        }
+
+        // keep the incomplete line at the start of the buffer
+        memmove(buf, buf + parsed, used - parsed);
+        used -= parsed;
+        parsed = 0;
+        if (used == cap) {
+            return false;
+        }
+        ssize_t n = recv(fd, buf + used, cap - used, 0);
+        if (n <= 0) {
+            return false;
+        }
+        used += n;
+    }
+}
+
+/**
+ * Takes a full sample of the server: the general, slab and item statistics. Returns false if the
+ * connection failed; a server that refuses `stats slabs` or `stats items` only leaves those out.
+ */
+static inline bool mcstats_sample(int fd, struct mcstats* s, char* buf, size_t cap)
+{
+    memset(s, 0, sizeof(*s));
+    if (!mcstats_query(fd, "stats", MCSTATS_GENERAL, s, buf, cap)) {
+        return false;
+    }
+    mcstats_query(fd, "stats slabs", MCSTATS_SLABS, s, buf, cap);
+    mcstats_query(fd, "stats items", MCSTATS_ITEMS, s, buf, cap);
+    return true;
+}
+
+/**
+ * The value of the field over the interval between two samples of `seconds`: the rate of a
+ * counter, the current value of a gauge, or the percentage of a core for CPU time. Returns false
+ * if either sample misses the field.
+ */
+static inline bool mcstats_interval(const struct mcstats* prev, const struct mcstats* cur, enum mcstats_field f,
+    double seconds, double* value)
+{
+    if (!mcstats_has(cur, f) || (mcstats_defs[f].kind != MCSTATS_GAUGE && !mcstats_has(prev, f))) {
+        return false;
+    }
+    switch (mcstats_defs[f].kind) {
+    case MCSTATS_COUNTER:
+        *value = seconds > 0 ? (cur->values[f] - prev->values[f]) / seconds : 0.0;
+        break;
+    case MCSTATS_GAUGE:
+        *value = cur->values[f];
+        break;
+    case MCSTATS_SECONDS:
+        *value = seconds > 0 ? 100.0 * (cur->values[f] - prev->values[f]) / seconds : 0.0;
+        break;
+    }
+    return true;
+}
+
+#endif /* LOADBALANCER_MCSTATS_H_ */
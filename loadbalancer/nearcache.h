@@ -0,0 +1,344 @@
+/* Sharded in-process cache for hot keys in front of the servers */
+
+#ifndef LOADBALANCER_NEARCACHE_H_
+#define LOADBALANCER_NEARCACHE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the CLOCK counter saturates here, a key survives this many sweeps of the hand without an access
+#define NEARCACHE_MAX_REF 3
+
+// the bytes an entry is charged on top of its value, roughly its share of the tables
+#define NEARCACHE_ENTRY_OVERHEAD 48
+
+struct nearcache_entry {
+    // the cached object id plus one, 0 marks a free entry
+    uint64_t key;
+    // the expiration time in timer ticks, 0 for none
+    uint64_t expires;
+    char* value;
+    uint32_t len;
+    // the size of the value buffer, which is kept when the entry is reused
+    uint32_t cap;
+    uint8_t ref;
+};
+
+/**
+ * One shard of the cache, with its own lock, tables, CLOCK hand and byte budget.
+ *
+ * The index is an open-addressing table with linear probing that maps a key to its entry; entries
+ * live in a separate array that the CLOCK hand sweeps. Accessing a key bumps its counter, the hand
+ * decrements counters and evicts the first entry it finds at zero, so keys that were hit more
+ * often survive more sweeps (as in S3-FIFO) while one-hit wonders leave on the first one.
+ */
+struct nearcache_shard {
+    int lock;
+    uint32_t index_mask;
+    uint32_t* index;
+    struct nearcache_entry* entries;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t hand;
+    // free entries below `high`, entries at and above it have never been used
+    uint32_t* free_list;
+    uint32_t num_free;
+    uint32_t high;
+    size_t bytes;
+    size_t budget;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t expirations;
+} __attribute__((aligned(64)));
+
+struct nearcache {
+    struct nearcache_shard* shards;
+    size_t num_shards;
+    unsigned shard_bits;
+    size_t budget;
+    // the time to live of an entry in timer ticks, 0 for none
+    uint64_t ttl;
+};
+
+struct nearcache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t expirations;
+    uint64_t entries;
+    size_t bytes;
+};
+
+static inline void nearcache_lock(struct nearcache_shard* s)
+{
+    while (__atomic_exchange_n(&s->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&s->lock, __ATOMIC_RELAXED)) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+}
+
+static inline void nearcache_unlock(struct nearcache_shard* s)
+{
+    __atomic_store_n(&s->lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t nearcache_hash(uint64_t key)
+{
+    // splitmix64 finalizer
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9UL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebUL;
+    key ^= key >> 31;
+    return key;
+}
+
+/**
+ * Sets up a cache of `budget` bytes over `num_shards` shards (rounded up to a power of two).
+ * `avg_value` sizes the tables, `ttl` is given in timer ticks.
+ */
+static inline void nearcache_init(struct nearcache* nc, size_t budget, size_t num_shards, size_t avg_value,
+    uint64_t ttl)
+{
+    memset(nc, 0, sizeof(*nc));
+    while ((1UL << nc->shard_bits) < num_shards) {
+        nc->shard_bits++;
+    }
+    nc->num_shards = 1UL << nc->shard_bits;
+    nc->budget = budget;
+    nc->ttl = ttl;
+
+    nc->shards = (struct nearcache_shard*)aligned_alloc(64, nc->num_shards * sizeof(*nc->shards));
+    if (nc->shards == NULL) {
+        printf("failed to allocate memory for the near cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t shard_budget = budget / nc->num_shards;
+    size_t capacity = shard_budget / (avg_value + NEARCACHE_ENTRY_OVERHEAD) + 1;
+    size_t index_size = 1;
+    while (index_size < 2 * capacity) {
+        index_size <<= 1;
+    }
+
+    for (size_t i = 0; i < nc->num_shards; i++) {
+        struct nearcache_shard* s = &nc->shards[i];
+        memset(s, 0, sizeof(*s));
+        s->budget = shard_budget;
+        s->capacity = (uint32_t)capacity;
+        s->index_mask = (uint32_t)(index_size - 1);
+        s->index = (uint32_t*)calloc(index_size, sizeof(*s->index));
+        s->entries = (struct nearcache_entry*)calloc(capacity, sizeof(*s->entries));
+        s->free_list = (uint32_t*)calloc(capacity, sizeof(*s->free_list));
+        if (s->index == NULL || s->entries == NULL || s->free_list == NULL) {
+            printf("failed to allocate memory for the near cache\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static inline void nearcache_free(struct nearcache* nc)
+{
+    for (size_t i = 0; i < nc->num_shards; i++) {
+        struct nearcache_shard* s = &nc->shards[i];
+        for (uint32_t e = 0; e < s->high; e++) {
+            free(s->entries[e].value);
+        }
+        free(s->free_list);
+        free(s->entries);
+        free(s->index);
+    }
+    free(nc->shards);
+    nc->shards = NULL;
+}
+
+static inline struct nearcache_shard* nearcache_shard_of(const struct nearcache* nc, uint64_t hash)
+{
+    return &nc->shards[nc->shard_bits ? hash >> (64 - nc->shard_bits) : 0];
+}
+
+// returns the index slot that holds the key, or the empty slot where it would go
+static inline uint32_t nearcache_probe(const struct nearcache_shard* s, uint64_t key, uint64_t hash)
+{
+    uint32_t pos = (uint32_t)hash & s->index_mask;
+    while (s->index[pos] != 0 && s->entries[s->index[pos] - 1].key != key) {
+        pos = (pos + 1) & s->index_mask;
+    }
+    return pos;
+}
+
+// removes the entry at the index slot, shifting later entries of the probe sequence back
+static inline void nearcache_remove_at(struct nearcache_shard* s, uint32_t pos)
+{
+    uint32_t e = s->index[pos] - 1;
+    struct nearcache_entry* entry = &s->entries[e];
+    s->bytes -= entry->len + NEARCACHE_ENTRY_OVERHEAD;
+    entry->key = 0;
+    s->free_list[s->num_free++] = e;
+    s->count--;
+
+    uint32_t hole = pos;
+    uint32_t next = (pos + 1) & s->index_mask;
+    while (s->index[next] != 0) {
+        uint32_t home = (uint32_t)nearcache_hash(s->entries[s->index[next] - 1].key) & s->index_mask;
+        // move the entry into the hole unless its home lies cyclically within (hole, next]
+        if (((next - home) & s->index_mask) >= ((next - hole) & s->index_mask)) {
+            s->index[hole] = s->index[next];
+            hole = next;
+        }
+        next = (next + 1) & s->index_mask;
+    }
+    s->index[hole] = 0;
+}
+
+// advances the CLOCK hand until it has evicted an entry
+static inline void nearcache_evict_one(struct nearcache_shard* s)
+{
+    for (;;) {
+        struct nearcache_entry* entry = &s->entries[s->hand];
+        s->hand = s->hand + 1 < s->high ? s->hand + 1 : 0;
+        if (entry->key == 0) {
+            continue;
+        }
+        if (entry->ref > 0) {
+            entry->ref--;
+            continue;
+        }
+        nearcache_remove_at(s, nearcache_probe(s, entry->key, nearcache_hash(entry->key)));
+        s->evictions++;
+        return;
+    }
+}
+
+/**
+ * Copies the cached value of the object into `buf` (up to `cap` bytes) and returns true on a hit.
+ * `now` is the current time in timer ticks.
+ */
+static inline bool nearcache_get(struct nearcache* nc, uint64_t objid, char* buf, size_t cap, size_t* len,
+    uint64_t now)
+{
+    uint64_t key = objid + 1;
+    uint64_t hash = nearcache_hash(key);
+    struct nearcache_shard* s = nearcache_shard_of(nc, hash);
+
+    nearcache_lock(s);
+    uint32_t pos = nearcache_probe(s, key, hash);
+    if (s->index[pos] == 0) {
+        s->misses++;
+        nearcache_unlock(s);
+        return false;
+    }
+
+    struct nearcache_entry* entry = &s->entries[s->index[pos] - 1];
+    if (entry->expires != 0 && now >= entry->expires) {
+        nearcache_remove_at(s, pos);
+        s->expirations++;
+        s->misses++;
+        nearcache_unlock(s);
+        return false;
+    }
+
+    if (entry->ref < NEARCACHE_MAX_REF) {
+        entry->ref++;
+    }
+    *len = entry->len;
+    memcpy(buf, entry->value, entry->len < cap ? entry->len : cap);
+    s->hits++;
+    nearcache_unlock(s);
+    return true;
+}
+
+/**
+ * Caches the value of the object, evicting other entries of its shard as needed. Values larger
+ * than the shard's budget are not cached.
+ */
+static inline void nearcache_put(struct nearcache* nc, uint64_t objid, const char* value, size_t len, uint64_t now)
+{
+    uint64_t key = objid + 1;
+    uint64_t hash = nearcache_hash(key);
+    struct nearcache_shard* s = nearcache_shard_of(nc, hash);
+    size_t charge = len + NEARCACHE_ENTRY_OVERHEAD;
+    if (charge > s->budget) {
+        return;
+    }
+
+    nearcache_lock(s);
+    uint32_t pos = nearcache_probe(s, key, hash);
+    if (s->index[pos] != 0) {
+        // replace the value, a concurrent miss on the same key may have inserted it already
+        nearcache_remove_at(s, pos);
+    }
+    while (s->count > 0 && (s->bytes + charge > s->budget || s->count == s->capacity)) {
+        nearcache_evict_one(s);
+    }
+
+    uint32_t e = s->num_free > 0 ? s->free_list[--s->num_free] : s->high++;
+    struct nearcache_entry* entry = &s->entries[e];
+    if (entry->cap < len) {
+        // value buffers only grow and are reused by later entries in the same place
+        char* value = (char*)realloc(entry->value, len);
+        if (value == NULL) {
+            s->free_list[s->num_free++] = e;
+            nearcache_unlock(s);
+            return;
+        }
+        entry->value = value;
+        entry->cap = (uint32_t)len;
+    }
+    memcpy(entry->value, value, len);
+    entry->key = key;
+    entry->len = (uint32_t)len;
+    entry->ref = 0;
+    entry->expires = nc->ttl ? now + nc->ttl : 0;
+
+    s->index[nearcache_probe(s, key, hash)] = e + 1;
+    s->bytes += charge;
+    s->count++;
+    s->inserts++;
+    nearcache_unlock(s);
+}
+
+/**
+ * Drops the object from the cache, e.g. after it has been updated.
+ */
+static inline void nearcache_invalidate(struct nearcache* nc, uint64_t objid)
+{
+    uint64_t key = objid + 1;
+    uint64_t hash = nearcache_hash(key);
+    struct nearcache_shard* s = nearcache_shard_of(nc, hash);
+
+    nearcache_lock(s);
+    uint32_t pos = nearcache_probe(s, key, hash);
+    if (s->index[pos] != 0) {
+        nearcache_remove_at(s, pos);
+    }
+    nearcache_unlock(s);
+}
+
+static inline void nearcache_get_stats(struct nearcache* nc, struct nearcache_stats* st)
+{
+    memset(st, 0, sizeof(*st));
+    for (size_t i = 0; i < nc->num_shards; i++) {
+        struct nearcache_shard* s = &nc->shards[i];
+        nearcache_lock(s);
+        st->hits += s->hits;
+        st->misses += s->misses;
+        st->inserts += s->inserts;
+        st->evictions += s->evictions;
+        st->expirations += s->expirations;
+        st->entries += s->count;
+        st->bytes += s->bytes;
+        nearcache_unlock(s);
+    }
+}
+
+#endif /* LOADBALANCER_NEARCACHE_H_ */
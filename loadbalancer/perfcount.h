@@ -0,0 +1,193 @@
+/* Hardware and software performance counters via perf_event_open(2) */
+
+#ifndef LOADBALANCER_PERFCOUNT_H_
+#define LOADBALANCER_PERFCOUNT_H_
+
+#include <dirent.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum perfcount_event {
+    PERFCOUNT_CYCLES,
+    PERFCOUNT_INSTRUCTIONS,
+    // misses of the last level cache
+    PERFCOUNT_LLC_MISSES,
+    PERFCOUNT_CONTEXT_SWITCHES,
+    // entries into system calls, a tracepoint that needs access to tracefs
+    PERFCOUNT_SYSCALLS,
+    PERFCOUNT_MAX,
+};
+
+static const char* perfcount_event_names[PERFCOUNT_MAX] = {
+    "cycles",
+    "instructions",
+    "llc-misses",
+    "ctx-switches",
+    "syscalls",
+};
+
+/**
+ * The counters of a single task (thread). Every event is opened on its own, so an event the
+ * machine or the permissions do not support only leaves its fd at -1. Events are counted in user
+ * and kernel mode unless perf_event_paranoid restricts the process to user mode.
+ */
+struct perfcount_group {
+    int fd[PERFCOUNT_MAX];
+    bool user_only;
+};
+
+static inline int perfcount_open_event(pid_t tid, uint32_t type, uint64_t config, bool exclude_kernel)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    // the counters are multiplexed when there are more events than hardware counters
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// returns the tracepoint id of raw_syscalls:sys_enter, or -1 if tracefs is not accessible
+static inline long perfcount_syscall_tracepoint(void)
+{
+    static const char* paths[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+    };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        FILE* f = fopen(paths[i], "r");
+        if (f == NULL) {
+            continue;
+        }
+        long id = -1;
+        if (fscanf(f, "%ld", &id) != 1) {
+            id = -1;
+        }
+        fclose(f);
+        if (id >= 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Opens the counters for the task (0 for the calling thread) and returns the number of events
+ * that could be opened.
+ */
+static inline size_t perfcount_open(struct perfcount_group* g, pid_t tid)
+{
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+        // only happens in the kernel, so it always reads 0 in user mode
+        bool kernel_only;
+    } events[PERFCOUNT_SYSCALLS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, false },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, false },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, false },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, true },
+    };
+
+    memset(g, 0, sizeof(*g));
+    size_t opened = 0;
+    for (int e = 0; e < PERFCOUNT_SYSCALLS; e++) {
+        g->fd[e] = perfcount_open_event(tid, events[e].type, events[e].config, g->user_only);
+        // counting the kernel needs perf_event_paranoid <= 1, fall back to user mode otherwise
+        if (g->fd[e] < 0 && !g->user_only && (errno == EACCES || errno == EPERM)) {
+            g->user_only = true;
+            g->fd[e] = perfcount_open_event(tid, events[e].type, events[e].config, true);
+        }
+    }
+    for (int e = 0; e < PERFCOUNT_SYSCALLS; e++) {
+        // a kernel-only event is unavailable in user mode rather than counted as 0
+        if (g->user_only && events[e].kernel_only && g->fd[e] >= 0) {
+            close(g->fd[e]);
+            g->fd[e] = -1;
+        }
+        opened += g->fd[e] >= 0;
+    }
+
+    long tracepoint = perfcount_syscall_tracepoint();
+    g->fd[PERFCOUNT_SYSCALLS] = tracepoint < 0 ? -1
+                                               : perfcount_open_event(tid, PERF_TYPE_TRACEPOINT, tracepoint, false);
+    opened += g->fd[PERFCOUNT_SYSCALLS] >= 0;
+    return opened;
+}
+
+/**
+ * Opens a group for every thread of the process, up to `max`, and returns the number of groups.
+ * Threads the process starts later are not counted.
+ */
+static inline size_t perfcount_open_process(pid_t pid, struct perfcount_group* groups, size_t max)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+
+    size_t n = 0;
+    struct dirent* entry;
+    while (n < max && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (perfcount_open(&groups[n], (pid_t)atoi(entry->d_name)) > 0) {
+            n++;
+        }
+    }
+    closedir(dir);
+    return n;
+}
+
+static inline void perfcount_close(struct perfcount_group* g)
+{
+    for (int e = 0; e < PERFCOUNT_MAX; e++) {
+        if (g->fd[e] >= 0) {
+            close(g->fd[e]);
+            g->fd[e] = -1;
+        }
+    }
+}
+
+/**
+ * Reads the counters, scaled up for the time they were multiplexed out. Events that are not
+ * counted read as 0.
+ */
+static inline void perfcount_read(const struct perfcount_group* g, uint64_t* values)
+{
+    for (int e = 0; e < PERFCOUNT_MAX; e++) {
+        uint64_t buf[3] = { 0, 0, 0 };
+        values[e] = 0;
+        if (g->fd[e] < 0 || read(g->fd[e], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+            continue;
+        }
+        // buf: value, time enabled, time running
+        values[e] = buf[2] > 0 && buf[2] < buf[1] ? (uint64_t)((double)buf[0] * buf[1] / buf[2]) : buf[0];
+    }
+}
+
+// returns the events the group counts as a bit mask
+static inline uint32_t perfcount_available(const struct perfcount_group* g)
+{
+    uint32_t mask = 0;
+    for (int e = 0; e < PERFCOUNT_MAX; e++) {
+        if (g->fd[e] >= 0) {
+            mask |= 1U << e;
+        }
+    }
+    return mask;
+}
+
+#endif /* LOADBALANCER_PERFCOUNT_H_ */
@@ -0,0 +1,215 @@
+/* NUMA topology and thread placement for the loadbalancer */
+
+#ifndef LOADBALANCER_PLACEMENT_H_
+#define LOADBALANCER_PLACEMENT_H_
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PLACEMENT_MAX_NODES 64
+#define PLACEMENT_MAX_CPUS CPU_SETSIZE
+
+enum placement_kind {
+    // threads are left to the scheduler
+    PLACEMENT_NONE,
+    // threads fill the cores of one node before moving on to the next
+    PLACEMENT_COMPACT,
+    // threads are dealt round-robin over the nodes
+    PLACEMENT_SPREAD,
+};
+
+struct placement_node {
+    int id;
+    size_t num_cpus;
+    // the cpus of the node this process may run on, ascending
+    int cpus[PLACEMENT_MAX_CPUS];
+};
+
+/**
+ * The NUMA nodes of the machine as seen in /sys/devices/system/node, restricted to the cpus in the
+ * process' affinity mask (taskset, cgroups). Nodes without such cpus are left out, a machine
+ * without NUMA information is a single node 0.
+ */
+struct placement_topology {
+    size_t num_nodes;
+    struct placement_node nodes[PLACEMENT_MAX_NODES];
+};
+
+static inline const char* placement_kind_name(enum placement_kind kind)
+{
+    switch (kind) {
+    case PLACEMENT_NONE:
+        return "none";
+    case PLACEMENT_COMPACT:
+        return "compact";
+    case PLACEMENT_SPREAD:
+        return "spread";
+    }
+    return "unknown";
+}
+
+static inline bool placement_kind_parse(const char* s, enum placement_kind* kind)
+{
+    if (strcmp(s, "none") == 0) {
+        *kind = PLACEMENT_NONE;
+    } else if (strcmp(s, "compact") == 0) {
+        *kind = PLACEMENT_COMPACT;
+    } else if (strcmp(s, "spread") == 0) {
+        *kind = PLACEMENT_SPREAD;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Parses a kernel cpu list like "0-3,8-11" into `ids`, returns the number of ids or -1 if the
+ * list is malformed.
+ */
+static inline int placement_parse_list(const char* s, int* ids, size_t max)
+{
+    size_t n = 0;
+    while (*s != 0 && *s != '\n') {
+        char* end;
+        long lo = strtol(s, &end, 10);
+        long hi = lo;
+        if (end == s || lo < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo) {
+                return -1;
+            }
+        }
+        for (long i = lo; i <= hi && n < max; i++) {
+            ids[n++] = (int)i;
+        }
+        s = *end == ',' ? end + 1 : end;
+    }
+    return (int)n;
+}
+
+static inline int placement_read_list(const char* path, int* ids, size_t max)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char line[4096];
+    int n = fgets(line, sizeof(line), f) != NULL ? placement_parse_list(line, ids, max) : -1;
+    fclose(f);
+    return n;
+}
+
+static inline void placement_topology_init(struct placement_topology* t)
+{
+    memset(t, 0, sizeof(*t));
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        for (int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN) && cpu < PLACEMENT_MAX_CPUS; cpu++) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+
+    int node_ids[PLACEMENT_MAX_NODES];
+    int num_ids = placement_read_list("/sys/devices/system/node/online", node_ids, PLACEMENT_MAX_NODES);
+    for (int i = 0; i < num_ids; i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node_ids[i]);
+        struct placement_node* node = &t->nodes[t->num_nodes];
+        int num_cpus = placement_read_list(path, node->cpus, PLACEMENT_MAX_CPUS);
+        node->id = node_ids[i];
+        node->num_cpus = 0;
+        for (int c = 0; c < num_cpus; c++) {
+            if (CPU_ISSET(node->cpus[c], &allowed)) {
+                node->cpus[node->num_cpus++] = node->cpus[c];
+            }
+        }
+        if (node->num_cpus > 0) {
+            t->num_nodes++;
+        }
+    }
+
+    if (t->num_nodes == 0) {
+        struct placement_node* node = &t->nodes[0];
+        node->id = 0;
+        for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                node->cpus[node->num_cpus++] = cpu;
+            }
+        }
+        t->num_nodes = 1;
+    }
+}
+
+// returns the index of the node with the given id, or -1
+static inline int placement_node_index(const struct placement_topology* t, int id)
+{
+    for (size_t i = 0; i < t->num_nodes; i++) {
+        if (t->nodes[i].id == id) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Picks the node (index into the topology) and cpu of the thread. Threads beyond the number of
+ * cpus wrap around and share cores.
+ */
+static inline void placement_assign(const struct placement_topology* t, enum placement_kind kind, size_t tid,
+    size_t* node, int* cpu)
+{
+    if (kind == PLACEMENT_SPREAD) {
+        *node = tid % t->num_nodes;
+        const struct placement_node* n = &t->nodes[*node];
+        *cpu = n->cpus[(tid / t->num_nodes) % n->num_cpus];
+        return;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < t->num_nodes; i++) {
+        total += t->nodes[i].num_cpus;
+    }
+    size_t slot = tid % total;
+    for (*node = 0; slot >= t->nodes[*node].num_cpus; (*node)++) {
+        slot -= t->nodes[*node].num_cpus;
+    }
+    *cpu = t->nodes[*node].cpus[slot];
+}
+
+/**
+ * Pins the calling thread to the cpu and makes the node its preferred node for new memory, so the
+ * buffers it allocates and touches afterwards are local. Returns false if the kernel refused.
+ */
+static inline bool placement_bind(int cpu, int node_id)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return false;
+    }
+    if (node_id < 0 || node_id >= PLACEMENT_MAX_NODES) {
+        return false;
+    }
+
+    // set_mempolicy(2) without libnuma, the mask covers PLACEMENT_MAX_NODES nodes
+    unsigned long mask[PLACEMENT_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[node_id / (8 * sizeof(unsigned long))] |= 1UL << (node_id % (8 * sizeof(unsigned long)));
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, PLACEMENT_MAX_NODES + 1) == 0;
+}
+
+#endif /* LOADBALANCER_PLACEMENT_H_ */
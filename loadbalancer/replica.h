@@ -0,0 +1,213 @@
+/* Read policies over replicated keys, and the connections hedged gets are raced on */
+
+#ifndef LOADBALANCER_REPLICA_H_
+#define LOADBALANCER_REPLICA_H_
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mcproto.h"
+
+// the initial size of a hedge connection's buffers, a get request and one value
+#define REPLICA_BUFFER_SIZE (16 << 10)
+
+enum replica_policy {
+    // every read goes to the key's primary server
+    REPLICA_PRIMARY,
+    // a read goes to the less busy of two random replicas, by the requests outstanding on them
+    REPLICA_P2C,
+    // a read goes to the primary, and to a second replica if the primary is slower than a delay
+    REPLICA_HEDGED,
+};
+
+static inline const char* replica_policy_name(enum replica_policy policy)
+{
+    switch (policy) {
+    case REPLICA_PRIMARY:
+        return "primary";
+    case REPLICA_P2C:
+        return "p2c";
+    case REPLICA_HEDGED:
+        return "hedged";
+    }
+    return "unknown";
+}
+
+static inline bool replica_policy_parse(const char* s, enum replica_policy* policy)
+{
+    if (strcmp(s, "primary") == 0) {
+        *policy = REPLICA_PRIMARY;
+    } else if (strcmp(s, "p2c") == 0) {
+        *policy = REPLICA_P2C;
+    } else if (strcmp(s, "hedged") == 0) {
+        *policy = REPLICA_HEDGED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * A blocking connection a get can be sent on and waited for together with others. A get that
+ * lost the race leaves its response owed, it is read and dropped before the next one. A connection
+ * that failed is closed, its fd is -1 from then on and gets sent on it fail.
+ */
+struct replica_conn {
+    int fd;
+    struct mc_buf rbuf;
+    struct mc_buf wbuf;
+    // responses to requests that are still to arrive
+    size_t owed;
+};
+
+static inline void replica_conn_init(struct replica_conn* c, int fd)
+{
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    mc_buf_init(&c->rbuf, REPLICA_BUFFER_SIZE);
+    mc_buf_init(&c->wbuf, REPLICA_BUFFER_SIZE);
+}
+
+static inline void replica_conn_free(struct replica_conn* c)
+{
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    mc_buf_free(&c->rbuf);
+    mc_buf_free(&c->wbuf);
+}
+
+// closes the connection after a failure, the responses it still owed are lost
+static inline void replica_conn_drop(struct replica_conn* c)
+{
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->owed = 0;
+    mc_buf_consume(&c->rbuf, mc_buf_len(&c->rbuf));
+    mc_buf_consume(&c->wbuf, mc_buf_len(&c->wbuf));
+}
+
+static inline bool replica_conn_send_get(struct replica_conn* c, bool binary, const char* key, size_t keylen)
+{
+    if (c->fd < 0) {
+        return false;
+    }
+    mc_encode_request(&c->wbuf, binary, MC_REQ_GET, key, keylen, NULL, 0, 0);
+    while (mc_buf_len(&c->wbuf) > 0) {
+        ssize_t n = send(c->fd, mc_buf_head(&c->wbuf), mc_buf_len(&c->wbuf), MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            replica_conn_drop(c);
+            return false;
+        }
+        mc_buf_consume(&c->wbuf, n);
+    }
+    c->owed++;
+    return true;
+}
+
+/**
+ * Takes the next complete response off the connection's buffer. Returns MC_PARSE_INCOMPLETE if
+ * it has not fully arrived yet.
+ */
+static inline int replica_conn_parse(struct replica_conn* c, bool binary, struct mc_response* resp)
+{
+    if (c->owed == 0) {
+        return MC_PARSE_INCOMPLETE;
+    }
+    int rv = mc_parse_response(mc_buf_head(&c->rbuf), mc_buf_len(&c->rbuf), binary, MC_REQ_GET, resp);
+    if (rv == MC_PARSE_OK) {
+        c->owed--;
+    }
+    return rv;
+}
+
+static inline bool replica_conn_read(struct replica_conn* c)
+{
+    char* p = mc_buf_reserve(&c->rbuf, REPLICA_BUFFER_SIZE / 2);
+    ssize_t n = recv(c->fd, p, c->rbuf.cap - c->rbuf.end, 0);
+    if (n < 0 && errno == EINTR) {
+        return true;
+    }
+    if (n <= 0) {
+        return false;
+    }
+    mc_buf_commit(&c->rbuf, n);
+    return true;
+}
+
+/**
+ * Waits until one of the connections has the response it owes last, for at most `timeout_ns`
+ * (negative waits forever). Earlier responses a connection still owes are dropped on the way.
+ * Returns the index of the connection whose response is in `resp`, which stays valid until the
+ * response is consumed with mc_buf_consume(&rbuf, resp->len); -1 on timeout and -2 once every
+ * connection failed. A connection that fails is dropped while the others are still waited for.
+ */
+static inline int replica_wait(struct replica_conn** conns, size_t n, bool binary, int64_t timeout_ns,
+    struct mc_response* resp)
+{
+    struct timespec t_start;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    struct pollfd fds[2];
+    if (n > 2) {
+        return -2;
+    }
+
+    for (;;) {
+        size_t waiting = 0;
+        for (size_t i = 0; i < n; i++) {
+            int rv;
+            while ((rv = replica_conn_parse(conns[i], binary, resp)) == MC_PARSE_OK) {
+                if (conns[i]->owed == 0) {
+                    return (int)i;
+                }
+                mc_buf_consume(&conns[i]->rbuf, resp->len);
+            }
+            if (rv == MC_PARSE_ERROR) {
+                replica_conn_drop(conns[i]);
+            }
+            // poll skips the negative fds of dropped connections
+            fds[i].fd = conns[i]->owed > 0 ? conns[i]->fd : -1;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+            waiting += fds[i].fd >= 0;
+        }
+        if (waiting == 0) {
+            return -2;
+        }
+
+        struct timespec timeout;
+        struct timespec* ptimeout = NULL;
+        if (timeout_ns >= 0) {
+            struct timespec t_now;
+            clock_gettime(CLOCK_MONOTONIC, &t_now);
+            int64_t left = timeout_ns - ((t_now.tv_sec - t_start.tv_sec) * 1000000000L + t_now.tv_nsec - t_start.tv_nsec);
+            if (left <= 0) {
+                return -1;
+            }
+            timeout.tv_sec = left / 1000000000L;
+            timeout.tv_nsec = left % 1000000000L;
+            ptimeout = &timeout;
+        }
+        int ready = ppoll(fds, n, ptimeout, NULL);
+        if (ready < 0 && errno != EINTR) {
+            return -2;
+        }
+        for (size_t i = 0; ready > 0 && i < n; i++) {
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !replica_conn_read(conns[i])) {
+                replica_conn_drop(conns[i]);
+            }
+        }
+    }
+}
+
+#endif /* LOADBALANCER_REPLICA_H_ */
@@ -0,0 +1,157 @@
+/* Machine-readable benchmark results as JSON and CSV */
+
+#ifndef LOADBALANCER_RESULTS_H_
+#define LOADBALANCER_RESULTS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RESULTS_MAX_DEPTH 16
+
+/**
+ * A streaming JSON writer. Values inside objects are written with a key, values inside arrays
+ * with a NULL key; the writer keeps track of the separators and the indentation.
+ */
+struct results_json {
+    FILE* f;
+    int depth;
+    bool has_items[RESULTS_MAX_DEPTH];
+};
+
+static inline void results_json_init(struct results_json* j, FILE* f)
+{
+    memset(j, 0, sizeof(*j));
+    j->f = f;
+}
+
+static inline void results_json_string_raw(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (; *s != 0; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// writes the separator, indentation and key in front of a value
+static inline void results_json_key(struct results_json* j, const char* key)
+{
+    if (j->depth > 0) {
+        fputs(j->has_items[j->depth] ? ",\n" : "\n", j->f);
+        j->has_items[j->depth] = true;
+        fprintf(j->f, "%*s", 2 * j->depth, "");
+    }
+    if (key != NULL) {
+        results_json_string_raw(j->f, key);
+        fputs(": ", j->f);
+    }
+}
+
+static inline void results_json_open(struct results_json* j, const char* key, char bracket)
+{
+    results_json_key(j, key);
+    fputc(bracket, j->f);
+    if (j->depth + 1 < RESULTS_MAX_DEPTH) {
+        j->depth++;
+    }
+    j->has_items[j->depth] = false;
+}
+
+static inline void results_json_close(struct results_json* j, char bracket)
+{
+    bool has_items = j->has_items[j->depth];
+    j->depth--;
+    if (has_items) {
+        fprintf(j->f, "\n%*s", 2 * j->depth, "");
+    }
+    fputc(bracket, j->f);
+    if (j->depth == 0) {
+        fputc('\n', j->f);
+    }
+}
+
+static inline void results_json_object_begin(struct results_json* j, const char* key)
+{
+    results_json_open(j, key, '{');
+}
+
+static inline void results_json_object_end(struct results_json* j)
+{
+    results_json_close(j, '}');
+}
+
+static inline void results_json_array_begin(struct results_json* j, const char* key)
+{
+    results_json_open(j, key, '[');
+}
+
+static inline void results_json_array_end(struct results_json* j)
+{
+    results_json_close(j, ']');
+}
+
+static inline void results_json_uint(struct results_json* j, const char* key, uint64_t v)
+{
+    results_json_key(j, key);
+    fprintf(j->f, "%lu", (unsigned long)v);
+}
+
+static inline void results_json_int(struct results_json* j, const char* key, int64_t v)
+{
+    results_json_key(j, key);
+    fprintf(j->f, "%ld", (long)v);
+}
+
+static inline void results_json_double(struct results_json* j, const char* key, double v)
+{
+    results_json_key(j, key);
+    // JSON has no representation for nan or infinity
+    if (v != v || v > 1e300 || v < -1e300) {
+        fputs("null", j->f);
+    } else {
+        fprintf(j->f, "%.3f", v);
+    }
+}
+
+static inline void results_json_bool(struct results_json* j, const char* key, bool v)
+{
+    results_json_key(j, key);
+    fputs(v ? "true" : "false", j->f);
+}
+
+static inline void results_json_string(struct results_json* j, const char* key, const char* s)
+{
+    results_json_key(j, key);
+    results_json_string_raw(j->f, s);
+}
+
+/**
+ * Writes a CSV field, quoted if it contains a separator, a quote or a line break.
+ */
+static inline void results_csv_field(FILE* f, const char* s, bool last)
+{
+    if (strpbrk(s, ",\"\r\n") != NULL) {
+        fputc('"', f);
+        for (; *s != 0; s++) {
+            if (*s == '"') {
+                fputc('"', f);
+            }
+            fputc(*s, f);
+        }
+        fputc('"', f);
+    } else {
+        fputs(s, f);
+    }
+    fputc(last ? '\n' : ',', f);
+}
+
+#endif /* LOADBALANCER_RESULTS_H_ */
@@ -0,0 +1,231 @@
+/* Key to server routing for the loadbalancer */
+
+#ifndef LOADBALANCER_ROUTER_H_
+#define LOADBALANCER_ROUTER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the number of points each server gets on the ketama continuum (same as libketama)
+#define ROUTER_KETAMA_DEFAULT_VNODES 160
+
+enum router_kind {
+    // objid % num_servers, remaps almost every key when the server set changes
+    ROUTER_MODULO,
+    // consistent hashing on a continuum of virtual nodes
+    ROUTER_KETAMA,
+    // jump consistent hash (Lamping & Veach), no state but the server count
+    ROUTER_JUMP,
+};
+
+struct router_point {
+    uint32_t hash;
+    uint32_t server;
+};
+
+struct router {
+    enum router_kind kind;
+    size_t num_servers;
+    // the ketama continuum, sorted by hash
+    struct router_point* ring;
+    size_t num_points;
+};
+
+static inline const char* router_kind_name(enum router_kind kind)
+{
+    switch (kind) {
+    case ROUTER_MODULO:
+        return "modulo";
+    case ROUTER_KETAMA:
+        return "ketama";
+    case ROUTER_JUMP:
+        return "jump";
+    }
+    return "unknown";
+}
+
+static inline bool router_parse_kind(const char* name, enum router_kind* kind)
+{
+    if (strcmp(name, "modulo") == 0) {
+        *kind = ROUTER_MODULO;
+    } else if (strcmp(name, "ketama") == 0) {
+        *kind = ROUTER_KETAMA;
+    } else if (strcmp(name, "jump") == 0) {
+        *kind = ROUTER_JUMP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static inline uint64_t router_hash64(uint64_t x)
+{
+    // splitmix64 finalizer, spreads sequential object ids over the whole range
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9UL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebUL;
+    x ^= x >> 31;
+    return x;
+}
+
+static inline uint64_t router_hash_string(const char* s)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325UL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 0x100000001b3UL;
+    }
+    return router_hash64(h);
+}
+
+// like router_hash_string(), for keys that are not NUL-terminated
+static inline uint64_t router_hash_key(const char* key, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325UL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 0x100000001b3UL;
+    }
+    return router_hash64(h);
+}
+
+static int router_point_cmp(const void* a, const void* b)
+{
+    const struct router_point* pa = (const struct router_point*)a;
+    const struct router_point* pb = (const struct router_point*)b;
+    if (pa->hash != pb->hash) {
+        return pa->hash < pb->hash ? -1 : 1;
+    }
+    return pa->server < pb->server ? -1 : (pa->server > pb->server);
+}
+
+/**
+ * Initializes the router for the given servers.
+ *
+ * The ketama continuum is built from the server names, so a server keeps its points when other
+ * servers are added or removed and only the keys of the changed server move.
+ */
+static inline void router_init(struct router* r, enum router_kind kind, const char* const* names,
+    size_t num_servers, size_t vnodes)
+{
+    r->kind = kind;
+    r->num_servers = num_servers;
+    r->ring = NULL;
+    r->num_points = 0;
+
+    if (kind != ROUTER_KETAMA) {
+        return;
+    }
+
+    if (vnodes == 0) {
+        vnodes = ROUTER_KETAMA_DEFAULT_VNODES;
+    }
+
+    r->num_points = num_servers * vnodes;
+    r->ring = (struct router_point*)calloc(r->num_points, sizeof(*r->ring));
+    if (r->ring == NULL) {
+        printf("failed to allocate the ketama continuum\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char point_name[512];
+    for (size_t s = 0; s < num_servers; s++) {
+        for (size_t v = 0; v < vnodes; v++) {
+            snprintf(point_name, sizeof(point_name), "%s-%zu", names[s], v);
+            r->ring[s * vnodes + v].hash = (uint32_t)router_hash_string(point_name);
+            r->ring[s * vnodes + v].server = (uint32_t)s;
+        }
+    }
+
+    qsort(r->ring, r->num_points, sizeof(*r->ring), router_point_cmp);
+}
+
+static inline void router_free(struct router* r)
+{
+    free(r->ring);
+    r->ring = NULL;
+    r->num_points = 0;
+}
+
+static inline size_t router_jump_hash(uint64_t key, size_t num_buckets)
+{
+    // https://arxiv.org/abs/1406.2294
+    int64_t b = -1, j = 0;
+    while (j < (int64_t)num_buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+    }
+    return (size_t)b;
+}
+
+// returns the index of the first point at or after the hash, wrapping around at the end of the continuum
+static inline size_t router_ketama_point(const struct router* r, uint32_t h)
+{
+    size_t lo = 0, hi = r->num_points;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (r->ring[mid].hash < h) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo == r->num_points ? 0 : lo;
+}
+
+/**
+ * Returns the server index the object with the given id is stored on.
+ */
+static inline size_t router_lookup(const struct router* r, uint64_t objid)
+{
+    switch (r->kind) {
+    case ROUTER_KETAMA:
+        return r->ring[router_ketama_point(r, (uint32_t)router_hash64(objid))].server;
+    case ROUTER_JUMP:
+        return router_jump_hash(router_hash64(objid), r->num_servers);
+    case ROUTER_MODULO:
+    default:
+        return objid % r->num_servers;
+    }
+}
+
+/**
+ * Fills `servers` with the `n` distinct servers that hold replicas of the object, the primary
+ * (router_lookup) first. Ketama takes the next distinct servers along the continuum, so a replica
+ * set only changes where a server joins or leaves; the other routers take the servers following
+ * the primary. Returns the number of replicas, at most the number of servers.
+ */
+static inline size_t router_replicas(const struct router* r, uint64_t objid, size_t n, size_t* servers)
+{
+    if (n > r->num_servers) {
+        n = r->num_servers;
+    }
+    servers[0] = router_lookup(r, objid);
+    if (r->kind != ROUTER_KETAMA) {
+        for (size_t i = 1; i < n; i++) {
+            servers[i] = (servers[0] + i) % r->num_servers;
+        }
+        return n;
+    }
+
+    size_t found = 1;
+    size_t point = router_ketama_point(r, (uint32_t)router_hash64(objid));
+    for (size_t i = 1; i < r->num_points && found < n; i++) {
+        size_t server = r->ring[(point + i) % r->num_points].server;
+        bool seen = false;
+        for (size_t j = 0; j < found; j++) {
+            seen |= servers[j] == server;
+        }
+        if (!seen) {
+            servers[found++] = server;
+        }
+    }
+    return found;
+}
+
+#endif /* LOADBALANCER_ROUTER_H_ */
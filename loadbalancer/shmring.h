@@ -0,0 +1,407 @@
+/* Single-producer single-consumer byte rings in shared memory, a transport without the kernel */
+
+#ifndef LOADBALANCER_SHMRING_H_
+#define LOADBALANCER_SHMRING_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+// "lbshmrng", written last once the server has set up the segment
+#define SHMRING_MAGIC 0x676e726d6873626cUL
+#define SHMRING_VERSION 1
+
+// the most server threads a segment has bells for
+#define SHMRING_THREADS_MAX 64
+
+// how the consumer of a ring waits once it ran dry
+enum shmring_wait {
+    // poll the ring without ever giving up the core
+    SHMRING_SPIN,
+    // poll for a while, then sleep on a futex the producer wakes
+    SHMRING_FUTEX,
+};
+
+// the spins a consumer polls an empty ring for before it goes to sleep on the futex
+#define SHMRING_SPINS 2048
+
+enum shmring_state {
+    // no client, the server has reset the rings
+    SHMRING_FREE,
+    // claimed by a client
+    SHMRING_OPEN,
+    // given up by its client, the server resets it and frees it again
+    SHMRING_CLOSED,
+};
+
+/**
+ * A futex the consumer of one or more rings sleeps on. Producers bump `seq` and wake the consumer
+ * after publishing data, but only while it announced to sleep, so a busy consumer costs them
+ * nothing but a load.
+ */
+struct shmring_bell {
+    uint32_t seq;
+    uint32_t sleeping;
+} __attribute__((aligned(64)));
+
+/**
+ * The positions of one direction of a channel, in bytes since the channel was opened. Each side
+ * only writes its own position, on a cache line of its own.
+ */
+struct shmring {
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t head __attribute__((aligned(64)));
+};
+
+/**
+ * A client's connection to the server: a ring for the requests, one for the responses, and the
+ * bell the client sleeps on for responses. The server thread of the channel sleeps on its own bell.
+ */
+struct shmring_channel {
+    uint32_t state __attribute__((aligned(64)));
+    struct shmring req;
+    struct shmring resp;
+    struct shmring_bell bell;
+};
+
+/**
+ * The start of the mapping. The ring data of all channels follows the channels, each channel's
+ * request ring followed by its response ring.
+ */
+struct shmring_segment {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t num_channels;
+    uint32_t num_threads;
+    // set once the server is gone, clients fail instead of waiting forever
+    uint32_t shutdown;
+    uint64_t ring_size;
+    uint64_t data_offset;
+    uint64_t size;
+    struct shmring_bell bells[SHMRING_THREADS_MAX];
+    struct shmring_channel channels[];
+};
+
+/**
+ * One side of a channel: the ring it produces into and the one it consumes from, with the bells
+ * of their consumers. Both the client and the server side map the segment on their own.
+ */
+struct shmring_conn {
+    struct shmring_segment* seg;
+    struct shmring_channel* channel;
+    uint32_t index;
+    uint64_t mask;
+    struct shmring* tx;
+    char* tx_data;
+    struct shmring_bell* tx_bell;
+    struct shmring* rx;
+    char* rx_data;
+    struct shmring_bell* rx_bell;
+};
+
+static inline void shmring_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Opens the backing file of the segment: a path (e.g. on a hugetlbfs mount for huge pages) if the
+ * name starts with '/', a POSIX shared memory object otherwise.
+ */
+static inline int shmring_open_file(const char* name, int flags)
+{
+    if (name[0] == '/') {
+        return open(name, flags | O_CLOEXEC, 0600);
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "/%s", name);
+    return shm_open(path, flags, 0600);
+}
+
+static inline void shmring_unlink(const char* name)
+{
+    if (name[0] == '/') {
+        unlink(name);
+    } else {
+        char path[256];
+        snprintf(path, sizeof(path), "/%s", name);
+        shm_unlink(path);
+    }
+}
+
+static inline struct shmring_segment* shmring_map(int fd, size_t size)
+{
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    return p == MAP_FAILED ? NULL : (struct shmring_segment*)p;
+}
+
+/**
+ * Creates the segment with `num_channels` channels of two rings of `ring_size` bytes each (a power
+ * of two), served by `num_threads` threads. A segment of the same name is replaced. Returns NULL
+ * and sets errno on failure.
+ */
+static inline struct shmring_segment* shmring_create(const char* name, uint32_t num_channels, uint32_t num_threads,
+    uint64_t ring_size)
+{
+    if (num_threads == 0 || num_threads > SHMRING_THREADS_MAX || (ring_size & (ring_size - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    shmring_unlink(name);
+    int fd = shmring_open_file(name, O_RDWR | O_CREAT | O_EXCL);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // hugetlbfs only maps whole huge pages, its block size
+    struct statfs fs;
+    uint64_t page = fstatfs(fd, &fs) == 0 && fs.f_bsize > 0 ? (uint64_t)fs.f_bsize : 4096;
+    uint64_t data_offset = sizeof(struct shmring_segment) + num_channels * sizeof(struct shmring_channel);
+    data_offset = (data_offset + 4095) & ~4095UL;
+    uint64_t size = data_offset + 2 * ring_size * num_channels;
+    size = (size + page - 1) / page * page;
+
+    struct shmring_segment* seg = NULL;
+    if (ftruncate(fd, size) == 0) {
+        seg = shmring_map(fd, size);
+    }
+    int err = errno;
+    close(fd);
+    if (seg == NULL) {
+        shmring_unlink(name);
+        errno = err;
+        return NULL;
+    }
+
+    memset(seg, 0, data_offset);
+    seg->version = SHMRING_VERSION;
+    seg->num_channels = num_channels;
+    seg->num_threads = num_threads;
+    seg->ring_size = ring_size;
+    seg->data_offset = data_offset;
+    seg->size = size;
+    __atomic_store_n(&seg->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+    return seg;
+}
+
+/**
+ * Maps the segment a server created. Returns NULL and sets errno if there is none (yet).
+ */
+static inline struct shmring_segment* shmring_attach(const char* name)
+{
+    int fd = shmring_open_file(name, O_RDWR);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    struct shmring_segment* seg = NULL;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct shmring_segment)) {
+        seg = shmring_map(fd, st.st_size);
+    }
+    close(fd);
+    if (seg == NULL) {
+        return NULL;
+    }
+    if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC || seg->version != SHMRING_VERSION
+        || seg->size != (uint64_t)st.st_size) {
+        munmap(seg, st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+    return seg;
+}
+
+static inline void shmring_detach(struct shmring_segment* seg)
+{
+    munmap(seg, seg->size);
+}
+
+// sets up one side of the channel, the client produces requests and the server responses
+static inline void shmring_endpoint(struct shmring_conn* c, struct shmring_segment* seg, uint32_t index, bool server)
+{
+    struct shmring_channel* ch = &seg->channels[index];
+    char* req_data = (char*)seg + seg->data_offset + 2 * seg->ring_size * index;
+    char* resp_data = req_data + seg->ring_size;
+    struct shmring_bell* server_bell = &seg->bells[index % seg->num_threads];
+
+    c->seg = seg;
+    c->channel = ch;
+    c->index = index;
+    c->mask = seg->ring_size - 1;
+    c->tx = server ? &ch->resp : &ch->req;
+    c->tx_data = server ? resp_data : req_data;
+    c->tx_bell = server ? &ch->bell : server_bell;
+    c->rx = server ? &ch->req : &ch->resp;
+    c->rx_data = server ? req_data : resp_data;
+    c->rx_bell = server ? server_bell : &ch->bell;
+}
+
+/**
+ * Maps the segment and claims a free channel on it. Returns false and sets errno if the server is
+ * not there or all channels are taken.
+ */
+static inline bool shmring_connect(struct shmring_conn* c, const char* name)
+{
+    memset(c, 0, sizeof(*c));
+    struct shmring_segment* seg = shmring_attach(name);
+    if (seg == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < seg->num_channels; i++) {
+        uint32_t expected = SHMRING_FREE;
+        if (__atomic_compare_exchange_n(&seg->channels[i].state, &expected, SHMRING_OPEN, false, __ATOMIC_ACQ_REL,
+                __ATOMIC_RELAXED)) {
+            shmring_endpoint(c, seg, i, false);
+            return true;
+        }
+    }
+    shmring_detach(seg);
+    errno = EBUSY;
+    return false;
+}
+
+static inline bool shmring_notify(struct shmring_bell* b);
+
+// gives the channel back to the server and unmaps the segment
+static inline void shmring_disconnect(struct shmring_conn* c)
+{
+    if (c->seg == NULL) {
+        return;
+    }
+    __atomic_store_n(&c->channel->state, SHMRING_CLOSED, __ATOMIC_RELEASE);
+    shmring_notify(c->tx_bell);
+    shmring_detach(c->seg);
+    c->seg = NULL;
+}
+
+// the bytes waiting in the ring the side consumes
+static inline uint64_t shmring_readable(const struct shmring_conn* c)
+{
+    return __atomic_load_n(&c->rx->tail, __ATOMIC_ACQUIRE) - c->rx->head;
+}
+
+// the room left in the ring the side produces into
+static inline uint64_t shmring_writable(const struct shmring_conn* c)
+{
+    return c->mask + 1 - (c->tx->tail - __atomic_load_n(&c->tx->head, __ATOMIC_ACQUIRE));
+}
+
+static inline bool shmring_closed(const struct shmring_conn* c)
+{
+    return __atomic_load_n(&c->seg->shutdown, __ATOMIC_ACQUIRE) != 0;
+}
+
+/**
+ * Copies as much of [src, src + n) into the ring as fits and returns the number of bytes. The
+ * consumer only sees them with shmring_notify().
+ */
+static inline size_t shmring_write(struct shmring_conn* c, const char* src, size_t n)
+{
+    uint64_t tail = c->tx->tail;
+    uint64_t room = shmring_writable(c);
+    if (n > room) {
+        n = room;
+    }
+    size_t pos = tail & c->mask;
+    size_t first = n < c->mask + 1 - pos ? n : c->mask + 1 - pos;
+    memcpy(c->tx_data + pos, src, first);
+    memcpy(c->tx_data, src + first, n - first);
+    __atomic_store_n(&c->tx->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/**
+ * Copies up to `cap` bytes out of the ring and returns the number of bytes.
+ */
+static inline size_t shmring_read(struct shmring_conn* c, char* dst, size_t cap)
+{
+    uint64_t head = c->rx->head;
+    uint64_t n = shmring_readable(c);
+    if (n > cap) {
+        n = cap;
+    }
+    size_t pos = head & c->mask;
+    size_t first = n < c->mask + 1 - pos ? n : c->mask + 1 - pos;
+    memcpy(dst, c->rx_data + pos, first);
+    memcpy(dst + first, c->rx_data, n - first);
+    __atomic_store_n(&c->rx->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/**
+ * Wakes the consumer behind the bell if it sleeps, after data has been published. Returns true if
+ * that took a system call.
+ */
+static inline bool shmring_notify(struct shmring_bell* b)
+{
+    // orders the published tail before the load of `sleeping`, pairs with shmring_sleep_prepare()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&b->sleeping, __ATOMIC_RELAXED) == 0) {
+        return false;
+    }
+    __atomic_fetch_add(&b->seq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &b->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    return true;
+}
+
+/**
+ * Announces that the consumer is about to sleep on the bell. The consumer must check its rings
+ * once more afterwards and then either sleep with the returned sequence or cancel.
+ */
+static inline uint32_t shmring_sleep_prepare(struct shmring_bell* b)
+{
+    uint32_t seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&b->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return seq;
+}
+
+static inline void shmring_sleep_cancel(struct shmring_bell* b)
+{
+    __atomic_store_n(&b->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+// sleeps until a producer rang the bell after shmring_sleep_prepare(), or for at most `timeout_ns`
+static inline void shmring_sleep(struct shmring_bell* b, uint32_t seq, int64_t timeout_ns)
+{
+    struct timespec timeout = { (time_t)(timeout_ns / 1000000000L), (long)(timeout_ns % 1000000000L) };
+    syscall(SYS_futex, &b->seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+    __atomic_store_n(&b->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Waits until the ring the side consumes has data, the server shut down, or `timeout_ns` passed;
+ * when spinning only for SHMRING_SPINS polls. Returns the number of system calls it took.
+ */
+static inline size_t shmring_wait(struct shmring_conn* c, enum shmring_wait wait, int64_t timeout_ns)
+{
+    for (size_t spins = 0; spins < SHMRING_SPINS; spins++) {
+        if (shmring_readable(c) > 0 || shmring_closed(c)) {
+            return 0;
+        }
+        shmring_pause();
+    }
+    if (wait == SHMRING_SPIN) {
+        return 0;
+    }
+    uint32_t seq = shmring_sleep_prepare(c->rx_bell);
+    if (shmring_readable(c) > 0 || shmring_closed(c)) {
+        shmring_sleep_cancel(c->rx_bell);
+        return 0;
+    }
+    shmring_sleep(c->rx_bell, seq, timeout_ns);
+    return 1;
+}
+
+#endif /* LOADBALANCER_SHMRING_H_ */
@@ -0,0 +1,282 @@
+/* Key and value size distributions */
+
+#ifndef LOADBALANCER_SIZEDIST_H_
+#define LOADBALANCER_SIZEDIST_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum sizedist_kind {
+    // every object has the same size
+    SIZEDIST_FIXED,
+    // sizes are uniformly distributed over [min, max]
+    SIZEDIST_UNIFORM,
+    // sizes follow a histogram of observed sizes and their frequencies
+    SIZEDIST_EMPIRICAL,
+};
+
+/**
+ * A size distribution over the object ids.
+ *
+ * The size of an object is a function of its id, so the population phase and the benchmark phase
+ * agree on it without any per-object state, and different distributions (keys, values) are
+ * decorrelated by their seed.
+ */
+struct sizedist {
+    enum sizedist_kind kind;
+    size_t min;
+    size_t max;
+    uint64_t seed;
+
+    // empirical: the sizes in ascending order with their cumulative probabilities
+    size_t num_bins;
+    size_t* sizes;
+    double* cdf;
+};
+
+static inline const char* sizedist_kind_name(enum sizedist_kind kind)
+{
+    switch (kind) {
+    case SIZEDIST_FIXED:
+        return "fixed";
+    case SIZEDIST_UNIFORM:
+        return "uniform";
+    case SIZEDIST_EMPIRICAL:
+        return "empirical";
+    }
+    return "unknown";
+}
+
+static inline void sizedist_init_fixed(struct sizedist* d, size_t size, uint64_t seed)
+{
+    memset(d, 0, sizeof(*d));
+    d->kind = SIZEDIST_FIXED;
+    d->min = size;
+    d->max = size;
+    d->seed = seed;
+}
+
+struct sizedist_bin {
+    size_t size;
+    double weight;
+};
+
+static inline int sizedist_bin_compare(const void* a, const void* b)
+{
+    size_t x = ((const struct sizedist_bin*)a)->size;
+    size_t y = ((const struct sizedist_bin*)b)->size;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Reads a histogram file with one "<size> <weight>" pair per line, '#' starts a comment.
+ */
+static inline bool sizedist_load(struct sizedist* d, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        printf("failed to open the size histogram %s (%s)\n", path, strerror(errno));
+        return false;
+    }
+
+    size_t cap = 64, n = 0;
+    struct sizedist_bin* bins = (struct sizedist_bin*)malloc(cap * sizeof(*bins));
+    char line[256];
+    size_t lineno = 0;
+    bool ok = bins != NULL;
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        char* p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == 0) {
+            continue;
+        }
+        unsigned long long size;
+        double weight;
+        if (sscanf(p, "%llu %lf", &size, &weight) != 2 || size == 0 || weight < 0) {
+            printf("%s:%zu: expected <size> <weight>\n", path, lineno);
+            ok = false;
+            break;
+        }
+        if (n == cap) {
+            cap *= 2;
+            struct sizedist_bin* grown = (struct sizedist_bin*)realloc(bins, cap * sizeof(*bins));
+            if (grown == NULL) {
+                ok = false;
+                break;
+            }
+            bins = grown;
+        }
+        bins[n].size = size;
+        bins[n].weight = weight;
+        n++;
+    }
+    fclose(f);
+
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += bins[i].weight;
+    }
+    if (ok && (n == 0 || total <= 0)) {
+        printf("%s: the histogram is empty\n", path);
+        ok = false;
+    }
+    if (!ok) {
+        free(bins);
+        return false;
+    }
+
+    qsort(bins, n, sizeof(*bins), sizedist_bin_compare);
+    d->kind = SIZEDIST_EMPIRICAL;
+    d->num_bins = n;
+    d->sizes = (size_t*)calloc(n, sizeof(*d->sizes));
+    d->cdf = (double*)calloc(n, sizeof(*d->cdf));
+    if (d->sizes == NULL || d->cdf == NULL) {
+        free(bins);
+        return false;
+    }
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += bins[i].weight;
+        d->sizes[i] = bins[i].size;
+        d->cdf[i] = sum / total;
+    }
+    d->cdf[n - 1] = 1.0;
+    d->min = d->sizes[0];
+    d->max = d->sizes[n - 1];
+    free(bins);
+    return true;
+}
+
+/**
+ * Parses "<size>", "fixed:<size>", "uniform:<min>:<max>" or "file:<path>". Sizes must lie within
+ * [lo, hi].
+ */
+static inline bool sizedist_parse(struct sizedist* d, const char* spec, size_t lo, size_t hi, uint64_t seed)
+{
+    struct sizedist parsed;
+    memset(&parsed, 0, sizeof(parsed));
+    parsed.seed = seed;
+
+    char* end;
+    if (strncmp(spec, "file:", 5) == 0) {
+        if (!sizedist_load(&parsed, spec + 5)) {
+            return false;
+        }
+    } else if (strncmp(spec, "uniform:", 8) == 0) {
+        parsed.kind = SIZEDIST_UNIFORM;
+        parsed.min = strtoull(spec + 8, &end, 10);
+        if (*end != ':') {
+            return false;
+        }
+        parsed.max = strtoull(end + 1, &end, 10);
+        if (*end != 0 || parsed.max < parsed.min) {
+            return false;
+        }
+    } else {
+        const char* size = strncmp(spec, "fixed:", 6) == 0 ? spec + 6 : spec;
+        parsed.kind = SIZEDIST_FIXED;
+        parsed.min = strtoull(size, &end, 10);
+        parsed.max = parsed.min;
+        if (end == size || *end != 0) {
+            return false;
+        }
+    }
+
+    if (parsed.min < lo || parsed.max > hi) {
+        free(parsed.sizes);
+        free(parsed.cdf);
+        return false;
+    }
+
+    free(d->sizes);
+    free(d->cdf);
+    *d = parsed;
+    return true;
+}
+
+static inline void sizedist_free(struct sizedist* d)
+{
+    free(d->sizes);
+    free(d->cdf);
+    d->sizes = NULL;
+    d->cdf = NULL;
+}
+
+static inline uint64_t sizedist_hash(uint64_t x)
+{
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9UL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebUL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * Returns the size of the object.
+ */
+static inline size_t sizedist_size(const struct sizedist* d, uint64_t objid)
+{
+    if (d->kind == SIZEDIST_FIXED) {
+        return d->min;
+    }
+
+    uint64_t h = sizedist_hash(objid ^ d->seed);
+    if (d->kind == SIZEDIST_UNIFORM) {
+        return d->min + h % (d->max - d->min + 1);
+    }
+
+    // the first bin whose cumulative probability exceeds u
+    double u = (h >> 11) * (1.0 / (1UL << 53));
+    size_t lo = 0, hi = d->num_bins - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (d->cdf[mid] > u) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return d->sizes[lo];
+}
+
+static inline double sizedist_mean(const struct sizedist* d)
+{
+    switch (d->kind) {
+    case SIZEDIST_FIXED:
+        return (double)d->min;
+    case SIZEDIST_UNIFORM:
+        return (d->min + d->max) / 2.0;
+    case SIZEDIST_EMPIRICAL: {
+        double mean = 0, prev = 0;
+        for (size_t i = 0; i < d->num_bins; i++) {
+            mean += d->sizes[i] * (d->cdf[i] - prev);
+            prev = d->cdf[i];
+        }
+        return mean;
+    }
+    }
+    return 0;
+}
+
+static inline void sizedist_describe(const struct sizedist* d, char* buf, size_t len)
+{
+    switch (d->kind) {
+    case SIZEDIST_FIXED:
+        snprintf(buf, len, "%zu", d->min);
+        break;
+    case SIZEDIST_UNIFORM:
+        snprintf(buf, len, "uniform %zu .. %zu (mean %.0f)", d->min, d->max, sizedist_mean(d));
+        break;
+    case SIZEDIST_EMPIRICAL:
+        snprintf(buf, len, "empirical, %zu sizes in %zu .. %zu (mean %.0f)", d->num_bins, d->min, d->max,
+            sizedist_mean(d));
+        break;
+    }
+}
+
+#endif /* LOADBALANCER_SIZEDIST_H_ */
@@ -0,0 +1,88 @@
+/* Model of memcached's slab allocator for sizing the key space */
+
+#ifndef LOADBALANCER_SLABS_H_
+#define LOADBALANCER_SLABS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// memcached's defaults: 1 MB pages, chunks aligned to 8 bytes
+#define SLABS_PAGE_SIZE (1UL << 20)
+#define SLABS_CHUNK_ALIGN 8
+#define SLABS_MAX_CLASSES 64
+
+// the default of memcached's -f and -n
+#define SLABS_DEFAULT_FACTOR 1.25
+#define SLABS_DEFAULT_MIN_SIZE 48
+
+/**
+ * The slab classes of a memcached instance, computed the way slabs_init() does.
+ *
+ * Every item is stored in a chunk of the smallest class that fits it, and memory is handed to the
+ * classes in pages. Items larger than the biggest chunk (half a page) are split over several of
+ * them.
+ */
+struct slabs {
+    size_t num_classes;
+    size_t sizes[SLABS_MAX_CLASSES];
+    size_t perslab[SLABS_MAX_CLASSES];
+    // the per-item header in front of key and value, including the cas value
+    size_t item_header;
+};
+
+/**
+ * Computes the classes for the growth factor (-f) and the minimum key+value+flags space (-n),
+ * given the size of memcached's item structure.
+ */
+static inline void slabs_init(struct slabs* s, double factor, size_t min_size, size_t item_struct)
+{
+    memset(s, 0, sizeof(*s));
+    // memcached stores a cas value with every item unless it is started with -C
+    s->item_header = item_struct + sizeof(uint64_t);
+
+    size_t chunk_max = SLABS_PAGE_SIZE / 2;
+    double size = (double)(item_struct + min_size);
+    while (s->num_classes < SLABS_MAX_CLASSES - 1 && size < chunk_max / factor) {
+        size_t aligned = ((size_t)size + SLABS_CHUNK_ALIGN - 1) & ~(size_t)(SLABS_CHUNK_ALIGN - 1);
+        s->sizes[s->num_classes] = aligned;
+        s->perslab[s->num_classes] = SLABS_PAGE_SIZE / aligned;
+        s->num_classes++;
+        size = aligned * factor;
+    }
+    s->sizes[s->num_classes] = chunk_max;
+    s->perslab[s->num_classes] = SLABS_PAGE_SIZE / chunk_max;
+    s->num_classes++;
+}
+
+// the bytes memcached needs for an item: header, key with its terminator, value with its "\r\n"
+static inline size_t slabs_item_size(const struct slabs* s, size_t keylen, size_t vlen)
+{
+    return s->item_header + keylen + 1 + vlen + 2;
+}
+
+/**
+ * Returns the class an item of the given total size is stored in, items larger than the biggest
+ * chunk go to the last class.
+ */
+static inline size_t slabs_class(const struct slabs* s, size_t size)
+{
+    size_t lo = 0, hi = s->num_classes - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (s->sizes[mid] >= size) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// the number of chunks of its class an item occupies
+static inline size_t slabs_chunks(const struct slabs* s, size_t size)
+{
+    size_t chunk_max = s->sizes[s->num_classes - 1];
+    return size <= chunk_max ? 1 : (size + chunk_max - 1) / chunk_max;
+}
+
+#endif /* LOADBALANCER_SLABS_H_ */
@@ -0,0 +1,102 @@
+/* Steady-state detection and confidence intervals over the throughput of fixed intervals */
+
+#ifndef LOADBALANCER_STEADY_H_
+#define LOADBALANCER_STEADY_H_
+
+#include <math.h>
+#include <stddef.h>
+
+// the most intervals the warm-up is judged over
+#define STEADY_WINDOW_MAX 64
+
+/**
+ * The running mean and variance of a series of samples (Welford's method), numerically stable
+ * over long runs without keeping the samples.
+ */
+struct steady_stats {
+    size_t n;
+    double mean;
+    double m2;
+};
+
+static inline void steady_stats_init(struct steady_stats* s)
+{
+    s->n = 0;
+    s->mean = 0.0;
+    s->m2 = 0.0;
+}
+
+static inline void steady_stats_add(struct steady_stats* s, double x)
+{
+    s->n++;
+    double delta = x - s->mean;
+    s->mean += delta / s->n;
+    s->m2 += delta * (x - s->mean);
+}
+
+// the sample standard deviation, 0 with fewer than two samples
+static inline double steady_stats_stddev(const struct steady_stats* s)
+{
+    return s->n > 1 ? sqrt(s->m2 / (s->n - 1)) : 0.0;
+}
+
+// the two-sided 95% quantile of Student's t distribution with `df` degrees of freedom
+static inline double steady_t95(size_t df)
+{
+    static const double t[] = {
+        0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df < sizeof(t) / sizeof(t[0])) {
+        return t[df];
+    }
+    return df < 60 ? 2.000 : df < 120 ? 1.980 : 1.960;
+}
+
+// the half width of the 95% confidence interval of the mean, INFINITY with fewer than two samples
+static inline double steady_stats_ci95(const struct steady_stats* s)
+{
+    if (s->n < 2) {
+        return INFINITY;
+    }
+    return steady_t95(s->n - 1) * steady_stats_stddev(s) / sqrt((double)s->n);
+}
+
+// the last `size` samples, to tell when they stopped drifting
+struct steady_window {
+    double samples[STEADY_WINDOW_MAX];
+    size_t size;
+    // the samples pushed so far
+    size_t n;
+};
+
+static inline void steady_window_init(struct steady_window* w, size_t size)
+{
+    w->size = size < STEADY_WINDOW_MAX ? size : STEADY_WINDOW_MAX;
+    w->n = 0;
+}
+
+static inline void steady_window_push(struct steady_window* w, double x)
+{
+    w->samples[w->n++ % w->size] = x;
+}
+
+static inline bool steady_window_full(const struct steady_window* w)
+{
+    return w->n >= w->size;
+}
+
+// the coefficient of variation (standard deviation over mean) of the window's samples
+static inline double steady_window_cv(const struct steady_window* w)
+{
+    struct steady_stats s;
+    steady_stats_init(&s);
+    size_t n = w->n < w->size ? w->n : w->size;
+    for (size_t i = 0; i < n; i++) {
+        steady_stats_add(&s, w->samples[i]);
+    }
+    return s.mean > 0 ? steady_stats_stddev(&s) / s.mean : INFINITY;
+}
+
+#endif /* LOADBALANCER_STEADY_H_ */
@@ -0,0 +1,500 @@
+/* Sharded in-memory key-value table with optimistic reads, the store behind the local servers */
+
+#ifndef LOADBALANCER_STORE_H_
+#define LOADBALANCER_STORE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcproto.h"
+
+// the bytes of key and value a slot holds itself, larger items live in a buffer of their own
+#define STORE_INLINE 104
+
+// the initial number of slots per shard, the tables double at 3/4 load
+#define STORE_INITIAL_SLOTS 1024
+
+// the longest counter value, 20 digits for 2^64 - 1
+#define STORE_COUNTER_MAX 20
+
+// the times a read retries without the lock while writers keep changing the shard
+#define STORE_READ_RETRIES 4
+
+// a shard's table doubles at most this often, from STORE_INITIAL_SLOTS up to 2^32 slots
+#define STORE_GROW_MAX 22
+
+/**
+ * A slot of the open-addressing table: two cache lines with the key followed by the value inline,
+ * so the default items of the benchmark take a single probe and no pointer chase.
+ */
+struct store_slot {
+    // the hash of the key, 0 marks an empty slot
+    uint64_t hash;
+    uint32_t flags;
+    uint32_t vlen;
+    uint16_t keylen;
+    union {
+        char data[STORE_INLINE];
+        char* ext;
+    };
+} __attribute__((aligned(64)));
+
+/**
+ * One shard of the table with its own lock. Probing is linear, deletes shift the rest of the
+ * probe sequence back instead of leaving tombstones.
+ *
+ * Writers hold the lock and keep `seq` odd while they change the table, so reads of inline items
+ * go without the lock and retry if `seq` changed underneath. Such a read may still probe a table
+ * the shard has outgrown, which is why outgrown tables are only freed with the store.
+ */
+struct store_shard {
+    int lock;
+    uint32_t seq;
+    uint32_t mask;
+    uint32_t count;
+    struct store_slot* slots;
+    // the bytes of keys and values stored
+    size_t bytes;
+    struct store_slot* retired[STORE_GROW_MAX];
+    uint32_t num_retired;
+} __attribute__((aligned(64)));
+
+struct store {
+    struct store_shard* shards;
+    size_t num_shards;
+    unsigned shard_bits;
+};
+
+// how a store request treats an existing item
+enum store_mode {
+    STORE_SET,
+    // only if the key does not exist
+    STORE_ADD,
+    // only if the key exists, the value is added to its end
+    STORE_APPEND,
+};
+
+static inline void store_lock(struct store_shard* s)
+{
+    while (__atomic_exchange_n(&s->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&s->lock, __ATOMIC_RELAXED)) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+}
+
+static inline void store_unlock(struct store_shard* s)
+{
+    __atomic_store_n(&s->lock, 0, __ATOMIC_RELEASE);
+}
+
+// takes the lock to change the shard, optimistic readers retry until store_unlock_write()
+static inline void store_lock_write(struct store_shard* s)
+{
+    store_lock(s);
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    // orders the odd sequence before the changes, pairs with the fence in store_get_optimistic()
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void store_unlock_write(struct store_shard* s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    store_unlock(s);
+}
+
+static inline uint64_t store_hash(const char* key, size_t len)
+{
+    // FNV-1a with the splitmix64 finalizer, never 0
+    uint64_t h = 0xcbf29ce484222325UL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 0x100000001b3UL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9UL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebUL;
+    h ^= h >> 31;
+    return h ? h : 1;
+}
+
+static inline struct store_slot* store_slots_alloc(size_t n)
+{
+    struct store_slot* slots = (struct store_slot*)aligned_alloc(64, n * sizeof(*slots));
+    if (slots == NULL) {
+        printf("failed to allocate memory for the store\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(slots, 0, n * sizeof(*slots));
+    return slots;
+}
+
+/**
+ * Sets up an empty store of `num_shards` shards (rounded up to a power of two).
+ */
+static inline void store_init(struct store* st, size_t num_shards)
+{
+    memset(st, 0, sizeof(*st));
+    while ((1UL << st->shard_bits) < num_shards) {
+        st->shard_bits++;
+    }
+    st->num_shards = 1UL << st->shard_bits;
+    st->shards = (struct store_shard*)aligned_alloc(64, st->num_shards * sizeof(*st->shards));
+    if (st->shards == NULL) {
+        printf("failed to allocate memory for the store\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < st->num_shards; i++) {
+        struct store_shard* s = &st->shards[i];
+        memset(s, 0, sizeof(*s));
+        s->mask = STORE_INITIAL_SLOTS - 1;
+        s->slots = store_slots_alloc(STORE_INITIAL_SLOTS);
+    }
+}
+
+static inline bool store_slot_inline(const struct store_slot* e)
+{
+    return (size_t)e->keylen + e->vlen <= STORE_INLINE;
+}
+
+// the key followed by the value
+static inline char* store_slot_data(struct store_slot* e)
+{
+    return store_slot_inline(e) ? e->data : e->ext;
+}
+
+static inline void store_free(struct store* st)
+{
+    for (size_t i = 0; i < st->num_shards; i++) {
+        struct store_shard* s = &st->shards[i];
+        for (uint32_t p = 0; p <= s->mask; p++) {
+            if (s->slots[p].hash != 0 && !store_slot_inline(&s->slots[p])) {
+                free(s->slots[p].ext);
+            }
+        }
+        free(s->slots);
+        for (uint32_t r = 0; r < s->num_retired; r++) {
+            free(s->retired[r]);
+        }
+    }
+    free(st->shards);
+    st->shards = NULL;
+}
+
+static inline struct store_shard* store_shard_of(const struct store* st, uint64_t hash)
+{
+    return &st->shards[st->shard_bits ? hash >> (64 - st->shard_bits) : 0];
+}
+
+// returns the slot that holds the key, or the empty slot where it would go
+static inline uint32_t store_probe(const struct store_shard* s, uint64_t hash, const char* key, size_t keylen)
+{
+    uint32_t pos = (uint32_t)hash & s->mask;
+    for (;;) {
+        const struct store_slot* e = &s->slots[pos];
+        if (e->hash == 0) {
+            return pos;
+        }
+        if (e->hash == hash && e->keylen == keylen
+            && memcmp(store_slot_data((struct store_slot*)e), key, keylen) == 0) {
+            return pos;
+        }
+        pos = (pos + 1) & s->mask;
+    }
+}
+
+/**
+ * Doubles the table of the shard, rehashing every item into the new one. The new table is
+ * published before its mask, so a reader that sees the larger mask also sees the larger table.
+ */
+static inline void store_grow(struct store_shard* s)
+{
+    if (s->num_retired == STORE_GROW_MAX) {
+        printf("the store outgrew %u slots per shard\n", s->mask + 1);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t old_mask = s->mask;
+    uint32_t mask = old_mask * 2 + 1;
+    struct store_slot* old = s->slots;
+    struct store_slot* slots = store_slots_alloc((size_t)mask + 1);
+    for (uint32_t p = 0; p <= old_mask; p++) {
+        if (old[p].hash == 0) {
+            continue;
+        }
+        uint32_t pos = (uint32_t)old[p].hash & mask;
+        while (slots[pos].hash != 0) {
+            pos = (pos + 1) & mask;
+        }
+        slots[pos] = old[p];
+    }
+    __atomic_store_n(&s->slots, slots, __ATOMIC_RELEASE);
+    __atomic_store_n(&s->mask, mask, __ATOMIC_RELEASE);
+    s->retired[s->num_retired++] = old;
+}
+
+// removes the item at the slot, shifting later items of the probe sequence back
+static inline void store_remove_at(struct store_shard* s, uint32_t pos)
+{
+    struct store_slot* e = &s->slots[pos];
+    s->bytes -= e->keylen + e->vlen;
+    if (!store_slot_inline(e)) {
+        free(e->ext);
+    }
+    s->count--;
+
+    uint32_t hole = pos;
+    uint32_t next = (pos + 1) & s->mask;
+    while (s->slots[next].hash != 0) {
+        uint32_t home = (uint32_t)s->slots[next].hash & s->mask;
+        // move the item into the hole unless its home lies cyclically within (hole, next]
+        if (((next - home) & s->mask) >= ((next - hole) & s->mask)) {
+            s->slots[hole] = s->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & s->mask;
+    }
+    s->slots[hole].hash = 0;
+}
+
+/**
+ * Fills a new slot with the key and the value, which may be given in two parts, e.g. an old value
+ * and an appended one. Returns false if out of memory.
+ */
+static inline bool store_fill(struct store_slot* e, uint64_t hash, const char* key, size_t keylen,
+    const char* v1, size_t len1, const char* v2, size_t len2, uint32_t flags)
+{
+    size_t vlen = len1 + len2;
+    char* data = e->data;
+    if (keylen + vlen > STORE_INLINE) {
+        data = (char*)malloc(keylen + vlen);
+        if (data == NULL) {
+            return false;
+        }
+        e->ext = data;
+    }
+    memcpy(data, key, keylen);
+    memcpy(data + keylen, v1, len1);
+    memcpy(data + keylen + len1, v2, len2);
+    e->hash = hash;
+    e->flags = flags;
+    e->vlen = (uint32_t)vlen;
+    e->keylen = (uint16_t)keylen;
+    return true;
+}
+
+// replaces the item in the slot by the filled one, the old item's bytes are given back
+static inline void store_replace(struct store_shard* s, struct store_slot* e, const struct store_slot* item)
+{
+    if (e->hash != 0) {
+        s->bytes -= e->keylen + e->vlen;
+        if (!store_slot_inline(e)) {
+            free(e->ext);
+        }
+    } else {
+        s->count++;
+    }
+    s->bytes += item->keylen + item->vlen;
+    *e = *item;
+}
+
+/**
+ * Looks the key up without the lock. Only inline items are read this way, the buffer of a larger
+ * item may be freed by a writer while it is copied. Returns 1 on a hit with the value copied to
+ * `value`, 0 on a miss, and -1 if the caller has to take the lock: the item is not inline, or
+ * writers changed the shard on every try.
+ */
+static inline int store_get_optimistic(struct store_shard* s, uint64_t hash, const char* key, size_t keylen,
+    char* value, uint32_t* vlen, uint32_t* flags)
+{
+    for (int attempt = 0; attempt < STORE_READ_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            continue;
+        }
+        uint32_t mask = __atomic_load_n(&s->mask, __ATOMIC_ACQUIRE);
+        const struct store_slot* slots = __atomic_load_n(&s->slots, __ATOMIC_ACQUIRE);
+
+        // the slots may change while they are read, nothing read is trusted before `seq` is checked
+        int found = 0;
+        uint32_t pos = (uint32_t)hash & mask;
+        for (uint32_t probes = 0; probes <= mask; probes++, pos = (pos + 1) & mask) {
+            const struct store_slot* e = &slots[pos];
+            uint64_t h = e->hash;
+            if (h == 0) {
+                break;
+            }
+            if (h != hash) {
+                continue;
+            }
+            uint16_t elen = e->keylen;
+            uint32_t evlen = e->vlen;
+            if ((size_t)elen + evlen > STORE_INLINE) {
+                found = -1;
+                break;
+            }
+            if (elen == keylen && memcmp(e->data, key, keylen) == 0) {
+                memcpy(value, e->data + elen, evlen);
+                *vlen = evlen;
+                *flags = e->flags;
+                found = 1;
+                break;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) {
+            return found;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Appends the value of the key to `value` and returns true on a hit.
+ */
+static inline bool store_get(struct store* st, const char* key, size_t keylen, struct mc_buf* value, uint32_t* flags)
+{
+    uint64_t hash = store_hash(key, keylen);
+    struct store_shard* s = store_shard_of(st, hash);
+
+    char inline_value[STORE_INLINE];
+    uint32_t vlen;
+    int found = store_get_optimistic(s, hash, key, keylen, inline_value, &vlen, flags);
+    if (found >= 0) {
+        if (found) {
+            mc_buf_append(value, inline_value, vlen);
+        }
+        return found != 0;
+    }
+
+    store_lock(s);
+    struct store_slot* e = &s->slots[store_probe(s, hash, key, keylen)];
+    bool hit = e->hash != 0;
+    if (hit) {
+        *flags = e->flags;
+        mc_buf_append(value, store_slot_data(e) + e->keylen, e->vlen);
+    }
+    store_unlock(s);
+    return hit;
+}
+
+/**
+ * Stores the value under the key as the mode says. Returns a binary protocol status: OK,
+ * NOT_STORED if the mode's condition failed, or INTERNAL_ERROR if out of memory.
+ */
+static inline uint16_t store_put(struct store* st, enum store_mode mode, const char* key, size_t keylen,
+    const char* value, size_t vlen, uint32_t flags)
+{
+    uint64_t hash = store_hash(key, keylen);
+    struct store_shard* s = store_shard_of(st, hash);
+
+    store_lock_write(s);
+    uint32_t pos = store_probe(s, hash, key, keylen);
+    struct store_slot* e = &s->slots[pos];
+    bool exists = e->hash != 0;
+    if ((mode == STORE_ADD && exists) || (mode == STORE_APPEND && !exists)) {
+        store_unlock_write(s);
+        return MC_BIN_STATUS_NOT_STORED;
+    }
+
+    if (!exists && (s->count + 1) * 4 > ((size_t)s->mask + 1) * 3) {
+        store_grow(s);
+        pos = store_probe(s, hash, key, keylen);
+        e = &s->slots[pos];
+    }
+
+    struct store_slot item;
+    bool filled = mode == STORE_APPEND
+        ? store_fill(&item, hash, key, keylen, store_slot_data(e) + e->keylen, e->vlen, value, vlen, e->flags)
+        : store_fill(&item, hash, key, keylen, value, vlen, NULL, 0, flags);
+    if (filled) {
+        store_replace(s, e, &item);
+    }
+    store_unlock_write(s);
+    return filled ? MC_BIN_STATUS_OK : MC_BIN_STATUS_INTERNAL_ERROR;
+}
+
+/**
+ * Deletes the key, returns OK or NOT_FOUND.
+ */
+static inline uint16_t store_delete(struct store* st, const char* key, size_t keylen)
+{
+    uint64_t hash = store_hash(key, keylen);
+    struct store_shard* s = store_shard_of(st, hash);
+
+    store_lock_write(s);
+    uint32_t pos = store_probe(s, hash, key, keylen);
+    bool exists = s->slots[pos].hash != 0;
+    if (exists) {
+        store_remove_at(s, pos);
+    }
+    store_unlock_write(s);
+    return exists ? MC_BIN_STATUS_OK : MC_BIN_STATUS_NOT_FOUND;
+}
+
+/**
+ * Adds the delta to the decimal counter under the key, or subtracts it down to 0 as memcached
+ * does. Returns OK with the new value, NOT_FOUND, or DELTA_BADVAL if the value is not a number.
+ */
+static inline uint16_t store_delta(struct store* st, const char* key, size_t keylen, bool incr, uint64_t delta,
+    uint64_t* result)
+{
+    uint64_t hash = store_hash(key, keylen);
+    struct store_shard* s = store_shard_of(st, hash);
+
+    store_lock_write(s);
+    uint32_t pos = store_probe(s, hash, key, keylen);
+    struct store_slot* e = &s->slots[pos];
+    if (e->hash == 0) {
+        store_unlock_write(s);
+        return MC_BIN_STATUS_NOT_FOUND;
+    }
+
+    const char* v = store_slot_data(e) + e->keylen;
+    uint64_t n = 0;
+    bool numeric = e->vlen > 0 && e->vlen <= STORE_COUNTER_MAX;
+    for (uint32_t i = 0; numeric && i < e->vlen; i++) {
+        numeric = v[i] >= '0' && v[i] <= '9';
+        n = n * 10 + (v[i] - '0');
+    }
+    if (!numeric) {
+        store_unlock_write(s);
+        return MC_BIN_STATUS_DELTA_BADVAL;
+    }
+    n = incr ? n + delta : (delta > n ? 0 : n - delta);
+
+    char digits[STORE_COUNTER_MAX + 1];
+    int len = snprintf(digits, sizeof(digits), "%lu", (unsigned long)n);
+    struct store_slot item;
+    bool filled = store_fill(&item, hash, key, keylen, digits, len, NULL, 0, e->flags);
+    if (filled) {
+        store_replace(s, e, &item);
+        *result = n;
+    }
+    store_unlock_write(s);
+    return filled ? MC_BIN_STATUS_OK : MC_BIN_STATUS_INTERNAL_ERROR;
+}
+
+// counts the items and the bytes of their keys and values
+static inline void store_get_stats(struct store* st, uint64_t* items, size_t* bytes)
+{
+    *items = 0;
+    *bytes = 0;
+    for (size_t i = 0; i < st->num_shards; i++) {
+        struct store_shard* s = &st->shards[i];
+        store_lock(s);
+        *items += s->count;
+        *bytes += s->bytes;
+        store_unlock(s);
+    }
+}
+
+#endif /* LOADBALANCER_STORE_H_ */
@@ -0,0 +1,667 @@
+/* A parameter sweep driver for the loadbalancer benchmark */
+
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "results.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Option Parsing
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the loadbalancer supports this many servers
+#define SERVER_MAX 8
+#define DEFAULT_MEMCACHED_PORT 11211
+
+// the most values per dimension of the matrix
+#define AXIS_MAX 16
+
+// a dimension of the sweep matrix
+struct axis {
+    size_t num;
+    const char* values[AXIS_MAX];
+};
+
+// the number of servers per point
+static struct axis opt_servers = { 1, { "1" } };
+// tcp or unix
+static struct axis opt_transports = { 1, { "tcp" } };
+// the loadbalancer threads
+static struct axis opt_threads = { 1, { "4" } };
+// the loadbalancer batch sizes
+static struct axis opt_batch_sizes = { 1, { "1" } };
+// the workload presets (or op mixes with a ':') of the loadbalancer, "-" for its default
+static struct axis opt_workloads = { 1, { "-" } };
+
+// the number of runs per point
+static size_t opt_repeats = 3;
+// the memory limit of each memcached instance in MB
+static size_t opt_memory = 64;
+// the threads of each memcached instance
+static size_t opt_server_threads = 4;
+// the duration of the benchmark phase of a run in seconds
+static size_t opt_duration = 10;
+// the time memcached gets to answer requests after it was started, in seconds
+static size_t opt_startup_timeout = 10;
+
+static const char* opt_loadbalancer = "./loadbalancer/loadbalancer";
+static const char* opt_spawn_script = "scripts/spawn-memcached-process.sh";
+static const char* opt_output = "sweep-results";
+// the memcached commit the results are recorded for, defaults to $MEMCACHED_COMMIT
+static const char* opt_commit = NULL;
+
+// arguments passed on to every loadbalancer run (after "--")
+static char** opt_extra_args = NULL;
+static size_t opt_num_extra_args = 0;
+
+enum sweep_options {
+    OPT_SERVERS = 0x100,
+    OPT_TRANSPORTS,
+    OPT_THREADS,
+    OPT_BATCH_SIZES,
+    OPT_WORKLOADS,
+    OPT_REPEATS,
+    OPT_MEMORY,
+    OPT_SERVER_THREADS,
+    OPT_DURATION,
+    OPT_STARTUP_TIMEOUT,
+    OPT_LOADBALANCER,
+    OPT_SPAWN_SCRIPT,
+    OPT_OUTPUT,
+    OPT_COMMIT,
+};
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [options] [-- <loadbalancer arguments>]\n", prog);
+    printf("  --servers=<n,...>          servers per point (1 .. %u, default 1)\n", SERVER_MAX);
+    printf("  --transports=<t,...>       tcp and/or unix (default tcp)\n");
+    printf("  --threads=<n,...>          loadbalancer threads (default 4)\n");
+    printf("  --batch-sizes=<n,...>      loadbalancer batch sizes (default 1)\n");
+    printf("  --workloads=<w,...>        workload presets, '-' for the default mix\n");
+    printf("  --repeats=<n>              runs per point (default 3)\n");
+    printf("  --memory=<MB>              memory limit per memcached (default 64)\n");
+    printf("  --server-threads=<n>       threads per memcached (default 4)\n");
+    printf("  --duration=<s>             benchmark phase per run (default 10)\n");
+    printf("  --startup-timeout=<s>      time memcached gets to come up (default 10)\n");
+    printf("  --loadbalancer=<path>      default ./loadbalancer/loadbalancer\n");
+    printf("  --spawn-script=<path>      default scripts/spawn-memcached-process.sh\n");
+    printf("  --output=<dir>             default sweep-results\n");
+    printf("  --commit=<id>              memcached commit to record (default $MEMCACHED_COMMIT)\n");
+}
+
+// splits a comma-separated list into the axis, the values point into `list`
+static void axis_parse(struct axis* a, const char* name, char* list)
+{
+    a->num = 0;
+    for (char* save = NULL, *v = strtok_r(list, ",", &save); v != NULL; v = strtok_r(NULL, ",", &save)) {
+        if (a->num == AXIS_MAX) {
+            printf("Invalid %s: %s (at most %u values)\n", name, list, AXIS_MAX);
+            exit(EXIT_FAILURE);
+        }
+        a->values[a->num++] = v;
+    }
+    if (a->num == 0) {
+        printf("Invalid %s: empty list\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// checks that every value of the axis is a number in [lo, hi]
+static void axis_check_numbers(const struct axis* a, const char* name, size_t lo, size_t hi)
+{
+    for (size_t i = 0; i < a->num; i++) {
+        char* end;
+        unsigned long long v = strtoull(a->values[i], &end, 10);
+        if (*end != 0 || end == a->values[i] || v < lo || v > hi) {
+            printf("Invalid %s: %s (expected a number in %zu .. %zu)\n", name, a->values[i], lo, hi);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void options_parse(int argc, char* argv[])
+{
+    static struct option long_options[] = {
+        { "servers", required_argument, NULL, OPT_SERVERS },
+        { "transports", required_argument, NULL, OPT_TRANSPORTS },
+        { "threads", required_argument, NULL, OPT_THREADS },
+        { "batch-sizes", required_argument, NULL, OPT_BATCH_SIZES },
+        { "workloads", required_argument, NULL, OPT_WORKLOADS },
+        { "repeats", required_argument, NULL, OPT_REPEATS },
+        { "memory", required_argument, NULL, OPT_MEMORY },
+        { "server-threads", required_argument, NULL, OPT_SERVER_THREADS },
+        { "duration", required_argument, NULL, OPT_DURATION },
+        { "startup-timeout", required_argument, NULL, OPT_STARTUP_TIMEOUT },
+        { "loadbalancer", required_argument, NULL, OPT_LOADBALANCER },
+        { "spawn-script", required_argument, NULL, OPT_SPAWN_SCRIPT },
+        { "output", required_argument, NULL, OPT_OUTPUT },
+        { "commit", required_argument, NULL, OPT_COMMIT },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (c) {
+        case OPT_SERVERS:
+            axis_parse(&opt_servers, "servers", optarg);
+            axis_check_numbers(&opt_servers, "servers", 1, SERVER_MAX);
+            break;
+        case OPT_TRANSPORTS:
+            axis_parse(&opt_transports, "transports", optarg);
+            for (size_t i = 0; i < opt_transports.num; i++) {
+                if (strcmp(opt_transports.values[i], "tcp") != 0 && strcmp(opt_transports.values[i], "unix") != 0) {
+                    printf("Invalid transport: %s (expected tcp or unix)\n", opt_transports.values[i]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            break;
+        case OPT_THREADS:
+            axis_parse(&opt_threads, "threads", optarg);
+            axis_check_numbers(&opt_threads, "threads", 1, 4096);
+            break;
+        case OPT_BATCH_SIZES:
+            axis_parse(&opt_batch_sizes, "batch sizes", optarg);
+            axis_check_numbers(&opt_batch_sizes, "batch sizes", 1, 1 << 20);
+            break;
+        case OPT_WORKLOADS:
+            axis_parse(&opt_workloads, "workloads", optarg);
+            break;
+        case OPT_REPEATS:
+            opt_repeats = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_MEMORY:
+            opt_memory = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_SERVER_THREADS:
+            opt_server_threads = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_DURATION:
+            opt_duration = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_STARTUP_TIMEOUT:
+            opt_startup_timeout = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_LOADBALANCER:
+            opt_loadbalancer = optarg;
+            break;
+        case OPT_SPAWN_SCRIPT:
+            opt_spawn_script = optarg;
+            break;
+        case OPT_OUTPUT:
+            opt_output = optarg;
+            break;
+        case OPT_COMMIT:
+            opt_commit = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    opt_extra_args = &argv[optind];
+    opt_num_extra_args = argc - optind;
+
+    if (opt_repeats == 0) {
+        opt_repeats = 1;
+    }
+    if (opt_commit == NULL) {
+        opt_commit = getenv("MEMCACHED_COMMIT");
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Servers
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// set by SIGINT and SIGTERM, the sweep stops after cleaning up the current point
+static volatile sig_atomic_t sweep_stop = 0;
+
+static void sweep_signal(int sig)
+{
+    (void)sig;
+    sweep_stop = 1;
+}
+
+struct server {
+    pid_t pid;
+    bool is_unix;
+    int port;
+    char path[64];
+};
+
+// the loadbalancer's name for the server
+static void server_url(const struct server* s, char* buf, size_t len)
+{
+    if (s->is_unix) {
+        snprintf(buf, len, "unix://%s", s->path);
+    } else {
+        snprintf(buf, len, "tcp://localhost:%d", s->port);
+    }
+}
+
+/**
+ * Starts memcached instance `id` with the spawn script in its own process group, so stopping it
+ * also stops numactl and memcached underneath the script. The script listens on port 11211 + id
+ * for tcp and on memcached<id>.sock for unix.
+ */
+static bool server_spawn(struct server* s, size_t id, const char* transport, const char* log)
+{
+    memset(s, 0, sizeof(*s));
+    s->is_unix = strcmp(transport, "unix") == 0;
+    s->port = DEFAULT_MEMCACHED_PORT + (int)id;
+    snprintf(s->path, sizeof(s->path), "memcached%zu.sock", id);
+    if (s->is_unix) {
+        // a socket left behind by an earlier run would make the health check pass too early
+        unlink(s->path);
+    }
+
+    char id_arg[16], mem_arg[32], threads_arg[32];
+    snprintf(id_arg, sizeof(id_arg), "%zu", id);
+    snprintf(mem_arg, sizeof(mem_arg), "%zu", opt_memory);
+    snprintf(threads_arg, sizeof(threads_arg), "%zu", opt_server_threads);
+
+    s->pid = fork();
+    if (s->pid < 0) {
+        printf("failed to fork for memcached %zu (%s)\n", id, strerror(errno));
+        return false;
+    }
+    if (s->pid == 0) {
+        setpgid(0, 0);
+        int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execlp("bash", "bash", opt_spawn_script, id_arg, transport, mem_arg, threads_arg, (char*)NULL);
+        _exit(127);
+    }
+    setpgid(s->pid, s->pid);
+    return true;
+}
+
+static int server_connect(const struct server* s)
+{
+    int fd;
+    if (s->is_unix) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", s->path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(s->port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    return fd;
+}
+
+// returns true once the server answers a version request
+static bool server_healthy(const struct server* s)
+{
+    int fd = server_connect(s);
+    if (fd < 0) {
+        return false;
+    }
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char buf[128];
+    bool ok = false;
+    if (send(fd, "version\r\n", 9, MSG_NOSIGNAL) == 9) {
+        size_t len = 0;
+        ssize_t n;
+        while (len < sizeof(buf) - 1 && (n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0)) > 0) {
+            len += n;
+            if (memchr(buf, '\n', len) != NULL) {
+                break;
+            }
+        }
+        ok = len >= 8 && memcmp(buf, "VERSION ", 8) == 0;
+    }
+    close(fd);
+    return ok;
+}
+
+// polls the servers until all of them are healthy, instead of sleeping for a fixed time
+static bool servers_wait_healthy(struct server* servers, size_t n)
+{
+    struct timespec delay = { 0, 50 * 1000 * 1000 };
+    size_t attempts = opt_startup_timeout * 20;
+    for (size_t i = 0; i < n; i++) {
+        while (!server_healthy(&servers[i])) {
+            int status;
+            if (waitpid(servers[i].pid, &status, WNOHANG) == servers[i].pid) {
+                printf("memcached %zu exited during startup\n", i);
+                servers[i].pid = 0;
+                return false;
+            }
+            if (attempts-- == 0 || sweep_stop) {
+                printf("memcached %zu did not come up within %zu s\n", i, opt_startup_timeout);
+                return false;
+            }
+            nanosleep(&delay, NULL);
+        }
+    }
+    return true;
+}
+
+// stops the process group of every server and reaps it, killing it if it does not exit in time
+static void servers_stop(struct server* servers, size_t n)
+{
+    struct timespec delay = { 0, 50 * 1000 * 1000 };
+    for (size_t i = 0; i < n; i++) {
+        if (servers[i].pid > 0) {
+            kill(-servers[i].pid, SIGTERM);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (servers[i].pid <= 0) {
+            continue;
+        }
+        for (int tries = 0; waitpid(servers[i].pid, NULL, WNOHANG) == 0; tries++) {
+            if (tries == 100) {
+                kill(-servers[i].pid, SIGKILL);
+                waitpid(servers[i].pid, NULL, 0);
+                break;
+            }
+            nanosleep(&delay, NULL);
+        }
+        // memcached may outlive the script that started it for a moment
+        kill(-servers[i].pid, SIGKILL);
+        if (servers[i].is_unix) {
+            unlink(servers[i].path);
+        }
+        servers[i].pid = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Runs
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// one run of the sweep
+struct run {
+    size_t index;
+    size_t point;
+    size_t repeat;
+    const char* transport;
+    size_t num_servers;
+    const char* threads;
+    const char* batch_size;
+    const char* workload;
+    // the exit status of the loadbalancer, -1 if it did not run
+    int status;
+    char json[512];
+    char log[512];
+};
+
+/**
+ * Runs the loadbalancer against the servers, writing its output to the run's log and its results
+ * to the run's JSON file and the sweep's CSV file.
+ */
+static int run_loadbalancer(struct run* r, const struct server* servers, const char* csv)
+{
+    char servers_arg[SERVER_MAX * 64 + 16] = "--servers=";
+    for (size_t i = 0; i < r->num_servers; i++) {
+        char url[64];
+        server_url(&servers[i], url, sizeof(url));
+        strcat(servers_arg, i ? "," : "");
+        strcat(servers_arg, url);
+    }
+
+    char args[16][600];
+    size_t n = 0;
+    snprintf(args[n++], sizeof(args[0]), "%s", servers_arg);
+    snprintf(args[n++], sizeof(args[0]), "--num-threads=%s", r->threads);
+    snprintf(args[n++], sizeof(args[0]), "--batch-size=%s", r->batch_size);
+    snprintf(args[n++], sizeof(args[0]), "--x-benchmark-mem=%zu", opt_memory * r->num_servers);
+    snprintf(args[n++], sizeof(args[0]), "--x-benchmark-query-duration=%zu", opt_duration);
+    if (strcmp(r->workload, "-") != 0) {
+        snprintf(args[n++], sizeof(args[0]), "--%s=%s", strchr(r->workload, ':') ? "op-mix" : "workload",
+            r->workload);
+    }
+    snprintf(args[n++], sizeof(args[0]), "--results-json=%s", r->json);
+    snprintf(args[n++], sizeof(args[0]), "--results-csv=%s", csv);
+    snprintf(args[n++], sizeof(args[0]), "--meta=run=%zu", r->index);
+    snprintf(args[n++], sizeof(args[0]), "--meta=point=%zu", r->point);
+    snprintf(args[n++], sizeof(args[0]), "--meta=repeat=%zu", r->repeat);
+    snprintf(args[n++], sizeof(args[0]), "--meta=memcached_commit=%s", opt_commit ? opt_commit : "unknown");
+
+    char** argv = (char**)calloc(n + opt_num_extra_args + 2, sizeof(*argv));
+    if (argv == NULL) {
+        return -1;
+    }
+    argv[0] = (char*)opt_loadbalancer;
+    for (size_t i = 0; i < n; i++) {
+        argv[1 + i] = args[i];
+    }
+    for (size_t i = 0; i < opt_num_extra_args; i++) {
+        argv[1 + n + i] = opt_extra_args[i];
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        free(argv);
+        return -1;
+    }
+    if (pid == 0) {
+        int fd = open(r->log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execv(opt_loadbalancer, argv);
+        _exit(127);
+    }
+    free(argv);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// copies the run's results document into the sweep document, or null if there is none
+static void run_copy_json(FILE* out, const struct run* r)
+{
+    FILE* f = r->status == 0 ? fopen(r->json, "r") : NULL;
+    if (f == NULL) {
+        fputs("null", out);
+        return;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        // the document ends in a line break
+        if (feof(f) && buf[n - 1] == '\n') {
+            n--;
+        }
+        fwrite(buf, 1, n, out);
+    }
+    fclose(f);
+}
+
+/**
+ * Writes the sweep document: the metadata of the sweep and, per run, its point in the matrix, the
+ * exit status and the loadbalancer's results.
+ */
+static void sweep_write_json(const char* path, const struct run* runs, size_t num_runs, time_t started)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        printf("failed to open %s (%s)\n", path, strerror(errno));
+        return;
+    }
+
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    char when[64];
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&started));
+
+    struct results_json j;
+    results_json_init(&j, f);
+    results_json_object_begin(&j, NULL);
+    results_json_object_begin(&j, "meta");
+    results_json_string(&j, "memcached_commit", opt_commit ? opt_commit : "unknown");
+    results_json_string(&j, "host", host);
+    results_json_string(&j, "started", when);
+    results_json_uint(&j, "repeats", opt_repeats);
+    results_json_uint(&j, "duration_s", opt_duration);
+    results_json_uint(&j, "server_memory_mb", opt_memory);
+    results_json_uint(&j, "server_threads", opt_server_threads);
+    results_json_object_end(&j);
+
+    results_json_array_begin(&j, "runs");
+    for (size_t i = 0; i < num_runs; i++) {
+        const struct run* r = &runs[i];
+        results_json_object_begin(&j, NULL);
+        results_json_uint(&j, "run", r->index);
+        results_json_uint(&j, "point", r->point);
+        results_json_uint(&j, "repeat", r->repeat);
+        results_json_uint(&j, "servers", r->num_servers);
+        results_json_string(&j, "transport", r->transport);
+        results_json_string(&j, "threads", r->threads);
+        results_json_string(&j, "batch_size", r->batch_size);
+        results_json_string(&j, "workload", r->workload);
+        results_json_int(&j, "status", r->status);
+        results_json_key(&j, "results");
+        run_copy_json(f, r);
+        results_json_object_end(&j);
+    }
+    results_json_array_end(&j);
+    results_json_object_end(&j);
+    fclose(f);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[])
+{
+    options_parse(argc, argv);
+
+    if (mkdir(opt_output, 0755) != 0 && errno != EEXIST) {
+        printf("failed to create the output directory %s (%s)\n", opt_output, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sweep_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    size_t num_points = opt_servers.num * opt_transports.num * opt_threads.num * opt_batch_sizes.num
+        * opt_workloads.num;
+    size_t num_runs = num_points * opt_repeats;
+    struct run* runs = (struct run*)calloc(num_runs, sizeof(*runs));
+    if (runs == NULL) {
+        printf("failed to allocate memory for %zu runs\n", num_runs);
+        return EXIT_FAILURE;
+    }
+
+    char csv[512], json[512];
+    snprintf(csv, sizeof(csv), "%s/results.csv", opt_output);
+    snprintf(json, sizeof(json), "%s/sweep.json", opt_output);
+    unlink(csv);
+
+    printf("sweep: %zu points x %zu repeats, memcached commit %s, results in %s\n", num_points, opt_repeats,
+        opt_commit ? opt_commit : "unknown", opt_output);
+
+    time_t started = time(NULL);
+    size_t done = 0, failed = 0;
+    for (size_t point = 0; point < num_points && !sweep_stop; point++) {
+        // the last axis changes fastest
+        size_t rest = point;
+        size_t w = rest % opt_workloads.num;
+        rest /= opt_workloads.num;
+        size_t b = rest % opt_batch_sizes.num;
+        rest /= opt_batch_sizes.num;
+        size_t t = rest % opt_threads.num;
+        rest /= opt_threads.num;
+        size_t x = rest % opt_transports.num;
+        rest /= opt_transports.num;
+        size_t num_servers = strtoull(opt_servers.values[rest], NULL, 10);
+
+        for (size_t repeat = 0; repeat < opt_repeats && !sweep_stop; repeat++) {
+            struct run* r = &runs[done];
+            r->index = done;
+            r->point = point;
+            r->repeat = repeat;
+            r->num_servers = num_servers;
+            r->transport = opt_transports.values[x];
+            r->threads = opt_threads.values[t];
+            r->batch_size = opt_batch_sizes.values[b];
+            r->workload = opt_workloads.values[w];
+            r->status = -1;
+            snprintf(r->json, sizeof(r->json), "%s/run-%03zu.json", opt_output, done);
+            snprintf(r->log, sizeof(r->log), "%s/run-%03zu.log", opt_output, done);
+            done++;
+
+            printf("sweep: run %zu / %zu: %zu x %s, %s threads, batch %s, workload %s, repeat %zu\n", done,
+                num_runs, num_servers, r->transport, r->threads, r->batch_size, r->workload, repeat + 1);
+
+            // fresh servers for every run, so runs do not see each other's keys
+            struct server servers[SERVER_MAX];
+            size_t num_spawned = 0;
+            bool ok = true;
+            for (size_t i = 0; i < num_servers && ok; i++) {
+                char log[512];
+                snprintf(log, sizeof(log), "%s/run-%03zu-memcached%zu.log", opt_output, r->index, i);
+                ok = server_spawn(&servers[i], i, r->transport, log);
+                num_spawned += ok;
+            }
+            if (ok && servers_wait_healthy(servers, num_servers)) {
+                r->status = run_loadbalancer(r, servers, csv);
+            }
+            servers_stop(servers, num_spawned);
+
+            if (r->status != 0) {
+                printf("sweep: run %zu failed with status %d, see %s\n", done, r->status, r->log);
+                failed++;
+            }
+        }
+    }
+
+    sweep_write_json(json, runs, done, started);
+    printf("sweep: %zu runs, %zu failed%s, results in %s and %s\n", done, failed,
+        sweep_stop ? " (interrupted)" : "", json, csv);
+    free(runs);
+    return failed == 0 && !sweep_stop ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,67 @@
+/* Cheap monotonic timestamps for per-request latency measurements */
+
+#ifndef LOADBALANCER_TIMER_H_
+#define LOADBALANCER_TIMER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMER_USE_TSC 1
+#endif
+
+// the number of timer ticks per nanosecond, set by timer_calibrate()
+static double timer_ticks_per_ns = 1.0;
+
+static inline uint64_t timer_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/**
+ * Returns the current timestamp in timer ticks.
+ *
+ * On x86 this reads the invariant TSC, which costs a few nanoseconds and does not enter the kernel,
+ * elsewhere it falls back to CLOCK_MONOTONIC with one tick per nanosecond.
+ */
+static inline uint64_t timer_now(void)
+{
+#ifdef TIMER_USE_TSC
+    return __rdtsc();
+#else
+    return timer_monotonic_ns();
+#endif
+}
+
+/**
+ * Measures the tick rate of timer_now() against CLOCK_MONOTONIC.
+ */
+static inline void timer_calibrate(void)
+{
+#ifdef TIMER_USE_TSC
+    struct timespec delay = { 0, 50 * 1000 * 1000 };
+    uint64_t ns_start = timer_monotonic_ns();
+    uint64_t ticks_start = timer_now();
+    nanosleep(&delay, NULL);
+    uint64_t ns_end = timer_monotonic_ns();
+    uint64_t ticks_end = timer_now();
+    timer_ticks_per_ns = (double)(ticks_end - ticks_start) / (double)(ns_end - ns_start);
+    printf("timer: calibrated tsc at %.3f ticks/ns\n", timer_ticks_per_ns);
+#endif
+}
+
+static inline double timer_ticks_to_ns(uint64_t ticks)
+{
+    return (double)ticks / timer_ticks_per_ns;
+}
+
+static inline uint64_t timer_ns_to_ticks(double ns)
+{
+    return (uint64_t)(ns * timer_ticks_per_ns);
+}
+
+#endif /* LOADBALANCER_TIMER_H_ */
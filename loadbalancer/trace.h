@@ -0,0 +1,448 @@
+/* A compact binary trace of cache operations: recording, CSV import and streaming replay */
+
+#ifndef LOADBALANCER_TRACE_H_
+#define LOADBALANCER_TRACE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// "lbtrace1" in a little-endian file
+#define TRACE_MAGIC 0x3165636172746c62UL
+#define TRACE_VERSION 1
+
+// the records a reader maps at a time, 24 MB of the file
+#define TRACE_WINDOW_RECORDS (1UL << 20)
+
+// the largest value size a record holds
+#define TRACE_VALUE_MAX ((1U << 24) - 1)
+
+// the fields a CSV line is split into at most
+#define TRACE_CSV_FIELDS 8
+
+// the operations of a trace, numbered independently of the workload so traces stay readable
+enum trace_op {
+    TRACE_GET,
+    TRACE_SET,
+    TRACE_DELETE,
+    TRACE_INCR,
+    TRACE_DECR,
+    TRACE_CAS,
+    TRACE_APPEND,
+    TRACE_OP_MAX,
+};
+
+static const char* const trace_op_names[TRACE_OP_MAX] = {
+    "get", "set", "delete", "incr", "decr", "cas", "append",
+};
+
+struct trace_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t num_records;
+    // the time of the last record, the first one is at 0
+    uint64_t duration_ns;
+    uint32_t max_value_size;
+    uint32_t reserved;
+};
+
+/**
+ * One operation in 24 bytes. The key is an id: the object id of the run that recorded the trace,
+ * or a hash of the key of an imported one.
+ */
+struct trace_record {
+    // since the first record of the trace
+    uint64_t time_ns;
+    uint64_t key;
+    // the value size in the low 24 bits, the operation in the high 8 bits
+    uint32_t size_op;
+    // the expiration time in seconds, 0 for none
+    uint32_t ttl;
+};
+
+static inline enum trace_op trace_record_op(const struct trace_record* r)
+{
+    return (enum trace_op)(r->size_op >> 24);
+}
+
+static inline uint32_t trace_record_value_size(const struct trace_record* r)
+{
+    return r->size_op & TRACE_VALUE_MAX;
+}
+
+static inline void trace_record_init(struct trace_record* r, uint64_t time_ns, uint64_t key, enum trace_op op,
+    size_t value_size, uint32_t ttl)
+{
+    r->time_ns = time_ns;
+    r->key = key;
+    r->size_op = ((uint32_t)op << 24) | (uint32_t)(value_size < TRACE_VALUE_MAX ? value_size : TRACE_VALUE_MAX);
+    r->ttl = ttl;
+}
+
+/**
+ * Writes a trace through a large stdio buffer. The header is written again with the final counts
+ * when the trace is closed.
+ */
+struct trace_writer {
+    FILE* f;
+    struct trace_header header;
+};
+
+static inline bool trace_writer_open(struct trace_writer* w, const char* path)
+{
+    memset(w, 0, sizeof(*w));
+    w->f = fopen(path, "wb");
+    if (w->f == NULL) {
+        return false;
+    }
+    setvbuf(w->f, NULL, _IOFBF, 1 << 20);
+    w->header.magic = TRACE_MAGIC;
+    w->header.version = TRACE_VERSION;
+    w->header.record_size = sizeof(struct trace_record);
+    return fwrite(&w->header, sizeof(w->header), 1, w->f) == 1;
+}
+
+static inline bool trace_writer_append(struct trace_writer* w, const struct trace_record* r)
+{
+    w->header.num_records++;
+    if (r->time_ns > w->header.duration_ns) {
+        w->header.duration_ns = r->time_ns;
+    }
+    if (trace_record_value_size(r) > w->header.max_value_size) {
+        w->header.max_value_size = trace_record_value_size(r);
+    }
+    return fwrite(r, sizeof(*r), 1, w->f) == 1;
+}
+
+// writes the final header and closes the file, returns false if any write failed
+static inline bool trace_writer_close(struct trace_writer* w)
+{
+    bool ok = !ferror(w->f) && fseek(w->f, 0, SEEK_SET) == 0
+        && fwrite(&w->header, sizeof(w->header), 1, w->f) == 1;
+    ok &= fclose(w->f) == 0;
+    w->f = NULL;
+    return ok;
+}
+
+/**
+ * Reads a trace through a window of the file that is mapped on demand. A reader only ever maps one
+ * window, so a trace of many GB streams through the page cache without being loaded, and the
+ * readers of several threads share the cached pages.
+ */
+struct trace_reader {
+    int fd;
+    struct trace_header header;
+    void* map;
+    size_t map_len;
+    // the mapped records [first, first + count)
+    const struct trace_record* window;
+    uint64_t first;
+    uint64_t count;
+};
+
+/**
+ * Opens the trace and checks its header. Returns false with errno set, EINVAL for a file that is
+ * not a trace of this version or is shorter than its header says.
+ */
+static inline bool trace_reader_open(struct trace_reader* r, const char* path)
+{
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(r->fd, &st) != 0 || pread(r->fd, &r->header, sizeof(r->header), 0) != (ssize_t)sizeof(r->header)
+        || r->header.magic != TRACE_MAGIC || r->header.version != TRACE_VERSION
+        || r->header.record_size != sizeof(struct trace_record)
+        || (uint64_t)st.st_size < sizeof(r->header) + r->header.num_records * sizeof(struct trace_record)) {
+        close(r->fd);
+        r->fd = -1;
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+static inline void trace_reader_unmap(struct trace_reader* r)
+{
+    if (r->map != NULL) {
+        munmap(r->map, r->map_len);
+        r->map = NULL;
+        r->window = NULL;
+        r->count = 0;
+    }
+}
+
+static inline void trace_reader_close(struct trace_reader* r)
+{
+    trace_reader_unmap(r);
+    if (r->fd >= 0) {
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+// maps the window that holds record `i`, and has the kernel read ahead the one after it
+static inline bool trace_reader_map(struct trace_reader* r, uint64_t i)
+{
+    trace_reader_unmap(r);
+    uint64_t first = i - i % TRACE_WINDOW_RECORDS;
+    uint64_t count = r->header.num_records - first < TRACE_WINDOW_RECORDS ? r->header.num_records - first
+                                                                          : TRACE_WINDOW_RECORDS;
+    off_t offset = (off_t)(sizeof(r->header) + first * sizeof(struct trace_record));
+    off_t aligned = offset & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    size_t len = (size_t)(offset - aligned) + count * sizeof(struct trace_record);
+
+    void* map = mmap(NULL, len, PROT_READ, MAP_SHARED, r->fd, aligned);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    madvise(map, len, MADV_SEQUENTIAL);
+    posix_fadvise(r->fd, offset + count * sizeof(struct trace_record),
+        TRACE_WINDOW_RECORDS * sizeof(struct trace_record), POSIX_FADV_WILLNEED);
+
+    r->map = map;
+    r->map_len = len;
+    r->window = (const struct trace_record*)((char*)map + (offset - aligned));
+    r->first = first;
+    r->count = count;
+    return true;
+}
+
+/**
+ * Returns record `i`, or NULL past the end of the trace or if its window cannot be mapped. The
+ * record stays valid until a record of another window is read.
+ */
+static inline const struct trace_record* trace_reader_get(struct trace_reader* r, uint64_t i)
+{
+    if (i >= r->header.num_records) {
+        return NULL;
+    }
+    if (i < r->first || i >= r->first + r->count) {
+        if (!trace_reader_map(r, i)) {
+            return NULL;
+        }
+    }
+    return &r->window[i - r->first];
+}
+
+/**
+ * Merges traces that are each ordered by time into a single trace at `path`, with the times moved
+ * so that the merged trace starts at 0. Returns false with errno set on failure.
+ */
+static inline bool trace_merge(const char* path, const char* const* inputs, size_t n, uint64_t* num_records)
+{
+    struct trace_reader* readers = (struct trace_reader*)calloc(n, sizeof(*readers));
+    uint64_t* pos = (uint64_t*)calloc(n, sizeof(*pos));
+    if (readers == NULL || pos == NULL) {
+        free(readers);
+        free(pos);
+        errno = ENOMEM;
+        return false;
+    }
+
+    bool ok = true;
+    size_t opened = 0;
+    uint64_t t0 = UINT64_MAX;
+    for (; opened < n && ok; opened++) {
+        ok = trace_reader_open(&readers[opened], inputs[opened]);
+        const struct trace_record* r = ok ? trace_reader_get(&readers[opened], 0) : NULL;
+        if (r != NULL && r->time_ns < t0) {
+            t0 = r->time_ns;
+        }
+    }
+
+    struct trace_writer w;
+    ok = ok && trace_writer_open(&w, path);
+    while (ok) {
+        // few inputs, one per thread, so the oldest record is found by looking at each of them
+        size_t oldest = n;
+        const struct trace_record* next = NULL;
+        for (size_t i = 0; i < n; i++) {
+            const struct trace_record* r = trace_reader_get(&readers[i], pos[i]);
+            if (r != NULL && (next == NULL || r->time_ns < next->time_ns)) {
+                oldest = i;
+                next = r;
+            }
+        }
+        if (next == NULL) {
+            ok = trace_writer_close(&w);
+            break;
+        }
+        struct trace_record rec = *next;
+        rec.time_ns -= t0;
+        pos[oldest]++;
+        if (!trace_writer_append(&w, &rec)) {
+            trace_writer_close(&w);
+            ok = false;
+        }
+    }
+    if (ok) {
+        *num_records = w.header.num_records;
+    }
+
+    for (size_t i = 0; i < opened; i++) {
+        trace_reader_close(&readers[i]);
+    }
+    free(readers);
+    free(pos);
+    return ok;
+}
+
+// the CSV layouts a trace is imported from
+enum trace_csv_format {
+    // Twitter's production cache traces: timestamp,key,key size,value size,client id,operation,ttl
+    TRACE_CSV_TWITTER,
+    // timestamp,key,value size[,operation[,ttl]] with the timestamp in (fractional) seconds
+    TRACE_CSV_SIMPLE,
+};
+
+static inline bool trace_csv_format_parse(const char* s, enum trace_csv_format* format)
+{
+    if (strcmp(s, "twitter") == 0) {
+        *format = TRACE_CSV_TWITTER;
+    } else if (strcmp(s, "simple") == 0) {
+        *format = TRACE_CSV_SIMPLE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// maps a memcached command to the trace operation that stands in for it
+static inline bool trace_op_parse(const char* s, enum trace_op* op)
+{
+    static const struct {
+        const char* name;
+        enum trace_op op;
+    } ops[] = {
+        { "get", TRACE_GET },
+        { "gets", TRACE_GET },
+        { "set", TRACE_SET },
+        { "add", TRACE_SET },
+        { "replace", TRACE_SET },
+        { "cas", TRACE_CAS },
+        { "append", TRACE_APPEND },
+        { "prepend", TRACE_APPEND },
+        { "delete", TRACE_DELETE },
+        { "incr", TRACE_INCR },
+        { "decr", TRACE_DECR },
+    };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(s, ops[i].name) == 0) {
+            *op = ops[i].op;
+            return true;
+        }
+    }
+    return false;
+}
+
+// FNV-1a, the id of an imported key
+static inline uint64_t trace_key_hash(const char* key)
+{
+    uint64_t h = 0xcbf29ce484222325UL;
+    for (; *key; key++) {
+        h ^= (unsigned char)*key;
+        h *= 0x100000001b3UL;
+    }
+    return h;
+}
+
+/**
+ * Parses one CSV line of the format into the record. Times are taken relative to `*t0`, which the
+ * first line sets. Returns false for a line that does not parse, e.g., a header line.
+ */
+static inline bool trace_csv_parse_line(char* line, enum trace_csv_format format, double* t0, bool* have_t0,
+    struct trace_record* rec)
+{
+    line[strcspn(line, "\r\n")] = 0;
+    char* fields[TRACE_CSV_FIELDS];
+    size_t num_fields = 0;
+    for (char* p = line;;) {
+        fields[num_fields++] = p;
+        char* comma = strchr(p, ',');
+        if (comma == NULL || num_fields == TRACE_CSV_FIELDS) {
+            break;
+        }
+        *comma = 0;
+        p = comma + 1;
+    }
+
+    // the positions of the value size, operation and ttl columns
+    size_t size_col = 2, op_col = 3, ttl_col = 4;
+    if (format == TRACE_CSV_TWITTER) {
+        if (num_fields < 7) {
+            return false;
+        }
+        size_col = 3;
+        op_col = 5;
+        ttl_col = 6;
+    } else if (num_fields < 3) {
+        return false;
+    }
+
+    char* end;
+    double t = strtod(fields[0], &end);
+    if (end == fields[0] || fields[1][0] == 0) {
+        return false;
+    }
+    unsigned long value_size = strtoul(fields[size_col], &end, 10);
+    if (end == fields[size_col]) {
+        return false;
+    }
+    enum trace_op op = TRACE_GET;
+    if (op_col < num_fields && !trace_op_parse(fields[op_col], &op)) {
+        return false;
+    }
+    uint32_t ttl = ttl_col < num_fields ? (uint32_t)strtoul(fields[ttl_col], NULL, 10) : 0;
+
+    if (!*have_t0) {
+        *t0 = t;
+        *have_t0 = true;
+    }
+    uint64_t time_ns = t > *t0 ? (uint64_t)((t - *t0) * 1e9) : 0;
+    trace_record_init(rec, time_ns, trace_key_hash(fields[1]), op, value_size, ttl);
+    return true;
+}
+
+/**
+ * Converts a CSV trace into the writer's trace, streaming it line by line. Lines that do not parse
+ * are counted in `skipped`, times that go backwards are moved up to the previous record's, so the
+ * trace stays ordered. Returns false on a read error.
+ */
+static inline bool trace_import_csv(FILE* in, enum trace_csv_format format, struct trace_writer* w, uint64_t* skipped)
+{
+    char* line = NULL;
+    size_t cap = 0;
+    double t0 = 0;
+    bool have_t0 = false;
+    uint64_t t_last = 0;
+
+    *skipped = 0;
+    while (getline(&line, &cap, in) >= 0) {
+        struct trace_record rec;
+        if (!trace_csv_parse_line(line, format, &t0, &have_t0, &rec)) {
+            (*skipped)++;
+            continue;
+        }
+        if (rec.time_ns < t_last) {
+            rec.time_ns = t_last;
+        }
+        t_last = rec.time_ns;
+        if (!trace_writer_append(w, &rec)) {
+            break;
+        }
+    }
+    free(line);
+    return !ferror(in);
+}
+
+#endif /* LOADBALANCER_TRACE_H_ */
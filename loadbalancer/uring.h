@@ -0,0 +1,256 @@
+/* Minimal io_uring ring on top of the raw system calls */
+
+#ifndef LOADBALANCER_URING_H_
+#define LOADBALANCER_URING_H_
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * A submission and completion queue pair shared with the kernel.
+ *
+ * Only the pieces the native engines need are wrapped: ring setup with optional SQPOLL, registered
+ * files and buffers, and lock-free access to both queues. A ring is owned by a single thread.
+ */
+struct uring {
+    int fd;
+    unsigned flags;
+
+    // submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_flags;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    // entries filled in but not yet published to the kernel
+    unsigned sq_local_tail;
+
+    // completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    // the number of io_uring_enter() calls, to relate system calls to operations
+    uint64_t enters;
+};
+
+static inline int uring_setup(unsigned entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter(struct uring* r, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    r->enters++;
+    return (int)syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int uring_register(struct uring* r, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, r->fd, opcode, arg, nr_args);
+}
+
+/**
+ * Creates a ring with the given number of submission entries. With `sqpoll` a kernel thread polls
+ * the submission queue, so submitting does not need a system call while the thread is awake.
+ * Returns -errno on failure.
+ */
+static inline int uring_init(struct uring* r, unsigned entries, bool sqpoll)
+{
+    memset(r, 0, sizeof(*r));
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (sqpoll) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = 1000; // ms
+    }
+
+    r->fd = uring_setup(entries, &p);
+    if (r->fd < 0) {
+        return -errno;
+    }
+    r->flags = p.flags;
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size) {
+            r->sq_ring_size = r->cq_ring_size;
+        }
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+        IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        int err = -errno;
+        close(r->fd);
+        return err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+            IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            int err = -errno;
+            munmap(r->sq_ring, r->sq_ring_size);
+            close(r->fd);
+            return err;
+        }
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        int err = -errno;
+        if (r->cq_ring != r->sq_ring) {
+            munmap(r->cq_ring, r->cq_ring_size);
+        }
+        munmap(r->sq_ring, r->sq_ring_size);
+        close(r->fd);
+        return err;
+    }
+
+    char* sq = (char*)r->sq_ring;
+    r->sq_head = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_flags = (unsigned*)(sq + p.sq_off.flags);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->sq_local_tail = *r->sq_tail;
+
+    char* cq = (char*)r->cq_ring;
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // the index array is an identity mapping, sqes are used in ring order
+    for (unsigned i = 0; i <= *r->sq_mask; i++) {
+        r->sq_array[i] = i;
+    }
+    return 0;
+}
+
+static inline void uring_free(struct uring* r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+}
+
+/**
+ * Returns a cleared submission entry, or NULL if the submission queue is full.
+ */
+static inline struct io_uring_sqe* uring_get_sqe(struct uring* r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_local_tail - head > *r->sq_mask) {
+        return NULL;
+    }
+    struct io_uring_sqe* sqe = &r->sqes[r->sq_local_tail & *r->sq_mask];
+    r->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * Publishes the filled-in entries and optionally waits for `wait_nr` completions. With SQPOLL the
+ * kernel is only entered to wake up an idle poller or to wait. Returns -errno on failure.
+ */
+static inline int uring_submit(struct uring* r, unsigned wait_nr)
+{
+    unsigned to_submit = r->sq_local_tail - *r->sq_tail;
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = 0;
+    if (r->flags & IORING_SETUP_SQPOLL) {
+        // pairs with the poller setting the flag before it goes to sleep
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        }
+        to_submit = 0;
+    }
+    if (wait_nr > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    if (to_submit == 0 && flags == 0) {
+        return 0;
+    }
+
+    int rv = uring_enter(r, to_submit, wait_nr, flags);
+    if (rv < 0 && errno != EINTR && errno != EBUSY) {
+        return -errno;
+    }
+    return 0;
+}
+
+/**
+ * Returns the next completion or NULL, it stays valid until uring_cq_advance() is called.
+ */
+static inline struct io_uring_cqe* uring_peek_cqe(struct uring* r)
+{
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static inline void uring_cq_advance(struct uring* r, unsigned n)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + n, __ATOMIC_RELEASE);
+}
+
+static inline int uring_register_files(struct uring* r, const int* fds, unsigned n)
+{
+    return uring_register(r, IORING_REGISTER_FILES, fds, n) < 0 ? -errno : 0;
+}
+
+static inline int uring_register_buffer(struct uring* r, void* base, size_t len)
+{
+    struct iovec iov;
+    iov.iov_base = base;
+    iov.iov_len = len;
+    return uring_register(r, IORING_REGISTER_BUFFERS, &iov, 1) < 0 ? -errno : 0;
+}
+
+/**
+ * Prepares a read or write on a registered file using the registered buffer at `buf_index`.
+ */
+static inline void uring_prep_rw_fixed(struct io_uring_sqe* sqe, uint8_t opcode, int file_index, void* addr,
+    unsigned len, uint16_t buf_index, uint64_t user_data)
+{
+    sqe->opcode = opcode;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = file_index;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    // sockets have no file position
+    sqe->off = (uint64_t)-1;
+    sqe->buf_index = buf_index;
+    sqe->user_data = user_data;
+}
+
+#endif /* LOADBALANCER_URING_H_ */
@@ -0,0 +1,166 @@
+/* Operation mixes for the benchmark phase */
+
+#ifndef LOADBALANCER_WORKLOAD_H_
+#define LOADBALANCER_WORKLOAD_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "keydist.h"
+#include "xorshift.h"
+
+enum workload_op {
+    // get of an existing key
+    WORKLOAD_GET,
+    // overwrite of an existing key
+    WORKLOAD_SET,
+    // set of a new key, which becomes the latest key
+    WORKLOAD_INSERT,
+    WORKLOAD_DELETE,
+    WORKLOAD_INCR,
+    WORKLOAD_DECR,
+    // read-modify-write: gets followed by a cas with the returned cas value
+    WORKLOAD_CAS,
+    WORKLOAD_APPEND,
+    WORKLOAD_OP_MAX,
+};
+
+static const char* const workload_op_names[WORKLOAD_OP_MAX] = {
+    "get", "set", "insert", "delete", "incr", "decr", "cas", "append",
+};
+
+/**
+ * The relative weights of the operations, an operation with weight w is drawn with probability
+ * w / total.
+ */
+struct workload {
+    unsigned weights[WORKLOAD_OP_MAX];
+    unsigned total;
+};
+
+struct workload_preset {
+    const char* name;
+    const char* mix;
+    enum keydist_kind key_dist;
+    const char* description;
+};
+
+// YCSB-like core workloads (E is left out, memcached has no scans)
+static const struct workload_preset workload_presets[] = {
+    { "a", "get:50,set:50", KEYDIST_ZIPF, "update heavy" },
+    { "b", "get:95,set:5", KEYDIST_ZIPF, "read mostly" },
+    { "c", "get:100", KEYDIST_ZIPF, "read only" },
+    { "d", "get:95,insert:5", KEYDIST_LATEST, "read latest" },
+    { "f", "get:50,cas:50", KEYDIST_ZIPF, "read-modify-write" },
+};
+
+#define WORKLOAD_NUM_PRESETS (sizeof(workload_presets) / sizeof(workload_presets[0]))
+
+static inline void workload_init_read_only(struct workload* w)
+{
+    memset(w, 0, sizeof(*w));
+    w->weights[WORKLOAD_GET] = 1;
+    w->total = 1;
+}
+
+/**
+ * Parses a mix of the form "get:90,set:8,delete:2".
+ */
+static inline bool workload_parse_mix(struct workload* w, const char* spec)
+{
+    struct workload mix;
+    memset(&mix, 0, sizeof(mix));
+
+    const char* p = spec;
+    while (*p) {
+        const char* colon = strchr(p, ':');
+        if (colon == NULL) {
+            return false;
+        }
+
+        int op = -1;
+        for (int i = 0; i < WORKLOAD_OP_MAX; i++) {
+            if (strlen(workload_op_names[i]) == (size_t)(colon - p)
+                && strncmp(p, workload_op_names[i], colon - p) == 0) {
+                op = i;
+                break;
+            }
+        }
+        if (op < 0) {
+            return false;
+        }
+
+        char* end;
+        unsigned long weight = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1 || (*end != ',' && *end != 0)) {
+            return false;
+        }
+        mix.weights[op] += weight;
+        mix.total += weight;
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (mix.total == 0) {
+        return false;
+    }
+
+    *w = mix;
+    return true;
+}
+
+static inline const struct workload_preset* workload_find_preset(const char* name)
+{
+    for (size_t i = 0; i < WORKLOAD_NUM_PRESETS; i++) {
+        if (strcasecmp(name, workload_presets[i].name) == 0) {
+            return &workload_presets[i];
+        }
+    }
+    return NULL;
+}
+
+static inline bool workload_read_only(const struct workload* w)
+{
+    return w->weights[WORKLOAD_GET] == w->total;
+}
+
+static inline bool workload_has_op(const struct workload* w, enum workload_op op)
+{
+    return w->weights[op] > 0;
+}
+
+static inline void workload_describe(const struct workload* w, char* buf, size_t len)
+{
+    size_t off = 0;
+    buf[0] = 0;
+    for (int i = 0; i < WORKLOAD_OP_MAX && off < len; i++) {
+        if (w->weights[i] == 0) {
+            continue;
+        }
+        off += snprintf(buf + off, len - off, "%s%s %.1f%%", off ? ", " : "", workload_op_names[i],
+            100.0 * w->weights[i] / w->total);
+    }
+}
+
+/**
+ * Draws the next operation. Read-only mixes do not consume a random number.
+ */
+static inline enum workload_op workload_next(const struct workload* w, struct xor_shift* rand)
+{
+    if (w->weights[WORKLOAD_GET] == w->total) {
+        return WORKLOAD_GET;
+    }
+
+    unsigned r = (unsigned)xor_shift_next(rand, w->total);
+    for (int i = 0; i < WORKLOAD_OP_MAX; i++) {
+        if (r < w->weights[i]) {
+            return (enum workload_op)i;
+        }
+        r -= w->weights[i];
+    }
+    return WORKLOAD_GET;
+}
+
+#endif /* LOADBALANCER_WORKLOAD_H_ */
@@ -0,0 +1,36 @@
+/* Fast per-thread pseudo random numbers */
+
+#ifndef LOADBALANCER_XORSHIFT_H_
+#define LOADBALANCER_XORSHIFT_H_
+
+#include <stdint.h>
+
+struct xor_shift {
+    uint64_t state;
+};
+
+static inline void xor_shift_init(struct xor_shift *st, uint64_t tid)
+{
+    st->state = 0xdeadbeefdeadbeef ^ tid;
+}
+
+static inline uint64_t xor_shift_next_u64(struct xor_shift *st) {
+    // https://en.wikipedia.org/wiki/Xorshift
+    uint64_t x = st->state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    st->state = x;
+    return x;
+}
+
+static inline uint64_t xor_shift_next(struct xor_shift *st, uint64_t num_elements) {
+    return xor_shift_next_u64(st) % num_elements;
+}
+
+// returns a uniformly distributed double in [0, 1)
+static inline double xor_shift_next_double(struct xor_shift *st) {
+    return (xor_shift_next_u64(st) >> 11) * (1.0 / (1UL << 53));
+}
+
+#endif /* LOADBALANCER_XORSHIFT_H_ */